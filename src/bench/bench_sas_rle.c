@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../readstat.h"
+#include "../sas/readstat_sas_rle.h"
+
+/* Decompression throughput over rows that look like a COMPRESS=CHAR data
+ * set: blank-padded character columns of varying fill, doubles with zeroed
+ * low-order bytes, and the occasional run of '@' or repeated digits. */
+
+#define ROW_COUNT   20000
+#define ITERATIONS  50
+
+typedef struct bench_column_s {
+    int     is_string;
+    size_t  width;
+} bench_column_t;
+
+static bench_column_t columns[] = {
+    { 0, 8 },  { 1, 8 },  { 1, 40 }, { 0, 8 },
+    { 1, 200 }, { 0, 8 }, { 1, 12 }, { 1, 3 },
+    { 0, 8 },  { 1, 64 }, { 0, 8 },  { 1, 1 },
+    { 1, 24 }, { 0, 8 },  { 1, 100 }, { 0, 8 }
+};
+
+static unsigned int bench_rand(unsigned int *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 16) & 0x7FFF;
+}
+
+static void fill_row(unsigned char *row, unsigned int *seed) {
+    size_t i;
+    size_t j, offset = 0;
+    for (i=0; i<sizeof(columns)/sizeof(columns[0]); i++) {
+        bench_column_t *column = &columns[i];
+        unsigned char *cell = &row[offset];
+        if (column->is_string) {
+            size_t fill = bench_rand(seed) % (column->width + 1);
+            int kind = bench_rand(seed) % 8;
+            for (j=0; j<fill; j++) {
+                if (kind == 0) {
+                    cell[j] = '@';
+                } else if (kind == 1) {
+                    cell[j] = '0' + (j / 5) % 10;
+                } else {
+                    cell[j] = 'a' + bench_rand(seed) % 26;
+                }
+            }
+            memset(&cell[fill], ' ', column->width - fill);
+        } else {
+            double value = (bench_rand(seed) % 4 == 0) ? 0.0 : (bench_rand(seed) % 100000) / 4.0;
+            memcpy(cell, &value, sizeof(double));
+        }
+        offset += column->width;
+    }
+}
+
+int main(void) {
+    size_t row_length = 0, compressed_total = 0;
+    unsigned int seed = 1;
+    size_t i;
+    int k;
+    for (i=0; i<sizeof(columns)/sizeof(columns[0]); i++) {
+        row_length += columns[i].width;
+    }
+
+    unsigned char *rows = malloc(ROW_COUNT * row_length);
+    unsigned char **compressed = malloc(ROW_COUNT * sizeof(unsigned char *));
+    size_t *compressed_lens = malloc(ROW_COUNT * sizeof(size_t));
+    unsigned char *output = malloc(row_length);
+
+    for (i=0; i<ROW_COUNT; i++) {
+        unsigned char *row = &rows[i * row_length];
+        fill_row(row, &seed);
+        compressed_lens[i] = sas_rle_compressed_len(row, row_length);
+        compressed[i] = malloc(compressed_lens[i]);
+        sas_rle_compress(compressed[i], compressed_lens[i], row, row_length);
+        compressed_total += compressed_lens[i];
+    }
+
+    for (i=0; i<ROW_COUNT; i++) {
+        if (sas_rle_decompress(output, row_length, compressed[i], compressed_lens[i]) != (ssize_t)row_length ||
+                memcmp(output, &rows[i * row_length], row_length) != 0) {
+            fprintf(stderr, "Row %ld did not round-trip\n", (long)i);
+            return 1;
+        }
+        if (sas_rle_decompressed_len(compressed[i], compressed_lens[i]) != (ssize_t)row_length) {
+            fprintf(stderr, "Row %ld measured the wrong length\n", (long)i);
+            return 1;
+        }
+    }
+
+    clock_t start = clock();
+    for (k=0; k<ITERATIONS; k++) {
+        for (i=0; i<ROW_COUNT; i++) {
+            sas_rle_decompress(output, row_length, compressed[i], compressed_lens[i]);
+        }
+    }
+    double seconds = 1.0 * (clock() - start) / CLOCKS_PER_SEC;
+    printf("%d rows x %ld bytes (%.1f%% compressed), %d iterations\n",
+            ROW_COUNT, (long)row_length, 100.0 * compressed_total / (ROW_COUNT * row_length),
+            ITERATIONS);
+    printf("%.3f s, %.1f MB/s decompressed\n", seconds,
+            1.0 * ITERATIONS * ROW_COUNT * row_length / seconds / 1e6);
+
+    for (i=0; i<ROW_COUNT; i++) {
+        free(compressed[i]);
+    }
+    free(compressed);
+    free(compressed_lens);
+    free(rows);
+    free(output);
+
+    return 0;
+}
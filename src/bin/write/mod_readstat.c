@@ -28,6 +28,7 @@ typedef struct mod_readstat_ctx_s {
 } mod_readstat_ctx_t;
 
 static ssize_t write_data(const void *bytes, size_t len, void *ctx);
+static readstat_off_t seek_data(readstat_off_t offset, readstat_io_flags_t whence, void *ctx);
 
 static int accept_file(const char *filename);
 static void *ctx_init(const char *filename);
@@ -61,6 +62,25 @@ static ssize_t write_data(const void *bytes, size_t len, void *ctx) {
     return write(mod_ctx->out_fd, bytes, len);
 }
 
+static readstat_off_t seek_data(readstat_off_t offset, readstat_io_flags_t whence, void *ctx) {
+    mod_readstat_ctx_t *mod_ctx = (mod_readstat_ctx_t *)ctx;
+    int flag = 0;
+    switch (whence) {
+        case READSTAT_SEEK_SET:
+            flag = SEEK_SET;
+            break;
+        case READSTAT_SEEK_CUR:
+            flag = SEEK_CUR;
+            break;
+        case READSTAT_SEEK_END:
+            flag = SEEK_END;
+            break;
+        default:
+            return -1;
+    }
+    return lseek(mod_ctx->out_fd, offset, flag);
+}
+
 static int accept_file(const char *filename) {
     return (rs_ends_with(filename, ".dta") ||
             rs_ends_with(filename, ".sav") ||
@@ -88,6 +108,8 @@ static void *ctx_init(const char *filename) {
     mod_ctx->writer = readstat_writer_init();
     readstat_writer_set_file_label(mod_ctx->writer, "Created by ReadStat <https://github.com/WizardMac/ReadStat>");
     readstat_set_data_writer(mod_ctx->writer, &write_data);
+    if (lseek(mod_ctx->out_fd, 0, SEEK_CUR) != -1)
+        readstat_set_data_seeker(mod_ctx->writer, &seek_data);
 
     return mod_ctx;
 }
@@ -295,6 +295,31 @@ typedef int (*readstat_value_label_handler)(const char *val_labels,
 typedef void (*readstat_error_handler)(const char *error_message, void *ctx);
 typedef int (*readstat_progress_handler)(double progress, void *ctx);
 
+/* Columnar batch delivery. If a batch handler is set, it is used instead of
+ * the value handler: values are accumulated into one column per non-skipped
+ * variable (indexed by readstat_variable_get_index_after_skipping) and handed
+ * over every batch_size rows, plus once more at the end of the data.
+ *
+ * Integer types (INT8, INT16, INT32) are stored in int32_values; FLOAT and
+ * DOUBLE in double_values. Strings are NUL-terminated and start at
+ * string_data + string_offsets[i]. Bit (i % 8) of missing[i / 8] is set for
+ * system-missing and tagged-missing values, and tags[i] holds the tag (or 0).
+ * The arrays are owned by ReadStat and are only valid inside the handler.
+ */
+typedef struct readstat_batch_column_s {
+    readstat_variable_t    *variable;
+    readstat_type_t         type;
+    double                 *double_values;
+    int32_t                *int32_values;
+    char                   *string_data;
+    size_t                 *string_offsets;
+    unsigned char          *missing;
+    char                   *tags;
+} readstat_batch_column_t;
+
+typedef int (*readstat_batch_handler)(int obs_index, int obs_count,
+        readstat_batch_column_t *columns, int column_count, void *ctx);
+
 #ifdef _MSC_VER
 typedef off_t readstat_off_t;
 typedef __int64 ssize_t;
@@ -316,6 +341,10 @@ typedef int (*readstat_open_handler)(const char *path, void *io_ctx);
 typedef int (*readstat_close_handler)(void *io_ctx);
 typedef readstat_off_t (*readstat_seek_handler)(readstat_off_t offset, readstat_io_flags_t whence, void *io_ctx);
 typedef ssize_t (*readstat_read_handler)(void *buf, size_t nbyte, void *io_ctx);
+/* Optional zero-copy read: return a pointer to the next nbyte bytes and
+ * advance past them, or NULL if they can't be lent (readers then fall back to
+ * the read handler). The memory must stay valid until the close handler runs. */
+typedef const void *(*readstat_borrow_handler)(size_t nbyte, void *io_ctx);
 typedef readstat_error_t (*readstat_update_handler)(long file_size, readstat_progress_handler progress_handler, void *user_ctx, void *io_ctx);
 
 typedef struct readstat_io_s {
@@ -326,6 +355,7 @@ typedef struct readstat_io_s {
     readstat_update_handler        update;
     void                          *io_ctx;
     int                            io_ctx_needs_free;
+    readstat_borrow_handler        borrow;
 } readstat_io_t;
 
 typedef struct readstat_callbacks_s {
@@ -337,8 +367,14 @@ typedef struct readstat_callbacks_s {
     readstat_value_label_handler   value_label;
     readstat_error_handler         error;
     readstat_progress_handler      progress;
+    readstat_batch_handler         batch;
 } readstat_callbacks_t;
 
+/* Opaque row index; see readstat_set_row_index() */
+typedef struct readstat_row_index_s readstat_row_index_t;
+/* Opaque column selection; see readstat_select_column_index() */
+typedef struct readstat_projection_s readstat_projection_t;
+
 typedef struct readstat_parser_s {
     readstat_callbacks_t    handlers;
     readstat_io_t          *io;
@@ -346,6 +382,10 @@ typedef struct readstat_parser_s {
     const char             *output_encoding;
     long                    row_limit;
     long                    row_offset;
+    long                    batch_size;
+    readstat_row_index_t   *row_index;
+    readstat_projection_t  *projection;
+    int                     thread_count;
 } readstat_parser_t;
 
 readstat_parser_t *readstat_parser_init(void);
@@ -360,14 +400,22 @@ readstat_error_t readstat_set_value_handler(readstat_parser_t *parser, readstat_
 readstat_error_t readstat_set_value_label_handler(readstat_parser_t *parser, readstat_value_label_handler value_label_handler);
 readstat_error_t readstat_set_error_handler(readstat_parser_t *parser, readstat_error_handler error_handler);
 readstat_error_t readstat_set_progress_handler(readstat_parser_t *parser, readstat_progress_handler progress_handler);
+readstat_error_t readstat_set_batch_handler(readstat_parser_t *parser, readstat_batch_handler batch_handler);
 
 readstat_error_t readstat_set_open_handler(readstat_parser_t *parser, readstat_open_handler open_handler);
 readstat_error_t readstat_set_close_handler(readstat_parser_t *parser, readstat_close_handler close_handler);
 readstat_error_t readstat_set_seek_handler(readstat_parser_t *parser, readstat_seek_handler seek_handler);
 readstat_error_t readstat_set_read_handler(readstat_parser_t *parser, readstat_read_handler read_handler);
+// Setting a read handler clears the borrow handler, so set this one afterwards
+readstat_error_t readstat_set_borrow_handler(readstat_parser_t *parser, readstat_borrow_handler borrow_handler);
 readstat_error_t readstat_set_update_handler(readstat_parser_t *parser, readstat_update_handler update_handler);
 readstat_error_t readstat_set_io_ctx(readstat_parser_t *parser, void *io_ctx);
 
+// Replaces the default read(2)-based I/O with a memory-mapped implementation
+// that lets the SAS7BDAT, DTA and SAV readers parse straight out of the mapping.
+// Falls back to read(2) for files that can't be mapped.
+readstat_error_t readstat_set_mmap_io(readstat_parser_t *parser);
+
 // Usually inferred from the file, but sometimes a manual override is desirable.
 // In particular, pre-14 Stata uses the system encoding, which is usually Win 1252
 // but could be anything. `encoding' should be an iconv-compatible name.
@@ -379,6 +427,42 @@ readstat_error_t readstat_set_handler_character_encoding(readstat_parser_t *pars
 readstat_error_t readstat_set_row_limit(readstat_parser_t *parser, long row_limit);
 readstat_error_t readstat_set_row_offset(readstat_parser_t *parser, long row_offset);
 
+// Number of rows per call to the batch handler. Defaults to 1024.
+readstat_error_t readstat_set_batch_size(readstat_parser_t *parser, long batch_size);
+
+// Decode data on up to thread_count worker threads: SAS7BDAT pages are
+// decompressed and their numeric values byte-swapped, and ZSAV blocks are
+// inflated. Handlers are still called from the calling thread, one at a time
+// and in row order, along with string conversion. Defaults to 1 (no worker
+// threads). Currently used by the SAS7BDAT and ZSAV readers; has no effect
+// if ReadStat was built without pthreads.
+readstat_error_t readstat_set_thread_count(readstat_parser_t *parser, int thread_count);
+
+// A row index records which rows live in which page of a compressed file, so
+// that later reads with a row offset can seek past pages instead of
+// decompressing them. An empty index is filled in as a side effect of a full
+// read; it is discarded and rebuilt if it does not match the file, going by
+// the file's size and a fingerprint of its header. Indexes can be saved next
+// to the data file and loaded again in a later session, on any machine: the
+// on-disk format is little-endian. Currently used by the SAS7BDAT and ZSAV
+// readers.
+readstat_row_index_t *readstat_row_index_init(void);
+void readstat_row_index_free(readstat_row_index_t *index);
+int64_t readstat_row_index_get_block_count(readstat_row_index_t *index);
+readstat_error_t readstat_row_index_save(readstat_row_index_t *index, const char *path);
+readstat_error_t readstat_row_index_load(readstat_row_index_t *index, const char *path);
+readstat_error_t readstat_set_row_index(readstat_parser_t *parser, readstat_row_index_t *index);
+
+// Restrict parsing to a subset of the columns, chosen by zero-based position
+// or by (case-sensitive) name before parsing starts. Once any column has been
+// selected, the others are dropped up front: they are not passed to the
+// variable handler, their values are never decoded or converted, and
+// index_after_skipping counts only the selected columns. Out-of-range
+// positions and unknown names select nothing. Honored by the DTA, SAV, POR,
+// SAS7BDAT and XPORT readers.
+readstat_error_t readstat_select_column_index(readstat_parser_t *parser, int index);
+readstat_error_t readstat_select_column_name(readstat_parser_t *parser, const char *name);
+
 /* Parse binary / portable files */
 readstat_error_t readstat_parse_dta(readstat_parser_t *parser, const char *path, void *user_ctx);
 readstat_error_t readstat_parse_sav(readstat_parser_t *parser, const char *path, void *user_ctx);
@@ -418,6 +502,13 @@ typedef readstat_error_t (*readstat_write_int16_callback)(void *row_data, const
 typedef readstat_error_t (*readstat_write_int32_callback)(void *row_data, const readstat_variable_t *variable, int32_t value);
 typedef readstat_error_t (*readstat_write_float_callback)(void *row_data, const readstat_variable_t *variable, float value);
 typedef readstat_error_t (*readstat_write_double_callback)(void *row_data, const readstat_variable_t *variable, double value);
+/* Optional: encode `count' doubles into the same cell of consecutive rows, `row_len' bytes apart.
+ * The write_floats callback has the same type, for FLOAT variables. */
+typedef readstat_error_t (*readstat_write_doubles_callback)(void *row_data, size_t row_len, const readstat_variable_t *variable,
+        const double *values, int count);
+/* Optional: the same for integers, which already fit the variable's type */
+typedef readstat_error_t (*readstat_write_int32s_callback)(void *row_data, size_t row_len, const readstat_variable_t *variable,
+        const int32_t *values, int count);
 typedef readstat_error_t (*readstat_write_string_callback)(void *row_data, const readstat_variable_t *variable, const char *value);
 typedef readstat_error_t (*readstat_write_string_ref_callback)(void *row_data, const readstat_variable_t *variable, readstat_string_ref_t *ref);
 typedef readstat_error_t (*readstat_write_missing_callback)(void *row_data, const readstat_variable_t *variable);
@@ -447,12 +538,22 @@ typedef struct readstat_writer_callbacks_s {
     readstat_end_data_callback          end_data;
     readstat_module_ctx_free_callback   module_ctx_free;
     readstat_metadata_ok_callback       metadata_ok;
+    readstat_write_doubles_callback     write_doubles;
+    readstat_write_doubles_callback     write_floats;
+    readstat_write_int32s_callback      write_int32s;
 } readstat_writer_callbacks_t;
 
 /* You'll need to define one of these to get going. Should return # bytes written,
  * or -1 on error, a la write(2) */
 typedef ssize_t (*readstat_data_writer)(const void *data, size_t len, void *ctx);
 
+/* Optionally, a function to reposition the output, a la lseek(2). Should
+ * return the new offset, or -1 on error. Offsets are relative to the first
+ * byte passed to the data writer, so an output that doesn't start at the
+ * beginning of a file has to add its own starting position. The writers
+ * only seek with READSTAT_SEEK_SET. */
+typedef readstat_off_t (*readstat_data_seeker)(readstat_off_t offset, readstat_io_flags_t whence, void *ctx);
+
 typedef struct readstat_writer_s {
     readstat_data_writer        data_writer;
     size_t                      bytes_written;
@@ -493,6 +594,13 @@ typedef struct readstat_writer_s {
     void                       *user_ctx;
 
     int                         initialized;
+
+    readstat_data_seeker        data_seeker;
+    char                       *write_buffer;
+    size_t                      write_buffer_size;
+    size_t                      write_buffer_used;
+    int                         compression_level;
+    int                         thread_count;
 } readstat_writer_t;
 
 /* Writer API */
@@ -504,6 +612,12 @@ readstat_writer_t *readstat_writer_init(void);
 // Then specify a function that will handle the output bytes...
 readstat_error_t readstat_set_data_writer(readstat_writer_t *writer, readstat_data_writer data_writer);
 
+// If the output is seekable, also specify a seek function. Compressed
+// SAS7BDAT and ZSAV files will then be streamed out as rows are written,
+// with the header filled in afterwards, rather than held in memory until
+// readstat_end_writing().
+readstat_error_t readstat_set_data_seeker(readstat_writer_t *writer, readstat_data_seeker data_seeker);
+
 // Next define your value labels, if any. Create as many named sets as you'd like.
 readstat_label_set_t *readstat_add_label_set(readstat_writer_t *writer, readstat_type_t type, const char *name);
 void readstat_label_double_value(readstat_label_set_t *label_set, double value, const char *label);
@@ -560,8 +674,20 @@ readstat_error_t readstat_writer_set_file_format_is_64bit(readstat_writer_t *wri
         int is_64bit); // applies only to SAS files; defaults to 1=true
 readstat_error_t readstat_writer_set_compression(readstat_writer_t *writer,
         readstat_compress_t compression); 
-        // READSTAT_COMPRESS_BINARY is supported only with SAV files (i.e. ZSAV files)
+        // READSTAT_COMPRESS_BINARY is supported only with sas7bdat (i.e. COMPRESS=BINARY)
+        // and SAV files (i.e. ZSAV files)
         // READSTAT_COMPRESS_ROWS is supported only with sas7bdat and SAV files
+readstat_error_t readstat_writer_set_compression_level(readstat_writer_t *writer,
+        int compression_level);
+        // zlib level (0-9) for READSTAT_COMPRESS_BINARY in ZSAV files; defaults to -1, zlib's default
+readstat_error_t readstat_writer_set_thread_count(readstat_writer_t *writer,
+        int thread_count);
+        // Compress ZSAV blocks on up to thread_count worker threads; defaults to 1
+
+// Output is collected into chunks of this size before being passed to the
+// data writer; the remainder is flushed by readstat_end_writing(). Defaults
+// to 64 KB; set to 0 to pass every write straight through.
+readstat_error_t readstat_writer_set_write_buffer_size(readstat_writer_t *writer, size_t size);
 
 // Optional error handler
 readstat_error_t readstat_writer_set_error_handler(readstat_writer_t *writer, 
@@ -596,6 +722,21 @@ readstat_error_t readstat_insert_tagged_missing_value(readstat_writer_t *writer,
 // Finally, close out the row
 readstat_error_t readstat_end_row(readstat_writer_t *writer);
 
+// Alternatively, write row_count complete rows at a time from column arrays,
+// laid out as for the batch handler (see readstat_batch_column_t). Each
+// column's variable must be one returned by readstat_add_variable and its type
+// must match the variable's; variables without a column are left empty.
+// STRING_REF columns hold indexes of string refs in int32_values, and INT8 and
+// INT16 values that don't fit their type are rejected with
+// READSTAT_ERROR_NUMERIC_VALUE_IS_OUT_OF_RANGE. Types are checked once per call
+// rather than once per value. A batch that would run
+// past the row count given to readstat_begin_writing_* is rejected with
+// READSTAT_ERROR_ROW_COUNT_MISMATCH before anything is written. Otherwise stops
+// at the first value that can't be written, returning its error; earlier rows
+// stay written.
+readstat_error_t readstat_insert_column_batch(readstat_writer_t *writer, int row_count,
+        const readstat_batch_column_t *columns, int columns_count);
+
 // Once you've written all the rows, clean up after yourself
 readstat_error_t readstat_end_writing(readstat_writer_t *writer);
 void readstat_writer_free(readstat_writer_t *writer);
@@ -0,0 +1,264 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "readstat.h"
+#include "readstat_batch.h"
+
+readstat_batch_t *readstat_batch_init(readstat_parser_t *parser, void *user_ctx) {
+    readstat_batch_t *batch = NULL;
+    if (!parser->handlers.batch)
+        return NULL;
+
+    if ((batch = calloc(1, sizeof(readstat_batch_t))) == NULL)
+        return NULL;
+
+    batch->handler = parser->handlers.batch;
+    batch->user_ctx = user_ctx;
+    batch->batch_size = parser->batch_size;
+    if (batch->batch_size <= 0)
+        batch->batch_size = READSTAT_DEFAULT_BATCH_SIZE;
+
+    return batch;
+}
+
+static void readstat_batch_column_free(readstat_batch_column_t *column) {
+    free(column->double_values);
+    free(column->int32_values);
+    free(column->string_data);
+    free(column->string_offsets);
+    free(column->missing);
+    free(column->tags);
+}
+
+void readstat_batch_free(readstat_batch_t *batch) {
+    if (batch) {
+        int i;
+        for (i=0; i<batch->columns_count; i++) {
+            readstat_batch_column_free(&batch->columns[i]);
+        }
+        free(batch->columns);
+        free(batch->string_data_lens);
+        free(batch->string_data_capacities);
+        free(batch);
+    }
+}
+
+static readstat_error_t readstat_batch_grow_columns(readstat_batch_t *batch, int columns_count) {
+    int capacity = batch->columns_capacity ? batch->columns_capacity : 8;
+    while (capacity < columns_count)
+        capacity *= 2;
+
+    if (capacity > batch->columns_capacity) {
+        readstat_batch_column_t *columns = NULL;
+        size_t *lens = NULL, *capacities = NULL;
+
+        if ((columns = realloc(batch->columns, capacity * sizeof(readstat_batch_column_t))) == NULL)
+            return READSTAT_ERROR_MALLOC;
+        batch->columns = columns;
+
+        if ((lens = realloc(batch->string_data_lens, capacity * sizeof(size_t))) == NULL)
+            return READSTAT_ERROR_MALLOC;
+        batch->string_data_lens = lens;
+
+        if ((capacities = realloc(batch->string_data_capacities, capacity * sizeof(size_t))) == NULL)
+            return READSTAT_ERROR_MALLOC;
+        batch->string_data_capacities = capacities;
+
+        memset(&batch->columns[batch->columns_capacity], 0,
+                (capacity - batch->columns_capacity) * sizeof(readstat_batch_column_t));
+        memset(&batch->string_data_lens[batch->columns_capacity], 0,
+                (capacity - batch->columns_capacity) * sizeof(size_t));
+        memset(&batch->string_data_capacities[batch->columns_capacity], 0,
+                (capacity - batch->columns_capacity) * sizeof(size_t));
+
+        batch->columns_capacity = capacity;
+    }
+
+    if (columns_count > batch->columns_count)
+        batch->columns_count = columns_count;
+
+    return READSTAT_OK;
+}
+
+static readstat_error_t readstat_batch_column_init(readstat_batch_t *batch,
+        readstat_batch_column_t *column, readstat_variable_t *variable) {
+    readstat_type_t type = variable->type;
+    size_t bitmap_len = (batch->batch_size + 7) / 8;
+
+    if (type == READSTAT_TYPE_STRING_REF)
+        type = READSTAT_TYPE_STRING;
+
+    column->variable = variable;
+    column->type = type;
+
+    if ((column->missing = calloc(bitmap_len, 1)) == NULL)
+        return READSTAT_ERROR_MALLOC;
+
+    if ((column->tags = calloc(batch->batch_size, 1)) == NULL)
+        return READSTAT_ERROR_MALLOC;
+
+    if (type == READSTAT_TYPE_STRING) {
+        if ((column->string_offsets = calloc(batch->batch_size, sizeof(size_t))) == NULL)
+            return READSTAT_ERROR_MALLOC;
+    } else if (type == READSTAT_TYPE_INT8 || type == READSTAT_TYPE_INT16 ||
+            type == READSTAT_TYPE_INT32) {
+        if ((column->int32_values = calloc(batch->batch_size, sizeof(int32_t))) == NULL)
+            return READSTAT_ERROR_MALLOC;
+    } else {
+        if ((column->double_values = calloc(batch->batch_size, sizeof(double))) == NULL)
+            return READSTAT_ERROR_MALLOC;
+    }
+
+    return READSTAT_OK;
+}
+
+readstat_error_t readstat_batch_row(readstat_batch_t *batch, int obs_index, int *row) {
+    readstat_error_t retval = READSTAT_OK;
+
+    if (batch->obs_count && obs_index - batch->obs_index >= batch->batch_size) {
+        if ((retval = readstat_batch_flush(batch)) != READSTAT_OK)
+            return retval;
+    }
+
+    if (batch->obs_count == 0)
+        batch->obs_index = obs_index;
+
+    *row = obs_index - batch->obs_index;
+    if (*row < 0 || *row >= batch->batch_size)
+        return READSTAT_ERROR_PARSE;
+
+    if (*row + 1 > batch->obs_count)
+        batch->obs_count = *row + 1;
+
+    return READSTAT_OK;
+}
+
+readstat_error_t readstat_batch_column(readstat_batch_t *batch, readstat_variable_t *variable,
+        readstat_batch_column_t **column) {
+    readstat_error_t retval = READSTAT_OK;
+    int index = variable->index_after_skipping;
+
+    if (index >= batch->columns_count) {
+        if ((retval = readstat_batch_grow_columns(batch, index + 1)) != READSTAT_OK)
+            return retval;
+    }
+
+    if (batch->columns[index].variable == NULL) {
+        if ((retval = readstat_batch_column_init(batch, &batch->columns[index], variable)) != READSTAT_OK)
+            return retval;
+    }
+
+    *column = &batch->columns[index];
+    return READSTAT_OK;
+}
+
+void readstat_batch_set_missing(readstat_batch_column_t *column, int row, char tag) {
+    column->missing[row / 8] |= (1 << (row % 8));
+    column->tags[row] = tag;
+}
+
+/* Returns len bytes at the end of the column's string data for the string in
+ * this row, or NULL if they can't be allocated */
+char *readstat_batch_reserve_string(readstat_batch_t *batch, readstat_batch_column_t *column,
+        int row, size_t len) {
+    size_t index = column - batch->columns;
+    size_t offset = batch->string_data_lens[index];
+
+    if (offset + len > batch->string_data_capacities[index]) {
+        size_t capacity = batch->string_data_capacities[index];
+        char *string_data = NULL;
+        if (capacity == 0)
+            capacity = 1024;
+        while (capacity < offset + len)
+            capacity *= 2;
+
+        if ((string_data = realloc(column->string_data, capacity)) == NULL)
+            return NULL;
+
+        column->string_data = string_data;
+        batch->string_data_capacities[index] = capacity;
+    }
+
+    column->string_offsets[row] = offset;
+    return &column->string_data[offset];
+}
+
+/* Keeps the NUL-terminated string just written to the reserved space */
+void readstat_batch_end_string(readstat_batch_t *batch, readstat_batch_column_t *column) {
+    size_t index = column - batch->columns;
+    size_t offset = batch->string_data_lens[index];
+
+    batch->string_data_lens[index] = offset + strlen(&column->string_data[offset]) + 1;
+}
+
+readstat_error_t readstat_batch_set_string(readstat_batch_t *batch, readstat_batch_column_t *column,
+        int row, const char *string) {
+    size_t len = string ? strlen(string) : 0;
+    char *dst = NULL;
+
+    if ((dst = readstat_batch_reserve_string(batch, column, row, len + 1)) == NULL)
+        return READSTAT_ERROR_MALLOC;
+
+    if (len)
+        memcpy(dst, string, len);
+    dst[len] = '\0';
+
+    readstat_batch_end_string(batch, column);
+
+    return READSTAT_OK;
+}
+
+readstat_error_t readstat_batch_append(readstat_batch_t *batch, int obs_index,
+        readstat_variable_t *variable, readstat_value_t value) {
+    readstat_error_t retval = READSTAT_OK;
+    readstat_batch_column_t *column = NULL;
+    int row = 0;
+
+    if ((retval = readstat_batch_row(batch, obs_index, &row)) != READSTAT_OK)
+        goto cleanup;
+
+    if ((retval = readstat_batch_column(batch, variable, &column)) != READSTAT_OK)
+        goto cleanup;
+
+    if (value.is_system_missing || value.is_tagged_missing)
+        readstat_batch_set_missing(column, row, value.is_tagged_missing ? value.tag : '\0');
+
+    if (column->type == READSTAT_TYPE_STRING) {
+        retval = readstat_batch_set_string(batch, column, row, readstat_string_value(value));
+    } else if (column->int32_values) {
+        column->int32_values[row] = readstat_int32_value(value);
+    } else {
+        column->double_values[row] = readstat_double_value(value);
+    }
+
+cleanup:
+    return retval;
+}
+
+readstat_error_t readstat_batch_flush(readstat_batch_t *batch) {
+    readstat_error_t retval = READSTAT_OK;
+    int i;
+
+    if (batch == NULL || batch->obs_count == 0)
+        return READSTAT_OK;
+
+    if (batch->handler(batch->obs_index, batch->obs_count,
+                batch->columns, batch->columns_count, batch->user_ctx) != READSTAT_HANDLER_OK) {
+        retval = READSTAT_ERROR_USER_ABORT;
+    }
+
+    for (i=0; i<batch->columns_count; i++) {
+        readstat_batch_column_t *column = &batch->columns[i];
+        if (column->missing)
+            memset(column->missing, 0, (batch->obs_count + 7) / 8);
+        if (column->tags)
+            memset(column->tags, 0, batch->obs_count);
+        batch->string_data_lens[i] = 0;
+    }
+
+    batch->obs_index += batch->obs_count;
+    batch->obs_count = 0;
+
+    return retval;
+}
@@ -0,0 +1,41 @@
+
+#define READSTAT_DEFAULT_BATCH_SIZE 1024
+
+typedef struct readstat_batch_s {
+    readstat_batch_handler      handler;
+    void                       *user_ctx;
+    long                        batch_size;
+
+    int                         obs_index;
+    int                         obs_count;
+
+    readstat_batch_column_t    *columns;
+    size_t                     *string_data_lens;
+    size_t                     *string_data_capacities;
+    int                         columns_count;
+    int                         columns_capacity;
+} readstat_batch_t;
+
+readstat_batch_t *readstat_batch_init(readstat_parser_t *parser, void *user_ctx);
+void readstat_batch_free(readstat_batch_t *batch);
+
+/* Readers fill a row by asking for its slot with readstat_batch_row (which
+ * hands over a full batch first) and the column of each variable with
+ * readstat_batch_column, then storing the decoded value straight into the
+ * column's int32_values or double_values. Strings are converted into space
+ * from readstat_batch_reserve_string and committed with
+ * readstat_batch_end_string. */
+readstat_error_t readstat_batch_row(readstat_batch_t *batch, int obs_index, int *row);
+readstat_error_t readstat_batch_column(readstat_batch_t *batch, readstat_variable_t *variable,
+        readstat_batch_column_t **column);
+void readstat_batch_set_missing(readstat_batch_column_t *column, int row, char tag);
+char *readstat_batch_reserve_string(readstat_batch_t *batch, readstat_batch_column_t *column,
+        int row, size_t len);
+void readstat_batch_end_string(readstat_batch_t *batch, readstat_batch_column_t *column);
+readstat_error_t readstat_batch_set_string(readstat_batch_t *batch, readstat_batch_column_t *column,
+        int row, const char *string);
+
+/* Appends one value, for readers that already have it as a readstat_value_t */
+readstat_error_t readstat_batch_append(readstat_batch_t *batch, int obs_index,
+        readstat_variable_t *variable, readstat_value_t value);
+readstat_error_t readstat_batch_flush(readstat_batch_t *batch);
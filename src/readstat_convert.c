@@ -1,27 +1,219 @@
-
 #include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include "readstat.h"
 #include "readstat_iconv.h"
 #include "readstat_convert.h"
 
-readstat_error_t readstat_convert(char *dst, size_t dst_len, const char *src, size_t src_len, iconv_t converter) {
+#define READSTAT_HIGH_BITS  UINT64_C(0x8080808080808080)
+
+/* An ISO-2022 switch to a double-byte set and back, all in ASCII bytes */
+static const char readstat_iso2022_shift[] = "\x1b$B!!\x1b(B";
+
+static int readstat_iconv_passes_through(iconv_t cd, const char *probe, size_t probe_len) {
+    char converted[128];
+    char *src = (char *)probe;
+    size_t src_left = probe_len;
+    char *dst = converted;
+    size_t dst_left = sizeof(converted);
+
+    size_t status = iconv(cd, (readstat_iconv_inbuf_t)&src, &src_left, &dst, &dst_left);
+
+    /* Back to the initial shift state, whatever happened */
+    iconv(cd, NULL, NULL, NULL, NULL);
+
+    return (status != (size_t)-1 && src_left == 0 && sizeof(converted) - dst_left == probe_len &&
+            memcmp(probe, converted, probe_len) == 0);
+}
+
+/* Feed 7-bit ASCII through the converter and see whether it comes out
+ * unchanged. This rules out EBCDIC and other non-ASCII source encodings,
+ * wide output encodings, and stateful encodings that give meaning to ASCII
+ * bytes like '+' or SO. ISO-2022-JP lets a lone ESC through, so it's caught
+ * with an actual escape sequence instead. */
+static int readstat_converter_is_ascii_compatible(iconv_t cd) {
+    char ascii[128];
+    int i;
+
+    for (i=0; i<sizeof(ascii); i++) {
+        ascii[i] = i;
+    }
+
+    return (readstat_iconv_passes_through(cd, ascii, sizeof(ascii)) &&
+            readstat_iconv_passes_through(cd, readstat_iso2022_shift, sizeof(readstat_iso2022_shift)-1));
+}
+
+/* Convert each byte on its own to fill in the table. A byte that iconv
+ * needs more of (EINVAL) starts a multi-byte sequence, and then there's no
+ * table; nor is there one if a byte comes out longer than a table entry.
+ * Neither is there if converting the bytes one at a time gives a different
+ * answer than converting them all at once, as it would for a stateful
+ * encoding on either side. */
+static int readstat_converter_init_table(readstat_converter_t *converter) {
+    const char *shift = readstat_iso2022_shift;
+    size_t shift_len = sizeof(readstat_iso2022_shift)-1;
+    char probe[256 + sizeof(readstat_iso2022_shift)];
+    char expected[sizeof(probe) * READSTAT_CONVERTER_MAX_SEQUENCE];
+    char converted[sizeof(expected)];
+    size_t probe_len = 0, expected_len = 0;
+    int i;
+
+    for (i=0; i<256; i++) {
+        char byte = i;
+        char *src = &byte;
+        size_t src_left = 1;
+        char *dst = converter->sequences[i];
+        size_t dst_left = READSTAT_CONVERTER_MAX_SEQUENCE;
+
+        size_t status = iconv(converter->cd, (readstat_iconv_inbuf_t)&src, &src_left, &dst, &dst_left);
+        int saved_errno = errno;
+        size_t held_back = dst_left;
+        iconv(converter->cd, NULL, NULL, &dst, &held_back);
+        iconv(converter->cd, NULL, NULL, NULL, NULL);
+
+        if (status == (size_t)-1) {
+            if (saved_errno != EILSEQ)
+                return 0;
+            converter->sequence_lens[i] = -1;
+            continue;
+        }
+        /* Some code pages (e.g. WINDOWS-1258) hold a character back in case
+         * the next one combines with it */
+        if (held_back != dst_left)
+            return 0;
+        converter->sequence_lens[i] = READSTAT_CONVERTER_MAX_SEQUENCE - dst_left;
+        probe[probe_len++] = byte;
+    }
+    for (i=0; i<shift_len; i++) {
+        if (converter->sequence_lens[(unsigned char)shift[i]] == -1)
+            break;
+    }
+    if (i == shift_len) {
+        memcpy(&probe[probe_len], shift, shift_len);
+        probe_len += shift_len;
+    }
+
+    for (i=0; i<probe_len; i++) {
+        unsigned char byte = probe[i];
+        memcpy(&expected[expected_len], converter->sequences[byte], converter->sequence_lens[byte]);
+        expected_len += converter->sequence_lens[byte];
+    }
+
+    char *src = probe;
+    size_t src_left = probe_len;
+    char *dst = converted;
+    size_t dst_left = sizeof(converted);
+    size_t status = iconv(converter->cd, (readstat_iconv_inbuf_t)&src, &src_left, &dst, &dst_left);
+    iconv(converter->cd, NULL, NULL, NULL, NULL);
+
+    return (status != (size_t)-1 && src_left == 0 && sizeof(converted) - dst_left == expected_len &&
+            memcmp(expected, converted, expected_len) == 0);
+}
+
+static readstat_error_t readstat_convert_single_byte(char *dst, size_t dst_len, const char *src, size_t src_len,
+        const readstat_converter_t *converter) {
+    const unsigned char *bytes = (const unsigned char *)src;
+    size_t dst_left = dst_len - 1;
+    size_t i;
+
+    for (i=0; i<src_len; i++) {
+        int len = converter->sequence_lens[bytes[i]];
+        if (len == -1)
+            return READSTAT_ERROR_CONVERT_BAD_STRING;
+        if (len > dst_left)
+            return READSTAT_ERROR_CONVERT_LONG_STRING;
+        /* A fixed-size copy is quicker, when there's room for it */
+        if (dst_left >= READSTAT_CONVERTER_MAX_SEQUENCE) {
+            memcpy(dst, converter->sequences[bytes[i]], READSTAT_CONVERTER_MAX_SEQUENCE);
+        } else {
+            memcpy(dst, converter->sequences[bytes[i]], len);
+        }
+        dst += len;
+        dst_left -= len;
+    }
+    *dst = '\0';
+
+    return READSTAT_OK;
+}
+
+static int readstat_is_ascii(const char *src, size_t src_len) {
+    const unsigned char *bytes = (const unsigned char *)src;
+    uint64_t high_bits = 0;
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= src_len; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, &bytes[i], sizeof(uint64_t));
+        high_bits |= word;
+    }
+    for (; i<src_len; i++) {
+        high_bits |= bytes[i];
+    }
+
+    return !(high_bits & READSTAT_HIGH_BITS);
+}
+
+readstat_converter_t *readstat_converter_init(const char *dst_charset, const char *src_charset) {
+    iconv_t cd = iconv_open(dst_charset, src_charset);
+    if (cd == (iconv_t)-1)
+        return NULL;
+
+    readstat_converter_t *converter = calloc(1, sizeof(readstat_converter_t));
+    if (converter == NULL) {
+        iconv_close(cd);
+        return NULL;
+    }
+
+    converter->cd = cd;
+    converter->ascii_compatible = readstat_converter_is_ascii_compatible(cd);
+    converter->single_byte = readstat_converter_init_table(converter);
+
+    return converter;
+}
+
+void readstat_converter_free(readstat_converter_t *converter) {
+    if (converter == NULL)
+        return;
+
+    iconv_close(converter->cd);
+    free(converter);
+}
+
+readstat_error_t readstat_convert(char *dst, size_t dst_len, const char *src, size_t src_len,
+        readstat_converter_t *converter) {
     /* strip off spaces from the input because the programs use ASCII space
      * padding even with non-ASCII encoding. */
     while (src_len && src[src_len-1] == ' ') {
         src_len--;
     }
+    /* Most strings are plain ASCII, which needs no conversion at all */
+    if (converter && converter->ascii_compatible && readstat_is_ascii(src, src_len)) {
+        converter = NULL;
+    }
     if (dst_len == 0) {
         return READSTAT_ERROR_CONVERT_LONG_STRING;
+    } else if (converter && converter->single_byte) {
+        return readstat_convert_single_byte(dst, dst_len, src, src_len, converter);
     } else if (converter) {
         size_t dst_left = dst_len - 1;
         char *dst_end = dst;
-        size_t status = iconv(converter, (readstat_iconv_inbuf_t)&src, &src_len, &dst_end, &dst_left);
+        size_t status = iconv(converter->cd, (readstat_iconv_inbuf_t)&src, &src_len, &dst_end, &dst_left);
+        int saved_errno = errno;
+        /* Each string stands alone, so flush out anything that iconv held
+         * back, and leave cd in its initial state for the next one */
+        if ((status != (size_t)-1 || saved_errno == EINVAL) &&
+                iconv(converter->cd, NULL, NULL, &dst_end, &dst_left) == (size_t)-1) {
+            status = (size_t)-1;
+            saved_errno = errno;
+        }
+        iconv(converter->cd, NULL, NULL, NULL, NULL);
         if (status == (size_t)-1) {
-            if (errno == E2BIG) {
+            if (saved_errno == E2BIG) {
                 return READSTAT_ERROR_CONVERT_LONG_STRING;
-            } else if (errno == EILSEQ) {
+            } else if (saved_errno == EILSEQ) {
                 return READSTAT_ERROR_CONVERT_BAD_STRING;
-            } else if (errno != EINVAL) { /* EINVAL indicates improper truncation; accept it */
+            } else if (saved_errno != EINVAL) { /* EINVAL indicates improper truncation; accept it */
                 return READSTAT_ERROR_CONVERT;
             }
         }
@@ -1,2 +1,6 @@
 
-readstat_error_t readstat_convert(char *dst, size_t dst_len, const char *src, size_t src_len, iconv_t converter);
+readstat_converter_t *readstat_converter_init(const char *dst_charset, const char *src_charset);
+void readstat_converter_free(readstat_converter_t *converter);
+
+readstat_error_t readstat_convert(char *dst, size_t dst_len, const char *src, size_t src_len,
+        readstat_converter_t *converter);
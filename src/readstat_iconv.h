@@ -13,3 +13,17 @@ typedef struct readstat_charset_entry_s {
     int     code;
     char    name[32];
 } readstat_charset_entry_t;
+
+#define READSTAT_CONVERTER_MAX_SEQUENCE   4
+
+typedef struct readstat_converter_s {
+    iconv_t     cd;
+    /* Whether 7-bit ASCII comes out of cd unchanged, in which case strings
+     * without any high bits set are copied rather than converted */
+    int         ascii_compatible;
+    /* For single-byte source encodings, what cd makes of each byte (or -1
+     * for bytes it rejects), so that strings are converted by lookup */
+    int         single_byte;
+    int8_t      sequence_lens[256];
+    char        sequences[256][READSTAT_CONVERTER_MAX_SEQUENCE];
+} readstat_converter_t;
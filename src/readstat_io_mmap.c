@@ -0,0 +1,181 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+#if !defined _WIN32 && !defined __CYGWIN__
+#include <sys/mman.h>
+#define HAVE_MMAP 1
+#endif
+
+#include "readstat.h"
+#include "readstat_io_unistd.h"
+#include "readstat_io_mmap.h"
+
+/* Memory-mapped input. The whole file is mapped read-only at open time, reads
+ * become memcpy's out of the mapping, and the borrow handler hands out
+ * pointers into it so that readers can parse in place. If the file can't be
+ * mapped (empty files, pipes, platforms without mmap) the handlers fall back
+ * to plain read(2) on the descriptor, and borrowing is refused. */
+
+int mmap_open_handler(const char *path, void *io_ctx) {
+    mmap_io_ctx_t *ctx = (mmap_io_ctx_t *)io_ctx;
+    unistd_io_ctx_t fd_ctx = { .fd = -1 };
+
+    ctx->data = NULL;
+    ctx->data_len = 0;
+    ctx->pos = 0;
+    ctx->fd = unistd_open_handler(path, &fd_ctx);
+    if (ctx->fd == -1)
+        return -1;
+
+#if HAVE_MMAP
+    struct stat st;
+    if (fstat(ctx->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+            (uint64_t)st.st_size <= SIZE_MAX) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, ctx->fd, 0);
+        if (data != MAP_FAILED) {
+            ctx->data = data;
+            ctx->data_len = st.st_size;
+        }
+    }
+#endif
+
+    return ctx->fd;
+}
+
+int mmap_close_handler(void *io_ctx) {
+    mmap_io_ctx_t *ctx = (mmap_io_ctx_t *)io_ctx;
+    unistd_io_ctx_t fd_ctx = { .fd = ctx->fd };
+
+#if HAVE_MMAP
+    if (ctx->data)
+        munmap((void *)ctx->data, ctx->data_len);
+#endif
+    ctx->data = NULL;
+    ctx->data_len = 0;
+    ctx->fd = -1;
+
+    return unistd_close_handler(&fd_ctx);
+}
+
+readstat_off_t mmap_seek_handler(readstat_off_t offset,
+        readstat_io_flags_t whence, void *io_ctx) {
+    mmap_io_ctx_t *ctx = (mmap_io_ctx_t *)io_ctx;
+    readstat_off_t pos = 0;
+
+    if (ctx->data == NULL) {
+        unistd_io_ctx_t fd_ctx = { .fd = ctx->fd };
+        return unistd_seek_handler(offset, whence, &fd_ctx);
+    }
+
+    switch (whence) {
+        case READSTAT_SEEK_SET:
+            pos = offset;
+            break;
+        case READSTAT_SEEK_CUR:
+            pos = ctx->pos + offset;
+            break;
+        case READSTAT_SEEK_END:
+            pos = ctx->data_len + offset;
+            break;
+        default:
+            return -1;
+    }
+
+    if (pos < 0)
+        return -1;
+
+    ctx->pos = pos;
+    return pos;
+}
+
+ssize_t mmap_read_handler(void *buf, size_t nbyte, void *io_ctx) {
+    mmap_io_ctx_t *ctx = (mmap_io_ctx_t *)io_ctx;
+    size_t avail = 0;
+
+    if (ctx->data == NULL) {
+        unistd_io_ctx_t fd_ctx = { .fd = ctx->fd };
+        return unistd_read_handler(buf, nbyte, &fd_ctx);
+    }
+
+    if (ctx->pos < ctx->data_len)
+        avail = ctx->data_len - ctx->pos;
+    if (nbyte > avail)
+        nbyte = avail;
+
+    memcpy(buf, ctx->data + ctx->pos, nbyte);
+    ctx->pos += nbyte;
+
+    return nbyte;
+}
+
+const void *mmap_borrow_handler(size_t nbyte, void *io_ctx) {
+    mmap_io_ctx_t *ctx = (mmap_io_ctx_t *)io_ctx;
+    const void *bytes = NULL;
+
+    if (ctx->data == NULL || ctx->pos > ctx->data_len || nbyte > ctx->data_len - ctx->pos)
+        return NULL;
+
+    bytes = ctx->data + ctx->pos;
+    ctx->pos += nbyte;
+
+    return bytes;
+}
+
+readstat_error_t mmap_update_handler(long file_size, 
+        readstat_progress_handler progress_handler, void *user_ctx,
+        void *io_ctx) {
+    mmap_io_ctx_t *ctx = (mmap_io_ctx_t *)io_ctx;
+
+    if (ctx->data == NULL) {
+        unistd_io_ctx_t fd_ctx = { .fd = ctx->fd };
+        return unistd_update_handler(file_size, progress_handler, user_ctx, &fd_ctx);
+    }
+
+    if (!progress_handler)
+        return READSTAT_OK;
+
+    if (progress_handler(1.0 * ctx->pos / file_size, user_ctx))
+        return READSTAT_ERROR_USER_ABORT;
+
+    return READSTAT_OK;
+}
+
+readstat_error_t mmap_io_init(readstat_parser_t *parser) {
+    readstat_error_t retval = READSTAT_OK;
+    mmap_io_ctx_t *io_ctx = NULL;
+
+    if ((retval = readstat_set_open_handler(parser, mmap_open_handler)) != READSTAT_OK)
+        return retval;
+
+    if ((retval = readstat_set_close_handler(parser, mmap_close_handler)) != READSTAT_OK)
+        return retval;
+
+    if ((retval = readstat_set_seek_handler(parser, mmap_seek_handler)) != READSTAT_OK)
+        return retval;
+
+    if ((retval = readstat_set_read_handler(parser, mmap_read_handler)) != READSTAT_OK)
+        return retval;
+
+    if ((retval = readstat_set_borrow_handler(parser, mmap_borrow_handler)) != READSTAT_OK)
+        return retval;
+
+    if ((retval = readstat_set_update_handler(parser, mmap_update_handler)) != READSTAT_OK)
+        return retval;
+
+    if ((io_ctx = calloc(1, sizeof(mmap_io_ctx_t))) == NULL)
+        return READSTAT_ERROR_MALLOC;
+
+    io_ctx->fd = -1;
+
+    retval = readstat_set_io_ctx(parser, (void*) io_ctx);
+    parser->io->io_ctx_needs_free = 1;
+
+    return retval;
+}
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "readstat.h"
+#include "readstat_parallel.h"
+
+/* Runs work() over an array of items on a set of threads. Thread t handles
+ * items t, t + thread_count, t + 2*thread_count... so no locking is needed,
+ * and the caller is free to do other things until readstat_parallel_wait().
+ * Without pthreads, or if a thread can't be started, its share of the items
+ * is processed on the calling thread instead.
+ *
+ * The threads are started by the first readstat_parallel_start() and then
+ * wait for the next one, so that a reader handing out batch after batch
+ * doesn't create threads or allocate for each of them. They are stopped by
+ * readstat_parallel_free(). Each readstat_parallel_start() first waits for
+ * the run before it, so a reader can go through the results of one batch
+ * while the same threads work on the next. */
+
+typedef struct readstat_thread_s {
+    struct readstat_thread_pool_s  *pool;
+    int                  index;
+    int                  started;
+#if HAVE_PTHREAD
+    pthread_t            thread;
+#endif
+} readstat_thread_t;
+
+typedef struct readstat_thread_pool_s {
+    readstat_parallel_t *parallel;
+    readstat_thread_t   *threads;
+    int                  threads_count;
+    /* Threads [0, active_count) work on the current run, and busy_count of
+     * them haven't finished it yet */
+    int                  active_count;
+    int                  busy_count;
+    unsigned long        generation;
+    int                  stopping;
+#if HAVE_PTHREAD
+    pthread_mutex_t      lock;
+    pthread_cond_t       start;
+    pthread_cond_t       done;
+#endif
+} readstat_thread_pool_t;
+
+static void readstat_parallel_run_slice(readstat_parallel_t *parallel, int index) {
+    size_t i;
+    for (i=index; i<parallel->item_count; i+=parallel->thread_count) {
+        parallel->work(parallel->items + i * parallel->item_size, parallel->ctx);
+    }
+}
+
+#if HAVE_PTHREAD
+static void *readstat_parallel_thread_main(void *arg) {
+    readstat_thread_t *thread = (readstat_thread_t *)arg;
+    readstat_thread_pool_t *pool = thread->pool;
+    unsigned long generation = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->stopping && pool->generation == generation)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stopping)
+            break;
+
+        generation = pool->generation;
+        if (thread->index < pool->active_count) {
+            readstat_parallel_t *parallel = pool->parallel;
+            pthread_mutex_unlock(&pool->lock);
+            readstat_parallel_run_slice(parallel, thread->index);
+            pthread_mutex_lock(&pool->lock);
+            if (--pool->busy_count == 0)
+                pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/* Starts up to thread_count threads; returns NULL if even the pool can't be
+ * allocated */
+static readstat_thread_pool_t *readstat_thread_pool_init(int thread_count) {
+    readstat_thread_pool_t *pool = NULL;
+    int i;
+
+    if ((pool = calloc(1, sizeof(readstat_thread_pool_t))) == NULL)
+        return NULL;
+
+    if ((pool->threads = calloc(thread_count, sizeof(readstat_thread_t))) == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (i=0; i<thread_count; i++) {
+        readstat_thread_t *thread = &pool->threads[i];
+        thread->pool = pool;
+        thread->index = i;
+        thread->started = (pthread_create(&thread->thread, NULL,
+                    &readstat_parallel_thread_main, thread) == 0);
+        if (!thread->started)
+            break;
+        pool->threads_count++;
+    }
+
+    return pool;
+}
+#endif
+
+readstat_error_t readstat_parallel_start(readstat_parallel_t *parallel, int thread_count,
+        readstat_parallel_work_t work, void *ctx, void *items, size_t item_size, size_t item_count) {
+    int i, active_count = 0;
+
+    readstat_parallel_wait(parallel);
+
+    parallel->work = work;
+    parallel->ctx = ctx;
+    parallel->items = items;
+    parallel->item_size = item_size;
+    parallel->item_count = item_count;
+
+#if HAVE_PTHREAD
+    if (thread_count > item_count)
+        thread_count = item_count;
+#else
+    thread_count = 1;
+#endif
+
+    if (thread_count <= 1) {
+        parallel->thread_count = 1;
+        readstat_parallel_run_slice(parallel, 0);
+        return READSTAT_OK;
+    }
+
+#if HAVE_PTHREAD
+    readstat_thread_pool_t *pool = parallel->pool;
+    if (pool == NULL && (pool = parallel->pool = readstat_thread_pool_init(thread_count)) == NULL)
+        return READSTAT_ERROR_MALLOC;
+
+    parallel->thread_count = thread_count;
+
+    active_count = pool->threads_count < thread_count ? pool->threads_count : thread_count;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->parallel = parallel;
+    pool->active_count = active_count;
+    pool->busy_count = active_count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+#endif
+
+    for (i=active_count; i<thread_count; i++) {
+        readstat_parallel_run_slice(parallel, i);
+    }
+
+    return READSTAT_OK;
+}
+
+void readstat_parallel_wait(readstat_parallel_t *parallel) {
+#if HAVE_PTHREAD
+    readstat_thread_pool_t *pool = parallel->pool;
+
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy_count)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+void readstat_parallel_free(readstat_parallel_t *parallel) {
+#if HAVE_PTHREAD
+    readstat_thread_pool_t *pool = parallel->pool;
+    int i;
+
+    if (pool == NULL)
+        return;
+
+    readstat_parallel_wait(parallel);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i=0; i<pool->threads_count; i++) {
+        pthread_join(pool->threads[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->threads);
+    free(pool);
+    parallel->pool = NULL;
+#endif
+}
@@ -0,0 +1,19 @@
+typedef void (*readstat_parallel_work_t)(void *item, void *ctx);
+
+/* Zero-initialize before the first readstat_parallel_start(), and call
+ * readstat_parallel_free() when done with it */
+typedef struct readstat_parallel_s {
+    readstat_parallel_work_t    work;
+    void                       *ctx;
+    char                       *items;
+    size_t                      item_size;
+    size_t                      item_count;
+
+    int                         thread_count;
+    struct readstat_thread_pool_s  *pool;
+} readstat_parallel_t;
+
+readstat_error_t readstat_parallel_start(readstat_parallel_t *parallel, int thread_count,
+        readstat_parallel_work_t work, void *ctx, void *items, size_t item_size, size_t item_count);
+void readstat_parallel_wait(readstat_parallel_t *parallel);
+void readstat_parallel_free(readstat_parallel_t *parallel);
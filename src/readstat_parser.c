@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include "readstat.h"
 #include "readstat_io_unistd.h"
+#include "readstat_io_mmap.h"
+#include "readstat_projection.h"
 
 readstat_parser_t *readstat_parser_init() {
     readstat_parser_t *parser = calloc(1, sizeof(readstat_parser_t));
@@ -20,6 +22,7 @@ void readstat_parser_free(readstat_parser_t *parser) {
             readstat_set_io_ctx(parser, NULL);
             free(parser->io);
         }
+        readstat_projection_free(parser->projection);
         free(parser);
     }
 }
@@ -59,6 +62,11 @@ readstat_error_t readstat_set_progress_handler(readstat_parser_t *parser, readst
     return READSTAT_OK;
 }
 
+readstat_error_t readstat_set_batch_handler(readstat_parser_t *parser, readstat_batch_handler batch_handler) {
+    parser->handlers.batch = batch_handler;
+    return READSTAT_OK;
+}
+
 readstat_error_t readstat_set_fweight_handler(readstat_parser_t *parser, readstat_fweight_handler fweight_handler) {
     parser->handlers.fweight = fweight_handler;
     return READSTAT_OK;
@@ -81,6 +89,12 @@ readstat_error_t readstat_set_seek_handler(readstat_parser_t *parser, readstat_s
 
 readstat_error_t readstat_set_read_handler(readstat_parser_t *parser, readstat_read_handler read_handler) {
     parser->io->read = read_handler;
+    parser->io->borrow = NULL;
+    return READSTAT_OK;
+}
+
+readstat_error_t readstat_set_borrow_handler(readstat_parser_t *parser, readstat_borrow_handler borrow_handler) {
+    parser->io->borrow = borrow_handler;
     return READSTAT_OK;
 }
 
@@ -100,6 +114,10 @@ readstat_error_t readstat_set_io_ctx(readstat_parser_t *parser, void *io_ctx) {
     return READSTAT_OK;
 }
 
+readstat_error_t readstat_set_mmap_io(readstat_parser_t *parser) {
+    return mmap_io_init(parser);
+}
+
 readstat_error_t readstat_set_file_character_encoding(readstat_parser_t *parser, const char *encoding) {
     parser->input_encoding = encoding;
     return READSTAT_OK;
@@ -119,3 +137,42 @@ readstat_error_t readstat_set_row_offset(readstat_parser_t *parser, long row_off
     parser->row_offset = row_offset;
     return READSTAT_OK;
 }
+
+readstat_error_t readstat_set_batch_size(readstat_parser_t *parser, long batch_size) {
+    parser->batch_size = batch_size;
+    return READSTAT_OK;
+}
+
+readstat_error_t readstat_set_thread_count(readstat_parser_t *parser, int thread_count) {
+    parser->thread_count = thread_count;
+    return READSTAT_OK;
+}
+
+readstat_error_t readstat_set_row_index(readstat_parser_t *parser, readstat_row_index_t *index) {
+    parser->row_index = index;
+    return READSTAT_OK;
+}
+
+static readstat_error_t readstat_parser_init_projection(readstat_parser_t *parser) {
+    if (parser->projection == NULL &&
+            (parser->projection = calloc(1, sizeof(readstat_projection_t))) == NULL)
+        return READSTAT_ERROR_MALLOC;
+
+    return READSTAT_OK;
+}
+
+readstat_error_t readstat_select_column_index(readstat_parser_t *parser, int index) {
+    readstat_error_t retval = readstat_parser_init_projection(parser);
+    if (retval != READSTAT_OK)
+        return retval;
+
+    return readstat_projection_add_index(parser->projection, index);
+}
+
+readstat_error_t readstat_select_column_name(readstat_parser_t *parser, const char *name) {
+    readstat_error_t retval = readstat_parser_init_projection(parser);
+    if (retval != READSTAT_OK)
+        return retval;
+
+    return readstat_projection_add_name(parser->projection, name);
+}
@@ -0,0 +1,77 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "readstat.h"
+#include "readstat_projection.h"
+
+void readstat_projection_free(readstat_projection_t *projection) {
+    if (projection) {
+        long i;
+        for (i=0; i<projection->names_count; i++) {
+            free(projection->names[i]);
+        }
+        free(projection->names);
+        free(projection->indexes);
+        free(projection);
+    }
+}
+
+readstat_error_t readstat_projection_add_index(readstat_projection_t *projection, int index) {
+    if (projection->indexes_count == projection->indexes_capacity) {
+        long capacity = projection->indexes_capacity ? 2 * projection->indexes_capacity : 16;
+        int *indexes = realloc(projection->indexes, capacity * sizeof(int));
+        if (indexes == NULL)
+            return READSTAT_ERROR_MALLOC;
+
+        projection->indexes = indexes;
+        projection->indexes_capacity = capacity;
+    }
+
+    projection->indexes[projection->indexes_count++] = index;
+
+    return READSTAT_OK;
+}
+
+readstat_error_t readstat_projection_add_name(readstat_projection_t *projection, const char *name) {
+    char *copy = NULL;
+    if (name == NULL || name[0] == '\0')
+        return READSTAT_ERROR_NAME_IS_ZERO_LENGTH;
+
+    if (projection->names_count == projection->names_capacity) {
+        long capacity = projection->names_capacity ? 2 * projection->names_capacity : 16;
+        char **names = realloc(projection->names, capacity * sizeof(char *));
+        if (names == NULL)
+            return READSTAT_ERROR_MALLOC;
+
+        projection->names = names;
+        projection->names_capacity = capacity;
+    }
+
+    if ((copy = malloc(strlen(name) + 1)) == NULL)
+        return READSTAT_ERROR_MALLOC;
+
+    strcpy(copy, name);
+    projection->names[projection->names_count++] = copy;
+
+    return READSTAT_OK;
+}
+
+/* Called once per column while the variables are set up, so a linear scan
+ * of the (usually short) selection is fine. A NULL projection selects every
+ * column. */
+int readstat_projection_includes(const readstat_projection_t *projection, int index, const char *name) {
+    long i;
+    if (projection == NULL)
+        return 1;
+
+    for (i=0; i<projection->indexes_count; i++) {
+        if (projection->indexes[i] == index)
+            return 1;
+    }
+    for (i=0; name && i<projection->names_count; i++) {
+        if (strcmp(projection->names[i], name) == 0)
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,15 @@
+
+struct readstat_projection_s {
+    int        *indexes;
+    long        indexes_count;
+    long        indexes_capacity;
+
+    char      **names;
+    long        names_count;
+    long        names_capacity;
+};
+
+void readstat_projection_free(readstat_projection_t *projection);
+readstat_error_t readstat_projection_add_index(readstat_projection_t *projection, int index);
+readstat_error_t readstat_projection_add_name(readstat_projection_t *projection, const char *name);
+int readstat_projection_includes(const readstat_projection_t *projection, int index, const char *name);
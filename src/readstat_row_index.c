@@ -0,0 +1,239 @@
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "readstat.h"
+#include "readstat_bits.h"
+#include "readstat_row_index.h"
+
+#define READSTAT_ROW_INDEX_MAGIC  "RSROWIX3"
+
+/* On disk, every number is little-endian: a header of magic, file size,
+ * block size, fingerprint and entry count, then the entries. */
+#define READSTAT_ROW_INDEX_HEADER_LEN  40
+#define READSTAT_ROW_INDEX_ENTRY_LEN   (24 + READSTAT_ROW_INDEX_STATE_LEN)
+
+readstat_row_index_t *readstat_row_index_init() {
+    return calloc(1, sizeof(readstat_row_index_t));
+}
+
+void readstat_row_index_free(readstat_row_index_t *index) {
+    if (index) {
+        free(index->entries);
+        free(index);
+    }
+}
+
+/* Readers fingerprint the parts of a file that tell it apart from others of
+ * the same size, such as its header, with 64-bit FNV-1a */
+uint64_t readstat_row_index_fingerprint(uint64_t fingerprint, const void *bytes, size_t len) {
+    const unsigned char *data = (const unsigned char *)bytes;
+    size_t i;
+
+    for (i=0; i<len; i++) {
+        fingerprint ^= data[i];
+        fingerprint *= UINT64_C(0x100000001b3);
+    }
+
+    return fingerprint;
+}
+
+/* An index describes exactly one file. If the file it was built from has
+ * a different size, block layout or fingerprint, throw the entries away and
+ * start again. */
+void readstat_row_index_reset(readstat_row_index_t *index, int64_t file_size, int64_t block_size,
+        uint64_t fingerprint) {
+    if (index->file_size == file_size && index->block_size == block_size &&
+            index->fingerprint == fingerprint)
+        return;
+
+    index->file_size = file_size;
+    index->block_size = block_size;
+    index->fingerprint = fingerprint;
+    index->entries_count = 0;
+}
+
+readstat_error_t readstat_row_index_add_entry(readstat_row_index_t *index, int64_t block,
+        int64_t first_row, int64_t row_count, int32_t flags, const void *state, size_t state_len) {
+    /* Blocks must be indexed in file order; anything else is already known */
+    if (block != index->entries_count)
+        return READSTAT_OK;
+
+    if (state_len > READSTAT_ROW_INDEX_STATE_LEN)
+        return READSTAT_ERROR_PARSE;
+
+    if (index->entries_count == index->entries_capacity) {
+        int64_t capacity = index->entries_capacity ? 2 * index->entries_capacity : 256;
+        readstat_row_index_entry_t *entries = realloc(index->entries,
+                capacity * sizeof(readstat_row_index_entry_t));
+        if (entries == NULL)
+            return READSTAT_ERROR_MALLOC;
+
+        index->entries = entries;
+        index->entries_capacity = capacity;
+    }
+
+    readstat_row_index_entry_t *entry = &index->entries[index->entries_count++];
+    memset(entry, 0, sizeof(readstat_row_index_entry_t));
+    entry->first_row = first_row;
+    entry->row_count = row_count;
+    entry->flags = flags;
+    if (state_len)
+        memcpy(entry->state, state, state_len);
+
+    return READSTAT_OK;
+}
+
+readstat_row_index_entry_t *readstat_row_index_get_entry(readstat_row_index_t *index, int64_t block) {
+    if (index == NULL || block < 0 || block >= index->entries_count)
+        return NULL;
+
+    return &index->entries[block];
+}
+
+int64_t readstat_row_index_get_block_count(readstat_row_index_t *index) {
+    return index->entries_count;
+}
+
+static void readstat_row_index_put8(unsigned char *bytes, uint64_t value) {
+    if (!machine_is_little_endian())
+        value = byteswap8(value);
+    memcpy(bytes, &value, sizeof(uint64_t));
+}
+
+static void readstat_row_index_put4(unsigned char *bytes, uint32_t value) {
+    if (!machine_is_little_endian())
+        value = byteswap4(value);
+    memcpy(bytes, &value, sizeof(uint32_t));
+}
+
+static uint64_t readstat_row_index_get8(const unsigned char *bytes) {
+    uint64_t value = 0;
+    memcpy(&value, bytes, sizeof(uint64_t));
+    return machine_is_little_endian() ? value : byteswap8(value);
+}
+
+static uint32_t readstat_row_index_get4(const unsigned char *bytes) {
+    uint32_t value = 0;
+    memcpy(&value, bytes, sizeof(uint32_t));
+    return machine_is_little_endian() ? value : byteswap4(value);
+}
+
+readstat_error_t readstat_row_index_save(readstat_row_index_t *index, const char *path) {
+    readstat_error_t retval = READSTAT_OK;
+    unsigned char header[READSTAT_ROW_INDEX_HEADER_LEN];
+    unsigned char bytes[READSTAT_ROW_INDEX_ENTRY_LEN];
+    FILE *file = NULL;
+    int64_t i;
+
+    if ((file = fopen(path, "wb")) == NULL) {
+        retval = READSTAT_ERROR_OPEN;
+        goto cleanup;
+    }
+
+    memcpy(&header[0], READSTAT_ROW_INDEX_MAGIC, 8);
+    readstat_row_index_put8(&header[8], index->file_size);
+    readstat_row_index_put8(&header[16], index->block_size);
+    readstat_row_index_put8(&header[24], index->fingerprint);
+    readstat_row_index_put8(&header[32], index->entries_count);
+
+    if (fwrite(header, sizeof(header), 1, file) != 1) {
+        retval = READSTAT_ERROR_WRITE;
+        goto cleanup;
+    }
+
+    for (i=0; i<index->entries_count; i++) {
+        readstat_row_index_entry_t *entry = &index->entries[i];
+        readstat_row_index_put8(&bytes[0], entry->first_row);
+        readstat_row_index_put8(&bytes[8], entry->row_count);
+        readstat_row_index_put4(&bytes[16], entry->flags);
+        readstat_row_index_put4(&bytes[20], entry->reserved);
+        memcpy(&bytes[24], entry->state, READSTAT_ROW_INDEX_STATE_LEN);
+
+        if (fwrite(bytes, sizeof(bytes), 1, file) != 1) {
+            retval = READSTAT_ERROR_WRITE;
+            goto cleanup;
+        }
+    }
+
+cleanup:
+    if (file && fclose(file) != 0 && retval == READSTAT_OK)
+        retval = READSTAT_ERROR_WRITE;
+
+    return retval;
+}
+
+readstat_error_t readstat_row_index_load(readstat_row_index_t *index, const char *path) {
+    readstat_error_t retval = READSTAT_OK;
+    readstat_row_index_entry_t *entries = NULL;
+    unsigned char header[READSTAT_ROW_INDEX_HEADER_LEN];
+    unsigned char bytes[READSTAT_ROW_INDEX_ENTRY_LEN];
+    FILE *file = NULL;
+    int64_t entries_count = 0;
+    int64_t i;
+
+    if ((file = fopen(path, "rb")) == NULL) {
+        retval = READSTAT_ERROR_OPEN;
+        goto cleanup;
+    }
+
+    if (fread(header, sizeof(header), 1, file) != 1) {
+        retval = READSTAT_ERROR_READ;
+        goto cleanup;
+    }
+
+    entries_count = readstat_row_index_get8(&header[32]);
+
+    if (memcmp(&header[0], READSTAT_ROW_INDEX_MAGIC, 8) != 0 || entries_count < 0 ||
+            entries_count > SIZE_MAX / sizeof(readstat_row_index_entry_t)) {
+        retval = READSTAT_ERROR_PARSE;
+        goto cleanup;
+    }
+
+    if (entries_count && (entries = calloc(entries_count, sizeof(readstat_row_index_entry_t))) == NULL) {
+        retval = READSTAT_ERROR_MALLOC;
+        goto cleanup;
+    }
+
+    for (i=0; i<entries_count; i++) {
+        readstat_row_index_entry_t *entry = &entries[i];
+
+        if (fread(bytes, sizeof(bytes), 1, file) != 1) {
+            retval = READSTAT_ERROR_READ;
+            goto cleanup;
+        }
+
+        entry->first_row = readstat_row_index_get8(&bytes[0]);
+        entry->row_count = readstat_row_index_get8(&bytes[8]);
+        entry->flags = readstat_row_index_get4(&bytes[16]);
+        entry->reserved = readstat_row_index_get4(&bytes[20]);
+        memcpy(entry->state, &bytes[24], READSTAT_ROW_INDEX_STATE_LEN);
+
+        /* The readers skip rows by these counts, so each block has to start
+         * where the one before it ends */
+        if (entry->first_row < 0 || entry->row_count < 0 ||
+                entry->row_count > INT64_MAX - entry->first_row ||
+                (i > 0 && entry->first_row != entries[i-1].first_row + entries[i-1].row_count)) {
+            retval = READSTAT_ERROR_PARSE;
+            goto cleanup;
+        }
+    }
+
+    free(index->entries);
+    index->entries = entries;
+    index->entries_count = entries_count;
+    index->entries_capacity = entries_count;
+    index->file_size = readstat_row_index_get8(&header[8]);
+    index->block_size = readstat_row_index_get8(&header[16]);
+    index->fingerprint = readstat_row_index_get8(&header[24]);
+    entries = NULL;
+
+cleanup:
+    if (file)
+        fclose(file);
+    free(entries);
+
+    return retval;
+}
@@ -0,0 +1,33 @@
+
+#define READSTAT_ROW_INDEX_HAS_METADATA  0x01
+#define READSTAT_ROW_INDEX_STATE_LEN     16
+
+/* FNV-1a offset basis, to start a fingerprint */
+#define READSTAT_ROW_INDEX_FINGERPRINT_INIT  UINT64_C(0xcbf29ce484222325)
+
+typedef struct readstat_row_index_entry_s {
+    int64_t     first_row;
+    int64_t     row_count;
+    int32_t     flags;
+    int32_t     reserved;
+    /* Format-specific decoder state at the start of the block. It is saved
+     * byte for byte, so formats must lay it out in a fixed byte order. */
+    unsigned char state[READSTAT_ROW_INDEX_STATE_LEN];
+} readstat_row_index_entry_t;
+
+struct readstat_row_index_s {
+    int64_t                     file_size;
+    int64_t                     block_size;
+    uint64_t                    fingerprint;
+
+    readstat_row_index_entry_t *entries;
+    int64_t                     entries_count;
+    int64_t                     entries_capacity;
+};
+
+uint64_t readstat_row_index_fingerprint(uint64_t fingerprint, const void *bytes, size_t len);
+void readstat_row_index_reset(readstat_row_index_t *index, int64_t file_size, int64_t block_size,
+        uint64_t fingerprint);
+readstat_error_t readstat_row_index_add_entry(readstat_row_index_t *index, int64_t block,
+        int64_t first_row, int64_t row_count, int32_t flags, const void *state, size_t state_len);
+readstat_row_index_entry_t *readstat_row_index_get_entry(readstat_row_index_t *index, int64_t block);
@@ -10,6 +10,8 @@
 #define VALUE_LABELS_INITIAL_CAPACITY 10
 #define STRING_REFS_INITIAL_CAPACITY 100
 #define LABEL_SET_VARIABLES_INITIAL_CAPACITY 2
+#define WRITE_BUFFER_DEFAULT_SIZE    65536
+#define WRITE_BATCH_STAGING_SIZE     65536
 
 static readstat_error_t readstat_write_row_default_callback(void *writer_ctx, void *bytes, size_t len) {
     return readstat_write_bytes((readstat_writer_t *)writer_ctx, bytes, len);
@@ -52,6 +54,9 @@ readstat_writer_t *readstat_writer_init() {
 
     writer->timestamp = time(NULL);
     writer->is_64bit = 1;
+    writer->compression_level = -1;
+    writer->write_buffer_size = WRITE_BUFFER_DEFAULT_SIZE;
+    writer->thread_count = 1;
     writer->callbacks.write_row = &readstat_write_row_default_callback;
 
     return writer;
@@ -181,6 +186,7 @@ void readstat_writer_free(readstat_writer_t *writer) {
         if (writer->row) {
             free(writer->row);
         }
+        free(writer->write_buffer);
         free(writer);
     }
 }
@@ -190,15 +196,95 @@ readstat_error_t readstat_set_data_writer(readstat_writer_t *writer, readstat_da
     return READSTAT_OK;
 }
 
-readstat_error_t readstat_write_bytes(readstat_writer_t *writer, const void *bytes, size_t len) {
-    size_t bytes_written = writer->data_writer(bytes, len, writer->user_ctx);
-    if (bytes_written < len) {
+readstat_error_t readstat_set_data_seeker(readstat_writer_t *writer, readstat_data_seeker data_seeker) {
+    writer->data_seeker = data_seeker;
+    return READSTAT_OK;
+}
+
+readstat_error_t readstat_writer_set_write_buffer_size(readstat_writer_t *writer, size_t size) {
+    readstat_error_t retval = readstat_flush_writes(writer);
+    if (retval != READSTAT_OK)
+        return retval;
+
+    free(writer->write_buffer);
+    writer->write_buffer = NULL;
+    writer->write_buffer_size = size;
+    return READSTAT_OK;
+}
+
+static readstat_error_t readstat_write_bytes_unbuffered(readstat_writer_t *writer, const void *bytes, size_t len) {
+    ssize_t bytes_written = writer->data_writer(bytes, len, writer->user_ctx);
+    if (bytes_written < 0 || (size_t)bytes_written < len) {
         return READSTAT_ERROR_WRITE;
     }
-    writer->bytes_written += bytes_written;
     return READSTAT_OK;
 }
 
+/* Pass any buffered output on to the data writer */
+readstat_error_t readstat_flush_writes(readstat_writer_t *writer) {
+    readstat_error_t retval = READSTAT_OK;
+    if (writer->write_buffer_used == 0)
+        return READSTAT_OK;
+
+    retval = readstat_write_bytes_unbuffered(writer, writer->write_buffer, writer->write_buffer_used);
+    writer->write_buffer_used = 0;
+    return retval;
+}
+
+/* Small writes are collected in the write buffer so that the data writer
+ * sees a few large chunks rather than many tiny ones; anything at least as
+ * big as the buffer goes straight through. */
+readstat_error_t readstat_write_bytes(readstat_writer_t *writer, const void *bytes, size_t len) {
+    readstat_error_t retval = READSTAT_OK;
+
+    if (len > writer->write_buffer_size - writer->write_buffer_used) {
+        if ((retval = readstat_flush_writes(writer)) != READSTAT_OK)
+            goto cleanup;
+    }
+
+    if (len >= writer->write_buffer_size) {
+        retval = readstat_write_bytes_unbuffered(writer, bytes, len);
+    } else {
+        if (writer->write_buffer == NULL &&
+                (writer->write_buffer = malloc(writer->write_buffer_size)) == NULL) {
+            retval = READSTAT_ERROR_MALLOC;
+            goto cleanup;
+        }
+        memcpy(&writer->write_buffer[writer->write_buffer_used], bytes, len);
+        writer->write_buffer_used += len;
+    }
+    if (retval != READSTAT_OK)
+        goto cleanup;
+
+    writer->bytes_written += len;
+
+cleanup:
+    return retval;
+}
+
+/* Overwrite bytes that have already been written, then return to the end of
+ * the output. Requires a data seeker. */
+readstat_error_t readstat_write_bytes_at(readstat_writer_t *writer, size_t offset,
+        const void *bytes, size_t len) {
+    readstat_error_t retval = READSTAT_OK;
+
+    if (writer->data_seeker == NULL || offset + len > writer->bytes_written)
+        return READSTAT_ERROR_SEEK;
+
+    if ((retval = readstat_flush_writes(writer)) != READSTAT_OK)
+        return retval;
+
+    if (writer->data_seeker(offset, READSTAT_SEEK_SET, writer->user_ctx) == -1)
+        return READSTAT_ERROR_SEEK;
+
+    retval = readstat_write_bytes_unbuffered(writer, bytes, len);
+
+    if (writer->data_seeker(writer->bytes_written, READSTAT_SEEK_SET, writer->user_ctx) == -1)
+        retval = READSTAT_ERROR_SEEK;
+
+    return retval;
+}
+
 readstat_error_t readstat_write_bytes_as_lines(readstat_writer_t *writer,
         const void *bytes, size_t len, size_t line_len, const char *line_sep) {
     size_t line_sep_len = strlen(line_sep);
@@ -510,6 +596,21 @@ readstat_error_t readstat_writer_set_compression(readstat_writer_t *writer,
     return READSTAT_OK;
 }
 
+readstat_error_t readstat_writer_set_compression_level(readstat_writer_t *writer,
+        int compression_level) {
+    if (compression_level < -1 || compression_level > 9)
+        return READSTAT_ERROR_UNSUPPORTED_COMPRESSION;
+
+    writer->compression_level = compression_level;
+    return READSTAT_OK;
+}
+
+readstat_error_t readstat_writer_set_thread_count(readstat_writer_t *writer,
+        int thread_count) {
+    writer->thread_count = thread_count;
+    return READSTAT_OK;
+}
+
 readstat_error_t readstat_writer_set_error_handler(readstat_writer_t *writer, 
         readstat_error_handler error_handler) {
     writer->error_handler = error_handler;
@@ -644,6 +745,255 @@ readstat_error_t readstat_end_row(readstat_writer_t *writer) {
     return error;
 }
 
+static readstat_error_t readstat_validate_batch_column(readstat_writer_t *writer,
+        const readstat_batch_column_t *column) {
+    const readstat_variable_t *variable = column->variable;
+    if (variable == NULL || variable->index >= writer->variables_count ||
+            writer->variables[variable->index] != variable)
+        return READSTAT_ERROR_VALUE_TYPE_MISMATCH;
+
+    if (column->type != variable->type)
+        return READSTAT_ERROR_VALUE_TYPE_MISMATCH;
+
+    switch (column->type) {
+        case READSTAT_TYPE_INT8:
+        case READSTAT_TYPE_INT16:
+        case READSTAT_TYPE_INT32:
+            if (column->int32_values == NULL)
+                return READSTAT_ERROR_VALUE_TYPE_MISMATCH;
+            break;
+        case READSTAT_TYPE_FLOAT:
+        case READSTAT_TYPE_DOUBLE:
+            if (column->double_values == NULL)
+                return READSTAT_ERROR_VALUE_TYPE_MISMATCH;
+            break;
+        case READSTAT_TYPE_STRING:
+            if (column->string_data == NULL || column->string_offsets == NULL)
+                return READSTAT_ERROR_VALUE_TYPE_MISMATCH;
+            break;
+        case READSTAT_TYPE_STRING_REF:
+            if (!writer->callbacks.write_string_ref)
+                return READSTAT_ERROR_STRING_REFS_NOT_SUPPORTED;
+            if (column->int32_values == NULL)
+                return READSTAT_ERROR_VALUE_TYPE_MISMATCH;
+            break;
+    }
+
+    return READSTAT_OK;
+}
+
+static int readstat_batch_value_is_missing(const readstat_batch_column_t *column, int i) {
+    return column->missing && (column->missing[i / 8] & (1 << (i % 8)));
+}
+
+static readstat_error_t readstat_encode_batch_value(readstat_writer_t *writer,
+        const readstat_batch_column_t *column, void *cell, int first_row, int i) {
+    const readstat_variable_t *variable = column->variable;
+
+    if (readstat_batch_value_is_missing(column, i)) {
+        if (column->tags && column->tags[i]) {
+            if (!writer->callbacks.write_missing_tagged) {
+                writer->callbacks.write_missing_number(cell, variable);
+                return READSTAT_ERROR_TAGGED_VALUES_NOT_SUPPORTED;
+            }
+            return writer->callbacks.write_missing_tagged(cell, variable, column->tags[i]);
+        }
+        if (column->type == READSTAT_TYPE_STRING)
+            return writer->callbacks.write_missing_string(cell, variable);
+        if (column->type == READSTAT_TYPE_STRING_REF)
+            return writer->callbacks.write_string_ref(cell, variable, NULL);
+
+        return writer->callbacks.write_missing_number(cell, variable);
+    }
+
+    switch (column->type) {
+        case READSTAT_TYPE_INT8:
+            if (column->int32_values[i] < INT8_MIN || column->int32_values[i] > INT8_MAX)
+                return READSTAT_ERROR_NUMERIC_VALUE_IS_OUT_OF_RANGE;
+            return writer->callbacks.write_int8(cell, variable, column->int32_values[i]);
+        case READSTAT_TYPE_INT16:
+            if (column->int32_values[i] < INT16_MIN || column->int32_values[i] > INT16_MAX)
+                return READSTAT_ERROR_NUMERIC_VALUE_IS_OUT_OF_RANGE;
+            return writer->callbacks.write_int16(cell, variable, column->int32_values[i]);
+        case READSTAT_TYPE_INT32:
+            return writer->callbacks.write_int32(cell, variable, column->int32_values[i]);
+        case READSTAT_TYPE_FLOAT:
+            return writer->callbacks.write_float(cell, variable, column->double_values[i]);
+        case READSTAT_TYPE_DOUBLE:
+            return writer->callbacks.write_double(cell, variable, column->double_values[i]);
+        case READSTAT_TYPE_STRING:
+            return writer->callbacks.write_string(cell, variable,
+                    &column->string_data[column->string_offsets[i]]);
+        case READSTAT_TYPE_STRING_REF:
+            {
+                readstat_string_ref_t *ref = readstat_get_string_ref(writer, column->int32_values[i]);
+                if (ref && ref->first_o == -1 && ref->first_v == -1) {
+                    ref->first_o = first_row + i;
+                    ref->first_v = variable->index;
+                }
+                return writer->callbacks.write_string_ref(cell, variable, ref);
+            }
+    }
+
+    return READSTAT_ERROR_VALUE_TYPE_MISMATCH;
+}
+
+static int readstat_has_column_encoder(readstat_writer_t *writer, readstat_type_t type) {
+    switch (type) {
+        case READSTAT_TYPE_INT8:
+        case READSTAT_TYPE_INT16:
+        case READSTAT_TYPE_INT32:
+            return writer->callbacks.write_int32s != NULL;
+        case READSTAT_TYPE_FLOAT:
+            return writer->callbacks.write_floats != NULL;
+        case READSTAT_TYPE_DOUBLE:
+            return writer->callbacks.write_doubles != NULL;
+        default:
+            return 0;
+    }
+}
+
+static readstat_error_t readstat_check_int32_range(const int32_t *values, int count,
+        int32_t min, int32_t max) {
+    int i;
+    for (i=0; i<count; i++) {
+        if (values[i] < min || values[i] > max)
+            return READSTAT_ERROR_NUMERIC_VALUE_IS_OUT_OF_RANGE;
+    }
+    return READSTAT_OK;
+}
+
+/* Encodes n values, none of them missing, with the module's whole-column
+ * encoder */
+static readstat_error_t readstat_encode_batch_run(readstat_writer_t *writer,
+        const readstat_batch_column_t *column, unsigned char *cell, int i, int n) {
+    const readstat_variable_t *variable = column->variable;
+    readstat_error_t retval = READSTAT_OK;
+
+    switch (column->type) {
+        case READSTAT_TYPE_INT8:
+            retval = readstat_check_int32_range(&column->int32_values[i], n, INT8_MIN, INT8_MAX);
+            break;
+        case READSTAT_TYPE_INT16:
+            retval = readstat_check_int32_range(&column->int32_values[i], n, INT16_MIN, INT16_MAX);
+            break;
+        case READSTAT_TYPE_FLOAT:
+            return writer->callbacks.write_floats(cell, writer->row_len, variable, &column->double_values[i], n);
+        case READSTAT_TYPE_DOUBLE:
+            return writer->callbacks.write_doubles(cell, writer->row_len, variable, &column->double_values[i], n);
+        default:
+            break;
+    }
+    if (retval != READSTAT_OK)
+        return retval;
+
+    return writer->callbacks.write_int32s(cell, writer->row_len, variable, &column->int32_values[i], n);
+}
+
+/* Numeric columns go through the module's whole-column encoder when it has
+ * one, a run of present values at a time; missing values in between are
+ * encoded one cell at a time, and whatever sits under them in the value
+ * array is never looked at. */
+static readstat_error_t readstat_encode_batch_column(readstat_writer_t *writer,
+        const readstat_batch_column_t *column, unsigned char *cell, int first_row, int i, int n) {
+    readstat_error_t retval = READSTAT_OK;
+    int run_start = i;
+    int k;
+
+    for (k=i; k<=i+n; k++) {
+        if (k < i+n && !readstat_batch_value_is_missing(column, k))
+            continue;
+
+        if (k > run_start) {
+            retval = readstat_encode_batch_run(writer, column, &cell[(run_start - i) * writer->row_len],
+                    run_start, k - run_start);
+            if (retval != READSTAT_OK)
+                return retval;
+        }
+        if (k < i+n) {
+            retval = readstat_encode_batch_value(writer, column, &cell[(k - i) * writer->row_len], first_row, k);
+            if (retval != READSTAT_OK)
+                return retval;
+        }
+        run_start = k + 1;
+    }
+
+    return READSTAT_OK;
+}
+
+/* Rows are encoded a chunk at a time into a staging buffer, one column at a
+ * time, so that the inner loop always calls the same encoder. */
+readstat_error_t readstat_insert_column_batch(readstat_writer_t *writer, int row_count,
+        const readstat_batch_column_t *columns, int columns_count) {
+    readstat_error_t retval = READSTAT_OK;
+    unsigned char *rows = NULL;
+    int first_row = writer->current_row;
+    int chunk_rows = 0;
+    int i, j, k;
+
+    if (!writer->initialized)
+        return READSTAT_ERROR_WRITER_NOT_INITIALIZED;
+
+    /* Nothing may be written if the batch would run past the declared row
+     * count, since the rows before it can't be taken back */
+    if (row_count < 0 || row_count > writer->row_count - writer->current_row)
+        return READSTAT_ERROR_ROW_COUNT_MISMATCH;
+
+    for (j=0; j<columns_count; j++) {
+        if ((retval = readstat_validate_batch_column(writer, &columns[j])) != READSTAT_OK)
+            goto cleanup;
+    }
+
+    if (row_count == 0)
+        goto cleanup;
+
+    if (writer->current_row == 0) {
+        if ((retval = readstat_begin_writing_data(writer)) != READSTAT_OK)
+            goto cleanup;
+    }
+
+    chunk_rows = writer->row_len ? WRITE_BATCH_STAGING_SIZE / writer->row_len : row_count;
+    if (chunk_rows < 1)
+        chunk_rows = 1;
+    if (chunk_rows > row_count)
+        chunk_rows = row_count;
+
+    if ((rows = malloc(chunk_rows * writer->row_len)) == NULL) {
+        retval = READSTAT_ERROR_MALLOC;
+        goto cleanup;
+    }
+
+    for (i=0; i<row_count; i+=chunk_rows) {
+        int n = row_count - i < chunk_rows ? row_count - i : chunk_rows;
+        memset(rows, '\0', n * writer->row_len);
+
+        for (j=0; j<columns_count; j++) {
+            const readstat_batch_column_t *column = &columns[j];
+            unsigned char *cell = &rows[column->variable->offset];
+            if (readstat_has_column_encoder(writer, column->type)) {
+                if ((retval = readstat_encode_batch_column(writer, column, cell, first_row, i, n)) != READSTAT_OK)
+                    goto cleanup;
+                continue;
+            }
+            for (k=i; k<i+n; k++, cell += writer->row_len) {
+                if ((retval = readstat_encode_batch_value(writer, column, cell, first_row, k)) != READSTAT_OK)
+                    goto cleanup;
+            }
+        }
+
+        for (k=0; k<n; k++) {
+            retval = writer->callbacks.write_row(writer, &rows[k * writer->row_len], writer->row_len);
+            if (retval != READSTAT_OK)
+                goto cleanup;
+            writer->current_row++;
+        }
+    }
+
+cleanup:
+    free(rows);
+    return retval;
+}
+
 readstat_error_t readstat_end_writing(readstat_writer_t *writer) {
     if (!writer->initialized)
         return READSTAT_ERROR_WRITER_NOT_INITIALIZED;
@@ -667,8 +1017,11 @@ readstat_error_t readstat_end_writing(readstat_writer_t *writer) {
         }
     }
 
-    if (!writer->callbacks.end_data)
-        return READSTAT_OK;
+    if (writer->callbacks.end_data) {
+        readstat_error_t retval = writer->callbacks.end_data(writer);
+        if (retval != READSTAT_OK)
+            return retval;
+    }
 
-    return writer->callbacks.end_data(writer);
+    return readstat_flush_writes(writer);
 }
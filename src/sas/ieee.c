@@ -8,413 +8,174 @@
  * "RECORD LAYOUT OF A SAS VERSION 5 OR 6 DATA SET IN SAS TRANSPORT (XPORT) FORMAT"
  * https://support.sas.com/techsup/technote/ts140.pdf
  *
- * Modifications include using stdint.h and supporting infinite IEEE values.
+ * Modifications include using stdint.h, supporting infinite IEEE values, and
+ * working on whole 64-bit patterns instead of pairs of 32-bit halves, so that
+ * columns of values can be converted in a tight loop.
  */
 
-static void xpt2ieee(unsigned char *xport, unsigned char *ieee);
-static void ieee2xpt(unsigned char *ieee, unsigned char *xport);
+#define XPT_SIGN_BIT        0x8000000000000000ULL
+#define XPT_FRACTION_MASK   0x00FFFFFFFFFFFFFFULL
+#define IEEE_FRACTION_MASK  0x000FFFFFFFFFFFFFULL
+#define IEEE_IMPLICIT_BIT   0x0010000000000000ULL
+#define IEEE_INFINITY       0x7FF0000000000000ULL
 
-#ifndef FLOATREP
-#define FLOATREP get_native()
-int get_native();
-#endif
-
-void memreverse(void *intp_void, int l) {
-    if (!machine_is_little_endian())
-        return;
-
-    int i,j;
-    char save;
-    char *intp = (char *)intp_void;
-
-    j = l/2;
-    for (i=0;i<j;i++) {
-        save = intp[i];
-        intp[i] = intp[l-i-1];
-        intp[l-i-1] = save;
-    }
+/* IBM format: sign bit, 7 bit exponent (excess 64, power of 16), 56 bit
+ * fraction with the radix point to the left of the high order hex digit.
+ *
+ * IEEE format: sign bit, 11 bit exponent (excess 1023, power of 2), 52 bit
+ * fraction with an implied "1" to the left of the binary point.
+ *
+ * Going to IEEE, the high order hex digit of the IBM fraction is shifted down
+ * until its leading bit lands on the implicit "1", which is then cleared; the
+ * exponent is adjusted by the shift count. At most 3 bits of fraction are
+ * lost. */
+static uint64_t xpt2ieee(uint64_t xport) {
+    uint64_t fraction = xport & XPT_FRACTION_MASK;
+    int exponent = (int)((xport >> 56) & 0x7F);
+    int lead, shift;
+
+    if (xport == 0)
+        return 0;
+
+    /* A lone non-zero first byte is a missing value; keep the byte in a NaN */
+    if (fraction == 0 && (xport >> 56))
+        return 0xFFFF000000000000ULL | ((~xport >> 56) & 0xFF) << 40;
+
+    if ((xport & ~XPT_SIGN_BIT) == ~XPT_SIGN_BIT)
+        return (xport & XPT_SIGN_BIT) | IEEE_INFINITY;
+
+    /* Position (0-3) of the leading bit within the high order hex digit */
+    lead = (int)((fraction >> 53) & 0x07);
+    shift = (lead > 0) + (lead > 1) + (lead > 3);
+
+    /* The exponent is adjusted by 65 rather than 64 because the fraction
+     * bits sit 4 positions lower than they would in a normalized number */
+    return (xport & XPT_SIGN_BIT) |
+        ((fraction >> shift) & ~IEEE_IMPLICIT_BIT) |
+        ((uint64_t)((exponent - 65) * 4 + shift + 1023) << 52);
 }
 
-int cnxptiee(const void *from_bytes, int fromtype, void *to_bytes, int totype)
-{
-    unsigned char *from = (unsigned char *)from_bytes;
-    unsigned char *to = (unsigned char *)to_bytes;
-    unsigned char temp[8];
-    int i;
+/* Going to IBM, the implicit "1" is put back and the fraction shifted left
+ * by the remainder of dividing the binary exponent by 4; as the IBM fraction
+ * has 4 more bits than the IEEE one, no bits are lost. Exponents beyond the
+ * IBM range turn into zero or the largest IBM value. */
+static uint64_t ieee2xpt(uint64_t ieee) {
+    uint64_t sign = ieee & XPT_SIGN_BIT;
+    int exponent;
 
-    if (fromtype == CN_TYPE_NATIVE) {
-        fromtype = FLOATREP;
-    }
-    switch(fromtype) {
-        case CN_TYPE_IEEEL :
-            if (totype == CN_TYPE_IEEEL)
-                break;
-            for (i=7;i>=0;i--) {
-                temp[7-i] = from[i];
-            }
-            from = temp;
-            fromtype = CN_TYPE_IEEEB;
-            /* Break intentionally omitted. */
-        case CN_TYPE_IEEEB :
-            /* Break intentionally omitted. */
-        case CN_TYPE_XPORT :
-            break;
-        default:
-            return(-1);
-    }
-    if (totype == CN_TYPE_NATIVE) {
-        totype = FLOATREP;
-    }
-    switch(totype) {
-        case CN_TYPE_XPORT :
-        case CN_TYPE_IEEEB :
-        case CN_TYPE_IEEEL :
-            break;
-        default:
-            return(-2);
-    }
-    if (fromtype == totype) {
-        memcpy(to,from,8);
-        return(0);
-    }
-    switch(fromtype) {
-        case CN_TYPE_IEEEB :
-            if (totype == CN_TYPE_XPORT)
-                ieee2xpt(from,to);
-            else memcpy(to,from,8);
-            break;
-        case CN_TYPE_XPORT :
-            xpt2ieee(from,to);
-            break;
-    }
-    if (totype == CN_TYPE_IEEEL) {
-        memcpy(temp,to,8);
-        for (i=7;i>=0;i--) {
-            to[7-i] = temp[i];
-        }
+    /* Missing value (1st 2 bytes are FFFF) */
+    if ((ieee >> 48) == 0xFFFF) {
+        unsigned char misschar = (unsigned char)~(ieee >> 40);
+        return (uint64_t)(misschar == 0xD2 ? 0x6D : misschar) << 56;
     }
-    return(0);
-}
-
-int get_native() {
-    static unsigned char float_reps[][8] = {
-        {0x41,0x10,0x00,0x00,0x00,0x00,0x00,0x00},
-        {0x3f,0xf0,0x00,0x00,0x00,0x00,0x00,0x00},
-        {0x00,0x00,0x00,0x00,0x00,0x00,0xf0,0x3f}
-    };
 
-    static double one = 1.00;
+    exponent = (int)((ieee >> 52) & 0x7FF) - 1023;
 
-    int i,j;
-    j = sizeof(float_reps)/8;
-    for (i=0;i<j;i++)  {
-        if (memcmp(&one,float_reps+i,8) == 0)
-            return(i+1);
-    }
-    return(-1);
-}
+    if (ieee == 0 || exponent < -260)
+        return 0;
 
-void xpt2ieee(unsigned char *xport, unsigned char *ieee) {
-    char temp[8];
-    register int shift;
-    register int nib;
-    uint32_t ieee1,ieee2;
-    uint32_t xport1 = 0;
-    uint32_t xport2 = 0;
+    if (exponent > 248)
+        return sign | ~XPT_SIGN_BIT;
 
-    memcpy(temp,xport,8);
-    memset(ieee,0,8);
+    /* -260 <= exponent <= 248, so this is floor(exponent / 4) + 65 and
+     * exponent mod 4 without relying on shifts of negative numbers */
+    return sign |
+        ((uint64_t)((exponent + 260) / 4) << 56) |
+        (((ieee & IEEE_FRACTION_MASK) | IEEE_IMPLICIT_BIT) << ((exponent + 260) % 4));
+}
 
-    if (*temp && memcmp(temp+1,ieee,7) == 0) {
-        ieee[0] = ieee[1] = 0xff;
-        ieee[2] = ~(*temp);
-        return;
+static uint64_t xpt_load(const unsigned char *xport, size_t width, int little_endian) {
+    uint64_t bits = 0;
+    size_t i;
+    if (width == 8) {
+        memcpy(&bits, xport, 8);
+        return little_endian ? byteswap8(bits) : bits;
     }
-
-    memcpy(&xport1,temp,sizeof(uint32_t));
-    memreverse(&xport1,sizeof(uint32_t));
-    memcpy(&xport2,temp+4,sizeof(uint32_t));
-    memreverse(&xport2,sizeof(uint32_t));
-
-    /***************************************************************/
-    /* Translate IBM format floating point numbers into IEEE */
-    /* format floating point numbers. */
-    /* */
-    /* IEEE format: */
-    /* */
-    /* 6 5 0 */
-    /* 3 1 0 */
-    /* */
-    /* SEEEEEEEEEEEMMMM ............ MMMM */
-    /* */
-    /* Sign bit, 11 bits exponent, 52 bit fraction. Exponent is */
-    /* excess 1023. The fraction is multiplied by a power of 2 of */
-
-    /* the actual exponent. Normalized floating point numbers are */
-    /* represented with the binary point immediately to the left */
-    /* of the fraction with an implied "1" to the left of the */
-    /* binary point. */
-    /* */
-    /* IBM format: */
-    /* */
-    /* 6 5 0 */
-    /* 3 1 0 */
-    /* */
-    /* SEEEEEEEMMMM ......... MMMM */
-    /* */
-    /* Sign bit, 7 bit exponent, 56 bit fraction. Exponent is */
-    /* excess 64. The fraction is multiplied bya power of 16 of */
-    /* the actual exponent. Normalized floating point numbers are */
-    /* represented with the radix point immediately to the left of*/
-    /* the high order hex fraction digit. */
-    /* */
-    /* How do you translate from IBM format to IEEE? */
-    /* */
-    /* Translating back to ieee format from ibm is easier than */
-    /* going the other way. You lose at most, 3 bits of fraction, */
-    /* but nothing can be done about that. The only tricky parts */
-    /* are setting up the correct binary exponent from the ibm */
-    /* hex exponent, and removing the implicit "1" bit of the ieee*/
-    /* fraction (see vzctdbl). We must shift down the high order */
-    /* nibble of the ibm fraction until it is 1. This is the */
-    /* implicit 1. The bit is then cleared and the exponent */
-    /* adjusted by the number of positions shifted. A more */
-    /* thorough discussion is in vzctdbl.c. */
-
-    if ((xport1 & 0x7fffffff) == 0x7fffffff && xport2 == 0xffffffff) {
-        ieee1 = (xport1 & 0x80000000) | 0x7ff00000;
-        ieee2 = 0;
-        goto doret;
+    for (i=0; i<width; i++) {
+        bits = (bits << 8) | xport[i];
     }
+    return bits << (64 - 8 * width);
+}
 
-    /* Get the first half of the ibm number without the exponent */
-    /* into the ieee number */
-    ieee1 = xport1 & 0x00ffffff;
-
-    /* get the second half of the ibm number into the second half */
-    /* of the ieee number . If both halves were 0. then just */
-    /* return since the ieee number is zero. */
-    if ((!(ieee2 = xport2)) && !xport1)
+static void xpt_store(unsigned char *xport, size_t width, uint64_t bits, int little_endian) {
+    size_t i;
+    if (width == 8) {
+        if (little_endian)
+            bits = byteswap8(bits);
+        memcpy(xport, &bits, 8);
         return;
-
-    /* The fraction bit to the left of the binary point in the */
-    /* ieee format was set and the number was shifted 0, 1, 2, or */
-    /* 3 places. This will tell us how to adjust the ibm exponent */
-    /* to be a power of 2 ieee exponent and how to shift the */
-    /* fraction bits to restore the correct magnitude. */
-
-    if ((nib = (int)xport1) & 0x00800000) {
-        shift = 3;
-    } else if (nib & 0x00400000) {
-        shift = 2;
-    } else if (nib & 0x00200000) {
-        shift = 1;
-    } else {
-        shift = 0;
     }
-
-    if (shift) {
-        /* shift the ieee number down the correct number of places */
-        /* then set the second half of the ieee number to be the */
-        /* second half of the ibm number shifted appropriately, */
-        /* ored with the bits from the first half that would have */
-        /* been shifted in if we could shift a double. All we are */
-        /* worried about are the low order 3 bits of the first */
-        /* half since we're only shifting by 1, 2, or 3. */
-        ieee1 >>= shift;
-        ieee2 = (xport2 >> shift) |
-            ((xport1 & 0x00000007) << (29 + (3 - shift)));
+    for (i=0; i<width; i++) {
+        xport[i] = (unsigned char)(bits >> (56 - 8 * i));
     }
-
-    /* clear the 1 bit to the left of the binary point */
-    ieee1 &= 0xffefffff;
-
-    /* set the exponent of the ieee number to be the actual */
-    /* exponent plus the shift count + 1023. Or this into the */
-    /* first half of the ieee number. The ibm exponent is excess */
-    /* 64 but is adjusted by 65 since during conversion to ibm */
-    /* format the exponent is incremented by 1 and the fraction */
-    /* bits left 4 positions to the right of the radix point. */
-    ieee1 |=
-        (((((int32_t)(*temp & 0x7f) - 65) * 4) + shift + 1023) << 20) |
-        (xport1 & 0x80000000);
-
-doret:
-    memreverse(&ieee1,sizeof(uint32_t));
-    memcpy(ieee,&ieee1,sizeof(uint32_t));
-    memreverse(&ieee2,sizeof(uint32_t));
-    memcpy(ieee+4,&ieee2,sizeof(uint32_t));
-    return;
 }
 
-/*-------------------------------------------------------------*/
-/* Name: ieee2xpt */
-/* Purpose: converts IEEE to transport */
-/* Usage: rc = ieee2xpt(to_ieee,p_data); */
-/* Notes: this routine is an adaptation of the wzctdbl routine */
-/* from the Apollo. */
-/*-------------------------------------------------------------*/
-
-void ieee2xpt(unsigned char *ieee, unsigned char *xport) {
-    register int shift;
-    unsigned char misschar;
-    int ieee_exp;
-    uint32_t xport1,xport2;
-    uint32_t ieee1 = 0;
-    uint32_t ieee2 = 0;
-
-    char ieee8[8];
+static uint64_t double_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(double));
+    return bits;
+}
 
-    memcpy(ieee8,ieee,8);
+static double bits_double(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(double));
+    return value;
+}
 
-    /*------get 2 longs for shifting------------------------------*/
-    memcpy(&ieee1,ieee8,sizeof(uint32_t));
-    memreverse(&ieee1,sizeof(uint32_t));
-    memcpy(&ieee2,ieee8+4,sizeof(uint32_t));
-    memreverse(&ieee2,sizeof(uint32_t));
+double xpt_decode_double(const void *xport, size_t width) {
+    return bits_double(xpt2ieee(xpt_load(xport, width, machine_is_little_endian())));
+}
 
-    memset(xport,0,8);
+void xpt_encode_double(void *xport, size_t width, double value) {
+    xpt_store(xport, width, ieee2xpt(double_bits(value)), machine_is_little_endian());
+}
 
-    /*-----if IEEE value is missing (1st 2 bytes are FFFF)-----*/
-    if (*ieee8 == (char)0xff && ieee8[1] == (char)0xff) {
-        misschar = ~ieee8[2];
-        *xport = (misschar == 0xD2) ? 0x6D : misschar;
-        return;
+void xpt_decode_doubles(double *values, const void *xport, size_t width, size_t stride, size_t count) {
+    const unsigned char *src = xport;
+    int little_endian = machine_is_little_endian();
+    size_t i;
+    for (i=0; i<count; i++, src += stride) {
+        values[i] = bits_double(xpt2ieee(xpt_load(src, width, little_endian)));
     }
+}
 
-    /**************************************************************/
-    /* Translate IEEE floating point number into IBM format float */
-    /* */
-    /* IEEE format: */
-    /* */
-    /* 6 5 0 */
-    /* 3 1 0 */
-    /* */
-    /* SEEEEEEEEEEEMMMM ........ MMMM */
-    /* */
-    /* Sign bit, 11 bit exponent, 52 fraction. Exponent is excess */
-    /* 1023. The fraction is multiplied by a power of 2 of the */
-    /* actual exponent. Normalized floating point numbers are */
-    /* represented with the binary point immediately to the left */
-    /* of the fraction with an implied "1" to the left of the */
-    /* binary point. */
-    /* */
-    /* IBM format: */
-    /* */
-    /* 6 5 0 */
-    /* 3 5 0 */
-    /* */
-    /* SEEEEEEEMMMM ......... MMMM */
-    /* */
-    /* Sign bit, 7 bit exponent, 56 bit fraction. Exponent is */
-    /* excess 64. The fraction is multiplied by a power of 16 of */
-    /* of the actual exponent. Normalized floating point numbers */
-    /* are presented with the radix point immediately to the left */
-    /* of the high order hex fraction digit. */
-    /* */
-    /* How do you translate from local to IBM format? */
-    /* */
-    /* The ieee format gives you a number that has a power of 2 */
-    /* exponent and a fraction of the form "1.<fraction bits>". */
-    /* The first step is to get that "1" bit back into the */
-    /* fraction. Right shift it down 1 position, set the high */
-    /* order bit and reduce the binary exponent by 1. Now we have */
-
-    /* a fraction that looks like ".1<fraction bits>" and it's */
-    /* ready to be shoved into ibm format. The ibm fraction has 4 */
-    /* more bits than the ieee, the ieee fraction must therefore */
-    /* be shifted left 4 positions before moving it in. We must */
-    /* also correct the fraction bits to account for the loss of 2*/
-    /* bits when converting from a binary exponent to a hex one */
-    /* (>> 2). We must shift the fraction left for 0, 1, 2, or 3 */
-    /* positions to maintain the proper magnitude. Doing */
-    /* conversion this way would tend to lose bits in the fraction*/
-    /* which is not desirable or necessary if we cheat a bit. */
-    /* First of all, we know that we are going to have to shift */
-    /* the ieee fraction left 4 places to put it in the right */
-    /* position; we won't do that, we'll just leave it where it is*/
-    /* and increment the ibm exponent by one, this will have the */
-    /* same effect and we won't have to do any shifting. Now, */
-    /* since we have 4 bits in front of the fraction to work with,*/
-    /* we won't lose any bits. We set the bit to the left of the */
-    /* fraction which is the implicit "1" in the ieee fraction. We*/
-    /* then adjust the fraction to account for the loss of bits */
-    /* when going to a hex exponent. This adjustment will never */
-    /* involve shifting by more than 3 positions so no bits are */
-    /* lost. */
-
-    /* Get ieee number less the exponent into the first half of */
-    /* the ibm number */
-
-    xport1 = ieee1 & 0x000fffff;
-
-    /* get the second half of the number into the second half of */
-    /* the ibm number and see if both halves are 0. If so, ibm is */
-    /* also 0 and we just return */
-
-    if ((!(xport2 = ieee2)) && !ieee1) {
-        ieee_exp = 0;
-        goto doret;
+void xpt_encode_doubles(void *xport, size_t width, size_t stride, const double *values, size_t count) {
+    unsigned char *dst = xport;
+    int little_endian = machine_is_little_endian();
+    size_t i;
+    for (i=0; i<count; i++, dst += stride) {
+        xpt_store(dst, width, ieee2xpt(double_bits(values[i])), little_endian);
     }
+}
 
-    /* get the actual exponent value out of the ieee number. The */
-    /* ibm fraction is a power of 16 and the ieee fraction a power*/
-    /* of 2 (16 ** n == 2 ** 4n). Save the low order 2 bits since */
-    /* they will get lost when we divide the exponent by 4 (right */
-    /* shift by 2) and we will have to shift the fraction by the */
-    /* appropriate number of bits to keep the proper magnitude. */
-    shift = (int)
-        (ieee_exp = (int)(((ieee1 >> 16) & 0x7ff0) >> 4) - 1023)
-        & 3;
-    /* the ieee format has an implied "1" immdeiately to the left */
-    /* of the binary point. Show it in here. */
-    xport1 |= 0x00100000;
-    if (shift)
-    {
-        /* set the first half of the ibm number by shifting it left */
-
-        /* the appropriate number of bits and oring in the bits */
-        /* from the lower half that would have been shifted in (if */
-        /* we could shift a double). The shift count can never */
-        /* exceed 3, so all we care about are the high order 3 */
-        /* bits. We don't want sign extention so make sure it's an */
-        /* unsigned char. We'll shift either5, 6, or 7 places to */
-        /* keep 3, 2, or 1 bits. After that, shift the second half */
-        /* of the number the right number of places. We always get */
-        /* zero fill on left shifts. */
-        xport1 = (xport1 << shift) |
-            ((unsigned char) (((ieee2 >> 24) & 0xE0) >>
-                (5 + (3 - shift))));
+int cnxptiee(const void *from_bytes, int fromtype, void *to_bytes, int totype) {
+    uint64_t bits = 0;
+    int little_endian = machine_is_little_endian();
 
-        xport2 <<= shift;
-    }
+    if (fromtype == CN_TYPE_NATIVE)
+        fromtype = little_endian ? CN_TYPE_IEEEL : CN_TYPE_IEEEB;
+    if (totype == CN_TYPE_NATIVE)
+        totype = little_endian ? CN_TYPE_IEEEL : CN_TYPE_IEEEB;
 
-    /* Now set the ibm exponent and the sign of the fraction. The */
-    /* power of 2 ieee exponent must be divided by 4 and made */
-    /* excess 64 (we add 65 here because of the poisition of the */
-    /* fraction bits, essentially 4 positions lower than they */
-    /* should be so we incrment the ibm exponent). */
+    if (fromtype != CN_TYPE_XPORT && fromtype != CN_TYPE_IEEEB && fromtype != CN_TYPE_IEEEL)
+        return -1;
+    if (totype != CN_TYPE_XPORT && totype != CN_TYPE_IEEEB && totype != CN_TYPE_IEEEL)
+        return -2;
 
-    xport1 |=
+    /* Everything below works on big-endian bit patterns */
+    bits = xpt_load(from_bytes, 8, little_endian);
+    if (fromtype == CN_TYPE_IEEEL)
+        bits = byteswap8(bits);
 
-        (((ieee_exp >>2) + 65) | ((ieee1 >> 24) & 0x80)) << 24;
-    /* If the ieee exponent is greater than 248 or less than -260, */
-    /* then it cannot fit in the ibm exponent field. Send back the */
-    /* appropriate flag. */
+    if (fromtype == CN_TYPE_XPORT && totype != CN_TYPE_XPORT) {
+        bits = xpt2ieee(bits);
+    } else if (fromtype != CN_TYPE_XPORT && totype == CN_TYPE_XPORT) {
+        bits = ieee2xpt(bits);
+    }
 
-doret:
-    if (ieee_exp < -260) {
-        memset(xport,0x00,8);
-    } else if (ieee_exp > 248) {
-        memset(xport+1,0xFF,7);
+    if (totype == CN_TYPE_IEEEL)
+        bits = byteswap8(bits);
+    xpt_store(to_bytes, 8, bits, little_endian);
 
-        *xport = 0x7F | ((ieee1 >> 24) & 0x80);
-    } else {
-        memreverse(&xport1,sizeof(uint32_t));
-        memcpy(xport,&xport1,sizeof(uint32_t));
-        memreverse(&xport2,sizeof(uint32_t));
-        memcpy(xport+4,&xport2,sizeof(uint32_t));
-    }
-    return;
+    return 0;
 }
-
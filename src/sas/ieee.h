@@ -4,3 +4,14 @@
 #define CN_TYPE_IEEEL 3
 
 int cnxptiee(const void *from_bytes, int fromtype, void *to_bytes, int totype);
+
+/* Conversions between native doubles and IBM 370 doubles truncated to
+ * `width' bytes (XPORT_MIN_DOUBLE_SIZE to XPORT_MAX_DOUBLE_SIZE). The batch
+ * versions convert `count' values whose XPORT bytes are `stride' bytes apart,
+ * e.g. one column of a block of rows. Missing values are not recognized
+ * here: a lone first byte decodes to a NaN, and a NaN with FFFF in its high
+ * bytes encodes to a lone first byte. */
+double xpt_decode_double(const void *xport, size_t width);
+void xpt_encode_double(void *xport, size_t width, double value);
+void xpt_decode_doubles(double *values, const void *xport, size_t width, size_t stride, size_t count);
+void xpt_encode_doubles(void *xport, size_t width, size_t stride, const double *values, size_t count);
@@ -363,6 +363,19 @@ cleanup:
     return retval;
 }
 
+/* Overwrite the page count in a header that has already been written */
+readstat_error_t sas_write_page_count(readstat_writer_t *writer, sas_header_info_t *hinfo) {
+    size_t offset = sizeof(sas_header_start_t) + hinfo->pad1 + 2 * sizeof(double) + 16 + 2 * sizeof(uint32_t);
+
+    if (hinfo->u64) {
+        uint64_t page_count = hinfo->page_count;
+        return readstat_write_bytes_at(writer, offset, &page_count, sizeof(uint64_t));
+    }
+
+    uint32_t page_count = hinfo->page_count;
+    return readstat_write_bytes_at(writer, offset, &page_count, sizeof(uint32_t));
+}
+
 sas_header_info_t *sas_header_info_init(readstat_writer_t *writer, int is_64bit) {
     sas_header_info_t *hinfo = calloc(1, sizeof(sas_header_info_t));
     hinfo->creation_time = writer->timestamp;
@@ -435,23 +448,31 @@ readstat_error_t sas_validate_tag(char tag) {
     return READSTAT_ERROR_TAGGED_VALUE_IS_OUT_OF_RANGE;
 }
 
-void sas_assign_tag(readstat_value_t *value, uint8_t tag) {
+char sas_missing_tag(uint8_t tag) {
     /* We accommodate two tag schemes. In the first, the tag is an ASCII code
      * given by uint8_t tag above. System missing is represented by an ASCII
      * period. In the second scheme, (tag-2) is an offset from 'A', except when
      * tag == 0, in which case it represents an underscore, or tag == 1, in
      * which case it represents system-missing.
+     *
+     * Returns the tag, or 0 for system-missing.
      */
     if (tag == 0) {
         tag = '_';
     } else if (tag >= 2 && tag < 28) {
         tag = 'A' + (tag - 2);
     }
-    if (sas_validate_tag(tag) == READSTAT_OK) {
-        value->tag = tag;
+    if (sas_validate_tag(tag) == READSTAT_OK)
+        return tag;
+
+    return 0;
+}
+
+void sas_assign_tag(readstat_value_t *value, uint8_t tag) {
+    value->tag = sas_missing_tag(tag);
+    if (value->tag) {
         value->is_tagged_missing = 1;
     } else {
-        value->tag = 0;
         value->is_system_missing = 1;
     }
 }
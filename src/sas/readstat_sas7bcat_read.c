@@ -30,12 +30,12 @@ typedef struct sas7bcat_ctx_s {
     int            block_pointers_capacity;
     const char    *input_encoding;
     const char    *output_encoding;
-    iconv_t        converter;
+    readstat_converter_t *converter;
 } sas7bcat_ctx_t;
 
 static void sas7bcat_ctx_free(sas7bcat_ctx_t *ctx) {
     if (ctx->converter)
-        iconv_close(ctx->converter);
+        readstat_converter_free(ctx->converter);
     if (ctx->block_pointers)
         free(ctx->block_pointers);
 
@@ -412,12 +412,10 @@ readstat_error_t readstat_parse_sas7bcat(readstat_parser_t *parser, const char *
     }
 
     if (ctx->input_encoding && ctx->output_encoding && strcmp(ctx->input_encoding, ctx->output_encoding) != 0) {
-        iconv_t converter = iconv_open(ctx->output_encoding, ctx->input_encoding);
-        if (converter == (iconv_t)-1) {
+        if ((ctx->converter = readstat_converter_init(ctx->output_encoding, ctx->input_encoding)) == NULL) {
             retval = READSTAT_ERROR_UNSUPPORTED_CHARSET;
             goto cleanup;
         }
-        ctx->converter = converter;
     }
 
     if (ctx->metadata_handler) {
@@ -7,12 +7,19 @@
 #include <inttypes.h>
 #include "readstat_sas.h"
 #include "readstat_sas_rle.h"
+#include "readstat_sas_rdc.h"
 #include "../readstat_iconv.h"
 #include "../readstat_convert.h"
 #include "../readstat_malloc.h"
+#include "../readstat_batch.h"
+#include "../readstat_projection.h"
+#include "../readstat_row_index.h"
+#include "../readstat_parallel.h"
 
-#define SAS_COMPRESSION_SIGNATURE_RLE  "SASYZCRL"
-#define SAS_COMPRESSION_SIGNATURE_RDC  "SASYZCR2"
+
+#define SAS7BDAT_PAGES_PER_THREAD   4
+/* How far back from the end of the file to look for the first AMD page */
+#define SAS7BDAT_AMD_SCAN_PAGES     64
 
 typedef struct col_info_s {
     sas_text_ref_t  name_ref;
@@ -32,6 +39,51 @@ typedef struct subheader_pointer_s {
     unsigned char is_compressed_data;
 } subheader_pointer_t;
 
+/* A page kept from pass 1: either borrowed from the I/O layer, or a copy */
+typedef struct sas7bdat_kept_page_s {
+    const char     *data;
+    char           *copy;
+} sas7bdat_kept_page_t;
+
+/* Where the numeric columns sit in a row, as of when pass 2 started
+ * handing out pages, so that worker threads can byte-swap them */
+typedef struct sas7bdat_numeric_layout_s {
+    int             valid;
+    int             col_info_count;
+    uint32_t        row_length;
+    /* Indexed by column; -1 for string columns */
+    int            *slots;
+    int             count;
+    uint64_t       *offsets;
+    uint32_t       *widths;
+} sas7bdat_numeric_layout_t;
+
+typedef struct sas7bdat_page_job_s {
+    const char     *page;
+    int64_t         page_index;
+    int             decoded;
+    int             data_page;
+    int             has_values;
+    uint32_t        row_count;
+    /* Either rows, or the rows of an uncompressed DATA page in place */
+    const char     *row_data;
+    char           *rows;
+    size_t          rows_capacity;
+    /* The numeric cells of each row, as the bits of a host double */
+    uint64_t       *values;
+    size_t          values_capacity;
+} sas7bdat_page_job_t;
+
+typedef struct sas7bdat_page_batch_s {
+    struct sas7bdat_ctx_s  *ctx;
+    uint32_t                row_length;
+    const sas7bdat_numeric_layout_t *layout;
+    char                   *pages;
+    sas7bdat_page_job_t    *jobs;
+    int                     jobs_count;
+    int                     pending;
+} sas7bdat_page_batch_t;
+
 typedef struct sas7bdat_ctx_s {
     readstat_callbacks_t handle;
     int64_t              file_size;
@@ -43,6 +95,7 @@ typedef struct sas7bdat_ctx_s {
     readstat_io_t *io;
     int            bswap;
     int            did_submit_columns;
+    int            rdc_compressed;
 
     uint32_t        row_length;
     uint32_t        page_row_count;
@@ -50,6 +103,7 @@ typedef struct sas7bdat_ctx_s {
     uint32_t        column_count;
     uint32_t        row_limit;
     uint32_t        row_offset;
+    uint64_t        skipped_row_count;
 
     uint64_t        header_size;
     uint64_t        page_count;
@@ -77,10 +131,38 @@ typedef struct sas7bdat_ctx_s {
     col_info_t    *col_info;
 
     readstat_variable_t **variables;
+    readstat_batch_t     *batch;
+
+    /* Indexes of the columns that are actually decoded, i.e. neither
+     * projected away nor skipped by the variable handler */
+    int           *selected_columns;
+    int            selected_columns_count;
+    const readstat_projection_t *projection;
+
+    readstat_row_index_t *row_index;
+    int                   page_has_metadata;
+
+    /* Pages at the front of the file that pass 1 has already read in full,
+     * kept so that pass 2 doesn't read them again */
+    sas7bdat_kept_page_t *pass1_pages;
+    int64_t        pass1_pages_count;
+    int64_t        pass1_pages_capacity;
+    int            pass1_saw_rows;
+    /* The DATA page that ended the front scan of pass 1, or -1 */
+    int64_t        pass1_data_page;
+
+    /* Nobody wants the rows, so parsing ends with the column metadata */
+    int            metadata_only;
+
+    int            thread_count;
+    /* While rows decoded on a worker thread are delivered, their numeric
+     * cells, found by column index through numeric_slots */
+    const uint64_t *row_values;
+    const int     *numeric_slots;
 
     const char    *input_encoding;
     const char    *output_encoding;
-    iconv_t        converter;
+    readstat_converter_t *converter;
 
     time_t         ctime;
     time_t         mtime;
@@ -107,6 +189,8 @@ static void sas7bdat_ctx_free(sas7bdat_ctx_t *ctx) {
     }
     if (ctx->col_info)
         free(ctx->col_info);
+    if (ctx->selected_columns)
+        free(ctx->selected_columns);
 
     if (ctx->scratch_buffer)
         free(ctx->scratch_buffer);
@@ -114,11 +198,22 @@ static void sas7bdat_ctx_free(sas7bdat_ctx_t *ctx) {
     if (ctx->page)
         free(ctx->page);
 
+    if (ctx->pass1_pages) {
+        int64_t i;
+        for (i=0; i<ctx->pass1_pages_count; i++) {
+            free(ctx->pass1_pages[i].copy);
+        }
+        free(ctx->pass1_pages);
+    }
+
     if (ctx->row)
         free(ctx->row);
 
+    if (ctx->batch)
+        readstat_batch_free(ctx->batch);
+
     if (ctx->converter)
-        iconv_close(ctx->converter);
+        readstat_converter_free(ctx->converter);
 
     free(ctx);
 }
@@ -157,8 +252,7 @@ static readstat_error_t sas7bdat_parse_column_text_subheader(const char *subhead
     /* another bit of a hack */
     if (len-signature_len > 12 + sizeof(SAS_COMPRESSION_SIGNATURE_RDC)-1 &&
             strncmp(blob + 12, SAS_COMPRESSION_SIGNATURE_RDC, sizeof(SAS_COMPRESSION_SIGNATURE_RDC)-1) == 0) {
-        retval = READSTAT_ERROR_UNSUPPORTED_COMPRESSION;
-        goto cleanup;
+        ctx->rdc_compressed = 1;
     }
 
 cleanup:
@@ -374,7 +468,57 @@ cleanup:
     return retval;
 }
 
-static readstat_error_t sas7bdat_handle_data_value(readstat_variable_t *variable, 
+static readstat_error_t sas7bdat_convert_string(char *dst, size_t dst_len,
+        col_info_t *col_info, const char *col_data, sas7bdat_ctx_t *ctx) {
+    readstat_error_t retval = readstat_convert(dst, dst_len, col_data, col_info->width, ctx->converter);
+    if (retval != READSTAT_OK && ctx->handle.error) {
+        snprintf(ctx->error_buf, sizeof(ctx->error_buf),
+                "ReadStat: Error converting string (row=%u, col=%u) to specified encoding: %.*s",
+                ctx->parsed_row_count+1, col_info->index+1, col_info->width, col_data);
+        ctx->handle.error(ctx->error_buf, ctx->user_ctx);
+    }
+    return retval;
+}
+
+/* A numeric cell holds the leading width bytes of a double */
+static uint64_t sas7bdat_read_double_bits(const char *col_data, uint32_t width, int little_endian) {
+    uint64_t  val = 0;
+    if (little_endian) {
+        int k;
+        for (k=0; k<width; k++) {
+            val = (val << 8) | (unsigned char)col_data[width-1-k];
+        }
+    } else {
+        int k;
+        for (k=0; k<width; k++) {
+            val = (val << 8) | (unsigned char)col_data[k];
+        }
+    }
+    return val << (8-width)*8;
+}
+
+/* Returns the value of a numeric cell; for a NaN, *tag gets the byte that
+ * says which missing value it is */
+static double sas7bdat_read_double(col_info_t *col_info, const char *col_data,
+        sas7bdat_ctx_t *ctx, uint8_t *tag) {
+    uint64_t  val = 0;
+    double dval = NAN;
+    if (ctx->row_values) {
+        val = ctx->row_values[ctx->numeric_slots[col_info->index]];
+    } else {
+        val = sas7bdat_read_double_bits(col_data, col_info->width, ctx->little_endian);
+    }
+
+    memcpy(&dval, &val, 8);
+
+    if (isnan(dval)) {
+        *tag = ~((val >> 40) & 0xFF);
+        return NAN;
+    }
+    return dval;
+}
+
+static readstat_error_t sas7bdat_handle_data_value(readstat_variable_t *variable,
         col_info_t *col_info, const char *col_data, sas7bdat_ctx_t *ctx) {
     readstat_error_t retval = READSTAT_OK;
     int cb_retval = 0;
@@ -384,44 +528,19 @@ static readstat_error_t sas7bdat_handle_data_value(readstat_variable_t *variable
     value.type = col_info->type;
 
     if (col_info->type == READSTAT_TYPE_STRING) {
-        retval = readstat_convert(ctx->scratch_buffer, ctx->scratch_buffer_len,
-                col_data, col_info->width, ctx->converter);
-        if (retval != READSTAT_OK) {
-            if (ctx->handle.error) {
-                snprintf(ctx->error_buf, sizeof(ctx->error_buf),
-                        "ReadStat: Error converting string (row=%u, col=%u) to specified encoding: %.*s",
-                        ctx->parsed_row_count+1, col_info->index+1, col_info->width, col_data);
-                ctx->handle.error(ctx->error_buf, ctx->user_ctx);
-            }
+        retval = sas7bdat_convert_string(ctx->scratch_buffer, ctx->scratch_buffer_len,
+                col_info, col_data, ctx);
+        if (retval != READSTAT_OK)
             goto cleanup;
-        }
 
         value.v.string_value = ctx->scratch_buffer;
     } else if (col_info->type == READSTAT_TYPE_DOUBLE) {
-        uint64_t  val = 0;
-        double dval = NAN;
-        if (ctx->little_endian) {
-            int k;
-            for (k=0; k<col_info->width; k++) {
-                val = (val << 8) | (unsigned char)col_data[col_info->width-1-k];
-            }
-        } else {
-            int k;
-            for (k=0; k<col_info->width; k++) {
-                val = (val << 8) | (unsigned char)col_data[k];
-            }
-        }
-        val <<= (8-col_info->width)*8;
-
-        memcpy(&dval, &val, 8);
-
-        if (isnan(dval)) {
-            value.v.double_value = NAN;
-            sas_assign_tag(&value, ~((val >> 40) & 0xFF));
-        } else {
-            value.v.double_value = dval;
-        }
+        uint8_t tag = 0;
+        value.v.double_value = sas7bdat_read_double(col_info, col_data, ctx, &tag);
+        if (isnan(value.v.double_value))
+            sas_assign_tag(&value, tag);
     }
+
     cb_retval = ctx->handle.value(ctx->parsed_row_count, variable, value, ctx->user_ctx);
 
     if (cb_retval != READSTAT_HANDLER_OK)
@@ -431,35 +550,69 @@ cleanup:
     return retval;
 }
 
+/* Decode a cell straight into its batch column */
+static readstat_error_t sas7bdat_handle_batch_value(readstat_variable_t *variable,
+        col_info_t *col_info, const char *col_data, int row, sas7bdat_ctx_t *ctx) {
+    readstat_error_t retval = READSTAT_OK;
+    readstat_batch_column_t *column = NULL;
+
+    if ((retval = readstat_batch_column(ctx->batch, variable, &column)) != READSTAT_OK)
+        goto cleanup;
+
+    if (col_info->type == READSTAT_TYPE_STRING) {
+        size_t dst_len = 4*col_info->width+1;
+        char *dst = NULL;
+        if ((dst = readstat_batch_reserve_string(ctx->batch, column, row, dst_len)) == NULL) {
+            retval = READSTAT_ERROR_MALLOC;
+            goto cleanup;
+        }
+        if ((retval = sas7bdat_convert_string(dst, dst_len, col_info, col_data, ctx)) != READSTAT_OK)
+            goto cleanup;
+
+        readstat_batch_end_string(ctx->batch, column);
+    } else if (col_info->type == READSTAT_TYPE_DOUBLE) {
+        uint8_t tag = 0;
+        column->double_values[row] = sas7bdat_read_double(col_info, col_data, ctx, &tag);
+        if (isnan(column->double_values[row]))
+            readstat_batch_set_missing(column, row, sas_missing_tag(tag));
+    }
+
+cleanup:
+    return retval;
+}
+
 static readstat_error_t sas7bdat_parse_single_row(const char *data, sas7bdat_ctx_t *ctx) {
     if (ctx->parsed_row_count == ctx->row_limit)
         return READSTAT_OK;
     if (ctx->row_offset) {
         ctx->row_offset--;
+        ctx->skipped_row_count++;
         return READSTAT_OK;
     }
 
     readstat_error_t retval = READSTAT_OK;
+    int row = 0;
     int j;
-    if (ctx->handle.value) {
-        ctx->scratch_buffer_len = 4*ctx->max_col_width+1;
-        ctx->scratch_buffer = readstat_realloc(ctx->scratch_buffer, ctx->scratch_buffer_len);
-        if (ctx->scratch_buffer == NULL) {
-            retval = READSTAT_ERROR_MALLOC;
+    if (ctx->batch) {
+        if ((retval = readstat_batch_row(ctx->batch, ctx->parsed_row_count, &row)) != READSTAT_OK)
             goto cleanup;
-        }
-
-        for (j=0; j<ctx->column_count; j++) {
-            col_info_t *col_info = &ctx->col_info[j];
-            readstat_variable_t *variable = ctx->variables[j];
-            if (variable->skip)
-                continue;
+    }
+    if (ctx->handle.value || ctx->batch) {
+        for (j=0; j<ctx->selected_columns_count; j++) {
+            int index = ctx->selected_columns[j];
+            col_info_t *col_info = &ctx->col_info[index];
+            readstat_variable_t *variable = ctx->variables[index];
+            const char *col_data = &data[col_info->offset];
 
             if (col_info->offset > ctx->row_length || col_info->offset + col_info->width > ctx->row_length) {
                 retval = READSTAT_ERROR_PARSE;
                 goto cleanup;
             }
-            retval = sas7bdat_handle_data_value(variable, col_info, &data[col_info->offset], ctx);
+            if (ctx->batch) {
+                retval = sas7bdat_handle_batch_value(variable, col_info, col_data, row, ctx);
+            } else {
+                retval = sas7bdat_handle_data_value(variable, col_info, col_data, ctx);
+            }
             if (retval != READSTAT_OK) {
                 goto cleanup;
             }
@@ -490,14 +643,22 @@ cleanup:
     return retval;
 }
 
-static readstat_error_t sas7bdat_parse_subheader_rle(const char *subheader, size_t len, sas7bdat_ctx_t *ctx) {
+static ssize_t sas7bdat_decompress_row(char *row, size_t row_length,
+        const char *subheader, size_t len, sas7bdat_ctx_t *ctx) {
+    if (ctx->rdc_compressed)
+        return sas_rdc_decompress(row, row_length, subheader, len);
+
+    return sas_rle_decompress(row, row_length, subheader, len);
+}
+
+static readstat_error_t sas7bdat_parse_subheader_compressed(const char *subheader, size_t len, sas7bdat_ctx_t *ctx) {
     if (ctx->row_limit == ctx->parsed_row_count)
         return READSTAT_OK;
 
     readstat_error_t retval = READSTAT_OK;
     ssize_t bytes_decompressed = 0;
 
-    bytes_decompressed = sas_rle_decompress(ctx->row, ctx->row_length, subheader, len);
+    bytes_decompressed = sas7bdat_decompress_row(ctx->row, ctx->row_length, subheader, len, ctx);
 
     if (bytes_decompressed != ctx->row_length) {
         retval = READSTAT_ERROR_ROW_WIDTH_MISMATCH;
@@ -612,6 +773,10 @@ cleanup:
 
 static readstat_error_t sas7bdat_submit_columns(sas7bdat_ctx_t *ctx, int compressed) {
     readstat_error_t retval = READSTAT_OK;
+    readstat_compress_t compression = READSTAT_COMPRESS_NONE;
+    if (compressed) {
+        compression = ctx->rdc_compressed ? READSTAT_COMPRESS_BINARY : READSTAT_COMPRESS_ROWS;
+    }
     if (ctx->handle.metadata) {
         readstat_metadata_t metadata = {
             .row_count = ctx->row_limit,
@@ -621,7 +786,7 @@ static readstat_error_t sas7bdat_submit_columns(sas7bdat_ctx_t *ctx, int compres
             .creation_time = ctx->ctime,
             .modified_time = ctx->mtime,
             .file_format_version = ctx->version,
-            .compression = compressed ? READSTAT_COMPRESS_ROWS : READSTAT_COMPRESS_NONE,
+            .compression = compression,
             .endianness = ctx->little_endian ? READSTAT_ENDIAN_LITTLE : READSTAT_ENDIAN_BIG,
             .is64bit = ctx->u64
         };
@@ -637,6 +802,19 @@ static readstat_error_t sas7bdat_submit_columns(sas7bdat_ctx_t *ctx, int compres
         retval = READSTAT_ERROR_MALLOC;
         goto cleanup;
     }
+    if ((ctx->selected_columns = readstat_calloc(ctx->column_count, sizeof(int))) == NULL) {
+        retval = READSTAT_ERROR_MALLOC;
+        goto cleanup;
+    }
+    /* Every string cell is converted into the same buffer, so it's sized
+     * once here for the widest column rather than checked on every row */
+    if (ctx->handle.value || ctx->batch) {
+        ctx->scratch_buffer_len = 4*ctx->max_col_width+1;
+        if ((ctx->scratch_buffer = readstat_malloc(ctx->scratch_buffer_len)) == NULL) {
+            retval = READSTAT_ERROR_MALLOC;
+            goto cleanup;
+        }
+    }
     int i;
     int index_after_skipping = 0;
     for (i=0; i<ctx->column_count; i++) {
@@ -644,9 +822,12 @@ static readstat_error_t sas7bdat_submit_columns(sas7bdat_ctx_t *ctx, int compres
         if (ctx->variables[i] == NULL)
             break;
 
-        int cb_retval = READSTAT_HANDLER_OK;
-        if (ctx->handle.variable) {
-            cb_retval = ctx->handle.variable(i, ctx->variables[i], ctx->variables[i]->format, ctx->user_ctx);
+        int cb_retval = READSTAT_HANDLER_SKIP_VARIABLE;
+        if (readstat_projection_includes(ctx->projection, i, ctx->variables[i]->name)) {
+            cb_retval = READSTAT_HANDLER_OK;
+            if (ctx->handle.variable) {
+                cb_retval = ctx->handle.variable(i, ctx->variables[i], ctx->variables[i]->format, ctx->user_ctx);
+            }
         }
         if (cb_retval == READSTAT_HANDLER_ABORT) {
             retval = READSTAT_ERROR_USER_ABORT;
@@ -656,6 +837,7 @@ static readstat_error_t sas7bdat_submit_columns(sas7bdat_ctx_t *ctx, int compres
         if (cb_retval == READSTAT_HANDLER_SKIP_VARIABLE) {
             ctx->variables[i]->skip = 1;
         } else {
+            ctx->selected_columns[ctx->selected_columns_count++] = i;
             index_after_skipping++;
         }
     }
@@ -765,9 +947,11 @@ static readstat_error_t sas7bdat_parse_page_pass1(const char *page, size_t page_
                             != READSTAT_OK) {
                         goto cleanup;
                     }
+                } else if (shp_info.is_compressed_data && !sas7bdat_signature_is_recognized(signature)) {
+                    ctx->pass1_saw_rows = 1;
                 }
             } else if (shp_info.compression == SAS_COMPRESSION_ROW) {
-                /* void */
+                ctx->pass1_saw_rows = 1;
             } else {
                 retval = READSTAT_ERROR_UNSUPPORTED_COMPRESSION;
                 goto cleanup;
@@ -834,6 +1018,7 @@ static readstat_error_t sas7bdat_parse_page_pass2(const char *page, size_t page_
                         }
                     } else {
                         if (signature != SAS_SUBHEADER_SIGNATURE_COLUMN_TEXT) {
+                            ctx->page_has_metadata = 1;
                             if ((retval = sas7bdat_parse_subheader(signature, page + shp_info.offset, shp_info.len, ctx)) != READSTAT_OK) {
                                 goto cleanup;
                             }
@@ -843,7 +1028,7 @@ static readstat_error_t sas7bdat_parse_page_pass2(const char *page, size_t page_
                     if ((retval = sas7bdat_submit_columns_if_needed(ctx, 1)) != READSTAT_OK) {
                         goto cleanup;
                     }
-                    if ((retval = sas7bdat_parse_subheader_rle(page + shp_info.offset, shp_info.len, ctx)) != READSTAT_OK) {
+                    if ((retval = sas7bdat_parse_subheader_compressed(page + shp_info.offset, shp_info.len, ctx)) != READSTAT_OK) {
                         goto cleanup;
                     }
                 } else {
@@ -874,7 +1059,7 @@ static readstat_error_t sas7bdat_parse_page_pass2(const char *page, size_t page_
         if ((retval = sas7bdat_submit_columns_if_needed(ctx, 0)) != READSTAT_OK) {
             goto cleanup;
         }
-        if (ctx->handle.value) {
+        if (ctx->handle.value || ctx->batch) {
             retval = sas7bdat_parse_rows(data, page + page_size - data, ctx);
         }
     } 
@@ -883,58 +1068,159 @@ cleanup:
     return retval;
 }
 
-static readstat_error_t sas7bdat_parse_meta_pages_pass1(sas7bdat_ctx_t *ctx, int64_t *outLastExaminedPage) {
+/* Pass 1 only wants META, MIX and AMD pages (or with amd_only, just AMD
+ * pages). Read just enough of page i to learn its type, and fetch the rest
+ * only if it's wanted; otherwise *out_page is left NULL. */
+static int sas7bdat_page_is_wanted_pass1(uint16_t page_type, int amd_only) {
+    if ((page_type & SAS_PAGE_TYPE_MASK) == SAS_PAGE_TYPE_DATA)
+        return 0;
+    if ((page_type & SAS_PAGE_TYPE_COMP))
+        return 0;
+    if (amd_only && (page_type & SAS_PAGE_TYPE_MASK) != SAS_PAGE_TYPE_AMD)
+        return 0;
+    return 1;
+}
+
+static readstat_error_t sas7bdat_read_page_pass1(sas7bdat_ctx_t *ctx, int64_t i, int amd_only,
+        const char **out_page, uint16_t *out_page_type) {
     readstat_error_t retval = READSTAT_OK;
     readstat_io_t *io = ctx->io;
-    int64_t i;
+    const char *page = NULL;
 
-    /* look for META and MIX pages at beginning... */
-    for (i=0; i<ctx->page_count; i++) {
-        if (io->seek(ctx->header_size + i*ctx->page_size, READSTAT_SEEK_SET, io->io_ctx) == -1) {
-            retval = READSTAT_ERROR_SEEK;
-            if (ctx->handle.error) {
-                snprintf(ctx->error_buf, sizeof(ctx->error_buf), "ReadStat: Failed to seek to position %" PRId64 
-                        " (= %" PRId64 " + %" PRId64 "*%" PRId64 ")",
-                        ctx->header_size + i*ctx->page_size, ctx->header_size, i, ctx->page_size);
-                ctx->handle.error(ctx->error_buf, ctx->user_ctx);
-            }
-            goto cleanup;
+    if (io->seek(ctx->header_size + i*ctx->page_size, READSTAT_SEEK_SET, io->io_ctx) == -1) {
+        retval = READSTAT_ERROR_SEEK;
+        if (ctx->handle.error) {
+            snprintf(ctx->error_buf, sizeof(ctx->error_buf), "ReadStat: Failed to seek to position %" PRId64 
+                    " (= %" PRId64 " + %" PRId64 "*%" PRId64 ")",
+                    ctx->header_size + i*ctx->page_size, ctx->header_size, i, ctx->page_size);
+            ctx->handle.error(ctx->error_buf, ctx->user_ctx);
         }
+        goto cleanup;
+    }
 
-        readstat_off_t off = 0;
-        if (ctx->u64)
-            off = 16;
+    readstat_off_t off = 0;
+    if (ctx->u64)
+        off = 16;
 
-        size_t head_len = off + 16 + 2;
-        size_t tail_len = ctx->page_size - head_len;
+    size_t head_len = off + 16 + 2;
+    size_t tail_len = ctx->page_size - head_len;
 
+    if (io->borrow && (page = io->borrow(ctx->page_size, io->io_ctx)) != NULL) {
+        *out_page_type = sas_read2(&page[off+16], ctx->bswap);
+    } else {
         if (io->read(ctx->page, head_len, io->io_ctx) < head_len) {
             retval = READSTAT_ERROR_READ;
             goto cleanup;
         }
 
-        uint16_t page_type = sas_read2(&ctx->page[off+16], ctx->bswap);
+        *out_page_type = sas_read2(&ctx->page[off+16], ctx->bswap);
 
-        if ((page_type & SAS_PAGE_TYPE_MASK) == SAS_PAGE_TYPE_DATA)
-            break;
-        if ((page_type & SAS_PAGE_TYPE_COMP))
-            continue;
+        if (!sas7bdat_page_is_wanted_pass1(*out_page_type, amd_only))
+            goto cleanup;
 
         if (io->read(ctx->page + head_len, tail_len, io->io_ctx) < tail_len) {
             retval = READSTAT_ERROR_READ;
             goto cleanup;
         }
 
-        if ((retval = sas7bdat_parse_page_pass1(ctx->page, ctx->page_size, ctx)) != READSTAT_OK) {
-            if (ctx->handle.error && retval != READSTAT_ERROR_USER_ABORT) {
-                int64_t pos = io->seek(0, READSTAT_SEEK_CUR, io->io_ctx);
-                snprintf(ctx->error_buf, sizeof(ctx->error_buf), 
-                        "ReadStat: Error parsing page %" PRId64 ", bytes %" PRId64 "-%" PRId64, 
-                        i, pos - ctx->page_size, pos-1);
-                ctx->handle.error(ctx->error_buf, ctx->user_ctx);
-            }
+        page = ctx->page;
+    }
+
+    if (!sas7bdat_page_is_wanted_pass1(*out_page_type, amd_only))
+        page = NULL;
+
+cleanup:
+    *out_page = page;
+
+    return retval;
+}
+
+static readstat_error_t sas7bdat_parse_page_pass1_at(const char *page, int64_t i, sas7bdat_ctx_t *ctx) {
+    readstat_error_t retval = READSTAT_OK;
+    readstat_io_t *io = ctx->io;
+
+    if ((retval = sas7bdat_parse_page_pass1(page, ctx->page_size, ctx)) != READSTAT_OK) {
+        if (ctx->handle.error && retval != READSTAT_ERROR_USER_ABORT) {
+            int64_t pos = io->seek(0, READSTAT_SEEK_CUR, io->io_ctx);
+            snprintf(ctx->error_buf, sizeof(ctx->error_buf), 
+                    "ReadStat: Error parsing page %" PRId64 ", bytes %" PRId64 "-%" PRId64, 
+                    i, pos - ctx->page_size, pos-1);
+            ctx->handle.error(ctx->error_buf, ctx->user_ctx);
+        }
+    }
+
+    return retval;
+}
+
+/* Pages are kept only while they form an unbroken run from the start of the
+ * file, so that page i of the run is always the i-th page kept. A borrowed
+ * page stays valid until the file is closed, so only pages that were read
+ * into ctx->page need copying. */
+static readstat_error_t sas7bdat_keep_page_pass1(sas7bdat_ctx_t *ctx, int64_t i, const char *page) {
+    sas7bdat_kept_page_t *kept = NULL;
+
+    if (ctx->pass1_pages_count != i)
+        return READSTAT_OK;
+
+    if (ctx->pass1_pages_count == ctx->pass1_pages_capacity) {
+        int64_t capacity = ctx->pass1_pages_capacity ? 2 * ctx->pass1_pages_capacity : 4;
+        sas7bdat_kept_page_t *pages = readstat_realloc(ctx->pass1_pages,
+                capacity * sizeof(sas7bdat_kept_page_t));
+        if (pages == NULL)
+            return READSTAT_ERROR_MALLOC;
+        ctx->pass1_pages = pages;
+        ctx->pass1_pages_capacity = capacity;
+    }
+
+    kept = &ctx->pass1_pages[ctx->pass1_pages_count];
+    kept->data = page;
+    kept->copy = NULL;
+    if (page == ctx->page) {
+        if ((kept->copy = readstat_malloc(ctx->page_size)) == NULL)
+            return READSTAT_ERROR_MALLOC;
+        memcpy(kept->copy, page, ctx->page_size);
+        kept->data = kept->copy;
+    }
+    ctx->pass1_pages_count++;
+
+    return READSTAT_OK;
+}
+
+/* Column metadata precedes the rows, except on AMD pages, which are picked
+ * up from the back of the file. So the front scan is done at the first
+ * DATA page, or at the first META or MIX page that carries rows -- in
+ * compressed files every page is a META page, and there's no need to read
+ * all of them here. */
+static readstat_error_t sas7bdat_parse_meta_pages_pass1(sas7bdat_ctx_t *ctx, int64_t *outLastExaminedPage) {
+    readstat_error_t retval = READSTAT_OK;
+    int64_t i;
+
+    /* look for META and MIX pages at beginning... */
+    for (i=0; i<ctx->page_count; i++) {
+        const char *page = NULL;
+        uint16_t page_type = 0;
+
+        if ((retval = sas7bdat_read_page_pass1(ctx, i, 0, &page, &page_type)) != READSTAT_OK)
             goto cleanup;
+
+        if ((page_type & SAS_PAGE_TYPE_MASK) == SAS_PAGE_TYPE_DATA) {
+            ctx->pass1_data_page = i;
+            break;
         }
+        if (page == NULL)
+            continue;
+
+        if ((retval = sas7bdat_parse_page_pass1_at(page, i, ctx)) != READSTAT_OK)
+            goto cleanup;
+
+        if ((retval = sas7bdat_keep_page_pass1(ctx, i, page)) != READSTAT_OK)
+            goto cleanup;
+
+        if ((page_type & SAS_PAGE_TYPE_MASK) == SAS_PAGE_TYPE_MIX)
+            ctx->pass1_saw_rows = 1;
+
+        if (ctx->pass1_saw_rows)
+            break;
     }
 
 cleanup:
@@ -944,68 +1230,592 @@ cleanup:
     return retval;
 }
 
+/* AMD pages are written at the end of the file, though rows appended later
+ * can follow them. Pages are read backwards from the end until a page of
+ * rows turns up before an AMD page. If none of the last
+ * SAS7BDAT_AMD_SCAN_PAGES pages is an AMD page, the scan stops there: a file
+ * without AMD pages, the usual case, would otherwise cost a seek and a read
+ * for every page after the front scan, which in a compressed file is nearly
+ * all of them. */
 static readstat_error_t sas7bdat_parse_amd_pages_pass1(int64_t last_examined_page_pass1, sas7bdat_ctx_t *ctx) {
     readstat_error_t retval = READSTAT_OK;
-    readstat_io_t *io = ctx->io;
     uint64_t i;
     uint64_t amd_page_count = 0;
+    uint64_t pages_scanned = 0;
+    /* If rows live on META pages, the only pages left with metadata are
+     * AMD pages, and the rest needn't be read beyond their headers */
+    int amd_only = ctx->pass1_saw_rows;
 
     /* ...then AMD pages at the end */
     for (i=ctx->page_count-1; i>last_examined_page_pass1; i--) {
-        if (io->seek(ctx->header_size + i*ctx->page_size, READSTAT_SEEK_SET, io->io_ctx) == -1) {
-            retval = READSTAT_ERROR_SEEK;
-            if (ctx->handle.error) {
-                snprintf(ctx->error_buf, sizeof(ctx->error_buf), "ReadStat: Failed to seek to position %" PRId64 
-                        " (= %" PRId64 " + %" PRId64 "*%" PRId64 ")",
-                        ctx->header_size + i*ctx->page_size, ctx->header_size, i, ctx->page_size);
-                ctx->handle.error(ctx->error_buf, ctx->user_ctx);
-            }
-            goto cleanup;
-        }
+        const char *page = NULL;
+        uint16_t page_type = 0;
 
-        readstat_off_t off = 0;
-        if (ctx->u64)
-            off = 16;
-
-        size_t head_len = off + 16 + 2;
-        size_t tail_len = ctx->page_size - head_len;
+        if (amd_page_count == 0 && pages_scanned++ == SAS7BDAT_AMD_SCAN_PAGES)
+            break;
 
-        if (io->read(ctx->page, head_len, io->io_ctx) < head_len) {
-            retval = READSTAT_ERROR_READ;
+        if ((retval = sas7bdat_read_page_pass1(ctx, i, amd_only, &page, &page_type)) != READSTAT_OK)
             goto cleanup;
-        }
 
-        uint16_t page_type = sas_read2(&ctx->page[off+16], ctx->bswap);
-
-        if ((page_type & SAS_PAGE_TYPE_MASK) == SAS_PAGE_TYPE_DATA) {
+        if ((page_type & SAS_PAGE_TYPE_MASK) == SAS_PAGE_TYPE_DATA ||
+                (amd_only && page == NULL && !(page_type & SAS_PAGE_TYPE_COMP))) {
             /* Usually AMD pages are at the end but sometimes data pages appear after them */
             if (amd_page_count > 0)
                 break;
             continue;
         }
-        if ((page_type & SAS_PAGE_TYPE_COMP))
+        if (page == NULL)
             continue;
 
-        if (io->read(ctx->page + head_len, tail_len, io->io_ctx) < tail_len) {
+        if ((retval = sas7bdat_parse_page_pass1_at(page, i, ctx)) != READSTAT_OK)
+            goto cleanup;
+
+        amd_page_count++;
+    }
+
+cleanup:
+
+    return retval;
+}
+
+/* While rows are still being skipped, read only the page header. DATA pages
+ * hold nothing but rows, and their row count is in the header, so a page
+ * that lies entirely before row_offset can be stepped over with a seek
+ * instead of being read and walked row by row. */
+static readstat_error_t sas7bdat_read_page_or_skip_rows(sas7bdat_ctx_t *ctx,
+        const char **out_page, int *out_skipped) {
+    readstat_error_t retval = READSTAT_OK;
+    readstat_io_t *io = ctx->io;
+    const char *page = NULL;
+    size_t head_len = ctx->page_header_size;
+    size_t tail_len = ctx->page_size - head_len;
+
+    *out_skipped = 0;
+
+    if (io->borrow && (page = io->borrow(ctx->page_size, io->io_ctx)) != NULL) {
+        if (!ctx->row_offset || ctx->page_size < head_len)
+            goto cleanup;
+
+        uint16_t page_type = sas_read2(&page[ctx->page_header_size-8], ctx->bswap);
+        uint16_t page_row_count = sas_read2(&page[ctx->page_header_size-6], ctx->bswap);
+
+        if ((page_type & SAS_PAGE_TYPE_MASK) == SAS_PAGE_TYPE_DATA && page_row_count <= ctx->row_offset) {
+            ctx->row_offset -= page_row_count;
+            ctx->skipped_row_count += page_row_count;
+            *out_skipped = 1;
+        }
+        goto cleanup;
+    }
+
+    page = ctx->page;
+
+    if (!ctx->row_offset || ctx->page_size < head_len) {
+        if (io->read(ctx->page, ctx->page_size, io->io_ctx) < ctx->page_size)
             retval = READSTAT_ERROR_READ;
+        goto cleanup;
+    }
+
+    if (io->read(ctx->page, head_len, io->io_ctx) < head_len) {
+        retval = READSTAT_ERROR_READ;
+        goto cleanup;
+    }
+
+    uint16_t page_type = sas_read2(&ctx->page[ctx->page_header_size-8], ctx->bswap);
+    uint16_t page_row_count = sas_read2(&ctx->page[ctx->page_header_size-6], ctx->bswap);
+
+    if ((page_type & SAS_PAGE_TYPE_MASK) == SAS_PAGE_TYPE_DATA && page_row_count <= ctx->row_offset) {
+        if (io->seek(tail_len, READSTAT_SEEK_CUR, io->io_ctx) == -1) {
+            retval = READSTAT_ERROR_SEEK;
             goto cleanup;
         }
+        ctx->row_offset -= page_row_count;
+        ctx->skipped_row_count += page_row_count;
+        *out_skipped = 1;
+        goto cleanup;
+    }
 
-        if ((retval = sas7bdat_parse_page_pass1(ctx->page, ctx->page_size, ctx)) != READSTAT_OK) {
-            if (ctx->handle.error && retval != READSTAT_ERROR_USER_ABORT) {
-                int64_t pos = io->seek(0, READSTAT_SEEK_CUR, io->io_ctx);
-                snprintf(ctx->error_buf, sizeof(ctx->error_buf), 
-                        "ReadStat: Error parsing page %" PRId64 ", bytes %" PRId64 "-%" PRId64, 
-                        i, pos - ctx->page_size, pos-1);
-                ctx->handle.error(ctx->error_buf, ctx->user_ctx);
+    if (io->read(ctx->page + head_len, tail_len, io->io_ctx) < tail_len) {
+        retval = READSTAT_ERROR_READ;
+        goto cleanup;
+    }
+
+cleanup:
+    *out_page = page;
+
+    return retval;
+}
+
+/* Only pages that were read to the end are indexed; the row count of the
+ * page where row_limit was reached is not known. */
+static readstat_error_t sas7bdat_index_page(sas7bdat_ctx_t *ctx, int64_t page, uint64_t first_row) {
+    if (ctx->row_index == NULL)
+        return READSTAT_OK;
+
+    return readstat_row_index_add_entry(ctx->row_index, page, first_row,
+            ctx->skipped_row_count + ctx->parsed_row_count - first_row,
+            ctx->page_has_metadata ? READSTAT_ROW_INDEX_HAS_METADATA : 0, NULL, 0);
+}
+
+/* The header holds the creation and modification times, the page count and
+ * the data set label, which is enough to tell a file from another of the
+ * same size that an index might have been built from */
+static readstat_error_t sas7bdat_fingerprint_header(sas7bdat_ctx_t *ctx, uint64_t *out_fingerprint) {
+    readstat_io_t *io = ctx->io;
+    uint64_t fingerprint = READSTAT_ROW_INDEX_FINGERPRINT_INIT;
+    char buffer[1024];
+    int64_t left = ctx->header_size;
+
+    if (io->seek(0, READSTAT_SEEK_SET, io->io_ctx) == -1)
+        return READSTAT_ERROR_SEEK;
+
+    while (left) {
+        size_t len = left < sizeof(buffer) ? left : sizeof(buffer);
+        if (io->read(buffer, len, io->io_ctx) < len)
+            return READSTAT_ERROR_READ;
+        fingerprint = readstat_row_index_fingerprint(fingerprint, buffer, len);
+        left -= len;
+    }
+
+    *out_fingerprint = fingerprint;
+    return READSTAT_OK;
+}
+
+static void sas7bdat_report_page_error(sas7bdat_ctx_t *ctx, int64_t page, readstat_error_t retval) {
+    if (ctx->handle.error && retval != READSTAT_ERROR_USER_ABORT) {
+        int64_t pos = ctx->header_size + page * ctx->page_size;
+        snprintf(ctx->error_buf, sizeof(ctx->error_buf), 
+                "ReadStat: Error parsing page %" PRId64 ", bytes %" PRId64 "-%" PRId64, 
+                page, pos, pos + ctx->page_size - 1);
+        ctx->handle.error(ctx->error_buf, ctx->user_ctx);
+    }
+}
+
+static int sas7bdat_page_job_reserve(sas7bdat_page_job_t *job, size_t rows_capacity) {
+    char *rows = NULL;
+    if (rows_capacity <= job->rows_capacity)
+        return 1;
+    if ((rows = readstat_realloc(job->rows, rows_capacity)) == NULL)
+        return 0;
+    job->rows = rows;
+    job->rows_capacity = rows_capacity;
+    return 1;
+}
+
+static int sas7bdat_page_job_reserve_values(sas7bdat_page_job_t *job, size_t values_capacity) {
+    uint64_t *values = NULL;
+    if (values_capacity <= job->values_capacity)
+        return 1;
+    if ((values = readstat_realloc(job->values, values_capacity * sizeof(uint64_t))) == NULL)
+        return 0;
+    job->values = values;
+    job->values_capacity = values_capacity;
+    return 1;
+}
+
+/* The most rows sas7bdat_decode_page() can take from a page: one per
+ * subheader on META pages, which are copied out into job->rows, the row
+ * count on DATA pages, which are left in place, and none on the others */
+static uint16_t sas7bdat_page_rows_bound(sas7bdat_ctx_t *ctx, const char *page, int *copied) {
+    uint16_t page_type = sas_read2(&page[ctx->page_header_size-8], ctx->bswap);
+    uint16_t row_count = 0;
+    uint16_t subheader_count = 0;
+
+    *copied = 0;
+    if ((page_type & SAS_PAGE_TYPE_MASK) == SAS_PAGE_TYPE_DATA) {
+        row_count = sas_read2(&page[ctx->page_header_size-6], ctx->bswap);
+        if (ctx->page_header_size + row_count * (uint64_t)ctx->row_length > ctx->page_size)
+            return 0;
+        return row_count;
+    }
+    if ((page_type & SAS_PAGE_TYPE_MASK) != SAS_PAGE_TYPE_META || (page_type & SAS_PAGE_TYPE_COMP))
+        return 0;
+
+    subheader_count = sas_read2(&page[ctx->page_header_size-4], ctx->bswap);
+    if (ctx->page_header_size + subheader_count*ctx->subheader_pointer_size > ctx->page_size)
+        return 0;
+
+    *copied = 1;
+    return subheader_count;
+}
+
+static int sas7bdat_page_job_add_row(sas7bdat_page_job_t *job, uint32_t row_length) {
+    size_t rows_len = (job->row_count + 1) * (size_t)row_length;
+    if (rows_len > job->rows_capacity) {
+        size_t rows_capacity = job->rows_capacity ? 2 * job->rows_capacity : 16 * (size_t)row_length;
+        if (rows_capacity < rows_len)
+            rows_capacity = rows_len;
+        if (!sas7bdat_page_job_reserve(job, rows_capacity))
+            return 0;
+    }
+    job->row_count++;
+    return 1;
+}
+
+static void sas7bdat_numeric_layout_free(sas7bdat_numeric_layout_t *layout) {
+    free(layout->slots);
+    free(layout->offsets);
+    free(layout->widths);
+}
+
+/* A column that doesn't fit in the row leaves the layout invalid, and then
+ * the main thread reads every numeric cell itself, and reports the error */
+static readstat_error_t sas7bdat_numeric_layout_init(sas7bdat_numeric_layout_t *layout, sas7bdat_ctx_t *ctx) {
+    int i;
+
+    memset(layout, 0, sizeof(sas7bdat_numeric_layout_t));
+    layout->col_info_count = ctx->col_info_count;
+    layout->row_length = ctx->row_length;
+    if (ctx->col_info_count == 0)
+        return READSTAT_OK;
+
+    if ((layout->slots = readstat_malloc(ctx->col_info_count * sizeof(int))) == NULL ||
+            (layout->offsets = readstat_malloc(ctx->col_info_count * sizeof(uint64_t))) == NULL ||
+            (layout->widths = readstat_malloc(ctx->col_info_count * sizeof(uint32_t))) == NULL)
+        return READSTAT_ERROR_MALLOC;
+
+    for (i=0; i<ctx->col_info_count; i++) {
+        col_info_t *col_info = &ctx->col_info[i];
+        layout->slots[i] = -1;
+        if (col_info->type != READSTAT_TYPE_DOUBLE)
+            continue;
+        if (col_info->index != i || col_info->width == 0 || col_info->width > 8 ||
+                col_info->offset > ctx->row_length || col_info->offset + col_info->width > ctx->row_length)
+            return READSTAT_OK;
+
+        layout->slots[i] = layout->count;
+        layout->offsets[layout->count] = col_info->offset;
+        layout->widths[layout->count] = col_info->width;
+        layout->count++;
+    }
+    layout->valid = 1;
+
+    return READSTAT_OK;
+}
+
+/* A page in pass 2 can still hold column subheaders, so check that the
+ * columns haven't moved since the layout was taken */
+static int sas7bdat_numeric_layout_matches(const sas7bdat_numeric_layout_t *layout, sas7bdat_ctx_t *ctx) {
+    int i;
+
+    if (!layout->valid || layout->count == 0 || layout->col_info_count != ctx->col_info_count ||
+            layout->row_length != ctx->row_length)
+        return 0;
+
+    for (i=0; i<ctx->col_info_count; i++) {
+        col_info_t *col_info = &ctx->col_info[i];
+        int slot = layout->slots[i];
+        if ((col_info->type == READSTAT_TYPE_DOUBLE) != (slot != -1))
+            return 0;
+        if (slot != -1 && (col_info->index != i || col_info->offset != layout->offsets[slot] ||
+                    col_info->width != layout->widths[slot]))
+            return 0;
+    }
+    return 1;
+}
+
+/* Pages that hold nothing but (usually compressed) rows are decompressed
+ * into job->rows. Returns 0 for anything else. */
+static int sas7bdat_decode_subheader_rows(sas7bdat_page_job_t *job, sas7bdat_page_batch_t *batch) {
+    sas7bdat_ctx_t *ctx = batch->ctx;
+    const char *page = job->page;
+    size_t page_size = ctx->page_size;
+    uint32_t row_length = batch->row_length;
+
+    uint16_t subheader_count = sas_read2(&page[ctx->page_header_size-4], ctx->bswap);
+
+    int i;
+    const char *shp = &page[ctx->page_header_size];
+    int lshp = ctx->subheader_pointer_size;
+
+    if (ctx->page_header_size + subheader_count*lshp > page_size)
+        return 0;
+
+    for (i=0; i<subheader_count; i++) {
+        subheader_pointer_t shp_info = { 0 };
+        uint32_t signature = 0;
+        if (sas7bdat_parse_subheader_pointer(shp, page + page_size - shp, &shp_info, ctx) != READSTAT_OK)
+            return 0;
+        if (shp_info.len > 0 && shp_info.compression != SAS_COMPRESSION_TRUNC) {
+            if (sas7bdat_validate_subheader_pointer(&shp_info, page_size, subheader_count, ctx) != READSTAT_OK)
+                return 0;
+            if (shp_info.compression == SAS_COMPRESSION_NONE) {
+                signature = sas_read4(page + shp_info.offset, ctx->bswap);
+                if (!ctx->little_endian && signature == -1 && ctx->u64) {
+                    signature = sas_read4(page + shp_info.offset + 4, ctx->bswap);
+                }
+                if (shp_info.is_compressed_data && !sas7bdat_signature_is_recognized(signature)) {
+                    if (shp_info.len != row_length)
+                        return 0;
+                    if (!sas7bdat_page_job_add_row(job, row_length))
+                        return 0;
+                    memcpy(&job->rows[(job->row_count-1) * (size_t)row_length],
+                            page + shp_info.offset, row_length);
+                } else if (signature != SAS_SUBHEADER_SIGNATURE_COLUMN_TEXT) {
+                    return 0;
+                }
+            } else if (shp_info.compression == SAS_COMPRESSION_ROW) {
+                if (!sas7bdat_page_job_add_row(job, row_length))
+                    return 0;
+                if (sas7bdat_decompress_row(&job->rows[(job->row_count-1) * (size_t)row_length], row_length,
+                            page + shp_info.offset, shp_info.len, ctx) != row_length)
+                    return 0;
+            } else {
+                return 0;
             }
+        }
+
+        shp += lshp;
+    }
+
+    job->row_data = job->rows;
+    return 1;
+}
+
+/* The rows of a DATA page are used where they are */
+static int sas7bdat_find_data_rows(sas7bdat_page_job_t *job, sas7bdat_page_batch_t *batch) {
+    sas7bdat_ctx_t *ctx = batch->ctx;
+    uint16_t row_count = sas_read2(&job->page[ctx->page_header_size-6], ctx->bswap);
+
+    if (ctx->page_header_size + row_count * (uint64_t)batch->row_length > ctx->page_size)
+        return 0;
+
+    job->row_data = &job->page[ctx->page_header_size];
+    job->row_count = row_count;
+    job->data_page = 1;
+    return 1;
+}
+
+static void sas7bdat_decode_values(sas7bdat_page_job_t *job, sas7bdat_page_batch_t *batch) {
+    const sas7bdat_numeric_layout_t *layout = batch->layout;
+    int little_endian = batch->ctx->little_endian;
+    uint64_t *values = job->values;
+    uint32_t i;
+    int k;
+
+    if (!layout->valid || layout->count == 0 || layout->row_length != batch->row_length ||
+            job->row_count * (size_t)layout->count > job->values_capacity)
+        return;
+
+    for (i=0; i<job->row_count; i++) {
+        const char *row = &job->row_data[i * (size_t)batch->row_length];
+        for (k=0; k<layout->count; k++) {
+            *values++ = sas7bdat_read_double_bits(&row[layout->offsets[k]], layout->widths[k], little_endian);
+        }
+    }
+    job->has_values = 1;
+}
+
+/* Runs on a worker thread. The rows of DATA pages, and of pages that hold
+ * nothing but (usually compressed) rows, are found or decompressed, and
+ * their numeric cells are byte-swapped into job->values. Anything else is
+ * left for sas7bdat_parse_page_pass2 on the main thread, which also takes
+ * care of reporting any errors. Only fields of ctx that are fixed by the
+ * file header are read here. */
+static void sas7bdat_decode_page(void *item, void *user_ctx) {
+    sas7bdat_page_job_t *job = (sas7bdat_page_job_t *)item;
+    sas7bdat_page_batch_t *batch = (sas7bdat_page_batch_t *)user_ctx;
+    sas7bdat_ctx_t *ctx = batch->ctx;
+
+    uint16_t page_type = sas_read2(&job->page[ctx->page_header_size-8], ctx->bswap);
+
+    if (batch->row_length == 0)
+        return;
+
+    if ((page_type & SAS_PAGE_TYPE_MASK) == SAS_PAGE_TYPE_DATA) {
+        if (!sas7bdat_find_data_rows(job, batch))
+            return;
+    } else if ((page_type & SAS_PAGE_TYPE_MASK) == SAS_PAGE_TYPE_META && !(page_type & SAS_PAGE_TYPE_COMP)) {
+        if (!sas7bdat_decode_subheader_rows(job, batch))
+            return;
+    } else {
+        return;
+    }
+
+    sas7bdat_decode_values(job, batch);
+    job->decoded = 1;
+}
+
+static readstat_error_t sas7bdat_parse_page_job(sas7bdat_ctx_t *ctx, sas7bdat_page_job_t *job,
+        sas7bdat_page_batch_t *batch) {
+    readstat_error_t retval = READSTAT_OK;
+    uint64_t first_row = ctx->skipped_row_count + ctx->parsed_row_count;
+    uint32_t row_length = batch->row_length;
+    int use_values = 0;
+    int i;
+
+    ctx->page_has_metadata = 0;
+
+    /* A ROW_SIZE subheader on an earlier page of the file could have changed
+     * the row length after this page was decoded */
+    if (job->decoded && row_length == ctx->row_length) {
+        if (job->data_page) {
+            ctx->page_row_count = job->row_count;
+            if ((retval = sas7bdat_submit_columns_if_needed(ctx, 0)) != READSTAT_OK)
+                goto cleanup;
+        } else if (job->row_count && (retval = sas7bdat_submit_columns_if_needed(ctx, 1)) != READSTAT_OK) {
             goto cleanup;
         }
 
-        amd_page_count++;
+        use_values = (job->has_values && sas7bdat_numeric_layout_matches(batch->layout, ctx));
+        ctx->numeric_slots = use_values ? batch->layout->slots : NULL;
+
+        for (i=0; i<job->row_count && ctx->parsed_row_count < ctx->row_limit; i++) {
+            ctx->row_values = use_values ? &job->values[i * (size_t)batch->layout->count] : NULL;
+            if ((retval = sas7bdat_parse_single_row(&job->row_data[i * (size_t)row_length], ctx)) != READSTAT_OK)
+                goto cleanup;
+        }
+    } else if ((retval = sas7bdat_parse_page_pass2(job->page, ctx->page_size, ctx)) != READSTAT_OK) {
+        sas7bdat_report_page_error(ctx, job->page_index, retval);
+        goto cleanup;
+    }
+
+    if (ctx->parsed_row_count != ctx->row_limit)
+        retval = sas7bdat_index_page(ctx, job->page_index, first_row);
+
+cleanup:
+    ctx->row_values = NULL;
+    ctx->numeric_slots = NULL;
+    return retval;
+}
+
+/* Once row_offset has been used up, pages are read in batches and handed to
+ * worker threads for decoding, while the main thread reads the next batch
+ * and delivers the rows of the previous one. Both batches share one set of
+ * threads: starting a batch first waits for the one before it, so at most
+ * thread_count threads are ever decoding. The jobs, their buffers and the
+ * threads are reused from batch to batch. A job's buffers are sized before
+ * its page is decoded, with room for twice as many rows as the fullest page
+ * so far, so they seldom have to grow again. */
+static readstat_error_t sas7bdat_parse_pages_pass2_parallel(sas7bdat_ctx_t *ctx, int64_t first_page) {
+    readstat_error_t retval = READSTAT_OK;
+    readstat_error_t read_retval = READSTAT_OK;
+    readstat_io_t *io = ctx->io;
+    readstat_parallel_t parallel = { 0 };
+    sas7bdat_numeric_layout_t layout;
+    sas7bdat_page_batch_t batches[2];
+    int batch_capacity = ctx->thread_count * SAS7BDAT_PAGES_PER_THREAD;
+    size_t rows_capacity = 0, values_capacity = 0;
+    int current = 0;
+    int64_t i = first_page;
+    int j, k;
+
+    memset(batches, 0, sizeof(batches));
+
+    if ((retval = sas7bdat_numeric_layout_init(&layout, ctx)) != READSTAT_OK)
+        goto cleanup;
+
+    for (k=0; k<2; k++) {
+        batches[k].ctx = ctx;
+        batches[k].layout = &layout;
+        if ((batches[k].jobs = readstat_calloc(batch_capacity, sizeof(sas7bdat_page_job_t))) == NULL ||
+                (batches[k].pages = readstat_malloc(batch_capacity * ctx->page_size)) == NULL) {
+            retval = READSTAT_ERROR_MALLOC;
+            goto cleanup;
+        }
+    }
+
+    if (io->seek(ctx->header_size + first_page*ctx->page_size, READSTAT_SEEK_SET, io->io_ctx) == -1) {
+        retval = READSTAT_ERROR_SEEK;
+        goto cleanup;
+    }
+
+    while (1) {
+        sas7bdat_page_batch_t *batch = &batches[current];
+        sas7bdat_page_batch_t *previous = &batches[1-current];
+
+        batch->row_length = ctx->row_length;
+        batch->jobs_count = 0;
+        while (batch->jobs_count < batch_capacity && i < ctx->page_count && read_retval == READSTAT_OK) {
+            sas7bdat_page_job_t *job = &batch->jobs[batch->jobs_count];
+            char *page = &batch->pages[batch->jobs_count * ctx->page_size];
+            size_t rows_bound = 0, rows_len = 0, values_len = 0;
+            int copied = 0;
+
+            if ((retval = sas7bdat_update_progress(ctx)) != READSTAT_OK)
+                goto cleanup;
+
+            job->page = NULL;
+            if (io->borrow)
+                job->page = io->borrow(ctx->page_size, io->io_ctx);
+            if (job->page == NULL) {
+                if (io->read(page, ctx->page_size, io->io_ctx) < ctx->page_size) {
+                    read_retval = READSTAT_ERROR_READ;
+                    break;
+                }
+                job->page = page;
+            }
+            job->page_index = i++;
+            job->decoded = 0;
+            job->data_page = 0;
+            job->has_values = 0;
+            job->row_count = 0;
+            batch->jobs_count++;
+
+            rows_bound = sas7bdat_page_rows_bound(ctx, job->page, &copied);
+            if (copied) {
+                rows_len = rows_bound * batch->row_length;
+                if (rows_len > rows_capacity)
+                    rows_capacity = 2 * rows_len;
+                if (rows_len > job->rows_capacity && !sas7bdat_page_job_reserve(job, rows_capacity)) {
+                    retval = READSTAT_ERROR_MALLOC;
+                    goto cleanup;
+                }
+            }
+            if (layout.valid) {
+                values_len = rows_bound * layout.count;
+                if (values_len > values_capacity)
+                    values_capacity = 2 * values_len;
+                if (values_len > job->values_capacity && !sas7bdat_page_job_reserve_values(job, values_capacity)) {
+                    retval = READSTAT_ERROR_MALLOC;
+                    goto cleanup;
+                }
+            }
+        }
+
+        /* Starting this batch waits for the previous one; otherwise wait
+         * for it here */
+        if (batch->jobs_count) {
+            if ((retval = readstat_parallel_start(&parallel, ctx->thread_count,
+                            &sas7bdat_decode_page, batch, batch->jobs, sizeof(sas7bdat_page_job_t),
+                            batch->jobs_count)) != READSTAT_OK)
+                goto cleanup;
+            batch->pending = 1;
+        } else {
+            readstat_parallel_wait(&parallel);
+        }
+
+        if (previous->pending) {
+            previous->pending = 0;
+
+            for (j=0; j<previous->jobs_count; j++) {
+                if ((retval = sas7bdat_parse_page_job(ctx, &previous->jobs[j], previous)) != READSTAT_OK)
+                    goto cleanup;
+                if (ctx->parsed_row_count == ctx->row_limit)
+                    goto cleanup;
+            }
+        }
+
+        if (batch->jobs_count == 0)
+            break;
+
+        current = 1 - current;
     }
 
+    retval = read_retval;
+
 cleanup:
+    readstat_parallel_free(&parallel);
+    for (k=0; k<2; k++) {
+        if (batches[k].jobs) {
+            for (j=0; j<batch_capacity; j++) {
+                free(batches[k].jobs[j].rows);
+                free(batches[k].jobs[j].values);
+            }
+            free(batches[k].jobs);
+        }
+        free(batches[k].pages);
+    }
+    sas7bdat_numeric_layout_free(&layout);
 
     return retval;
 }
@@ -1015,27 +1825,68 @@ static readstat_error_t sas7bdat_parse_all_pages_pass2(sas7bdat_ctx_t *ctx) {
     readstat_io_t *io = ctx->io;
     int64_t i;
 
+    int needs_seek = 0;
+
     for (i=0; i<ctx->page_count; i++) {
+        readstat_row_index_entry_t *entry = readstat_row_index_get_entry(ctx->row_index, i);
+        uint64_t first_row = ctx->skipped_row_count + ctx->parsed_row_count;
+        const char *page = NULL;
+        int skipped = 0;
+        /* Without a value handler, only the column metadata and the row
+         * count are wanted, and the pages that pass 1 kept all precede the
+         * first row. If pass 1 stopped on a DATA page just past them, the
+         * metadata is complete and that page needn't be read at all. */
+        if (ctx->metadata_only && i == ctx->pass1_pages_count && i == ctx->pass1_data_page) {
+            retval = sas7bdat_submit_columns_if_needed(ctx, 0);
+            goto cleanup;
+        }
+        if (ctx->thread_count > 1 && !ctx->metadata_only && ctx->row_offset == 0 &&
+                i >= ctx->pass1_pages_count) {
+            retval = sas7bdat_parse_pages_pass2_parallel(ctx, i);
+            goto cleanup;
+        }
         if ((retval = sas7bdat_update_progress(ctx)) != READSTAT_OK) {
             goto cleanup;
         }
-        if (io->read(ctx->page, ctx->page_size, io->io_ctx) < ctx->page_size) {
-            retval = READSTAT_ERROR_READ;
+        /* Pages holding only rows that precede row_offset are never read */
+        if (entry && ctx->row_offset && entry->row_count <= ctx->row_offset &&
+                !(entry->flags & READSTAT_ROW_INDEX_HAS_METADATA)) {
+            ctx->row_offset -= entry->row_count;
+            ctx->skipped_row_count += entry->row_count;
+            needs_seek = 1;
+            continue;
+        }
+        if (needs_seek && i >= ctx->pass1_pages_count) {
+            if (io->seek(ctx->header_size + i*ctx->page_size, READSTAT_SEEK_SET, io->io_ctx) == -1) {
+                retval = READSTAT_ERROR_SEEK;
+                goto cleanup;
+            }
+            needs_seek = 0;
+        }
+        ctx->page_has_metadata = 0;
+        if (i < ctx->pass1_pages_count) {
+            page = ctx->pass1_pages[i].data;
+        } else if ((retval = sas7bdat_read_page_or_skip_rows(ctx, &page, &skipped)) != READSTAT_OK) {
             goto cleanup;
         }
+        if (skipped) {
+            if ((retval = sas7bdat_index_page(ctx, i, first_row)) != READSTAT_OK)
+                goto cleanup;
+            continue;
+        }
 
-        if ((retval = sas7bdat_parse_page_pass2(ctx->page, ctx->page_size, ctx)) != READSTAT_OK) {
-            if (ctx->handle.error && retval != READSTAT_ERROR_USER_ABORT) {
-                int64_t pos = io->seek(0, READSTAT_SEEK_CUR, io->io_ctx);
-                snprintf(ctx->error_buf, sizeof(ctx->error_buf), 
-                        "ReadStat: Error parsing page %" PRId64 ", bytes %" PRId64 "-%" PRId64, 
-                        i, pos - ctx->page_size, pos-1);
-                ctx->handle.error(ctx->error_buf, ctx->user_ctx);
-            }
+        if ((retval = sas7bdat_parse_page_pass2(page, ctx->page_size, ctx)) != READSTAT_OK) {
+            sas7bdat_report_page_error(ctx, i, retval);
             goto cleanup;
         }
         if (ctx->parsed_row_count == ctx->row_limit)
             break;
+        /* The columns are submitted at the first row, and nothing past
+         * that point changes what the handlers have been told */
+        if (ctx->metadata_only && ctx->did_submit_columns)
+            break;
+        if ((retval = sas7bdat_index_page(ctx, i, first_row)) != READSTAT_OK)
+            goto cleanup;
     }
 cleanup:
 
@@ -1056,9 +1907,26 @@ readstat_error_t readstat_parse_sas7bdat(readstat_parser_t *parser, const char *
     ctx->user_ctx = user_ctx;
     ctx->io = parser->io;
     ctx->row_limit = parser->row_limit;
+    ctx->thread_count = parser->thread_count;
+    ctx->projection = parser->projection;
+    ctx->pass1_data_page = -1;
     if (parser->row_offset > 0)
         ctx->row_offset = parser->row_offset;
 
+    if (parser->handlers.batch && (ctx->batch = readstat_batch_init(parser, user_ctx)) == NULL) {
+        retval = READSTAT_ERROR_MALLOC;
+        goto cleanup;
+    }
+
+    /* Without a value or batch handler, parsing stops at the first DATA page,
+     * and indexing that little of the file would throw away a complete index
+     * the caller already had */
+    if (ctx->handle.value || ctx->batch) {
+        ctx->row_index = parser->row_index;
+    } else {
+        ctx->metadata_only = 1;
+    }
+
     if (io->open(path, io->io_ctx) == -1) {
         retval = READSTAT_ERROR_OPEN;
         goto cleanup;
@@ -1102,18 +1970,22 @@ readstat_error_t readstat_parse_sas7bdat(readstat_parser_t *parser, const char *
     if (ctx->input_encoding == NULL) {
         ctx->input_encoding = hinfo->encoding;
     }
+    if (ctx->row_index) {
+        uint64_t fingerprint = 0;
+        if ((retval = sas7bdat_fingerprint_header(ctx, &fingerprint)) != READSTAT_OK)
+            goto cleanup;
+        readstat_row_index_reset(ctx->row_index, ctx->file_size, ctx->page_size, fingerprint);
+    }
     if ((ctx->page = readstat_malloc(ctx->page_size)) == NULL) {
         retval = READSTAT_ERROR_MALLOC;
         goto cleanup;
     }
 
     if (ctx->input_encoding && ctx->output_encoding && strcmp(ctx->input_encoding, ctx->output_encoding) != 0) {
-        iconv_t converter = iconv_open(ctx->output_encoding, ctx->input_encoding);
-        if (converter == (iconv_t)-1) {
+        if ((ctx->converter = readstat_converter_init(ctx->output_encoding, ctx->input_encoding)) == NULL) {
             retval = READSTAT_ERROR_UNSUPPORTED_CHARSET;
             goto cleanup;
         }
-        ctx->converter = converter;
     }
 
     if ((retval = readstat_convert(ctx->file_label, sizeof(ctx->file_label),
@@ -1129,11 +2001,13 @@ readstat_error_t readstat_parse_sas7bdat(readstat_parser_t *parser, const char *
         goto cleanup;
     }
 
-    if (io->seek(ctx->header_size, READSTAT_SEEK_SET, io->io_ctx) == -1) {
+    /* Pass 2 picks up reading where the pages kept from pass 1 leave off */
+    int64_t pass2_start = ctx->header_size + ctx->pass1_pages_count * ctx->page_size;
+    if (io->seek(pass2_start, READSTAT_SEEK_SET, io->io_ctx) == -1) {
         retval = READSTAT_ERROR_SEEK;
         if (ctx->handle.error) {
             snprintf(ctx->error_buf, sizeof(ctx->error_buf), "ReadStat: Failed to seek to position %" PRId64, 
-                    ctx->header_size);
+                    pass2_start);
             ctx->handle.error(ctx->error_buf, ctx->user_ctx);
         }
         goto cleanup;
@@ -1147,7 +2021,11 @@ readstat_error_t readstat_parse_sas7bdat(readstat_parser_t *parser, const char *
         goto cleanup;
     }
 
-    if (ctx->handle.value && ctx->parsed_row_count != ctx->row_limit) {
+    if ((retval = readstat_batch_flush(ctx->batch)) != READSTAT_OK) {
+        goto cleanup;
+    }
+
+    if ((ctx->handle.value || ctx->batch) && ctx->parsed_row_count != ctx->row_limit) {
         retval = READSTAT_ERROR_ROW_COUNT_MISMATCH;
         if (ctx->handle.error) {
             snprintf(ctx->error_buf, sizeof(ctx->error_buf), "ReadStat: Expected %d rows in file, found %d",
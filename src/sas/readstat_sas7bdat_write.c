@@ -8,6 +8,7 @@
 #include "../readstat_writer.h"
 #include "readstat_sas.h"
 #include "readstat_sas_rle.h"
+#include "readstat_sas_rdc.h"
 
 typedef struct sas7bdat_subheader_s {
     uint32_t    signature;
@@ -38,6 +39,21 @@ typedef struct sas7bdat_column_text_array_s {
 typedef struct sas7bdat_write_ctx_s {
     sas_header_info_t       *hinfo;
     sas7bdat_subheader_array_t   *sarray;
+
+    /* The page currently being filled with subheaders */
+    char                    *page;
+    int16_t                  page_shp_count;
+    size_t                   page_shp_ptr_offset;
+    size_t                   page_shp_data_offset;
+    int64_t                  pages_written;
+
+    /* Full pages that can't be written until the header is */
+    int                      hold_pages;
+    char                   **held_pages;
+    int64_t                  held_pages_count;
+    int64_t                  held_pages_capacity;
+
+    char                    *row_buffer;
 } sas7bdat_write_ctx_t;
 
 static size_t sas7bdat_variable_width(readstat_type_t type, size_t user_width);
@@ -78,7 +94,7 @@ static int32_t sas7bdat_rows_per_page(readstat_writer_t *writer, sas_header_info
 }
 
 static int32_t sas7bdat_count_data_pages(readstat_writer_t *writer, sas_header_info_t *hinfo) {
-    if (writer->compression == READSTAT_COMPRESS_ROWS)
+    if (writer->compression != READSTAT_COMPRESS_NONE)
         return 0;
 
     int32_t rows_per_page = sas7bdat_rows_per_page(writer, hinfo);
@@ -320,7 +336,12 @@ static sas7bdat_subheader_t *sas7bdat_col_text_subheader_init(readstat_writer_t
 
     uint16_t used = sas_subheader_remainder(len, signature_len);
     memcpy(&subheader->data[signature_len], &used, sizeof(uint16_t));
-    memset(&subheader->data[signature_len+12], ' ', 8);
+    if (column_text->index == 0 && writer->compression == READSTAT_COMPRESS_BINARY) {
+        memcpy(&subheader->data[signature_len+12], SAS_COMPRESSION_SIGNATURE_RDC,
+                sizeof(SAS_COMPRESSION_SIGNATURE_RDC)-1);
+    } else {
+        memset(&subheader->data[signature_len+12], ' ', 8);
+    }
     memcpy(&subheader->data[signature_len+28], column_text->data, column_text->used);
     return subheader;
 }
@@ -373,12 +394,6 @@ static sas7bdat_subheader_array_t *sas7bdat_subheader_array_init(readstat_writer
 
     sarray->capacity = sarray->count;
 
-    if (writer->compression == READSTAT_COMPRESS_ROWS) {
-        sarray->capacity = (sarray->count + writer->row_count);
-        sarray->subheaders = realloc(sarray->subheaders, 
-                sarray->capacity * sizeof(sas7bdat_subheader_t *));
-    }
-
     return sarray;
 }
 
@@ -406,101 +421,167 @@ static int sas7bdat_subheader_type(uint32_t signature) {
             signature == SAS_SUBHEADER_SIGNATURE_COLUMN_LIST);
 }
 
-static readstat_error_t sas7bdat_emit_meta_pages(readstat_writer_t *writer) {
-    sas7bdat_write_ctx_t *ctx = (sas7bdat_write_ctx_t *)writer->module_ctx;
+static void sas7bdat_page_reset(sas7bdat_write_ctx_t *ctx) {
     sas_header_info_t *hinfo = ctx->hinfo;
-    sas7bdat_subheader_array_t *sarray = ctx->sarray;
-    readstat_error_t retval = READSTAT_OK;
     int16_t page_type = SAS_PAGE_TYPE_META;
-    char *page = malloc(hinfo->page_size);
-    int64_t shp_written = 0;
 
-    while (sarray->count > shp_written) {
-        memset(page, 0, hinfo->page_size);
-        int16_t shp_count = 0;
-        size_t shp_data_offset = hinfo->page_size;
-        size_t shp_ptr_offset = hinfo->page_header_size;
-        size_t shp_ptr_size = hinfo->subheader_pointer_size;
+    memset(ctx->page, 0, hinfo->page_size);
+    memcpy(&ctx->page[hinfo->page_header_size-8], &page_type, sizeof(int16_t));
+
+    ctx->page_shp_count = 0;
+    ctx->page_shp_ptr_offset = hinfo->page_header_size;
+    ctx->page_shp_data_offset = hinfo->page_size;
+}
+
+static readstat_error_t sas7bdat_hold_page(sas7bdat_write_ctx_t *ctx) {
+    char *page = NULL;
+
+    if (ctx->held_pages_count == ctx->held_pages_capacity) {
+        int64_t capacity = ctx->held_pages_capacity ? 2 * ctx->held_pages_capacity : 64;
+        char **held_pages = realloc(ctx->held_pages, capacity * sizeof(char *));
+        if (held_pages == NULL)
+            return READSTAT_ERROR_MALLOC;
+
+        ctx->held_pages = held_pages;
+        ctx->held_pages_capacity = capacity;
+    }
+
+    if ((page = malloc(ctx->hinfo->page_size)) == NULL)
+        return READSTAT_ERROR_MALLOC;
+
+    ctx->held_pages[ctx->held_pages_count++] = ctx->page;
+    ctx->page = page;
+
+    return READSTAT_OK;
+}
+
+static readstat_error_t sas7bdat_flush_page(readstat_writer_t *writer, sas7bdat_write_ctx_t *ctx) {
+    sas_header_info_t *hinfo = ctx->hinfo;
+    readstat_error_t retval = READSTAT_OK;
+
+    if (ctx->page_shp_count == 0)
+        goto cleanup;
+
+    if (hinfo->u64) {
+        memcpy(&ctx->page[34], &ctx->page_shp_count, sizeof(int16_t));
+        memcpy(&ctx->page[36], &ctx->page_shp_count, sizeof(int16_t));
+    } else {
+        memcpy(&ctx->page[18], &ctx->page_shp_count, sizeof(int16_t));
+        memcpy(&ctx->page[20], &ctx->page_shp_count, sizeof(int16_t));
+    }
+
+    if (ctx->hold_pages) {
+        retval = sas7bdat_hold_page(ctx);
+    } else {
+        retval = readstat_write_bytes(writer, ctx->page, hinfo->page_size);
+    }
+    if (retval != READSTAT_OK)
+        goto cleanup;
+
+    ctx->pages_written++;
+    sas7bdat_page_reset(ctx);
 
-        memcpy(&page[hinfo->page_header_size-8], &page_type, sizeof(int16_t));
+cleanup:
+    return retval;
+}
+
+/* Append a subheader to the current page, first flushing the page if the
+ * subheader won't fit */
+static readstat_error_t sas7bdat_emit_subheader(readstat_writer_t *writer, sas7bdat_write_ctx_t *ctx,
+        sas7bdat_subheader_t *subheader) {
+    sas_header_info_t *hinfo = ctx->hinfo;
+    readstat_error_t retval = READSTAT_OK;
+    size_t shp_ptr_size = hinfo->subheader_pointer_size;
+    size_t shp_ptr_offset = 0;
+    char *page = NULL;
+    uint32_t signature32 = subheader->signature;
 
-        if (sarray->subheaders[shp_written]->len + shp_ptr_size >
-                shp_data_offset - shp_ptr_offset) {
+    if (subheader->len + shp_ptr_size > ctx->page_shp_data_offset - ctx->page_shp_ptr_offset) {
+        if (ctx->page_shp_count == 0) {
             retval = READSTAT_ERROR_ROW_IS_TOO_WIDE_FOR_PAGE;
             goto cleanup;
         }
+        if ((retval = sas7bdat_flush_page(writer, ctx)) != READSTAT_OK)
+            goto cleanup;
 
-        while (sarray->count > shp_written && 
-                sarray->subheaders[shp_written]->len + shp_ptr_size <=
-                shp_data_offset - shp_ptr_offset) {
-            sas7bdat_subheader_t *subheader = sarray->subheaders[shp_written];
-            uint32_t signature32 = subheader->signature;
-
-            /* copy ptr */
-            if (hinfo->u64) {
-                uint64_t offset = shp_data_offset - subheader->len;
-                uint64_t len = subheader->len;
-                memcpy(&page[shp_ptr_offset], &offset, sizeof(uint64_t));
-                memcpy(&page[shp_ptr_offset+8], &len, sizeof(uint64_t));
-                if (subheader->is_row_data) {
-                    if (subheader->is_row_data_compressed) {
-                        page[shp_ptr_offset+16] = SAS_COMPRESSION_ROW;
-                    } else {
-                        page[shp_ptr_offset+16] = SAS_COMPRESSION_NONE;
-                    }
-                    page[shp_ptr_offset+17] = 1;
-                } else {
-                    page[shp_ptr_offset+17] = sas7bdat_subheader_type(subheader->signature);
-                    if (signature32 >= 0xFF000000) {
-                        int64_t signature64 = (int32_t)signature32;
-                        memcpy(&subheader->data[0], &signature64, sizeof(int64_t));
-                    } else {
-                        memcpy(&subheader->data[0], &signature32, sizeof(int32_t));
-                    }
-                }
-            } else {
-                uint32_t offset = shp_data_offset - subheader->len;
-                uint32_t len = subheader->len;
-                memcpy(&page[shp_ptr_offset], &offset, sizeof(uint32_t));
-                memcpy(&page[shp_ptr_offset+4], &len, sizeof(uint32_t));
-                if (subheader->is_row_data) {
-                    if (subheader->is_row_data_compressed) {
-                        page[shp_ptr_offset+8] = SAS_COMPRESSION_ROW;
-                    } else {
-                        page[shp_ptr_offset+8] = SAS_COMPRESSION_NONE;
-                    }
-                    page[shp_ptr_offset+9] = 1;
-                } else {
-                    page[shp_ptr_offset+9] = sas7bdat_subheader_type(subheader->signature);
-                    memcpy(&subheader->data[0], &signature32, sizeof(int32_t));
-                }
-            }
-            shp_ptr_offset += shp_ptr_size;
+        if (subheader->len + shp_ptr_size > ctx->page_shp_data_offset - ctx->page_shp_ptr_offset) {
+            retval = READSTAT_ERROR_ROW_IS_TOO_WIDE_FOR_PAGE;
+            goto cleanup;
+        }
+    }
 
-            /* copy data */
-            shp_data_offset -= subheader->len;
-            memcpy(&page[shp_data_offset], subheader->data, subheader->len);
+    page = ctx->page;
+    shp_ptr_offset = ctx->page_shp_ptr_offset;
 
-            shp_written++;
-            shp_count++;
+    /* copy ptr */
+    if (hinfo->u64) {
+        uint64_t offset = ctx->page_shp_data_offset - subheader->len;
+        uint64_t len = subheader->len;
+        memcpy(&page[shp_ptr_offset], &offset, sizeof(uint64_t));
+        memcpy(&page[shp_ptr_offset+8], &len, sizeof(uint64_t));
+        if (subheader->is_row_data) {
+            if (subheader->is_row_data_compressed) {
+                page[shp_ptr_offset+16] = SAS_COMPRESSION_ROW;
+            } else {
+                page[shp_ptr_offset+16] = SAS_COMPRESSION_NONE;
+            }
+            page[shp_ptr_offset+17] = 1;
+        } else {
+            page[shp_ptr_offset+17] = sas7bdat_subheader_type(subheader->signature);
+            if (signature32 >= 0xFF000000) {
+                int64_t signature64 = (int32_t)signature32;
+                memcpy(&subheader->data[0], &signature64, sizeof(int64_t));
+            } else {
+                memcpy(&subheader->data[0], &signature32, sizeof(int32_t));
+            }
         }
-
-        if (hinfo->u64) {
-            memcpy(&page[34], &shp_count, sizeof(int16_t));
-            memcpy(&page[36], &shp_count, sizeof(int16_t));
+    } else {
+        uint32_t offset = ctx->page_shp_data_offset - subheader->len;
+        uint32_t len = subheader->len;
+        memcpy(&page[shp_ptr_offset], &offset, sizeof(uint32_t));
+        memcpy(&page[shp_ptr_offset+4], &len, sizeof(uint32_t));
+        if (subheader->is_row_data) {
+            if (subheader->is_row_data_compressed) {
+                page[shp_ptr_offset+8] = SAS_COMPRESSION_ROW;
+            } else {
+                page[shp_ptr_offset+8] = SAS_COMPRESSION_NONE;
+            }
+            page[shp_ptr_offset+9] = 1;
         } else {
-            memcpy(&page[18], &shp_count, sizeof(int16_t));
-            memcpy(&page[20], &shp_count, sizeof(int16_t));
+            page[shp_ptr_offset+9] = sas7bdat_subheader_type(subheader->signature);
+            memcpy(&subheader->data[0], &signature32, sizeof(int32_t));
         }
+    }
+    ctx->page_shp_ptr_offset += shp_ptr_size;
+
+    /* copy data */
+    ctx->page_shp_data_offset -= subheader->len;
+    memcpy(&page[ctx->page_shp_data_offset], subheader->data, subheader->len);
+
+    ctx->page_shp_count++;
+
+cleanup:
+    return retval;
+}
+
+static readstat_error_t sas7bdat_emit_meta_pages(readstat_writer_t *writer) {
+    sas7bdat_write_ctx_t *ctx = (sas7bdat_write_ctx_t *)writer->module_ctx;
+    sas7bdat_subheader_array_t *sarray = ctx->sarray;
+    readstat_error_t retval = READSTAT_OK;
+    int64_t i;
 
-        retval = readstat_write_bytes(writer, page, hinfo->page_size);
+    for (i=0; i<sarray->count; i++) {
+        retval = sas7bdat_emit_subheader(writer, ctx, sarray->subheaders[i]);
         if (retval != READSTAT_OK)
             goto cleanup;
     }
 
-cleanup:
-    free(page);
+    /* Compressed rows are packed in after the metadata, starting on the
+     * same page */
+    if (writer->compression == READSTAT_COMPRESS_NONE)
+        retval = sas7bdat_flush_page(writer, ctx);
 
+cleanup:
     return retval;
 }
 
@@ -510,7 +591,7 @@ static int sas7bdat_page_is_too_small(readstat_writer_t *writer, sas_header_info
     if (writer->compression == READSTAT_COMPRESS_NONE && page_length < row_length)
         return 1;
 
-    if (writer->compression == READSTAT_COMPRESS_ROWS && page_length < row_length + hinfo->subheader_pointer_size)
+    if (writer->compression != READSTAT_COMPRESS_NONE && page_length < row_length + hinfo->subheader_pointer_size)
         return 1;
 
     if (page_length < sas7bdat_col_name_subheader_length(writer, hinfo) + hinfo->subheader_pointer_size)
@@ -536,39 +617,42 @@ static sas7bdat_write_ctx_t *sas7bdat_write_ctx_init(readstat_writer_t *writer)
     ctx->hinfo = hinfo;
     ctx->sarray = sas7bdat_subheader_array_init(writer, hinfo);
 
+    ctx->page = malloc(hinfo->page_size);
+    sas7bdat_page_reset(ctx);
+
+    if (writer->compression != READSTAT_COMPRESS_NONE)
+        ctx->row_buffer = malloc(row_length);
+
     return ctx;
 }
 
 static void sas7bdat_write_ctx_free(sas7bdat_write_ctx_t *ctx) {
+    int64_t i;
+    for (i=0; i<ctx->held_pages_count; i++) {
+        free(ctx->held_pages[i]);
+    }
+    free(ctx->held_pages);
+    free(ctx->page);
+    free(ctx->row_buffer);
     free(ctx->hinfo);
     sas7bdat_subheader_array_free(ctx->sarray);
     free(ctx);
 }
 
-static readstat_error_t sas7bdat_emit_header_and_meta_pages(readstat_writer_t *writer) {
+static readstat_error_t sas7bdat_emit_header_and_held_pages(readstat_writer_t *writer) {
     sas7bdat_write_ctx_t *ctx = (sas7bdat_write_ctx_t *)writer->module_ctx;
     readstat_error_t retval = READSTAT_OK;
-
-    if (sas7bdat_row_length(writer) == 0) {
-        retval = READSTAT_ERROR_TOO_FEW_COLUMNS;
-        goto cleanup;
-    }
-
-    if (writer->compression == READSTAT_COMPRESS_NONE &&
-            sas7bdat_rows_per_page(writer, ctx->hinfo) == 0) {
-        retval = READSTAT_ERROR_ROW_IS_TOO_WIDE_FOR_PAGE;
-        goto cleanup;
-    }
-
-    ctx->hinfo->page_count = sas7bdat_count_meta_pages(writer) + sas7bdat_count_data_pages(writer, ctx->hinfo);
+    int64_t i;
 
     retval = sas7bdat_emit_header(writer, ctx->hinfo);
     if (retval != READSTAT_OK)
         goto cleanup;
 
-    retval = sas7bdat_emit_meta_pages(writer);
-    if (retval != READSTAT_OK)
-        goto cleanup;
+    for (i=0; i<ctx->held_pages_count; i++) {
+        retval = readstat_write_bytes(writer, ctx->held_pages[i], ctx->hinfo->page_size);
+        if (retval != READSTAT_OK)
+            goto cleanup;
+    }
 
 cleanup:
     return retval;
@@ -577,15 +661,39 @@ cleanup:
 static readstat_error_t sas7bdat_begin_data(void *writer_ctx) {
     readstat_writer_t *writer = (readstat_writer_t *)writer_ctx;
     readstat_error_t retval = READSTAT_OK;
+    sas7bdat_write_ctx_t *ctx = NULL;
+
+    if (sas7bdat_row_length(writer) == 0) {
+        retval = READSTAT_ERROR_TOO_FEW_COLUMNS;
+        goto cleanup;
+    }
 
-    writer->module_ctx = sas7bdat_write_ctx_init(writer);
+    writer->module_ctx = ctx = sas7bdat_write_ctx_init(writer);
 
-    if (writer->compression == READSTAT_COMPRESS_NONE) {
-        retval = sas7bdat_emit_header_and_meta_pages(writer);
+    if (writer->compression == READSTAT_COMPRESS_NONE &&
+            sas7bdat_rows_per_page(writer, ctx->hinfo) == 0) {
+        retval = READSTAT_ERROR_ROW_IS_TOO_WIDE_FOR_PAGE;
+        goto cleanup;
+    }
+
+    /* The header requires a page count, which isn't known for compressed
+     * files until all the rows are in. If the output is seekable, write the
+     * header now and patch the count at the end; otherwise hold on to the
+     * pages and write the whole file at the end. */
+    if (writer->compression != READSTAT_COMPRESS_NONE && !writer->data_seeker) {
+        ctx->hold_pages = 1;
+    } else {
+        ctx->hinfo->page_count = sas7bdat_count_meta_pages(writer) + sas7bdat_count_data_pages(writer, ctx->hinfo);
+
+        retval = sas7bdat_emit_header(writer, ctx->hinfo);
         if (retval != READSTAT_OK)
             goto cleanup;
     }
 
+    retval = sas7bdat_emit_meta_pages(writer);
+    if (retval != READSTAT_OK)
+        goto cleanup;
+
 cleanup:
     if (retval != READSTAT_OK) {
         if (writer->module_ctx) {
@@ -602,12 +710,23 @@ static readstat_error_t sas7bdat_end_data(void *writer_ctx) {
     readstat_writer_t *writer = (readstat_writer_t *)writer_ctx;
     sas7bdat_write_ctx_t *ctx = (sas7bdat_write_ctx_t *)writer->module_ctx;
 
-    if (writer->compression == READSTAT_COMPRESS_ROWS) {
-        retval = sas7bdat_emit_header_and_meta_pages(writer);
+    if (writer->compression != READSTAT_COMPRESS_NONE) {
+        retval = sas7bdat_flush_page(writer, ctx);
+        if (retval != READSTAT_OK)
+            goto cleanup;
+
+        ctx->hinfo->page_count = ctx->pages_written;
+
+        if (ctx->hold_pages) {
+            retval = sas7bdat_emit_header_and_held_pages(writer);
+        } else {
+            retval = sas_write_page_count(writer, ctx->hinfo);
+        }
     } else {
         retval = sas_fill_page(writer, ctx->hinfo);
     }
 
+cleanup:
     return retval;
 }
 
@@ -636,6 +755,38 @@ static readstat_error_t sas7bdat_write_int8(void *row, const readstat_variable_t
     return sas7bdat_write_double(row, var, value);
 }
 
+static readstat_error_t sas7bdat_write_doubles(void *row, size_t row_len, const readstat_variable_t *var,
+        const double *values, int count) {
+    unsigned char *cell = (unsigned char *)row;
+    int i;
+    for (i=0; i<count; i++, cell += row_len) {
+        memcpy(cell, &values[i], sizeof(double));
+    }
+    return READSTAT_OK;
+}
+
+static readstat_error_t sas7bdat_write_floats(void *row, size_t row_len, const readstat_variable_t *var,
+        const double *values, int count) {
+    unsigned char *cell = (unsigned char *)row;
+    int i;
+    for (i=0; i<count; i++, cell += row_len) {
+        double value = (float)values[i];
+        memcpy(cell, &value, sizeof(double));
+    }
+    return READSTAT_OK;
+}
+
+static readstat_error_t sas7bdat_write_int32s(void *row, size_t row_len, const readstat_variable_t *var,
+        const int32_t *values, int count) {
+    unsigned char *cell = (unsigned char *)row;
+    int i;
+    for (i=0; i<count; i++, cell += row_len) {
+        double value = values[i];
+        memcpy(cell, &value, sizeof(double));
+    }
+    return READSTAT_OK;
+}
+
 static readstat_error_t sas7bdat_write_missing_tagged_raw(void *row, const readstat_variable_t *var, char tag) {
     union {
         double dval;
@@ -714,41 +865,51 @@ cleanup:
     return retval;
 }
 
-/* We don't actually write compressed data out at this point; the file header
- * requires a page count, so instead we collect the compressed subheaders in
- * memory and write the entire file at the end, once the page count can be
- * determined.
- */
 static readstat_error_t sas7bdat_write_row_compressed(readstat_writer_t *writer, sas7bdat_write_ctx_t *ctx,
         void *bytes, size_t len) {
     readstat_error_t retval = READSTAT_OK;
     size_t compressed_len = sas_rle_compressed_len(bytes, len);
+    sas7bdat_subheader_t subheader = { .is_row_data = 1 };
 
-    sas7bdat_subheader_t *subheader = NULL;
     if (compressed_len < len) {
-        subheader = sas7bdat_subheader_init(0, compressed_len);
-        subheader->is_row_data = 1;
-        subheader->is_row_data_compressed = 1;
-        size_t actual_len = sas_rle_compress(subheader->data, subheader->len, bytes, len);
+        subheader.data = ctx->row_buffer;
+        subheader.len = compressed_len;
+        subheader.is_row_data_compressed = 1;
+        size_t actual_len = sas_rle_compress(subheader.data, subheader.len, bytes, len);
         if (actual_len != compressed_len) {
             retval = READSTAT_ERROR_ROW_WIDTH_MISMATCH;
             goto cleanup;
         }
     } else {
-        subheader = sas7bdat_subheader_init(0, len);
-        subheader->is_row_data = 1;
-        memcpy(subheader->data, bytes, len);
+        subheader.data = bytes;
+        subheader.len = len;
     }
 
-    ctx->sarray->subheaders[ctx->sarray->count++] = subheader;
+    retval = sas7bdat_emit_subheader(writer, ctx, &subheader);
 
 cleanup:
-    if (retval != READSTAT_OK)
-        sas7bdat_subheader_free(subheader);
-
     return retval;
 }
 
+static readstat_error_t sas7bdat_write_row_rdc(readstat_writer_t *writer, sas7bdat_write_ctx_t *ctx,
+        void *bytes, size_t len) {
+    sas7bdat_subheader_t subheader = { .is_row_data = 1 };
+
+    /* Rows that don't shrink are stored as-is */
+    ssize_t compressed_len = sas_rdc_compress(ctx->row_buffer, len - 1, bytes, len);
+
+    if (compressed_len > 0) {
+        subheader.data = ctx->row_buffer;
+        subheader.len = compressed_len;
+        subheader.is_row_data_compressed = 1;
+    } else {
+        subheader.data = bytes;
+        subheader.len = len;
+    }
+
+    return sas7bdat_emit_subheader(writer, ctx, &subheader);
+}
+
 static readstat_error_t sas7bdat_write_row(void *writer_ctx, void *bytes, size_t len) {
     readstat_writer_t *writer = (readstat_writer_t *)writer_ctx;
     sas7bdat_write_ctx_t *ctx = (sas7bdat_write_ctx_t *)writer->module_ctx;
@@ -758,6 +919,8 @@ static readstat_error_t sas7bdat_write_row(void *writer_ctx, void *bytes, size_t
         retval = sas7bdat_write_row_uncompressed(writer, ctx, bytes, len);
     } else if (writer->compression == READSTAT_COMPRESS_ROWS) {
         retval = sas7bdat_write_row_compressed(writer, ctx, bytes, len);
+    } else if (writer->compression == READSTAT_COMPRESS_BINARY) {
+        retval = sas7bdat_write_row_rdc(writer, ctx, bytes, len);
     }
 
     return retval;
@@ -767,7 +930,8 @@ static readstat_error_t sas7bdat_metadata_ok(void *writer_ctx) {
     readstat_writer_t *writer = (readstat_writer_t *)writer_ctx;
 
     if (writer->compression != READSTAT_COMPRESS_NONE &&
-            writer->compression != READSTAT_COMPRESS_ROWS)
+            writer->compression != READSTAT_COMPRESS_ROWS &&
+            writer->compression != READSTAT_COMPRESS_BINARY)
         return READSTAT_ERROR_UNSUPPORTED_COMPRESSION;
 
     return READSTAT_OK;
@@ -784,6 +948,9 @@ readstat_error_t readstat_begin_writing_sas7bdat(readstat_writer_t *writer, void
     writer->callbacks.write_int32 = &sas7bdat_write_int32;
     writer->callbacks.write_float = &sas7bdat_write_float;
     writer->callbacks.write_double = &sas7bdat_write_double;
+    writer->callbacks.write_doubles = &sas7bdat_write_doubles;
+    writer->callbacks.write_floats = &sas7bdat_write_floats;
+    writer->callbacks.write_int32s = &sas7bdat_write_int32s;
 
     writer->callbacks.write_string = &sas7bdat_write_string;
     writer->callbacks.write_missing_string = &sas7bdat_write_missing_string;
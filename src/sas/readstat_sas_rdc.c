@@ -0,0 +1,305 @@
+
+/* Ross Data Compression (RDC), used by SAS for COMPRESS=BINARY data sets.
+ *
+ * The stream is a sequence of groups, each introduced by a big-endian 16-bit
+ * control word. Reading from the most significant bit down, a clear bit means
+ * the next item is a literal byte, and a set bit means the next item is a
+ * command. The high nibble of a command's first byte selects it:
+ *
+ *   0     short run      3-18 copies of the following byte
+ *   1     long run       19-4114 copies; a count byte, then the byte to repeat
+ *   2     long pattern   16-271 bytes copied from 3-4098 bytes back
+ *   3-15  short pattern  3-15 bytes (the command itself) copied from 3-4098
+ *                        bytes back
+ *
+ * Patterns may overlap the bytes they produce, and are copied forward one
+ * byte at a time in that case.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "readstat_sas_rdc.h"
+
+#define SAS_RDC_COMMAND_SHORT_RUN      0
+#define SAS_RDC_COMMAND_LONG_RUN       1
+#define SAS_RDC_COMMAND_LONG_PATTERN   2
+
+#define SAS_RDC_MIN_RUN             3
+#define SAS_RDC_MIN_LONG_RUN       19
+#define SAS_RDC_MAX_RUN          4114 // 15 + 255 * 16 + 19
+
+#define SAS_RDC_MIN_PATTERN         3
+#define SAS_RDC_MIN_LONG_PATTERN   16
+#define SAS_RDC_MAX_PATTERN       271 // 255 + 16
+
+#define SAS_RDC_MIN_OFFSET          3
+#define SAS_RDC_MAX_OFFSET       4098 // 15 + 255 * 16 + 3
+
+#define SAS_RDC_HASH_BITS          12
+
+ssize_t sas_rdc_decompressed_len(const void *input_buf, size_t input_len) {
+    return sas_rdc_decompress(NULL, 0, input_buf, input_len);
+}
+
+ssize_t sas_rdc_decompress(void *output_buf, size_t output_len,
+        const void *input_buf, size_t input_len) {
+    unsigned char *output = (unsigned char *)output_buf;
+    size_t output_written = 0;
+
+    const unsigned char *input = (const unsigned char *)input_buf;
+    const unsigned char *input_end = input + input_len;
+
+    uint16_t ctrl_bits = 0;
+    uint16_t ctrl_mask = 0;
+
+    while (input < input_end) {
+        ctrl_mask >>= 1;
+        if (ctrl_mask == 0) {
+            if (input_end - input < 3)
+                return -1;
+
+            ctrl_bits = (input[0] << 8) | input[1];
+            ctrl_mask = 0x8000;
+            input += 2;
+        }
+
+        if ((ctrl_bits & ctrl_mask) == 0) {
+            if (output) {
+                if (output_written + 1 > output_len)
+                    return -1;
+                output[output_written] = *input;
+            }
+            input++;
+            output_written++;
+            continue;
+        }
+
+        unsigned char command = (*input >> 4) & 0x0F;
+        size_t count = (*input & 0x0F);
+        size_t offset = 0;
+        size_t run_len = 0;
+        size_t pattern_len = 0;
+        unsigned char run_byte = 0;
+        input++;
+
+        if (command == SAS_RDC_COMMAND_SHORT_RUN) {
+            if (input_end - input < 1)
+                return -1;
+            run_len = count + SAS_RDC_MIN_RUN;
+            run_byte = input[0];
+            input += 1;
+        } else if (command == SAS_RDC_COMMAND_LONG_RUN) {
+            if (input_end - input < 2)
+                return -1;
+            run_len = count + (input[0] << 4) + SAS_RDC_MIN_LONG_RUN;
+            run_byte = input[1];
+            input += 2;
+        } else if (command == SAS_RDC_COMMAND_LONG_PATTERN) {
+            if (input_end - input < 2)
+                return -1;
+            offset = count + (input[0] << 4) + SAS_RDC_MIN_OFFSET;
+            pattern_len = input[1] + SAS_RDC_MIN_LONG_PATTERN;
+            input += 2;
+        } else {
+            if (input_end - input < 1)
+                return -1;
+            offset = count + (input[0] << 4) + SAS_RDC_MIN_OFFSET;
+            pattern_len = command;
+            input += 1;
+        }
+
+        if (run_len) {
+            if (output) {
+                if (output_written + run_len > output_len)
+                    return -1;
+                memset(&output[output_written], run_byte, run_len);
+            }
+            output_written += run_len;
+        } else {
+            if (offset > output_written)
+                return -1;
+            if (output) {
+                if (output_written + pattern_len > output_len)
+                    return -1;
+                unsigned char *dst = &output[output_written];
+                const unsigned char *src = dst - offset;
+                if (offset >= pattern_len) {
+                    memcpy(dst, src, pattern_len);
+                } else {
+                    size_t i;
+                    for (i=0; i<pattern_len; i++) {
+                        dst[i] = src[i];
+                    }
+                }
+            }
+            output_written += pattern_len;
+        }
+    }
+
+    return output_written;
+}
+
+typedef struct sas_rdc_writer_s {
+    unsigned char  *output;
+    size_t          output_len;
+    size_t          output_written;
+    size_t          ctrl_offset;
+    int             ctrl_count;
+    uint16_t        ctrl_bits;
+} sas_rdc_writer_t;
+
+/* Reserve room for an item of len bytes (starting a new control word if
+ * needed) and record whether it's a command. Returns a pointer to where the
+ * item's bytes go, or NULL if only measuring or if the output is full. */
+static int sas_rdc_begin_item(sas_rdc_writer_t *w, size_t len, int is_command,
+        unsigned char **item) {
+    *item = NULL;
+    if (w->ctrl_count == 0 || w->ctrl_count == 16) {
+        w->ctrl_offset = w->output_written;
+        w->ctrl_bits = 0;
+        w->ctrl_count = 0;
+        w->output_written += 2;
+    }
+    if (is_command)
+        w->ctrl_bits |= (0x8000 >> w->ctrl_count);
+    w->ctrl_count++;
+
+    if (w->output) {
+        if (w->output_written + len > w->output_len)
+            return 0;
+        w->output[w->ctrl_offset] = (w->ctrl_bits >> 8);
+        w->output[w->ctrl_offset+1] = (w->ctrl_bits & 0xFF);
+        *item = &w->output[w->output_written];
+    }
+    w->output_written += len;
+    return 1;
+}
+
+static int sas_rdc_emit_literal(sas_rdc_writer_t *w, unsigned char byte) {
+    unsigned char *item;
+    if (!sas_rdc_begin_item(w, 1, 0, &item))
+        return 0;
+    if (item)
+        item[0] = byte;
+    return 1;
+}
+
+static int sas_rdc_emit_run(sas_rdc_writer_t *w, unsigned char byte, size_t run_len) {
+    unsigned char *item;
+    if (run_len < SAS_RDC_MIN_LONG_RUN) {
+        if (!sas_rdc_begin_item(w, 2, 1, &item))
+            return 0;
+        if (item) {
+            item[0] = (SAS_RDC_COMMAND_SHORT_RUN << 4) + (run_len - SAS_RDC_MIN_RUN);
+            item[1] = byte;
+        }
+    } else {
+        size_t count = run_len - SAS_RDC_MIN_LONG_RUN;
+        if (!sas_rdc_begin_item(w, 3, 1, &item))
+            return 0;
+        if (item) {
+            item[0] = (SAS_RDC_COMMAND_LONG_RUN << 4) + (count & 0x0F);
+            item[1] = (count >> 4);
+            item[2] = byte;
+        }
+    }
+    return 1;
+}
+
+static int sas_rdc_emit_pattern(sas_rdc_writer_t *w, size_t offset, size_t pattern_len) {
+    unsigned char *item;
+    size_t count = offset - SAS_RDC_MIN_OFFSET;
+    if (pattern_len < SAS_RDC_MIN_LONG_PATTERN) {
+        if (!sas_rdc_begin_item(w, 2, 1, &item))
+            return 0;
+        if (item) {
+            item[0] = (pattern_len << 4) + (count & 0x0F);
+            item[1] = (count >> 4);
+        }
+    } else {
+        if (!sas_rdc_begin_item(w, 3, 1, &item))
+            return 0;
+        if (item) {
+            item[0] = (SAS_RDC_COMMAND_LONG_PATTERN << 4) + (count & 0x0F);
+            item[1] = (count >> 4);
+            item[2] = pattern_len - SAS_RDC_MIN_LONG_PATTERN;
+        }
+    }
+    return 1;
+}
+
+static size_t sas_rdc_hash(const unsigned char *p, size_t mask) {
+    uint32_t key = (p[0] << 16) | (p[1] << 8) | p[2];
+    return ((key * 2654435761U) >> (32 - SAS_RDC_HASH_BITS)) & mask;
+}
+
+ssize_t sas_rdc_compressed_len(const void *bytes, size_t len) {
+    return sas_rdc_compress(NULL, 0, bytes, len);
+}
+
+/* Greedy compressor: at each position, prefer a run of the current byte,
+ * then the most recent earlier occurrence of the next three bytes, and
+ * otherwise emit a literal. If output_buf is NULL, only measures the result;
+ * otherwise returns -1 if it won't fit in output_len bytes. */
+ssize_t sas_rdc_compress(void *output_buf, size_t output_len,
+        const void *input_buf, size_t input_len) {
+    const unsigned char *input = (const unsigned char *)input_buf;
+    sas_rdc_writer_t w = { .output = (unsigned char *)output_buf, .output_len = output_len };
+
+    /* Positions are stored plus one, so that zero means empty; only as much
+     * of the table as the input could fill is cleared. */
+    size_t table[1 << SAS_RDC_HASH_BITS];
+    size_t table_size = 16;
+    while (table_size < input_len && table_size < (1 << SAS_RDC_HASH_BITS))
+        table_size <<= 1;
+    size_t mask = table_size - 1;
+    memset(table, 0, table_size * sizeof(size_t));
+
+    size_t i = 0;
+    while (i < input_len) {
+        size_t left = input_len - i;
+        size_t run_len = 1;
+        while (run_len < left && run_len < SAS_RDC_MAX_RUN && input[i+run_len] == input[i])
+            run_len++;
+
+        if (run_len >= SAS_RDC_MIN_RUN) {
+            if (!sas_rdc_emit_run(&w, input[i], run_len))
+                return -1;
+            i += run_len;
+            continue;
+        }
+
+        size_t pattern_len = 0, offset = 0;
+        if (left >= SAS_RDC_MIN_PATTERN) {
+            size_t h = sas_rdc_hash(&input[i], mask);
+            size_t candidate = table[h];
+            table[h] = i + 1;
+            if (candidate && i - (candidate - 1) >= SAS_RDC_MIN_OFFSET &&
+                    i - (candidate - 1) <= SAS_RDC_MAX_OFFSET) {
+                const unsigned char *match = &input[candidate - 1];
+                size_t max_len = left < SAS_RDC_MAX_PATTERN ? left : SAS_RDC_MAX_PATTERN;
+                while (pattern_len < max_len && match[pattern_len] == input[i+pattern_len])
+                    pattern_len++;
+                offset = i - (candidate - 1);
+            }
+        }
+
+        if (pattern_len >= SAS_RDC_MIN_PATTERN) {
+            if (!sas_rdc_emit_pattern(&w, offset, pattern_len))
+                return -1;
+            size_t j;
+            for (j=1; j<pattern_len && i+j+SAS_RDC_MIN_PATTERN <= input_len; j++) {
+                table[sas_rdc_hash(&input[i+j], mask)] = i + j + 1;
+            }
+            i += pattern_len;
+        } else {
+            if (!sas_rdc_emit_literal(&w, input[i]))
+                return -1;
+            i++;
+        }
+    }
+
+    return w.output_written;
+}
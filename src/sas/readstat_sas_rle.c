@@ -31,97 +31,166 @@ static size_t command_lengths[16] = {
     [SAS_RLE_COMMAND_INSERT_BYTE3] = 1
 };
 
+/* Short runs are moved in whole SAS_RLE_CHUNK-sized blocks so that the
+ * compiler can emit a few fixed-width loads and stores instead of calling
+ * into memcpy/memset for every command. This may write up to
+ * SAS_RLE_CHUNK-1 bytes past the end of a run, so it's only used when that
+ * much room remains in both the input and the output. */
+#define SAS_RLE_CHUNK          16
+#define SAS_RLE_MAX_WIDE_RUN   64
+
+static void sas_rle_wide_copy(unsigned char *out, const unsigned char *in, size_t len) {
+    size_t i;
+    for (i=0; i<len; i+=SAS_RLE_CHUNK) {
+        memcpy(&out[i], &in[i], SAS_RLE_CHUNK);
+    }
+}
+
+static void sas_rle_wide_fill(unsigned char *out, unsigned char byte, size_t len) {
+    size_t i;
+    for (i=0; i<len; i+=SAS_RLE_CHUNK) {
+        memset(&out[i], byte, SAS_RLE_CHUNK);
+    }
+}
+
+static size_t sas_rle_round_up(size_t len) {
+    return (len + SAS_RLE_CHUNK - 1) & ~(size_t)(SAS_RLE_CHUNK - 1);
+}
+
+/* Decode one control byte (and its operands) starting at input. Returns a
+ * pointer just past the operands, or NULL if they run off the end. */
+static const unsigned char *sas_rle_decode_command(const unsigned char *input,
+        const unsigned char *input_end, size_t *copy_len, size_t *insert_len,
+        unsigned char *insert_byte) {
+    unsigned char control = *input++;
+    unsigned char command = (control & 0xF0) >> 4;
+    size_t length = (control & 0x0F);
+
+    *copy_len = 0;
+    *insert_len = 0;
+
+    if (command_lengths[command] > (size_t)(input_end - input)) {
+        return NULL;
+    }
+    switch (command) {
+        case SAS_RLE_COMMAND_COPY64:
+            *copy_len = (*input++) + 64 + length * 256;
+            break;
+        case SAS_RLE_COMMAND_INSERT_BYTE18:
+            *insert_len = (*input++) + 18 + length * 256;
+            *insert_byte = *input++;
+            break;
+        case SAS_RLE_COMMAND_INSERT_AT17:
+            *insert_len = (*input++) + 17 + length * 256;
+            *insert_byte = '@';
+            break;
+        case SAS_RLE_COMMAND_INSERT_BLANK17:
+            *insert_len = (*input++) + 17 + length * 256;
+            *insert_byte = ' ';
+            break;
+        case SAS_RLE_COMMAND_INSERT_ZERO17:
+            *insert_len = (*input++) + 17 + length * 256;
+            *insert_byte = '\0';
+            break;
+        case SAS_RLE_COMMAND_COPY1:  *copy_len = length + 1; break;
+        case SAS_RLE_COMMAND_COPY17: *copy_len = length + 17; break;
+        case SAS_RLE_COMMAND_COPY33: *copy_len = length + 33; break;
+        case SAS_RLE_COMMAND_COPY49: *copy_len = length + 49; break;
+        case SAS_RLE_COMMAND_INSERT_BYTE3:
+            *insert_byte = *input++;
+            *insert_len = length + 3;
+            break;
+        case SAS_RLE_COMMAND_INSERT_AT2:
+            *insert_byte = '@';
+            *insert_len = length + 2;
+            break;
+        case SAS_RLE_COMMAND_INSERT_BLANK2:
+            *insert_byte = ' ';
+            *insert_len = length + 2;
+            break;
+        case SAS_RLE_COMMAND_INSERT_ZERO2:
+            *insert_byte = '\0';
+            *insert_len = length + 2;
+            break;
+        default:
+            /* error out here? */
+            break;
+    }
+    return input;
+}
+
 ssize_t sas_rle_decompressed_len(const void *input_buf, size_t input_len) {
-    return sas_rle_decompress(NULL, 0, input_buf, input_len);
+    const unsigned char *input = (const unsigned char *)input_buf;
+    const unsigned char *input_end = input + input_len;
+    size_t output_written = 0;
+
+    while (input < input_end) {
+        size_t copy_len, insert_len;
+        unsigned char insert_byte;
+        if ((input = sas_rle_decode_command(input, input_end,
+                        &copy_len, &insert_len, &insert_byte)) == NULL) {
+            return -1;
+        }
+        if (copy_len > (size_t)(input_end - input)) {
+            return -1;
+        }
+        input += copy_len;
+        output_written += copy_len + insert_len;
+    }
+
+    return output_written;
 }
 
+/* Bytes of output_buf past the returned length may be overwritten. */
 ssize_t sas_rle_decompress(void *output_buf, size_t output_len, 
         const void *input_buf, size_t input_len) {
-    unsigned char *buffer = (unsigned char *)output_buf;
-    unsigned char *output = buffer;
-    size_t output_written = 0;
+    if (output_buf == NULL)
+        return sas_rle_decompressed_len(input_buf, input_len);
+
+    unsigned char *output = (unsigned char *)output_buf;
+    unsigned char *output_end = output + output_len;
 
     const unsigned char *input = (const unsigned char *)input_buf;
+    const unsigned char *input_end = input + input_len;
 
-    while (input < (const unsigned char *)input_buf + input_len) {
-        unsigned char control = *input++;
-        unsigned char command = (control & 0xF0) >> 4;
-        unsigned char length = (control & 0x0F);
-        int copy_len = 0;
-        int insert_len = 0;
+    while (input < input_end) {
+        size_t copy_len, insert_len;
         unsigned char insert_byte = '\0';
-        if (input + command_lengths[command] > (const unsigned char *)input_buf + input_len) {
+        size_t output_left;
+        if ((input = sas_rle_decode_command(input, input_end,
+                        &copy_len, &insert_len, &insert_byte)) == NULL) {
             return -1;
         }
-        switch (command) {
-            case SAS_RLE_COMMAND_COPY64:
-                copy_len = (*input++) + 64 + length * 256;
-                break;
-            case SAS_RLE_COMMAND_INSERT_BYTE18:
-                insert_len = (*input++) + 18 + length * 256;
-                insert_byte = *input++;
-                break;
-            case SAS_RLE_COMMAND_INSERT_AT17:
-                insert_len = (*input++) + 17 + length * 256;
-                insert_byte = '@';
-                break;
-            case SAS_RLE_COMMAND_INSERT_BLANK17:
-                insert_len = (*input++) + 17 + length * 256;
-                insert_byte = ' ';
-                break;
-            case SAS_RLE_COMMAND_INSERT_ZERO17:
-                insert_len = (*input++) + 17 + length * 256;
-                insert_byte = '\0';
-                break;
-            case SAS_RLE_COMMAND_COPY1:  copy_len = length + 1; break;
-            case SAS_RLE_COMMAND_COPY17: copy_len = length + 17; break;
-            case SAS_RLE_COMMAND_COPY33: copy_len = length + 33; break;
-            case SAS_RLE_COMMAND_COPY49: copy_len = length + 49; break;
-            case SAS_RLE_COMMAND_INSERT_BYTE3:
-                insert_byte = *input++;
-                insert_len = length + 3;
-                break;
-            case SAS_RLE_COMMAND_INSERT_AT2:
-                insert_byte = '@';
-                insert_len = length + 2;
-                break;
-            case SAS_RLE_COMMAND_INSERT_BLANK2:
-                insert_byte = ' ';
-                insert_len = length + 2;
-                break;
-            case SAS_RLE_COMMAND_INSERT_ZERO2:
-                insert_byte = '\0';
-                insert_len = length + 2;
-                break;
-            default:
-                /* error out here? */
-                break;
-        }
+        output_left = output_end - output;
         if (copy_len) {
-            if (output_written + copy_len > output_len) {
-                return -1;
-            }
-            if (input + copy_len > (const unsigned char *)input_buf + input_len) {
+            size_t input_left = input_end - input;
+            if (copy_len > output_left || copy_len > input_left) {
                 return -1;
             }
-            if (output) {
-                memcpy(&output[output_written], input, copy_len);
+            if (copy_len <= SAS_RLE_MAX_WIDE_RUN &&
+                    sas_rle_round_up(copy_len) <= output_left &&
+                    sas_rle_round_up(copy_len) <= input_left) {
+                sas_rle_wide_copy(output, input, copy_len);
+            } else {
+                memcpy(output, input, copy_len);
             }
             input += copy_len;
-            output_written += copy_len;
-        }
-        if (insert_len) {
-            if (output_written + insert_len > output_len) {
+            output += copy_len;
+        } else if (insert_len) {
+            if (insert_len > output_left) {
                 return -1;
             }
-            if (output) {
-                memset(&output[output_written], insert_byte, insert_len);
+            if (insert_len <= SAS_RLE_MAX_WIDE_RUN &&
+                    sas_rle_round_up(insert_len) <= output_left) {
+                sas_rle_wide_fill(output, insert_byte, insert_len);
+            } else {
+                memset(output, insert_byte, insert_len);
             }
-            output_written += insert_len;
+            output += insert_len;
         }
     }
 
-    return output_written;
+    return output - (unsigned char *)output_buf;
 }
 
 static size_t sas_rle_measure_copy_run(size_t copy_run) {
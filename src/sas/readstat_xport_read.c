@@ -4,16 +4,26 @@
 #include <sys/types.h>
 #include <stdint.h>
 #include <time.h>
+#include <math.h>
 
 #include "../readstat.h"
 #include "../readstat_iconv.h"
 #include "../readstat_convert.h"
 #include "../readstat_malloc.h"
+#include "../readstat_batch.h"
+#include "../readstat_projection.h"
 #include "readstat_sas.h"
 #include "readstat_xport.h"
 #include "ieee.h"
 
 #define LINE_LEN        80
+#define XPORT_BLOCK_SIZE  65536
+
+/* A column that is actually decoded, with its place in the row */
+typedef struct xport_column_s {
+    readstat_variable_t *variable;
+    size_t               offset;
+} xport_column_t;
 
 typedef struct xport_ctx_s {
     readstat_callbacks_t handle;
@@ -21,7 +31,7 @@ typedef struct xport_ctx_s {
     void          *user_ctx;
     const char    *input_encoding;
     const char    *output_encoding;
-    iconv_t        converter;
+    readstat_converter_t *converter;
 
     readstat_io_t *io;
     time_t         timestamp;
@@ -36,6 +46,15 @@ typedef struct xport_ctx_s {
     char           table_name[32*4+1];
 
     readstat_variable_t **variables;
+    readstat_batch_t     *batch;
+    const readstat_projection_t *projection;
+
+    xport_column_t *columns;
+    int             columns_count;
+    double         *doubles;
+    size_t          block_rows;
+    char           *string;
+    size_t          string_len;
 
     int            version;
 } xport_ctx_t;
@@ -60,8 +79,17 @@ static void xport_ctx_free(xport_ctx_t *ctx) {
         free(ctx->variables);
     }
     if (ctx->converter) {
-        iconv_close(ctx->converter);
+        readstat_converter_free(ctx->converter);
+    }
+    if (ctx->batch) {
+        readstat_batch_free(ctx->batch);
     }
+    if (ctx->columns)
+        free(ctx->columns);
+    if (ctx->doubles)
+        free(ctx->doubles);
+    if (ctx->string)
+        free(ctx->string);
 
     free(ctx);
 }
@@ -533,9 +561,12 @@ static readstat_error_t xport_read_variables(xport_ctx_t *ctx) {
         readstat_variable_t *variable = ctx->variables[i];
         variable->index_after_skipping = index_after_skipping;
         
-        int cb_retval = READSTAT_HANDLER_OK;
-        if (ctx->handle.variable) {
-            cb_retval = ctx->handle.variable(i, variable, variable->format, ctx->user_ctx);
+        int cb_retval = READSTAT_HANDLER_SKIP_VARIABLE;
+        if (readstat_projection_includes(ctx->projection, i, variable->name)) {
+            cb_retval = READSTAT_HANDLER_OK;
+            if (ctx->handle.variable) {
+                cb_retval = ctx->handle.variable(i, variable, variable->format, ctx->user_ctx);
+            }
         }
         if (cb_retval == READSTAT_HANDLER_ABORT) {
             retval = READSTAT_ERROR_USER_ABORT;
@@ -554,141 +585,292 @@ cleanup:
     return retval;
 }
 
-static readstat_error_t xport_process_row(xport_ctx_t *ctx, const char *row, size_t row_length) {
-    readstat_error_t retval = READSTAT_OK;
+static readstat_error_t xport_init_columns(xport_ctx_t *ctx) {
+    size_t offset = 0;
+    size_t longest_string = 0;
     int i;
-    off_t pos = 0;
-    char *string = NULL;
+
+    if ((ctx->columns = readstat_calloc(ctx->var_count, sizeof(xport_column_t))) == NULL)
+        return READSTAT_ERROR_MALLOC;
+
     for (i=0; i<ctx->var_count; i++) {
         readstat_variable_t *variable = ctx->variables[i];
+        if (!variable->skip) {
+            xport_column_t *column = &ctx->columns[ctx->columns_count++];
+            column->variable = variable;
+            column->offset = offset;
+            if (variable->type == READSTAT_TYPE_STRING && variable->storage_width > longest_string)
+                longest_string = variable->storage_width;
+        }
+        offset += variable->storage_width;
+    }
+
+    ctx->string_len = 4*longest_string+1;
+    if ((ctx->string = readstat_malloc(ctx->string_len)) == NULL)
+        return READSTAT_ERROR_MALLOC;
+
+    return READSTAT_OK;
+}
+
+static int xport_column_is_double(const xport_column_t *column) {
+    return (column->variable->type != READSTAT_TYPE_STRING &&
+            column->variable->storage_width >= XPORT_MIN_DOUBLE_SIZE &&
+            column->variable->storage_width <= XPORT_MAX_DOUBLE_SIZE);
+}
+
+/* Convert the numeric columns of rows [first, end) of a block, one column at
+ * a time */
+static void xport_decode_block(xport_ctx_t *ctx, const char *rows, size_t first, size_t end) {
+    int j;
+    if (first >= end)
+        return;
+
+    for (j=0; j<ctx->columns_count; j++) {
+        const xport_column_t *column = &ctx->columns[j];
+        if (xport_column_is_double(column)) {
+            xpt_decode_doubles(&ctx->doubles[j * ctx->block_rows + first],
+                    &rows[first * ctx->row_length + column->offset],
+                    column->variable->storage_width, ctx->row_length, end - first);
+        }
+    }
+}
+
+/* The rows of a block that will be handed out. Every row, blank or not, uses
+ * up one row of the offset and then one of the limit, after the blank rows
+ * still held back from the previous block. */
+static void xport_block_range(xport_ctx_t *ctx, size_t rows_count, int num_blank_rows,
+        size_t *out_first, size_t *out_end) {
+    int64_t count = rows_count;
+    int64_t first = (int64_t)ctx->row_offset - num_blank_rows;
+    int64_t end = count;
+
+    if (ctx->row_limit > 0)
+        end = first + (ctx->row_limit - ctx->parsed_row_count);
+
+    if (first < 0)
+        first = 0;
+    if (first > count)
+        first = count;
+    if (end < first)
+        end = first;
+    if (end > count)
+        end = count;
+
+    *out_first = first;
+    *out_end = end;
+}
+
+/* The value of numeric column j of a row; `doubles' holds the row's converted
+ * values at a stride of ctx->block_rows, or is NULL to convert it here. A
+ * NaN's missing code goes in *missing: '.' for system-missing, or the tag. */
+static double xport_read_double(xport_ctx_t *ctx, int j, const char *cell, const double *doubles,
+        char *missing) {
+    const xport_column_t *column = &ctx->columns[j];
+    double dval = NAN;
+
+    *missing = '\0';
+    if (xport_column_is_double(column)) {
+        if (doubles) {
+            dval = doubles[j * ctx->block_rows];
+        } else {
+            dval = xpt_decode_double(cell, column->variable->storage_width);
+        }
+        /* Only a lone first byte converts to NaN */
+        if (isnan(dval)) {
+            if (cell[0] == '.' || sas_validate_tag(cell[0]) == READSTAT_OK)
+                *missing = cell[0];
+        }
+    }
+
+    return dval;
+}
+
+static readstat_error_t xport_handle_row(xport_ctx_t *ctx, const char *row, const double *doubles) {
+    readstat_error_t retval = READSTAT_OK;
+    int j;
+
+    for (j=0; j<ctx->columns_count; j++) {
+        const xport_column_t *column = &ctx->columns[j];
+        readstat_variable_t *variable = column->variable;
+        const char *cell = &row[column->offset];
         readstat_value_t value = { .type = variable->type };
 
         if (variable->type == READSTAT_TYPE_STRING) {
-            string = readstat_realloc(string, 4*variable->storage_width+1);
-            if (string == NULL) {
-                retval = READSTAT_ERROR_MALLOC;
-                goto cleanup;
-            }
-            retval = readstat_convert(string, 4*variable->storage_width+1,
-                    &row[pos], variable->storage_width, ctx->converter);
+            retval = readstat_convert(ctx->string, ctx->string_len,
+                    cell, variable->storage_width, ctx->converter);
             if (retval != READSTAT_OK)
                 goto cleanup;
 
-            value.v.string_value = string;
+            value.v.string_value = ctx->string;
         } else {
-            double dval = NAN;
-            if (variable->storage_width <= XPORT_MAX_DOUBLE_SIZE &&
-                    variable->storage_width >= XPORT_MIN_DOUBLE_SIZE) {
-                char full_value[8] = { 0 };
-                if (memcmp(&full_value[1], &row[pos+1], variable->storage_width - 1) == 0 &&
-                        (row[pos] == '.' || sas_validate_tag(row[pos]) == READSTAT_OK)) {
-                    if (row[pos] == '.') {
-                        value.is_system_missing = 1;
-                    } else {
-                        value.tag = row[pos];
-                        value.is_tagged_missing = 1;
-                    }
-                } else {
-                    memcpy(full_value, &row[pos], variable->storage_width);
-                    int rc = cnxptiee(full_value, CN_TYPE_XPORT, &dval, CN_TYPE_NATIVE);
-                    if (rc != 0) {
-                        retval = READSTAT_ERROR_CONVERT;
-                        goto cleanup;
-                    }
-                }
+            char missing = '\0';
+            value.v.double_value = xport_read_double(ctx, j, cell, doubles, &missing);
+            if (missing == '.') {
+                value.is_system_missing = 1;
+            } else if (missing) {
+                value.tag = missing;
+                value.is_tagged_missing = 1;
             }
+        }
 
-            value.v.double_value = dval;
+        if (ctx->handle.value(ctx->parsed_row_count, variable, value, ctx->user_ctx) != READSTAT_HANDLER_OK) {
+            retval = READSTAT_ERROR_USER_ABORT;
+            goto cleanup;
         }
-        pos += variable->storage_width;
+    }
+
+cleanup:
+    return retval;
+}
+
+/* Decode a row straight into the batch's column arrays */
+static readstat_error_t xport_handle_batch_row(xport_ctx_t *ctx, const char *row, const double *doubles) {
+    readstat_error_t retval = READSTAT_OK;
+    int batch_row = 0;
+    int j;
+
+    if ((retval = readstat_batch_row(ctx->batch, ctx->parsed_row_count, &batch_row)) != READSTAT_OK)
+        goto cleanup;
+
+    for (j=0; j<ctx->columns_count; j++) {
+        const xport_column_t *column = &ctx->columns[j];
+        readstat_variable_t *variable = column->variable;
+        const char *cell = &row[column->offset];
+        readstat_batch_column_t *batch_column = NULL;
+
+        if ((retval = readstat_batch_column(ctx->batch, variable, &batch_column)) != READSTAT_OK)
+            goto cleanup;
 
-        if (ctx->handle.value && !ctx->variables[i]->skip && !ctx->row_offset) {
-            if (ctx->handle.value(ctx->parsed_row_count, variable, value, ctx->user_ctx) != READSTAT_HANDLER_OK) {
-                retval = READSTAT_ERROR_USER_ABORT;
+        if (variable->type == READSTAT_TYPE_STRING) {
+            char *dst = readstat_batch_reserve_string(ctx->batch, batch_column, batch_row, ctx->string_len);
+            if (dst == NULL) {
+                retval = READSTAT_ERROR_MALLOC;
                 goto cleanup;
             }
+            retval = readstat_convert(dst, ctx->string_len, cell, variable->storage_width, ctx->converter);
+            if (retval != READSTAT_OK)
+                goto cleanup;
+
+            readstat_batch_end_string(ctx->batch, batch_column);
+        } else {
+            char missing = '\0';
+            batch_column->double_values[batch_row] = xport_read_double(ctx, j, cell, doubles, &missing);
+            if (missing)
+                readstat_batch_set_missing(batch_column, batch_row, missing == '.' ? '\0' : missing);
         }
     }
+
+cleanup:
+    return retval;
+}
+
+/* Handle one row; `doubles' holds its converted numeric values at a stride of
+ * ctx->block_rows, or is NULL to convert them here */
+static readstat_error_t xport_process_row(xport_ctx_t *ctx, const char *row, const double *doubles) {
+    readstat_error_t retval = READSTAT_OK;
+
     if (ctx->row_offset) {
         ctx->row_offset--;
+        return READSTAT_OK;
+    }
+
+    if (ctx->batch) {
+        retval = xport_handle_batch_row(ctx, row, doubles);
     } else {
-        ctx->parsed_row_count++;
+        retval = xport_handle_row(ctx, row, doubles);
     }
+    if (retval == READSTAT_OK)
+        ctx->parsed_row_count++;
 
-cleanup:
-    free(string);
     return retval;
 }
 
+/* Rows are read and converted a block at a time. Rows of all blanks are
+ * held back until a non-blank row follows, since they may just be padding
+ * at the end of the last 80-byte record. */
 static readstat_error_t xport_read_data(xport_ctx_t *ctx) {
     if (!ctx->row_length)
         return READSTAT_OK;
 
-    if (!ctx->handle.value)
+    if (!ctx->handle.value && !ctx->batch)
         return READSTAT_OK;
 
     readstat_error_t retval = READSTAT_OK;
-    char *row = readstat_malloc(ctx->row_length);
-    char *blank_row = readstat_malloc(ctx->row_length);
+    char *rows = NULL;
+    char *blank_row = NULL;
     int num_blank_rows = 0;
+    size_t block_len, i;
+
+    ctx->block_rows = XPORT_BLOCK_SIZE / ctx->row_length;
+    if (ctx->block_rows == 0)
+        ctx->block_rows = 1;
+    block_len = ctx->block_rows * ctx->row_length;
+
+    if ((retval = xport_init_columns(ctx)) != READSTAT_OK)
+        goto cleanup;
+
+    rows = readstat_malloc(block_len);
+    blank_row = readstat_malloc(ctx->row_length);
+    ctx->doubles = readstat_calloc(ctx->columns_count ? ctx->columns_count : 1,
+            ctx->block_rows * sizeof(double));
 
-    if (row == NULL || blank_row == NULL) {
+    if (rows == NULL || blank_row == NULL || ctx->doubles == NULL) {
         retval = READSTAT_ERROR_MALLOC;
         goto cleanup;
     }
 
     memset(blank_row, ' ', ctx->row_length);
     while (1) {
-        ssize_t bytes_read = read_bytes(ctx, row, ctx->row_length);
+        ssize_t bytes_read = read_bytes(ctx, rows, block_len);
         if (bytes_read == -1) {
             retval = READSTAT_ERROR_READ;
             goto cleanup;
-        } else if (bytes_read < ctx->row_length) {
-            break;
         }
 
-        off_t pos = 0;
+        size_t rows_count = bytes_read / ctx->row_length;
+        size_t first_row, end_row;
+
+        xport_block_range(ctx, rows_count, num_blank_rows, &first_row, &end_row);
+        xport_decode_block(ctx, rows, first_row, end_row);
 
-        int row_is_blank = 1;
+        for (i=0; i<rows_count; i++) {
+            const char *row = &rows[i * ctx->row_length];
 
-        for (pos=0; pos<ctx->row_length; pos++) {
-            if (row[pos] != ' ') {
-                row_is_blank = 0;
-                break;
+            if (memcmp(row, blank_row, ctx->row_length) == 0) {
+                num_blank_rows++;
+                continue;
             }
-        }
 
-        if (row_is_blank) {
-            num_blank_rows++;
-            continue;
-        }
+            while (num_blank_rows) {
+                retval = xport_process_row(ctx, blank_row, NULL);
+                if (retval != READSTAT_OK)
+                    goto cleanup;
+
+                if (ctx->row_limit > 0 && ctx->parsed_row_count == ctx->row_limit)
+                    goto cleanup;
+
+                num_blank_rows--;
+            }
 
-        while (num_blank_rows) {
-            retval = xport_process_row(ctx, blank_row, ctx->row_length);
+            retval = xport_process_row(ctx, row, &ctx->doubles[i]);
             if (retval != READSTAT_OK)
                 goto cleanup;
 
-            if (ctx->row_limit > 0 && ctx->parsed_row_count == ctx->row_limit)
+            retval = xport_update_progress(ctx);
+            if (retval != READSTAT_OK)
                 goto cleanup;
 
-            num_blank_rows--;
+            if (ctx->row_limit > 0 && ctx->parsed_row_count == ctx->row_limit)
+                goto cleanup;
         }
 
-        retval = xport_process_row(ctx, row, ctx->row_length);
-        if (retval != READSTAT_OK)
-            goto cleanup;
-
-        retval = xport_update_progress(ctx);
-        if (retval != READSTAT_OK)
-            goto cleanup;
-
-        if (ctx->row_limit > 0 && ctx->parsed_row_count == ctx->row_limit)
+        if (bytes_read < block_len)
             break;
     }
 
 cleanup:
-    if (row)
-        free(row);
+    if (rows)
+        free(rows);
     if (blank_row)
         free(blank_row);
     return retval;
@@ -700,6 +882,7 @@ readstat_error_t readstat_parse_xport(readstat_parser_t *parser, const char *pat
 
     xport_ctx_t *ctx = xport_ctx_init();
     ctx->handle = parser->handlers;
+    ctx->projection = parser->projection;
     ctx->input_encoding = parser->input_encoding;
     ctx->output_encoding = parser->output_encoding;
     ctx->user_ctx = user_ctx;
@@ -708,6 +891,11 @@ readstat_error_t readstat_parse_xport(readstat_parser_t *parser, const char *pat
     if (parser->row_offset > 0)
         ctx->row_offset = parser->row_offset;
 
+    if (parser->handlers.batch && (ctx->batch = readstat_batch_init(parser, user_ctx)) == NULL) {
+        retval = READSTAT_ERROR_MALLOC;
+        goto cleanup;
+    }
+
     if (io->open(path, io->io_ctx) == -1) {
         retval = READSTAT_ERROR_OPEN;
         goto cleanup;
@@ -724,12 +912,10 @@ readstat_error_t readstat_parse_xport(readstat_parser_t *parser, const char *pat
     }
 
     if (ctx->input_encoding && ctx->output_encoding && strcmp(ctx->input_encoding, ctx->output_encoding) != 0) {
-        iconv_t converter = iconv_open(ctx->output_encoding, ctx->input_encoding);
-        if (converter == (iconv_t)-1) {
+        if ((ctx->converter = readstat_converter_init(ctx->output_encoding, ctx->input_encoding)) == NULL) {
             retval = READSTAT_ERROR_UNSUPPORTED_CHARSET;
             goto cleanup;
         }
-        ctx->converter = converter;
     }
 
     retval = xport_read_library_record(ctx);
@@ -772,6 +958,10 @@ readstat_error_t readstat_parse_xport(readstat_parser_t *parser, const char *pat
         retval = xport_read_data(ctx);
         if (retval != READSTAT_OK)
             goto cleanup;
+
+        retval = readstat_batch_flush(ctx->batch);
+        if (retval != READSTAT_OK)
+            goto cleanup;
     }
 
 cleanup:
@@ -453,14 +453,13 @@ static readstat_error_t xport_write_row(void *writer_ctx, void *row, size_t row_
 }
 
 static readstat_error_t xport_write_double(void *row, const readstat_variable_t *var, double value) {
-    char full_value[8];
-    int rc = cnxptiee(&value, CN_TYPE_NATIVE, full_value, CN_TYPE_XPORT);
-
-    if (rc)
-        return READSTAT_ERROR_CONVERT;
-
-    memcpy(row, full_value, var->storage_width);
+    xpt_encode_double(row, var->storage_width, value);
+    return READSTAT_OK;
+}
 
+static readstat_error_t xport_write_doubles(void *row, size_t row_len, const readstat_variable_t *var,
+        const double *values, int count) {
+    xpt_encode_doubles(row, var->storage_width, row_len, values, count);
     return READSTAT_OK;
 }
 
@@ -540,6 +539,7 @@ readstat_error_t readstat_begin_writing_xport(readstat_writer_t *writer, void *u
     writer->callbacks.write_int32 = &xport_write_int32;
     writer->callbacks.write_float = &xport_write_float;
     writer->callbacks.write_double = &xport_write_double;
+    writer->callbacks.write_doubles = &xport_write_doubles;
 
     writer->callbacks.write_string = &xport_write_string;
     writer->callbacks.write_missing_string = &xport_write_missing_string;
@@ -1,9 +1,10 @@
 #include <stdlib.h>
-#include <iconv.h>
 
 #include "../readstat.h"
+#include "../readstat_iconv.h"
 #include "../CKHashTable.h"
 #include "../readstat_convert.h"
+#include "../readstat_batch.h"
 
 #include "readstat_spss.h"
 #include "readstat_por.h"
@@ -95,7 +96,9 @@ void por_ctx_free(por_ctx_t *ctx) {
     if (ctx->var_dict)
         ck_hash_table_free(ctx->var_dict);
     if (ctx->converter)
-        iconv_close(ctx->converter);
+        readstat_converter_free(ctx->converter);
+    if (ctx->batch)
+        readstat_batch_free(ctx->batch);
     free(ctx);
 }
 
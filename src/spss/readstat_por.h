@@ -1,9 +1,12 @@
 
+#define POR_READ_BUFFER_SIZE    65536
+
 extern int8_t   por_ascii_lookup[256];
 extern uint16_t por_unicode_lookup[256];
 
 typedef struct por_ctx_s {
     readstat_callbacks_t    handle;
+    const readstat_projection_t *projection;
     size_t                  file_size;
     void                   *user_ctx;
 
@@ -11,13 +14,16 @@ typedef struct por_ctx_s {
     readstat_io_t *io;
     char           space;
     long           num_spaces;
+    size_t         read_buffer_pos;
+    size_t         read_buffer_used;
+    unsigned char  read_buffer[POR_READ_BUFFER_SIZE];
     time_t         timestamp;
     long           version;
     char           fweight_name[9];
     char           file_label[21];
     uint16_t       byte2unicode[256];
     size_t         base30_precision;
-    iconv_t        converter;
+    readstat_converter_t *converter;
     unsigned char *string_buffer;
     size_t         string_buffer_len;
     int            labels_offset;
@@ -27,6 +33,7 @@ typedef struct por_ctx_s {
     int            row_limit;
     int            row_offset;
     readstat_variable_t **variables;
+    struct readstat_batch_s *batch;
     spss_varinfo_t *varinfo;
     ck_hash_table_t *var_dict;
 } por_ctx_t;
@@ -15,6 +15,8 @@
 #include "../readstat_iconv.h"
 #include "../readstat_convert.h"
 #include "../readstat_malloc.h"
+#include "../readstat_batch.h"
+#include "../readstat_projection.h"
 #include "../CKHashTable.h"
 
 #include "readstat_por_parse.h"
@@ -43,29 +45,52 @@ static readstat_error_t por_update_progress(por_ctx_t *ctx) {
     return io->update(ctx->file_size, ctx->handle.progress, ctx->user_ctx, io->io_ctx);
 }
 
+static ssize_t fill_read_buffer(por_ctx_t *ctx) {
+    readstat_io_t *io = ctx->io;
+
+    if (ctx->read_buffer_pos < ctx->read_buffer_used)
+        return ctx->read_buffer_used - ctx->read_buffer_pos;
+
+    ssize_t bytes_read = io->read(ctx->read_buffer, sizeof(ctx->read_buffer), io->io_ctx);
+    ctx->read_buffer_pos = 0;
+    ctx->read_buffer_used = bytes_read > 0 ? bytes_read : 0;
+
+    return bytes_read;
+}
+
+/* Lines are at most POR_LINE_LENGTH characters, and short lines are
+ * implicitly padded with spaces. Input is pulled through read_buffer, and runs
+ * of bytes between line breaks are copied out in one go. */
 static ssize_t read_bytes(por_ctx_t *ctx, void *dst, size_t len) {
     char *dst_pos = (char *)dst;
-    readstat_io_t *io = ctx->io;
-    char byte;
+    char *dst_end = (char *)dst + len;
 
-    while (dst_pos < (char *)dst + len) {
+    while (dst_pos < dst_end) {
         if (ctx->num_spaces) {
-            *dst_pos++ = ctx->space;
-            ctx->num_spaces--;
+            size_t num_spaces = ctx->num_spaces;
+            if (num_spaces > dst_end - dst_pos)
+                num_spaces = dst_end - dst_pos;
+            memset(dst_pos, ctx->space, num_spaces);
+            dst_pos += num_spaces;
+            ctx->num_spaces -= num_spaces;
             continue;
         }
-        ssize_t bytes_read = io->read(&byte, 1, io->io_ctx);
+        ssize_t bytes_read = fill_read_buffer(ctx);
         if (bytes_read == 0) {
             break;
         }
         if (bytes_read == -1) {
             return -1;
         }
-        if (byte == '\r' || byte == '\n') {
-            if (byte == '\r') {
-                bytes_read = io->read(&byte, 1, io->io_ctx);
-                if (bytes_read == 0 || bytes_read == -1 || byte != '\n')
+        const unsigned char *src = &ctx->read_buffer[ctx->read_buffer_pos];
+        if (src[0] == '\r' || src[0] == '\n') {
+            ctx->read_buffer_pos++;
+            if (src[0] == '\r') {
+                bytes_read = fill_read_buffer(ctx);
+                if (bytes_read == 0 || bytes_read == -1 ||
+                        ctx->read_buffer[ctx->read_buffer_pos] != '\n')
                     return -1;
+                ctx->read_buffer_pos++;
             }
             ctx->num_spaces = POR_LINE_LENGTH - ctx->pos;
             ctx->pos = 0;
@@ -73,8 +98,18 @@ static ssize_t read_bytes(por_ctx_t *ctx, void *dst, size_t len) {
         } else if (ctx->pos == POR_LINE_LENGTH) {
             return -1;
         }
-        *dst_pos++ = byte;
-        ctx->pos++;
+        size_t run_len = 0;
+        size_t max_run_len = POR_LINE_LENGTH - ctx->pos;
+        if (max_run_len > bytes_read)
+            max_run_len = bytes_read;
+        if (max_run_len > dst_end - dst_pos)
+            max_run_len = dst_end - dst_pos;
+        while (run_len < max_run_len && src[run_len] != '\r' && src[run_len] != '\n')
+            run_len++;
+        memcpy(dst_pos, src, run_len);
+        dst_pos += run_len;
+        ctx->read_buffer_pos += run_len;
+        ctx->pos += run_len;
     }
     
     return (int)(dst_pos - (char *)dst);
@@ -191,6 +226,21 @@ static readstat_error_t maybe_read_double(por_ctx_t *ctx, double *out_double, in
     return read_double_with_peek(ctx, out_double, peek);
 }
 
+static readstat_error_t reserve_string_buffer(por_ctx_t *ctx, size_t len) {
+    if (len <= ctx->string_buffer_len)
+        return READSTAT_OK;
+
+    unsigned char *string_buffer = readstat_realloc(ctx->string_buffer, len);
+    if (string_buffer == NULL) {
+        ctx->string_buffer = NULL;
+        ctx->string_buffer_len = 0;
+        return READSTAT_ERROR_MALLOC;
+    }
+    ctx->string_buffer = string_buffer;
+    ctx->string_buffer_len = len;
+    return READSTAT_OK;
+}
+
 static readstat_error_t maybe_read_string(por_ctx_t *ctx, char *data, size_t len, int *out_finished) {
     readstat_error_t retval = READSTAT_OK;
     double value;
@@ -211,11 +261,8 @@ static readstat_error_t maybe_read_string(por_ctx_t *ctx, char *data, size_t len
     }
     string_length = (size_t)value;
     
-    if (string_length > ctx->string_buffer_len) {
-        ctx->string_buffer_len = string_length;
-        ctx->string_buffer = realloc(ctx->string_buffer, ctx->string_buffer_len);
-        memset(ctx->string_buffer, 0, ctx->string_buffer_len);
-    }
+    if ((retval = reserve_string_buffer(ctx, string_length)) != READSTAT_OK)
+        goto cleanup;
     
     if (read_bytes(ctx, ctx->string_buffer, string_length) == -1) {
         retval = READSTAT_ERROR_READ;
@@ -586,6 +633,10 @@ static readstat_error_t read_por_file_data(por_ctx_t *ctx) {
     if (ctx->var_count == 0)
         return READSTAT_OK;
 
+    /* No longer string would fit in input_string, so rows never need more */
+    if ((rs_retval = reserve_string_buffer(ctx, sizeof(input_string))) != READSTAT_OK)
+        return rs_retval;
+
     while (1) {
         int finished = 0;
         for (i=0; i<ctx->var_count; i++) {
@@ -628,7 +679,11 @@ static readstat_error_t read_por_file_data(por_ctx_t *ctx) {
                 }
                 value.is_system_missing = isnan(value.v.double_value);
             }
-            if (ctx->handle.value && !ctx->variables[i]->skip && !ctx->row_offset) {
+            if (ctx->batch && !ctx->variables[i]->skip && !ctx->row_offset) {
+                rs_retval = readstat_batch_append(ctx->batch, ctx->obs_count, ctx->variables[i], value);
+                if (rs_retval != READSTAT_OK)
+                    goto cleanup;
+            } else if (ctx->handle.value && !ctx->variables[i]->skip && !ctx->row_offset) {
                 if (ctx->handle.value(ctx->obs_count, ctx->variables[i], value, ctx->user_ctx) != READSTAT_HANDLER_OK) {
                     rs_retval = READSTAT_ERROR_USER_ABORT;
                     goto cleanup;
@@ -701,12 +756,15 @@ readstat_error_t handle_variables(por_ctx_t *ctx) {
 
         snprintf(label_name_buf, sizeof(label_name_buf), POR_LABEL_NAME_PREFIX "%d", info->labels_index);
 
-        int cb_retval = READSTAT_HANDLER_OK;
+        int cb_retval = READSTAT_HANDLER_SKIP_VARIABLE;
 
-        if (ctx->handle.variable) {
-            cb_retval = ctx->handle.variable(i, ctx->variables[i],
-                    info->labels_index == -1 ? NULL : label_name_buf,
-                    ctx->user_ctx);
+        if (readstat_projection_includes(ctx->projection, i, ctx->variables[i]->name)) {
+            cb_retval = READSTAT_HANDLER_OK;
+            if (ctx->handle.variable) {
+                cb_retval = ctx->handle.variable(i, ctx->variables[i],
+                        info->labels_index == -1 ? NULL : label_name_buf,
+                        ctx->user_ctx);
+            }
         }
 
         if (cb_retval == READSTAT_HANDLER_ABORT) {
@@ -746,6 +804,7 @@ readstat_error_t readstat_parse_por(readstat_parser_t *parser, const char *path,
     por_ctx_t *ctx = por_ctx_init();
     
     ctx->handle = parser->handlers;
+    ctx->projection = parser->projection;
     ctx->user_ctx = user_ctx;
     ctx->io = io;
     ctx->row_limit = parser->row_limit;
@@ -753,11 +812,8 @@ readstat_error_t readstat_parse_por(readstat_parser_t *parser, const char *path,
         ctx->row_offset = parser->row_offset;
 
     if (parser->output_encoding) {
-        if (strcmp(parser->output_encoding, "UTF-8") != 0)
-            ctx->converter = iconv_open(parser->output_encoding, "UTF-8");
-
-        if (ctx->converter == (iconv_t)-1) {
-            ctx->converter = NULL;
+        if (strcmp(parser->output_encoding, "UTF-8") != 0 &&
+                (ctx->converter = readstat_converter_init(parser->output_encoding, "UTF-8")) == NULL) {
             retval = READSTAT_ERROR_UNSUPPORTED_CHARSET;
             goto cleanup;
         }
@@ -889,8 +945,14 @@ readstat_error_t readstat_parse_por(readstat_parser_t *parser, const char *path,
                 if (retval != READSTAT_OK)
                     goto cleanup;
 
-                if (ctx->handle.value) {
+                if (ctx->handle.value || ctx->handle.batch) {
+                    if (ctx->handle.batch && (ctx->batch = readstat_batch_init(parser, user_ctx)) == NULL) {
+                        retval = READSTAT_ERROR_MALLOC;
+                        goto cleanup;
+                    }
                     retval = read_por_file_data(ctx);
+                    if (retval == READSTAT_OK)
+                        retval = readstat_batch_flush(ctx->batch);
                 }
                 goto cleanup;
             default:
@@ -2,10 +2,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
-#include <iconv.h>
 #include <inttypes.h>
 
 #include "../readstat.h"
+#include "../readstat_iconv.h"
 #include "../CKHashTable.h"
 #include "../readstat_writer.h"
 
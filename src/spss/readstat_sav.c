@@ -14,7 +14,9 @@
 #include "../readstat.h"
 #include "../readstat_bits.h"
 #include "../readstat_iconv.h"
+#include "../readstat_convert.h"
 #include "../readstat_malloc.h"
+#include "../readstat_batch.h"
 
 #include "readstat_sav.h"
 
@@ -80,15 +82,19 @@ void sav_ctx_free(sav_ctx_t *ctx) {
         }
         free(ctx->variables);
     }
+    if (ctx->columns)
+        free(ctx->columns);
     if (ctx->raw_string)
         free(ctx->raw_string);
     if (ctx->utf8_string)
         free(ctx->utf8_string);
     if (ctx->converter)
-        iconv_close(ctx->converter);
+        readstat_converter_free(ctx->converter);
     if (ctx->variable_display_values) {
         free(ctx->variable_display_values);
     }
+    if (ctx->batch)
+        readstat_batch_free(ctx->batch);
     free(ctx);
 }
 
@@ -63,6 +63,13 @@ typedef struct sav_dictionary_termination_record_s {
 
 #pragma pack(pop)
 
+/* A variable that is actually decoded; its data starts at
+ * 8*varinfo[varinfo_index]->offset in each row */
+typedef struct sav_column_s {
+    readstat_variable_t *variable;
+    int                  varinfo_index;
+} sav_column_t;
+
 typedef struct sav_ctx_s {
     readstat_callbacks_t  handle;
     size_t                file_size;
@@ -72,6 +79,11 @@ typedef struct sav_ctx_s {
     spss_varinfo_t      **varinfo;
     size_t                varinfo_capacity;
     readstat_variable_t **variables;
+    sav_column_t         *columns;
+    int                   columns_count;
+    struct readstat_batch_s *batch;
+    readstat_row_index_t *row_index;
+    const readstat_projection_t *projection;
 
     const char    *input_encoding;
     const char    *output_encoding;
@@ -79,7 +91,7 @@ typedef struct sav_ctx_s {
     time_t         timestamp;
     uint32_t      *variable_display_values;
     size_t         variable_display_values_count;
-    iconv_t        converter;
+    readstat_converter_t *converter;
     int            var_index;
     int            var_offset;
     int            var_count;
@@ -87,6 +99,7 @@ typedef struct sav_ctx_s {
     int            row_limit;
     int            row_offset;
     int            current_row;
+    int            thread_count;
     int            value_labels_count;
     int            fweight_index;
 
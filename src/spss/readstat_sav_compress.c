@@ -74,12 +74,70 @@ size_t sav_compress_row(void *output_row, void *input_row, size_t input_len,
     return output_offset;
 }
 
-void sav_decompress_row(struct sav_row_stream_s *state) {
-    double fp_value;
+static void sav_init_code_values(struct sav_row_stream_s *state) {
     uint64_t missing_value = state->bswap ? byteswap8(state->missing_value) : state->missing_value;
+    int code;
+
+    for (code=1; code<=251; code++) {
+        double fp_value = code - state->bias;
+        fp_value = state->bswap ? byteswap_double(fp_value) : fp_value;
+        memcpy(&state->code_values[code], &fp_value, sizeof(double));
+    }
+    memset(&state->code_values[254], ' ', sizeof(uint64_t));
+    state->code_values[255] = missing_value;
+
+    state->code_values_ready = 1;
+}
+
+/* Decode a whole control chunk at once. Only taken when all eight values
+ * (plus any raw 253 values) are available and will fit in the current row,
+ * so none of the per-value buffer checks are needed. */
+static int sav_decompress_chunk(struct sav_row_stream_s *state) {
+    const unsigned char *chunk = state->next_in;
+    const unsigned char *next_in = state->next_in + 8;
+    unsigned char *next_out = state->next_out;
+    int i;
+
+    if (state->avail_in < 72 || state->avail_out < 64 || memchr(chunk, 252, 8))
+        return 0;
+
+    for (i=0; i<8; i++) {
+        if (chunk[i] == 0)
+            continue;
+
+        if (chunk[i] == 253) {
+            memcpy(next_out, next_in, 8);
+            next_in += 8;
+        } else {
+            memcpy(next_out, &state->code_values[chunk[i]], 8);
+        }
+        next_out += 8;
+    }
+
+    state->avail_in -= (next_in - state->next_in);
+    state->next_in = next_in;
+    state->avail_out -= (next_out - state->next_out);
+    state->next_out = next_out;
+
+    return 1;
+}
+
+void sav_decompress_row(struct sav_row_stream_s *state) {
     int i = 8 - state->i;
+
+    if (!state->code_values_ready)
+        sav_init_code_values(state);
+
     while (1) {
         if (i == 8) {
+            if (sav_decompress_chunk(state)) {
+                if (state->avail_out < 8) {
+                    state->status = SAV_ROW_STREAM_FINISHED_ROW;
+                    goto done;
+                }
+                continue;
+            }
+
             if (state->avail_in < 8) {
                 state->status = SAV_ROW_STREAM_NEED_DATA;
                 goto done;
@@ -109,20 +167,8 @@ void sav_decompress_row(struct sav_row_stream_s *state) {
                     state->next_in += 8;
                     state->avail_in -= 8;
                     break;
-                case 254:
-                    memset(state->next_out, ' ', 8);
-                    state->next_out += 8;
-                    state->avail_out -= 8;
-                    break;
-                case 255:
-                    memcpy(state->next_out, &missing_value, sizeof(uint64_t));
-                    state->next_out += 8;
-                    state->avail_out -= 8;
-                    break;
-                default:
-                    fp_value = state->chunk[i] - state->bias;
-                    fp_value = state->bswap ? byteswap_double(fp_value) : fp_value;
-                    memcpy(state->next_out, &fp_value, sizeof(double));
+                default: /* 1-251, 254 and 255 */
+                    memcpy(state->next_out, &state->code_values[state->chunk[i]], 8);
                     state->next_out += 8;
                     state->avail_out -= 8;
                     break;
@@ -18,6 +18,10 @@ struct sav_row_stream_s {
     int                   i;
     int                   bswap;
 
+    /* Output bytes for each compression code, built on first use */
+    uint64_t              code_values[256];
+    int                   code_values_ready;
+
     enum sav_row_stream_status status;
 };
 
@@ -305,9 +305,15 @@ readstat_error_t sav_parse_long_variable_names_record(void *data, int count, sav
         size_t input_len = count;
         size_t output_len = input_len * 4;
         pe = p = output_buffer = readstat_malloc(output_len);
-        size_t status = iconv(ctx->converter, 
+        size_t status = iconv(ctx->converter->cd, 
                 (readstat_iconv_inbuf_t)&data, &input_len,
                 (char **)&pe, &output_len);
+        /* Flush anything iconv held back, and leave it in its initial state
+         * for the strings that are converted after this record */
+        if (status != (size_t)-1) {
+            status = iconv(ctx->converter->cd, NULL, NULL, (char **)&pe, &output_len);
+        }
+        iconv(ctx->converter->cd, NULL, NULL, NULL, NULL);
         if (status == (size_t)-1) {
             free(table);
             free(output_buffer);
@@ -322,12 +328,12 @@ readstat_error_t sav_parse_long_variable_names_record(void *data, int count, sav
     int cs;
 
     
-#line 326 "src/spss/readstat_sav_parse.c"
+#line 332 "src/spss/readstat_sav_parse.c"
 	{
 	cs = sav_long_variable_parse_start;
 	}
 
-#line 331 "src/spss/readstat_sav_parse.c"
+#line 337 "src/spss/readstat_sav_parse.c"
 	{
 	int _klen;
 	unsigned int _trans;
@@ -402,7 +408,7 @@ _match:
 		switch ( *_acts++ )
 		{
 	case 0:
-#line 105 "src/spss/readstat_sav_parse.rl"
+#line 111 "src/spss/readstat_sav_parse.rl"
 	{
             varlookup_t *found = bsearch(temp_key, table, var_count, sizeof(varlookup_t), &compare_key_varlookup);
             if (found) {
@@ -416,36 +422,36 @@ _match:
         }
 	break;
 	case 1:
-#line 117 "src/spss/readstat_sav_parse.rl"
+#line 123 "src/spss/readstat_sav_parse.rl"
 	{
             memcpy(temp_key, str_start, str_len);
             temp_key[str_len] = '\0';
         }
 	break;
 	case 2:
-#line 122 "src/spss/readstat_sav_parse.rl"
+#line 128 "src/spss/readstat_sav_parse.rl"
 	{
             memcpy(temp_val, str_start, str_len);
             temp_val[str_len] = '\0';
         }
 	break;
 	case 3:
-#line 129 "src/spss/readstat_sav_parse.rl"
+#line 135 "src/spss/readstat_sav_parse.rl"
 	{ str_start = p; }
 	break;
 	case 4:
-#line 129 "src/spss/readstat_sav_parse.rl"
+#line 135 "src/spss/readstat_sav_parse.rl"
 	{ str_len = p - str_start; }
 	break;
 	case 5:
-#line 131 "src/spss/readstat_sav_parse.rl"
+#line 137 "src/spss/readstat_sav_parse.rl"
 	{ str_start = p; }
 	break;
 	case 6:
-#line 131 "src/spss/readstat_sav_parse.rl"
+#line 137 "src/spss/readstat_sav_parse.rl"
 	{ str_len = p - str_start; }
 	break;
-#line 449 "src/spss/readstat_sav_parse.c"
+#line 455 "src/spss/readstat_sav_parse.c"
 		}
 	}
 
@@ -462,7 +468,7 @@ _again:
 	while ( __nacts-- > 0 ) {
 		switch ( *__acts++ ) {
 	case 0:
-#line 105 "src/spss/readstat_sav_parse.rl"
+#line 111 "src/spss/readstat_sav_parse.rl"
 	{
             varlookup_t *found = bsearch(temp_key, table, var_count, sizeof(varlookup_t), &compare_key_varlookup);
             if (found) {
@@ -476,17 +482,17 @@ _again:
         }
 	break;
 	case 2:
-#line 122 "src/spss/readstat_sav_parse.rl"
+#line 128 "src/spss/readstat_sav_parse.rl"
 	{
             memcpy(temp_val, str_start, str_len);
             temp_val[str_len] = '\0';
         }
 	break;
 	case 6:
-#line 131 "src/spss/readstat_sav_parse.rl"
+#line 137 "src/spss/readstat_sav_parse.rl"
 	{ str_len = p - str_start; }
 	break;
-#line 490 "src/spss/readstat_sav_parse.c"
+#line 496 "src/spss/readstat_sav_parse.c"
 		}
 	}
 	}
@@ -494,7 +500,7 @@ _again:
 	_out: {}
 	}
 
-#line 139 "src/spss/readstat_sav_parse.rl"
+#line 145 "src/spss/readstat_sav_parse.rl"
 
 
     if (cs < 11|| p != pe) {
@@ -518,7 +524,7 @@ _again:
 }
 
 
-#line 522 "src/spss/readstat_sav_parse.c"
+#line 528 "src/spss/readstat_sav_parse.c"
 static const char _sav_very_long_string_parse_actions[] = {
 	0, 1, 0, 1, 2, 1, 3, 2, 
 	4, 1, 2, 5, 2
@@ -591,7 +597,7 @@ static const int sav_very_long_string_parse_start = 1;
 static const int sav_very_long_string_parse_en_main = 1;
 
 
-#line 165 "src/spss/readstat_sav_parse.rl"
+#line 171 "src/spss/readstat_sav_parse.rl"
 
 
 readstat_error_t sav_parse_very_long_string_record(void *data, int count, sav_ctx_t *ctx) {
@@ -619,9 +625,15 @@ readstat_error_t sav_parse_very_long_string_record(void *data, int count, sav_ct
 
         pe = p = output_buffer = readstat_malloc(output_len);
 
-        size_t status = iconv(ctx->converter, 
+        size_t status = iconv(ctx->converter->cd, 
                 (readstat_iconv_inbuf_t)&data, &input_len,
                 (char **)&pe, &output_len);
+        /* Flush anything iconv held back, and leave it in its initial state
+         * for the strings that are converted after this record */
+        if (status != (size_t)-1) {
+            status = iconv(ctx->converter->cd, NULL, NULL, (char **)&pe, &output_len);
+        }
+        iconv(ctx->converter->cd, NULL, NULL, NULL, NULL);
         if (status == (size_t)-1) {
             free(output_buffer);
             return READSTAT_ERROR_PARSE;
@@ -635,12 +647,12 @@ readstat_error_t sav_parse_very_long_string_record(void *data, int count, sav_ct
     table = build_lookup_table(var_count, ctx);
     
     
-#line 639 "src/spss/readstat_sav_parse.c"
+#line 651 "src/spss/readstat_sav_parse.c"
 	{
 	cs = sav_very_long_string_parse_start;
 	}
 
-#line 644 "src/spss/readstat_sav_parse.c"
+#line 656 "src/spss/readstat_sav_parse.c"
 	{
 	int _klen;
 	unsigned int _trans;
@@ -715,7 +727,7 @@ _match:
 		switch ( *_acts++ )
 		{
 	case 0:
-#line 208 "src/spss/readstat_sav_parse.rl"
+#line 220 "src/spss/readstat_sav_parse.rl"
 	{
             varlookup_t *found = bsearch(temp_key, table, var_count, sizeof(varlookup_t), &compare_key_varlookup);
             if (found) {
@@ -724,14 +736,14 @@ _match:
         }
 	break;
 	case 1:
-#line 215 "src/spss/readstat_sav_parse.rl"
+#line 227 "src/spss/readstat_sav_parse.rl"
 	{
             memcpy(temp_key, str_start, str_len);
             temp_key[str_len] = '\0';
         }
 	break;
 	case 2:
-#line 220 "src/spss/readstat_sav_parse.rl"
+#line 232 "src/spss/readstat_sav_parse.rl"
 	{
             if ((*p) != '\0') {
                 unsigned char digit = (*p) - '0';
@@ -744,18 +756,18 @@ _match:
         }
 	break;
 	case 3:
-#line 233 "src/spss/readstat_sav_parse.rl"
+#line 245 "src/spss/readstat_sav_parse.rl"
 	{ str_start = p; }
 	break;
 	case 4:
-#line 233 "src/spss/readstat_sav_parse.rl"
+#line 245 "src/spss/readstat_sav_parse.rl"
 	{ str_len = p - str_start; }
 	break;
 	case 5:
-#line 235 "src/spss/readstat_sav_parse.rl"
+#line 247 "src/spss/readstat_sav_parse.rl"
 	{ temp_val = 0; }
 	break;
-#line 759 "src/spss/readstat_sav_parse.c"
+#line 771 "src/spss/readstat_sav_parse.c"
 		}
 	}
 
@@ -768,7 +780,7 @@ _again:
 	_out: {}
 	}
 
-#line 243 "src/spss/readstat_sav_parse.rl"
+#line 255 "src/spss/readstat_sav_parse.rl"
 
     
     if (cs < 12 || p != pe) {
@@ -85,9 +85,15 @@ readstat_error_t sav_parse_long_variable_names_record(void *data, int count, sav
         size_t input_len = count;
         size_t output_len = input_len * 4;
         pe = p = output_buffer = readstat_malloc(output_len);
-        size_t status = iconv(ctx->converter, 
+        size_t status = iconv(ctx->converter->cd, 
                 (readstat_iconv_inbuf_t)&data, &input_len,
                 (char **)&pe, &output_len);
+        /* Flush anything iconv held back, and leave it in its initial state
+         * for the strings that are converted after this record */
+        if (status != (size_t)-1) {
+            status = iconv(ctx->converter->cd, NULL, NULL, (char **)&pe, &output_len);
+        }
+        iconv(ctx->converter->cd, NULL, NULL, NULL, NULL);
         if (status == (size_t)-1) {
             free(table);
             free(output_buffer);
@@ -189,9 +195,15 @@ readstat_error_t sav_parse_very_long_string_record(void *data, int count, sav_ct
 
         pe = p = output_buffer = readstat_malloc(output_len);
 
-        size_t status = iconv(ctx->converter, 
+        size_t status = iconv(ctx->converter->cd, 
                 (readstat_iconv_inbuf_t)&data, &input_len,
                 (char **)&pe, &output_len);
+        /* Flush anything iconv held back, and leave it in its initial state
+         * for the strings that are converted after this record */
+        if (status != (size_t)-1) {
+            status = iconv(ctx->converter->cd, NULL, NULL, (char **)&pe, &output_len);
+        }
+        iconv(ctx->converter->cd, NULL, NULL, NULL, NULL);
         if (status == (size_t)-1) {
             free(output_buffer);
             return READSTAT_ERROR_PARSE;
@@ -13,6 +13,8 @@
 #include "../readstat_iconv.h"
 #include "../readstat_convert.h"
 #include "../readstat_malloc.h"
+#include "../readstat_batch.h"
+#include "../readstat_projection.h"
 
 #include "readstat_sav.h"
 #include "readstat_sav_compress.h"
@@ -122,9 +124,9 @@ typedef struct value_label_s {
 static readstat_error_t sav_update_progress(sav_ctx_t *ctx);
 static readstat_error_t sav_read_data(sav_ctx_t *ctx);
 static readstat_error_t sav_read_compressed_data(sav_ctx_t *ctx,
-        readstat_error_t (*row_handler)(unsigned char *, size_t, sav_ctx_t *));
+        readstat_error_t (*row_handler)(const unsigned char *, size_t, sav_ctx_t *));
 static readstat_error_t sav_read_uncompressed_data(sav_ctx_t *ctx,
-        readstat_error_t (*row_handler)(unsigned char *, size_t, sav_ctx_t *));
+        readstat_error_t (*row_handler)(const unsigned char *, size_t, sav_ctx_t *));
 
 static readstat_error_t sav_skip_variable_record(sav_ctx_t *ctx);
 static readstat_error_t sav_read_variable_record(sav_ctx_t *ctx);
@@ -144,17 +146,17 @@ static readstat_error_t sav_parse_machine_integer_info_record(const void *data,
 static readstat_error_t sav_parse_long_string_value_labels_record(const void *data, size_t size, size_t count, sav_ctx_t *ctx);
 static readstat_error_t sav_parse_long_string_missing_values_record(const void *data, size_t size, size_t count, sav_ctx_t *ctx);
 
-static void sav_tag_missing_double(readstat_value_t *value, sav_ctx_t *ctx) {
-    double fp_value = value->v.double_value;
+static int sav_double_is_missing(double fp_value, sav_ctx_t *ctx) {
     uint64_t long_value = 0;
     memcpy(&long_value, &fp_value, 8);
-    if (long_value == ctx->missing_double)
-        value->is_system_missing = 1;
-    if (long_value == ctx->lowest_double)
-        value->is_system_missing = 1;
-    if (long_value == ctx->highest_double)
-        value->is_system_missing = 1;
-    if (isnan(fp_value))
+    return (long_value == ctx->missing_double ||
+            long_value == ctx->lowest_double ||
+            long_value == ctx->highest_double ||
+            isnan(fp_value));
+}
+
+static void sav_tag_missing_double(readstat_value_t *value, sav_ctx_t *ctx) {
+    if (sav_double_is_missing(value->v.double_value, ctx))
         value->is_system_missing = 1;
 }
 
@@ -677,81 +679,146 @@ static readstat_error_t sav_read_dictionary_termination_record(sav_ctx_t *ctx) {
     return retval;
 }
 
-static readstat_error_t sav_process_row(unsigned char *buffer, size_t buffer_len, sav_ctx_t *ctx) {
-    if (ctx->row_offset) {
-        ctx->row_offset--;
-        return READSTAT_OK;
+static readstat_error_t sav_process_string(const unsigned char *buffer, size_t buffer_len,
+        sav_column_t *column, char *dst, size_t dst_len, sav_ctx_t *ctx) {
+    spss_varinfo_t *var_info = ctx->varinfo[column->varinfo_index];
+    size_t raw_str_used = 0;
+    int i;
+
+    /* Very long strings are stored as 255-byte segments, each padded out to
+     * 256 bytes; drop the padding byte between segments */
+    for (i=0; i<var_info->n_segments && column->varinfo_index + i < ctx->var_index; i++) {
+        spss_varinfo_t *col_info = ctx->varinfo[column->varinfo_index + i];
+        size_t data_offset = 8 * (size_t)col_info->offset;
+        size_t len = 8 * (size_t)col_info->width;
+
+        if (data_offset + len > buffer_len)
+            return READSTAT_ERROR_ROW_WIDTH_MISMATCH;
+
+        if (len > ctx->raw_string_len - raw_str_used)
+            len = (ctx->raw_string_len - raw_str_used) / 8 * 8;
+
+        memcpy(ctx->raw_string + raw_str_used, &buffer[data_offset], len);
+        raw_str_used += len;
+
+        if (i + 1 < var_info->n_segments)
+            raw_str_used--;
     }
 
+    return readstat_convert(dst, dst_len, ctx->raw_string, raw_str_used, ctx->converter);
+}
+
+static readstat_error_t sav_handle_row(const unsigned char *buffer, size_t buffer_len, sav_ctx_t *ctx) {
     readstat_error_t retval = READSTAT_OK;
     double fp_value;
-    int offset = 0;
-    readstat_off_t data_offset = 0;
-    size_t raw_str_used = 0;
-    int segment_offset = 0;
-    int var_index = 0, col = 0;
+    int j;
 
-    while (data_offset < buffer_len && col < ctx->var_index && var_index < ctx->var_index) {
-        spss_varinfo_t *col_info = ctx->varinfo[col];
-        spss_varinfo_t *var_info = ctx->varinfo[var_index];
+    for (j=0; j<ctx->columns_count; j++) {
+        sav_column_t *column = &ctx->columns[j];
+        spss_varinfo_t *var_info = ctx->varinfo[column->varinfo_index];
         readstat_value_t value = { .type = var_info->type };
-        if (offset > 31) {
-            retval = READSTAT_ERROR_PARSE;
+        if (var_info->type == READSTAT_TYPE_STRING) {
+            retval = sav_process_string(buffer, buffer_len, column,
+                    ctx->utf8_string, ctx->utf8_string_len, ctx);
+            if (retval == READSTAT_ERROR_ROW_WIDTH_MISMATCH) {
+                /* A short row just leaves out its trailing values */
+                retval = READSTAT_OK;
+                break;
+            }
+            if (retval != READSTAT_OK)
+                goto done;
+            value.v.string_value = ctx->utf8_string;
+        } else if (var_info->type == READSTAT_TYPE_DOUBLE) {
+            size_t data_offset = 8 * (size_t)var_info->offset;
+            if (data_offset + 8 > buffer_len)
+                break;
+
+            memcpy(&fp_value, &buffer[data_offset], 8);
+            if (ctx->bswap) {
+                fp_value = byteswap_double(fp_value);
+            }
+            value.v.double_value = fp_value;
+            sav_tag_missing_double(&value, ctx);
+        }
+        if (ctx->handle.value(ctx->current_row, column->variable, value, ctx->user_ctx) != READSTAT_HANDLER_OK) {
+            retval = READSTAT_ERROR_USER_ABORT;
             goto done;
         }
+    }
+done:
+    return retval;
+}
+
+/* Decode a row straight into the batch's column arrays */
+static readstat_error_t sav_handle_batch_row(const unsigned char *buffer, size_t buffer_len, sav_ctx_t *ctx) {
+    readstat_error_t retval = READSTAT_OK;
+    double fp_value;
+    int row = 0;
+    int j;
+
+    if ((retval = readstat_batch_row(ctx->batch, ctx->current_row, &row)) != READSTAT_OK)
+        goto done;
+
+    for (j=0; j<ctx->columns_count; j++) {
+        sav_column_t *column = &ctx->columns[j];
+        spss_varinfo_t *var_info = ctx->varinfo[column->varinfo_index];
+        size_t data_offset = 8 * (size_t)var_info->offset;
+        readstat_batch_column_t *batch_column = NULL;
+
+        /* A short row just leaves out its trailing values */
+        if (var_info->type == READSTAT_TYPE_DOUBLE && data_offset + 8 > buffer_len)
+            break;
+
+        if ((retval = readstat_batch_column(ctx->batch, column->variable, &batch_column)) != READSTAT_OK)
+            goto done;
+
         if (var_info->type == READSTAT_TYPE_STRING) {
-            if (raw_str_used + 8 <= ctx->raw_string_len) {
-                memcpy(ctx->raw_string + raw_str_used, &buffer[data_offset], 8);
-                raw_str_used += 8;
-            }
-            if (++offset == col_info->width) {
-                if (++segment_offset < var_info->n_segments) {
-                    raw_str_used--;
-                }
-                offset = 0;
-                col++;
+            char *dst = readstat_batch_reserve_string(ctx->batch, batch_column, row, ctx->utf8_string_len);
+            if (dst == NULL) {
+                retval = READSTAT_ERROR_MALLOC;
+                goto done;
             }
-            if (segment_offset == var_info->n_segments) {
-                if (!ctx->variables[var_info->index]->skip) {
-                    retval = readstat_convert(ctx->utf8_string, ctx->utf8_string_len, 
-                            ctx->raw_string, raw_str_used, ctx->converter);
-                    if (retval != READSTAT_OK)
-                        goto done;
-                    value.v.string_value = ctx->utf8_string;
-                    if (ctx->handle.value(ctx->current_row, ctx->variables[var_info->index],
-                                value, ctx->user_ctx) != READSTAT_HANDLER_OK) {
-                        retval = READSTAT_ERROR_USER_ABORT;
-                        goto done;
-                    }
-                }
-                raw_str_used = 0;
-                segment_offset = 0;
-                var_index += var_info->n_segments;
+            retval = sav_process_string(buffer, buffer_len, column, dst, ctx->utf8_string_len, ctx);
+            if (retval == READSTAT_ERROR_ROW_WIDTH_MISMATCH) {
+                retval = READSTAT_OK;
+                break;
             }
+            if (retval != READSTAT_OK)
+                goto done;
+            readstat_batch_end_string(ctx->batch, batch_column);
         } else if (var_info->type == READSTAT_TYPE_DOUBLE) {
-            if (!ctx->variables[var_info->index]->skip) {
-                memcpy(&fp_value, &buffer[data_offset], 8);
-                if (ctx->bswap) {
-                    fp_value = byteswap_double(fp_value);
-                }
-                value.v.double_value = fp_value;
-                sav_tag_missing_double(&value, ctx);
-                if (ctx->handle.value(ctx->current_row, ctx->variables[var_info->index],
-                            value, ctx->user_ctx) != READSTAT_HANDLER_OK) {
-                    retval = READSTAT_ERROR_USER_ABORT;
-                    goto done;
-                }
+            memcpy(&fp_value, &buffer[data_offset], 8);
+            if (ctx->bswap) {
+                fp_value = byteswap_double(fp_value);
             }
-            var_index += var_info->n_segments;
-            col++;
+            batch_column->double_values[row] = fp_value;
+            if (sav_double_is_missing(fp_value, ctx))
+                readstat_batch_set_missing(batch_column, row, '\0');
         }
-        data_offset += 8;
     }
-    ctx->current_row++;
 done:
     return retval;
 }
 
+static readstat_error_t sav_process_row(const unsigned char *buffer, size_t buffer_len, sav_ctx_t *ctx) {
+    readstat_error_t retval = READSTAT_OK;
+
+    if (ctx->row_offset) {
+        ctx->row_offset--;
+        return READSTAT_OK;
+    }
+
+    if (ctx->batch) {
+        retval = sav_handle_batch_row(buffer, buffer_len, ctx);
+    } else {
+        retval = sav_handle_row(buffer, buffer_len, ctx);
+    }
+    if (retval == READSTAT_OK)
+        ctx->current_row++;
+
+    return retval;
+}
+
 static readstat_error_t sav_read_data(sav_ctx_t *ctx) {
     readstat_error_t retval = READSTAT_OK;
     size_t longest_string = 256;
@@ -799,7 +866,7 @@ done:
 }
 
 static readstat_error_t sav_read_uncompressed_data(sav_ctx_t *ctx,
-        readstat_error_t (*row_handler)(unsigned char *, size_t, sav_ctx_t *)) {
+        readstat_error_t (*row_handler)(const unsigned char *, size_t, sav_ctx_t *)) {
     readstat_error_t retval = READSTAT_OK;
     readstat_io_t *io = ctx->io;
     unsigned char *buffer = NULL;
@@ -821,10 +888,16 @@ static readstat_error_t sav_read_uncompressed_data(sav_ctx_t *ctx,
         if (retval != READSTAT_OK)
             goto done;
 
-        if ((bytes_read = io->read(buffer, buffer_len, io->io_ctx)) != buffer_len)
-            goto done;
+        const unsigned char *row = NULL;
+        if (io->borrow)
+            row = io->borrow(buffer_len, io->io_ctx);
+        if (row == NULL) {
+            if ((bytes_read = io->read(buffer, buffer_len, io->io_ctx)) != buffer_len)
+                goto done;
+            row = buffer;
+        }
 
-        retval = row_handler(buffer, buffer_len, ctx);
+        retval = row_handler(row, buffer_len, ctx);
         if (retval != READSTAT_OK)
             goto done;
     }
@@ -836,7 +909,7 @@ done:
 }
 
 static readstat_error_t sav_read_compressed_data(sav_ctx_t *ctx,
-        readstat_error_t (*row_handler)(unsigned char *, size_t, sav_ctx_t *)) {
+        readstat_error_t (*row_handler)(const unsigned char *, size_t, sav_ctx_t *)) {
     readstat_error_t retval = READSTAT_OK;
     readstat_io_t *io = ctx->io;
     readstat_off_t data_offset = 0;
@@ -935,12 +1008,12 @@ static readstat_error_t sav_parse_machine_integer_info_record(const void *data,
         ctx->input_encoding = src_charset;
     }
     if (src_charset && dst_charset && strcmp(src_charset, dst_charset) != 0) {
-        iconv_t converter = iconv_open(dst_charset, src_charset);
-        if (converter == (iconv_t)-1) {
+        readstat_converter_t *converter = readstat_converter_init(dst_charset, src_charset);
+        if (converter == NULL) {
             return READSTAT_ERROR_UNSUPPORTED_CHARSET;
         }
         if (ctx->converter) {
-            iconv_close(ctx->converter);
+            readstat_converter_free(ctx->converter);
         }
         ctx->converter = converter;
     }
@@ -1470,24 +1543,39 @@ static void sav_set_n_segments_and_var_count(sav_ctx_t *ctx) {
     ctx->variables = readstat_calloc(ctx->var_count, sizeof(readstat_variable_t *));
 }
 
+/* Variables are set up even without a variable handler, since the rows are
+ * decoded through ctx->columns: one entry per variable that was neither
+ * projected away nor skipped by the handler. */
 static readstat_error_t sav_handle_variables(sav_ctx_t *ctx) {
     int i;
     int index_after_skipping = 0;
     readstat_error_t retval = READSTAT_OK;
 
-    if (!ctx->handle.variable)
+    if (ctx->var_count == 0)
         return retval;
 
+    if ((ctx->columns = readstat_calloc(ctx->var_count, sizeof(sav_column_t))) == NULL) {
+        retval = READSTAT_ERROR_MALLOC;
+        goto cleanup;
+    }
+
     for (i=0; i<ctx->var_index;) {
         char label_name_buf[256];
         spss_varinfo_t *info = ctx->varinfo[i];
-        ctx->variables[info->index] = spss_init_variable_for_info(info, index_after_skipping);
-
-        snprintf(label_name_buf, sizeof(label_name_buf), SAV_LABEL_NAME_PREFIX "%d", info->labels_index);
-
-        int cb_retval = ctx->handle.variable(info->index, ctx->variables[info->index],
-                info->labels_index == -1 ? NULL : label_name_buf,
-                ctx->user_ctx);
+        readstat_variable_t *variable = spss_init_variable_for_info(info, index_after_skipping);
+        ctx->variables[info->index] = variable;
+
+        int cb_retval = READSTAT_HANDLER_SKIP_VARIABLE;
+        if (readstat_projection_includes(ctx->projection, info->index, variable->name)) {
+            cb_retval = READSTAT_HANDLER_OK;
+            if (ctx->handle.variable) {
+                snprintf(label_name_buf, sizeof(label_name_buf), SAV_LABEL_NAME_PREFIX "%d", info->labels_index);
+
+                cb_retval = ctx->handle.variable(info->index, variable,
+                        info->labels_index == -1 ? NULL : label_name_buf,
+                        ctx->user_ctx);
+            }
+        }
 
         if (cb_retval == READSTAT_HANDLER_ABORT) {
             retval = READSTAT_ERROR_USER_ABORT;
@@ -1495,8 +1583,11 @@ static readstat_error_t sav_handle_variables(sav_ctx_t *ctx) {
         }
 
         if (cb_retval == READSTAT_HANDLER_SKIP_VARIABLE) {
-            ctx->variables[info->index]->skip = 1;
+            variable->skip = 1;
         } else {
+            sav_column_t *column = &ctx->columns[ctx->columns_count++];
+            column->variable = variable;
+            column->varinfo_index = i;
             index_after_skipping++;
         }
 
@@ -1584,6 +1675,12 @@ readstat_error_t readstat_parse_sav(readstat_parser_t *parser, const char *path,
     ctx->output_encoding = parser->output_encoding;
     ctx->user_ctx = user_ctx;
     ctx->file_size = file_size;
+    ctx->thread_count = parser->thread_count;
+    ctx->projection = parser->projection;
+    /* The data records are only read when there's a value or batch handler
+     * to give the rows to, so otherwise there's nothing to index */
+    if (ctx->handle.value || ctx->handle.batch)
+        ctx->row_index = parser->row_index;
     if (parser->row_offset > 0)
         ctx->row_offset = parser->row_offset;
     if (ctx->record_count != -1) {
@@ -1654,8 +1751,16 @@ readstat_error_t readstat_parse_sav(readstat_parser_t *parser, const char *path,
     if ((retval = sav_handle_fweight(ctx)) != READSTAT_OK)
         goto cleanup;
 
-    if (ctx->handle.value) {
-        retval = sav_read_data(ctx);
+    if (ctx->handle.value || ctx->handle.batch) {
+        if (ctx->handle.batch && (ctx->batch = readstat_batch_init(parser, user_ctx)) == NULL) {
+            retval = READSTAT_ERROR_MALLOC;
+            goto cleanup;
+        }
+
+        if ((retval = sav_read_data(ctx)) != READSTAT_OK)
+            goto cleanup;
+
+        retval = readstat_batch_flush(ctx->batch);
     }
     
 cleanup:
@@ -29,6 +29,7 @@
 #if HAVE_ZLIB
 #include <zlib.h>
 
+#include "../readstat_parallel.h"
 #include "readstat_zsav_compress.h"
 #include "readstat_zsav_write.h"
 #endif
@@ -1187,6 +1188,38 @@ static readstat_error_t sav_write_double(void *row, const readstat_variable_t *v
     return READSTAT_OK;
 }
 
+static readstat_error_t sav_write_doubles(void *row, size_t row_len, const readstat_variable_t *var,
+        const double *values, int count) {
+    unsigned char *cell = (unsigned char *)row;
+    int i;
+    for (i=0; i<count; i++, cell += row_len) {
+        memcpy(cell, &values[i], sizeof(double));
+    }
+    return READSTAT_OK;
+}
+
+static readstat_error_t sav_write_floats(void *row, size_t row_len, const readstat_variable_t *var,
+        const double *values, int count) {
+    unsigned char *cell = (unsigned char *)row;
+    int i;
+    for (i=0; i<count; i++, cell += row_len) {
+        double dval = (float)values[i];
+        memcpy(cell, &dval, sizeof(double));
+    }
+    return READSTAT_OK;
+}
+
+static readstat_error_t sav_write_int32s(void *row, size_t row_len, const readstat_variable_t *var,
+        const int32_t *values, int count) {
+    unsigned char *cell = (unsigned char *)row;
+    int i;
+    for (i=0; i<count; i++, cell += row_len) {
+        double dval = values[i];
+        memcpy(cell, &dval, sizeof(double));
+    }
+    return READSTAT_OK;
+}
+
 static readstat_error_t sav_write_string(void *row, const readstat_variable_t *var, const char *value) {
     memset(row, ' ', var->storage_width);
     if (value != NULL && value[0] != '\0') {
@@ -1390,7 +1423,13 @@ cleanup:
             writer->module_ctx = readstat_malloc(row_bound);
 #if HAVE_ZLIB
         } else if (writer->compression == READSTAT_COMPRESS_BINARY) {
-            writer->module_ctx = zsav_ctx_init(row_bound, writer->bytes_written);
+            writer->module_ctx = zsav_ctx_init(row_bound, writer->bytes_written,
+                    writer->compression_level, writer->thread_count);
+            if (writer->module_ctx == NULL) {
+                retval = READSTAT_ERROR_MALLOC;
+            } else {
+                retval = zsav_begin_data(writer);
+            }
 #endif
         }
     }
@@ -1426,6 +1465,9 @@ readstat_error_t readstat_begin_writing_sav(readstat_writer_t *writer, void *use
     writer->callbacks.write_int32 = &sav_write_int32;
     writer->callbacks.write_float = &sav_write_float;
     writer->callbacks.write_double = &sav_write_double;
+    writer->callbacks.write_doubles = &sav_write_doubles;
+    writer->callbacks.write_floats = &sav_write_floats;
+    writer->callbacks.write_int32s = &sav_write_int32s;
     writer->callbacks.write_string = &sav_write_string;
     writer->callbacks.write_missing_string = &sav_write_missing_string;
     writer->callbacks.write_missing_number = &sav_write_missing_number;
@@ -1,108 +1,184 @@
-
 #include <zlib.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
+#include "../readstat.h"
+#include "../readstat_parallel.h"
 #include "readstat_zsav_compress.h"
 
-zsav_ctx_t *zsav_ctx_init(size_t max_row_len, int64_t offset) {
-    zsav_ctx_t *ctx = calloc(1, sizeof(zsav_ctx_t));
+/* Row-compressed bytes are collected into fixed-size blocks, and each full
+ * block is deflated as a unit. Up to thread_count full blocks are compressed
+ * at a time on worker threads while the caller keeps filling the next ones;
+ * with a single thread each block is compressed as soon as it fills up. */
 
-    ctx->buffer = malloc(max_row_len);
+/* Returns NULL if any allocation fails */
+zsav_ctx_t *zsav_ctx_init(size_t max_row_len, int64_t offset,
+        int compression_level, int thread_count) {
+    zsav_ctx_t *ctx = calloc(1, sizeof(zsav_ctx_t));
+    if (ctx == NULL)
+        return NULL;
 
     ctx->blocks_capacity = 10;
-    ctx->blocks = calloc(ctx->blocks_capacity, sizeof(zsav_block_t *));
-
     ctx->uncompressed_block_size = 0x3FF000;
     ctx->zheader_ofs = offset;
 
-    ctx->compression_level = Z_DEFAULT_COMPRESSION;
+    ctx->compression_level = compression_level;
+    ctx->thread_count = thread_count > 1 ? thread_count : 1;
+
+    if ((ctx->buffer = malloc(max_row_len)) == NULL ||
+            (ctx->blocks = calloc(ctx->blocks_capacity, sizeof(zsav_block_t *))) == NULL ||
+            (ctx->running = calloc(ctx->thread_count, sizeof(zsav_block_t *))) == NULL) {
+        zsav_ctx_free(ctx);
+        return NULL;
+    }
 
     return ctx;
 }
 
 void zsav_ctx_free(zsav_ctx_t *ctx) {
     int i;
+    readstat_parallel_free(&ctx->parallel);
     for (i=0; i<ctx->blocks_count; i++) {
         zsav_block_t *block = ctx->blocks[i];
-        deflateEnd(&block->stream);
+        free(block->uncompressed_data);
         free(block->compressed_data);
         free(block);
     }
     free(ctx->blocks);
+    free(ctx->running);
     free(ctx->buffer);
     free(ctx);
 }
 
+/* Returns NULL, leaving the context as it was, if an allocation fails */
 zsav_block_t *zsav_add_block(zsav_ctx_t *ctx) {
     zsav_block_t *block = NULL;
     if (ctx->blocks_count == ctx->blocks_capacity) {
-        ctx->blocks = realloc(ctx->blocks, (ctx->blocks_capacity *= 2 ) * sizeof(zsav_block_t *));
+        zsav_block_t **blocks = realloc(ctx->blocks, 2 * ctx->blocks_capacity * sizeof(zsav_block_t *));
+        if (blocks == NULL)
+            return NULL;
+
+        ctx->blocks = blocks;
+        ctx->blocks_capacity *= 2;
     }
 
-    block = calloc(1, sizeof(zsav_block_t));
-    ctx->blocks[ctx->blocks_count++] = block;
+    if ((block = calloc(1, sizeof(zsav_block_t))) == NULL)
+        return NULL;
 
-    deflateInit(&block->stream, ctx->compression_level);
+    if ((block->uncompressed_data = malloc(ctx->uncompressed_block_size)) == NULL) {
+        free(block);
+        return NULL;
+    }
 
-    block->compressed_data_capacity = deflateBound(&block->stream, ctx->uncompressed_block_size);
-    block->compressed_data = malloc(block->compressed_data_capacity);
+    ctx->blocks[ctx->blocks_count++] = block;
 
     return block;
 }
 
+/* The block currently being filled, if any */
 zsav_block_t *zsav_current_block(zsav_ctx_t *ctx) {
-    if (ctx->blocks_count == 0)
+    if (ctx->blocks_count == ctx->blocks_full)
         return NULL;
 
     return ctx->blocks[ctx->blocks_count-1];
 }
 
-int zsav_compress_row(void *input, size_t input_len, int finish, zsav_ctx_t *ctx) {
-    off_t row_off = 0;
-    unsigned char *row_buffer = input;
-    size_t row_len = input_len;
-    zsav_block_t *block = zsav_current_block(ctx);
-    int deflate_status = Z_OK;
-    if (block == NULL) {
-        block = zsav_add_block(ctx);
+static void zsav_compress_block(void *item, void *ctx) {
+    zsav_block_t *block = *(zsav_block_t **)item;
+    zsav_ctx_t *zctx = (zsav_ctx_t *)ctx;
+    uLongf compressed_len = compressBound(block->uncompressed_size);
+
+    if ((block->compressed_data = malloc(compressed_len)) == NULL) {
+        block->compress_status = Z_MEM_ERROR;
+        return;
+    }
+
+    block->compress_status = compress2(block->compressed_data, &compressed_len,
+            block->uncompressed_data, block->uncompressed_size, zctx->compression_level);
+    block->compressed_size = compressed_len;
+
+    free(block->uncompressed_data);
+    block->uncompressed_data = NULL;
+}
+
+static readstat_error_t zsav_wait_blocks(zsav_ctx_t *ctx) {
+    readstat_error_t retval = READSTAT_OK;
+    int i;
+
+    readstat_parallel_wait(&ctx->parallel);
+
+    for (i=0; i<ctx->running_count; i++) {
+        if (ctx->running[i]->compress_status != Z_OK)
+            retval = READSTAT_ERROR_WRITE;
     }
+    ctx->running_count = 0;
+    ctx->blocks_compressed = ctx->blocks_started;
+
+    return retval;
+}
 
-    block->stream.next_in = row_buffer;
-    block->stream.avail_in = row_len;
+static readstat_error_t zsav_start_blocks(zsav_ctx_t *ctx) {
+    readstat_error_t retval = READSTAT_OK;
 
-    block->stream.next_out = &block->compressed_data[block->compressed_size];
-    block->stream.avail_out = block->compressed_data_capacity - block->compressed_size;
+    if ((retval = zsav_wait_blocks(ctx)) != READSTAT_OK)
+        goto cleanup;
 
-    /* If the row won't fit into this block, keep writing and flushing
-     * until the remainder fits. */
-    while (row_len - row_off > ctx->uncompressed_block_size - block->uncompressed_size) {
+    ctx->running_count = ctx->blocks_full - ctx->blocks_started;
+    memcpy(ctx->running, &ctx->blocks[ctx->blocks_started],
+            ctx->running_count * sizeof(zsav_block_t *));
+    ctx->blocks_started = ctx->blocks_full;
 
-        block->stream.avail_in = ctx->uncompressed_block_size - block->uncompressed_size;
-        row_off += ctx->uncompressed_block_size - block->uncompressed_size;
+    retval = readstat_parallel_start(&ctx->parallel, ctx->thread_count,
+            &zsav_compress_block, ctx, ctx->running, sizeof(zsav_block_t *), ctx->running_count);
 
-        if ((deflate_status = deflate(&block->stream, Z_FINISH)) != Z_STREAM_END) {
+cleanup:
+    return retval;
+}
+
+static readstat_error_t zsav_finish_block(zsav_ctx_t *ctx) {
+    ctx->blocks_full = ctx->blocks_count;
+    if (ctx->blocks_full - ctx->blocks_started < ctx->thread_count)
+        return READSTAT_OK;
+
+    return zsav_start_blocks(ctx);
+}
+
+readstat_error_t zsav_compress_row(void *input, size_t input_len, int finish, zsav_ctx_t *ctx) {
+    readstat_error_t retval = READSTAT_OK;
+    unsigned char *row_buffer = input;
+    size_t row_off = 0;
+    zsav_block_t *block = NULL;
+
+    while (row_off < input_len) {
+        if ((block = zsav_current_block(ctx)) == NULL &&
+                (block = zsav_add_block(ctx)) == NULL) {
+            retval = READSTAT_ERROR_MALLOC;
             goto cleanup;
         }
 
-        block->compressed_size = block->compressed_data_capacity - block->stream.avail_out;
-        block->uncompressed_size = ctx->uncompressed_block_size - block->stream.avail_in;
-
-        block = zsav_add_block(ctx);
+        size_t len = ctx->uncompressed_block_size - block->uncompressed_size;
+        if (len > input_len - row_off)
+            len = input_len - row_off;
 
-        block->stream.next_in = &row_buffer[row_off];
-        block->stream.avail_in = row_len - row_off;
+        memcpy(&block->uncompressed_data[block->uncompressed_size], &row_buffer[row_off], len);
+        block->uncompressed_size += len;
+        row_off += len;
 
-        block->stream.next_out = block->compressed_data;
-        block->stream.avail_out = block->compressed_data_capacity;
+        if (block->uncompressed_size == ctx->uncompressed_block_size) {
+            if ((retval = zsav_finish_block(ctx)) != READSTAT_OK)
+                goto cleanup;
+        }
     }
 
-    /* Now the rest of the row will fit in the block */
-    deflate_status = deflate(&block->stream, finish ? Z_FINISH : Z_NO_FLUSH);
-
-    block->compressed_size = block->compressed_data_capacity - block->stream.avail_out;
-    block->uncompressed_size += (row_len - row_off) - block->stream.avail_in;
+    if (finish) {
+        ctx->blocks_full = ctx->blocks_count;
+        if ((retval = zsav_start_blocks(ctx)) != READSTAT_OK)
+            goto cleanup;
+        if ((retval = zsav_wait_blocks(ctx)) != READSTAT_OK)
+            goto cleanup;
+    }
 
 cleanup:
-    return deflate_status;
+    return retval;
 }
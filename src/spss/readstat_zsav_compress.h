@@ -3,10 +3,9 @@ typedef struct zsav_block_s {
     int32_t        uncompressed_size;
     int32_t        compressed_size;
 
-    z_stream       stream;
-
+    unsigned char *uncompressed_data;
     unsigned char *compressed_data;
-    size_t         compressed_data_capacity;
+    int            compress_status;
 } zsav_block_t;
 
 typedef struct zsav_ctx_s {
@@ -15,15 +14,31 @@ typedef struct zsav_ctx_s {
     int             blocks_count;
     int             blocks_capacity;
 
+    /* blocks[0..blocks_written) have been passed to the data writer;
+     * blocks[blocks_written..blocks_compressed) are ready to be written;
+     * blocks[blocks_compressed..blocks_started) are being compressed;
+     * blocks[blocks_started..blocks_full) are full and waiting for it */
+    int             blocks_written;
+    int             blocks_compressed;
+    int             blocks_started;
+    int             blocks_full;
+
     int64_t         uncompressed_block_size;
     int64_t         zheader_ofs;
 
     int             compression_level;
+    int             thread_count;
+    int             streaming;
+
+    zsav_block_t      **running;
+    int                 running_count;
+    readstat_parallel_t parallel;
 } zsav_ctx_t;
 
-zsav_ctx_t *zsav_ctx_init(size_t max_row_len, int64_t offset);
+zsav_ctx_t *zsav_ctx_init(size_t max_row_len, int64_t offset,
+        int compression_level, int thread_count);
 void zsav_ctx_free(zsav_ctx_t *ctx);
 
 zsav_block_t *zsav_add_block(zsav_ctx_t *ctx);
 zsav_block_t *zsav_current_block(zsav_ctx_t *ctx);
-int zsav_compress_row(void *input, size_t input_len, int finish, zsav_ctx_t *zctx);
+readstat_error_t zsav_compress_row(void *input, size_t input_len, int finish, zsav_ctx_t *zctx);
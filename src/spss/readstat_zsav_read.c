@@ -1,10 +1,13 @@
 #include <stdlib.h>
+#include <string.h>
 #include <zlib.h>
 
 #include "../readstat.h"
 #include "../readstat_bits.h"
 #include "../readstat_iconv.h"
 #include "../readstat_malloc.h"
+#include "../readstat_parallel.h"
+#include "../readstat_row_index.h"
 #include "readstat_sav.h"
 #include "readstat_sav_compress.h"
 
@@ -28,27 +31,261 @@ struct ztrailer_entry {
     int32_t compressed_size;
 };
 
-readstat_error_t zsav_read_compressed_data(sav_ctx_t *ctx,
-        readstat_error_t (*row_handler)(unsigned char *, size_t, sav_ctx_t *)) {
+typedef struct zsav_block_s {
+    int                    index;
+    struct ztrailer_entry *entry;
+    unsigned char         *compressed;
+    size_t                 compressed_capacity;
+    unsigned char         *uncompressed;
+    size_t                 uncompressed_capacity;
+    uLongf                 uncompressed_len;
+    int                    status;
+    /* Kept from block to block, since inflateInit() allocates */
+    z_stream               stream;
+    int                    stream_ready;
+} zsav_block_t;
+
+typedef struct zsav_block_batch_s {
+    zsav_block_t          *blocks;
+    int                    blocks_count;
+    int                    pending;
+} zsav_block_batch_t;
+
+typedef struct zsav_row_ctx_s {
+    struct sav_row_stream_s state;
+    unsigned char         *row;
+    size_t                 row_len;
+    size_t                 row_offset;
+    int64_t                rows_completed;
+} zsav_row_ctx_t;
+
+/* Row streams run across block boundaries, so a row index entry also records
+ * where the stream was at the start of its block: the unconsumed part of the
+ * current control chunk, and how much of the current row was already output.
+ * In the entry, row_words is stored little-endian. */
+typedef struct zsav_block_state_s {
+    unsigned char          chunk_remaining;
+    unsigned char          chunk[8];
+    uint32_t               row_words;
+} zsav_block_state_t;
+
+#define ZSAV_BLOCK_STATE_LEN  13
+
+static void zsav_read_block_state(zsav_block_state_t *block_state, const unsigned char *state) {
+    block_state->chunk_remaining = state[0];
+    memcpy(block_state->chunk, &state[1], sizeof(block_state->chunk));
+    block_state->row_words = state[9] | (state[10] << 8) | (state[11] << 16) | ((uint32_t)state[12] << 24);
+}
+
+static void zsav_save_block_state(zsav_row_ctx_t *row_ctx, unsigned char *state) {
+    uint32_t row_words = row_ctx->row_offset / 8;
+    state[0] = row_ctx->state.i;
+    memcpy(&state[1], row_ctx->state.chunk, sizeof(row_ctx->state.chunk));
+    state[9] = row_words & 0xFF;
+    state[10] = (row_words >> 8) & 0xFF;
+    state[11] = (row_words >> 16) & 0xFF;
+    state[12] = (row_words >> 24) & 0xFF;
+}
+
+static void zsav_restore_block_state(zsav_row_ctx_t *row_ctx, const unsigned char *state) {
+    zsav_block_state_t block_state;
+    zsav_read_block_state(&block_state, state);
+    row_ctx->state.i = block_state.chunk_remaining;
+    row_ctx->row_offset = block_state.row_words * 8;
+    memcpy(row_ctx->state.chunk, block_state.chunk, sizeof(block_state.chunk));
+}
+
+/* Start at the last indexed block whose first new row is at or before
+ * row_offset, and skip only the rows from there on. */
+static readstat_error_t zsav_skip_indexed_blocks(sav_ctx_t *ctx, zsav_row_ctx_t *row_ctx,
+        int n_blocks, int *out_block_i) {
+    int64_t i;
+    int64_t block_count = readstat_row_index_get_block_count(ctx->row_index);
+    readstat_row_index_entry_t *start = NULL;
+
+    for (i=0; i<block_count && i<n_blocks; i++) {
+        readstat_row_index_entry_t *entry = readstat_row_index_get_entry(ctx->row_index, i);
+        zsav_block_state_t block_state;
+        zsav_read_block_state(&block_state, entry->state);
+        if (block_state.chunk_remaining > 8 || (block_state.row_words &&
+                    block_state.row_words * 8 >= row_ctx->row_len))
+            return READSTAT_ERROR_PARSE;
+        if (entry->first_row + (block_state.row_words ? 1 : 0) > ctx->row_offset)
+            break;
+        start = entry;
+        *out_block_i = i;
+    }
+
+    if (start) {
+        zsav_restore_block_state(row_ctx, start->state);
+        row_ctx->rows_completed = start->first_row;
+        ctx->row_offset -= start->first_row;
+    }
+
+    return READSTAT_OK;
+}
+
+
+/* Same as uncompress(), but reusing the block's stream */
+static void zsav_inflate_block(void *item, void *ctx) {
+    zsav_block_t *block = (zsav_block_t *)item;
+    z_stream *stream = &block->stream;
+
+    if (block->stream_ready) {
+        block->status = inflateReset(stream);
+    } else {
+        block->status = inflateInit(stream);
+        block->stream_ready = (block->status == Z_OK);
+    }
+    if (block->status != Z_OK)
+        return;
+
+    stream->next_in = block->compressed;
+    stream->avail_in = block->entry->compressed_size;
+    stream->next_out = block->uncompressed;
+    stream->avail_out = block->entry->uncompressed_size;
+
+    block->status = inflate(stream, Z_FINISH);
+    block->uncompressed_len = stream->total_out;
+    if (block->status == Z_STREAM_END) {
+        block->status = Z_OK;
+    } else if (block->status == Z_OK) {
+        block->status = Z_DATA_ERROR;
+    }
+}
+
+/* The first time a block buffer is used, it's sized for the largest block
+ * in the file (given by `largest'), so that it never has to grow */
+static readstat_error_t zsav_read_block(sav_ctx_t *ctx, zsav_block_t *block,
+        struct ztrailer_entry *entry, int index, const struct ztrailer_entry *largest) {
     readstat_error_t retval = READSTAT_OK;
     readstat_io_t *io = ctx->io;
+
+    block->index = index;
+    block->entry = entry;
+    if (io->seek(entry->compressed_ofs, READSTAT_SEEK_SET, io->io_ctx) == -1) {
+        retval = READSTAT_ERROR_SEEK;
+        goto cleanup;
+    }
+    if (entry->compressed_size > block->compressed_capacity) {
+        if ((block->compressed = readstat_realloc(block->compressed, largest->compressed_size)) == NULL) {
+            retval = READSTAT_ERROR_MALLOC;
+            goto cleanup;
+        }
+        block->compressed_capacity = largest->compressed_size;
+    }
+    if (io->read(block->compressed, entry->compressed_size, io->io_ctx) != entry->compressed_size) {
+        retval = READSTAT_ERROR_READ;
+        goto cleanup;
+    }
+    if (entry->uncompressed_size > block->uncompressed_capacity) {
+        if ((block->uncompressed = readstat_realloc(block->uncompressed, largest->uncompressed_size)) == NULL) {
+            retval = READSTAT_ERROR_MALLOC;
+            goto cleanup;
+        }
+        block->uncompressed_capacity = largest->uncompressed_size;
+    }
+
+cleanup:
+    return retval;
+}
+
+/* Feeds one inflated block through the row decompressor. Sets *out_done
+ * once the last row, or the row limit, has been reached. */
+static readstat_error_t zsav_process_block(sav_ctx_t *ctx, zsav_block_t *block, zsav_row_ctx_t *row_ctx,
+        readstat_error_t (*row_handler)(const unsigned char *, size_t, sav_ctx_t *), int *out_done) {
+    readstat_error_t retval = READSTAT_OK;
+    struct sav_row_stream_s *state = &row_ctx->state;
     readstat_off_t data_offset = 0;
+    int64_t first_row = row_ctx->rows_completed;
+    unsigned char block_state[READSTAT_ROW_INDEX_STATE_LEN] = { 0 };
+
+    if (block->status != Z_OK || block->uncompressed_len != block->entry->uncompressed_size) {
+        retval = READSTAT_ERROR_PARSE;
+        goto cleanup;
+    }
+
+    if (ctx->row_index)
+        zsav_save_block_state(row_ctx, block_state);
 
-    size_t uncompressed_row_len = ctx->var_offset * 8;
-    readstat_off_t uncompressed_offset = 0;
-    unsigned char *uncompressed_row = NULL;
+    state->status = SAV_ROW_STREAM_HAVE_DATA;
 
-    uLongf uncompressed_block_len = 0;
-    unsigned char *compressed_block = NULL, *uncompressed_block = NULL;
+    while (state->status != SAV_ROW_STREAM_NEED_DATA) {
+        state->next_in = &block->uncompressed[data_offset];
+        state->avail_in = block->uncompressed_len - data_offset;
 
-    struct sav_row_stream_s state = { 
-        .missing_value = ctx->missing_double,
-        .bias = ctx->bias,
-        .bswap = ctx->bswap };
+        state->next_out = &row_ctx->row[row_ctx->row_offset];
+        state->avail_out = row_ctx->row_len - row_ctx->row_offset;
+
+        sav_decompress_row(state);
+
+        row_ctx->row_offset = row_ctx->row_len - state->avail_out;
+        data_offset = block->uncompressed_len - state->avail_in;
+
+        if (state->status == SAV_ROW_STREAM_FINISHED_ROW) {
+            retval = row_handler(row_ctx->row, row_ctx->row_len, ctx);
+            if (retval != READSTAT_OK)
+                goto cleanup;
+
+            row_ctx->row_offset = 0;
+            row_ctx->rows_completed++;
+        }
+
+        if (state->status == SAV_ROW_STREAM_FINISHED_ALL ||
+                (ctx->row_limit > 0 && ctx->current_row == ctx->row_limit)) {
+            *out_done = 1;
+            goto cleanup;
+        }
+    }
+
+    if (ctx->row_index) {
+        retval = readstat_row_index_add_entry(ctx->row_index, block->index, first_row,
+                row_ctx->rows_completed - first_row, 0, block_state, ZSAV_BLOCK_STATE_LEN);
+    }
+
+cleanup:
+    return retval;
+}
+
+/* The batch must have been inflated already */
+static readstat_error_t zsav_process_batch(sav_ctx_t *ctx, zsav_block_batch_t *batch, zsav_row_ctx_t *row_ctx,
+        readstat_error_t (*row_handler)(const unsigned char *, size_t, sav_ctx_t *), int *out_done) {
+    readstat_error_t retval = READSTAT_OK;
+    int i;
+
+    batch->pending = 0;
+
+    for (i=0; i<batch->blocks_count && !*out_done; i++) {
+        if ((retval = zsav_process_block(ctx, &batch->blocks[i], row_ctx, row_handler, out_done)) != READSTAT_OK)
+            break;
+    }
+
+    return retval;
+}
+
+readstat_error_t zsav_read_compressed_data(sav_ctx_t *ctx,
+        readstat_error_t (*row_handler)(const unsigned char *, size_t, sav_ctx_t *)) {
+    readstat_error_t retval = READSTAT_OK;
+    readstat_io_t *io = ctx->io;
+
+    zsav_row_ctx_t row_ctx = {
+        .state = {
+            .missing_value = ctx->missing_double,
+            .bias = ctx->bias,
+            .bswap = ctx->bswap },
+        .row_len = ctx->var_offset * 8 };
+
+    readstat_parallel_t parallel = { 0 };
+    zsav_block_batch_t batches[2] = { { 0 } };
+    int batch_capacity = 1;
+    int current = 0;
+    int done = 0;
 
     struct zheader zheader;
     struct ztrailer ztrailer;
     struct ztrailer_entry *ztrailer_entries = NULL;
+    struct ztrailer_entry largest = { 0 };
+    uint64_t fingerprint = READSTAT_ROW_INDEX_FINGERPRINT_INIT;
 
     int n_blocks = 0;
     int block_i = 0;
@@ -80,25 +317,35 @@ readstat_error_t zsav_read_compressed_data(sav_ctx_t *ctx,
         goto cleanup;
     }
 
+    /* The block table, with the compressed size of every block, tells the
+     * file apart from another of the same size that an index was built from */
+    fingerprint = readstat_row_index_fingerprint(fingerprint, &ztrailer, sizeof(struct ztrailer));
+
     ztrailer.bias = ctx->bswap ? byteswap8(ztrailer.bias) : ztrailer.bias;
     ztrailer.zero = ctx->bswap ? byteswap8(ztrailer.zero) : ztrailer.zero;
     ztrailer.block_size = ctx->bswap ? byteswap4(ztrailer.block_size) : ztrailer.block_size;
     ztrailer.n_blocks = ctx->bswap ? byteswap4(ztrailer.n_blocks) : ztrailer.n_blocks;
 
-    if (n_blocks != ztrailer.n_blocks) {
+    if (n_blocks < 0 || n_blocks != ztrailer.n_blocks) {
         retval = READSTAT_ERROR_PARSE;
         goto cleanup;
     }
 
-    if (n_blocks && (ztrailer_entries = readstat_malloc(n_blocks * sizeof(struct ztrailer_entry))) == NULL) {
-        retval = READSTAT_ERROR_MALLOC;
-        goto cleanup;
-    }
+    /* A file with no rows has no blocks */
+    if (n_blocks) {
+        if ((ztrailer_entries = readstat_malloc(n_blocks * sizeof(struct ztrailer_entry))) == NULL) {
+            retval = READSTAT_ERROR_MALLOC;
+            goto cleanup;
+        }
 
-    if (io->read(ztrailer_entries, n_blocks * sizeof(struct ztrailer_entry), io->io_ctx) < 
-            n_blocks * sizeof(struct ztrailer_entry)) {
-        retval = READSTAT_ERROR_READ;
-        goto cleanup;
+        if (io->read(ztrailer_entries, n_blocks * sizeof(struct ztrailer_entry), io->io_ctx) < 
+                n_blocks * sizeof(struct ztrailer_entry)) {
+            retval = READSTAT_ERROR_READ;
+            goto cleanup;
+        }
+
+        fingerprint = readstat_row_index_fingerprint(fingerprint, ztrailer_entries,
+                n_blocks * sizeof(struct ztrailer_entry));
     }
 
     for (i=0; i<n_blocks; i++) {
@@ -108,83 +355,99 @@ readstat_error_t zsav_read_compressed_data(sav_ctx_t *ctx,
         entry->compressed_ofs = ctx->bswap ? byteswap8(entry->compressed_ofs) : entry->compressed_ofs;
         entry->uncompressed_size = ctx->bswap ? byteswap4(entry->uncompressed_size) : entry->uncompressed_size;
         entry->compressed_size = ctx->bswap ? byteswap4(entry->compressed_size) : entry->compressed_size;
+
+        if (entry->uncompressed_size < 0 || entry->compressed_size < 0) {
+            retval = READSTAT_ERROR_PARSE;
+            goto cleanup;
+        }
+        if (entry->uncompressed_size > largest.uncompressed_size)
+            largest.uncompressed_size = entry->uncompressed_size;
+        if (entry->compressed_size > largest.compressed_size)
+            largest.compressed_size = entry->compressed_size;
     }
 
-    if (uncompressed_row_len && (uncompressed_row = readstat_malloc(uncompressed_row_len)) == NULL) {
+    if (row_ctx.row_len && (row_ctx.row = readstat_malloc(row_ctx.row_len)) == NULL) {
         retval = READSTAT_ERROR_MALLOC;
         goto cleanup;
     }
 
-    while (1) {
-        if (block_i == n_blocks)
+    if (ctx->row_index) {
+        readstat_row_index_reset(ctx->row_index, ctx->file_size, ztrailer.block_size, fingerprint);
+        if (ctx->row_offset > 0 &&
+                (retval = zsav_skip_indexed_blocks(ctx, &row_ctx, n_blocks, &block_i)) != READSTAT_OK)
             goto cleanup;
+    }
 
-        struct ztrailer_entry *entry = &ztrailer_entries[block_i];
-        if (io->seek(entry->compressed_ofs, READSTAT_SEEK_SET, io->io_ctx) == -1) {
-            retval = READSTAT_ERROR_SEEK;
-            goto cleanup;
-        }
-        if ((compressed_block = readstat_realloc(compressed_block, entry->compressed_size)) == NULL) {
-            retval = READSTAT_ERROR_MALLOC;
-            goto cleanup;
-        }
-        if (io->read(compressed_block, entry->compressed_size, io->io_ctx) != entry->compressed_size) {
-            retval = READSTAT_ERROR_READ;
-            goto cleanup;
-        }
+    /* With worker threads, blocks are inflated a batch at a time while the
+     * rows of the previous batch are handed out on this thread. Both batches
+     * share one set of threads: starting a batch first waits for the one
+     * before it, so at most thread_count threads are ever inflating. */
+    if (ctx->thread_count > 1)
+        batch_capacity = ctx->thread_count;
 
-        uncompressed_block_len = entry->uncompressed_size;
-        if ((uncompressed_block = readstat_realloc(uncompressed_block, uncompressed_block_len)) == NULL) {
+    for (i=0; i<2; i++) {
+        if ((batches[i].blocks = readstat_calloc(batch_capacity, sizeof(zsav_block_t))) == NULL) {
             retval = READSTAT_ERROR_MALLOC;
             goto cleanup;
         }
-        int status = uncompress(uncompressed_block, &uncompressed_block_len,
-                compressed_block, entry->compressed_size);
-        if (status != Z_OK || uncompressed_block_len != entry->uncompressed_size) {
-            retval = READSTAT_ERROR_PARSE;
-            goto cleanup;
-        }
-
-        block_i++;
-        state.status = SAV_ROW_STREAM_HAVE_DATA;
-        data_offset = 0;
-
-        while (state.status != SAV_ROW_STREAM_NEED_DATA) {
-            state.next_in = &uncompressed_block[data_offset];
-            state.avail_in = uncompressed_block_len - data_offset;
-
-            state.next_out = &uncompressed_row[uncompressed_offset];
-            state.avail_out = uncompressed_row_len - uncompressed_offset;
-
-            sav_decompress_row(&state);
+    }
 
-            uncompressed_offset = uncompressed_row_len - state.avail_out;
-            data_offset = uncompressed_block_len - state.avail_in;
+    while (!done) {
+        zsav_block_batch_t *batch = &batches[current];
+        zsav_block_batch_t *previous = &batches[1-current];
 
-            if (state.status == SAV_ROW_STREAM_FINISHED_ROW) {
-                retval = row_handler(uncompressed_row, uncompressed_row_len, ctx);
-                if (retval != READSTAT_OK)
-                    goto cleanup;
+        batch->blocks_count = 0;
+        while (batch->blocks_count < batch_capacity && block_i < n_blocks) {
+            if ((retval = zsav_read_block(ctx, &batch->blocks[batch->blocks_count],
+                            &ztrailer_entries[block_i], block_i, &largest)) != READSTAT_OK)
+                goto cleanup;
+            batch->blocks_count++;
+            block_i++;
+        }
 
-                uncompressed_offset = 0;
-            }
+        if (batch->blocks_count) {
+            if ((retval = readstat_parallel_start(&parallel, ctx->thread_count,
+                            &zsav_inflate_block, NULL, batch->blocks, sizeof(zsav_block_t),
+                            batch->blocks_count)) != READSTAT_OK)
+                goto cleanup;
+            batch->pending = 1;
+        } else {
+            readstat_parallel_wait(&parallel);
+        }
 
-            if (state.status == SAV_ROW_STREAM_FINISHED_ALL)
+        if (ctx->thread_count > 1) {
+            if (previous->pending &&
+                    (retval = zsav_process_batch(ctx, previous, &row_ctx, row_handler, &done)) != READSTAT_OK)
                 goto cleanup;
-            if (ctx->row_limit > 0 && ctx->current_row == ctx->row_limit)
+            current = 1 - current;
+        } else if (batch->pending) {
+            if ((retval = zsav_process_batch(ctx, batch, &row_ctx, row_handler, &done)) != READSTAT_OK)
                 goto cleanup;
         }
+
+        if (batch->blocks_count == 0)
+            break;
     }
 
 cleanup:
-    if (uncompressed_row)
-        free(uncompressed_row);
+    readstat_parallel_free(&parallel);
+    for (i=0; i<2; i++) {
+        if (batches[i].blocks) {
+            int j;
+            for (j=0; j<batch_capacity; j++) {
+                zsav_block_t *block = &batches[i].blocks[j];
+                if (block->stream_ready)
+                    inflateEnd(&block->stream);
+                free(block->compressed);
+                free(block->uncompressed);
+            }
+            free(batches[i].blocks);
+        }
+    }
+    if (row_ctx.row)
+        free(row_ctx.row);
     if (ztrailer_entries)
         free(ztrailer_entries);
-    if (compressed_block)
-        free(compressed_block);
-    if (uncompressed_block)
-        free(uncompressed_block);
 
     return retval;
 }
@@ -4,34 +4,51 @@
 
 #include "../readstat.h"
 #include "../readstat_writer.h"
+#include "../readstat_parallel.h"
 #include "readstat_sav_compress.h"
 #include "readstat_zsav_compress.h"
 #include "readstat_zsav_write.h"
 
+static readstat_error_t zsav_write_data_blocks(readstat_writer_t *writer, zsav_ctx_t *zctx);
+
+readstat_error_t zsav_begin_data(readstat_writer_t *writer) {
+    zsav_ctx_t *zctx = writer->module_ctx;
+    if (writer->data_seeker == NULL)
+        return READSTAT_OK;
+
+    /* Reserve the zheader; it's filled in by zsav_end_data once the block
+     * sizes are known */
+    zctx->streaming = 1;
+    return readstat_write_zeros(writer, 24);
+}
+
 readstat_error_t zsav_write_compressed_row(void *writer_ctx, void *row, size_t len) {
     readstat_writer_t *writer = (readstat_writer_t *)writer_ctx;
     zsav_ctx_t *zctx = writer->module_ctx;
+    readstat_error_t retval = READSTAT_OK;
     /* Kind of frustrating that SPSS does double compression.  If they just
      * z-compressed the uncompressed data, we could calculate the block count
      * in advance and write out the file in a streaming manner. As things stand
      * we have to build up the file in memory until we know the final block
-     * count. A possible streaming solution would be to declare the number of
-     * blocks required to hold the maximum possible row-compressed size and
-     * then fill out the end with no-op zero bytes (that get z-compressed very
-     * small).
+     * count, unless the output is seekable, in which case the blocks are
+     * written out as they are compressed and the zheader is patched at the
+     * end.
      */
     size_t row_len = sav_compress_row(zctx->buffer, row, len, writer);
-    int deflate_status = zsav_compress_row(zctx->buffer, row_len,
+    retval = zsav_compress_row(zctx->buffer, row_len,
             writer->current_row + 1 == writer->row_count, zctx);
+    if (retval != READSTAT_OK)
+        goto cleanup;
 
-    if (deflate_status != Z_OK && deflate_status != Z_STREAM_END)
-        return READSTAT_ERROR_WRITE;
+    if (zctx->streaming)
+        retval = zsav_write_data_blocks(writer, zctx);
 
-    return  READSTAT_OK;
+cleanup:
+    return retval;
 }
 
 static readstat_error_t zsav_write_data_header(readstat_writer_t *writer, zsav_ctx_t *zctx) {
-    readstat_error_t retval = READSTAT_OK;
+    uint64_t zheader[3];
     uint64_t zheader_ofs = zctx->zheader_ofs;
     uint64_t ztrailer_ofs = zheader_ofs + 24;
     uint64_t ztrailer_len = 24 + zctx->blocks_count * 24;
@@ -42,27 +59,27 @@ static readstat_error_t zsav_write_data_header(readstat_writer_t *writer, zsav_c
         ztrailer_ofs += block->compressed_size;
     }
 
-    if ((retval = readstat_write_bytes(writer, &zheader_ofs, sizeof(uint64_t))) != READSTAT_OK)
-        goto cleanup;
+    zheader[0] = zheader_ofs;
+    zheader[1] = ztrailer_ofs;
+    zheader[2] = ztrailer_len;
 
-    if ((retval = readstat_write_bytes(writer, &ztrailer_ofs, sizeof(uint64_t))) != READSTAT_OK)
-        goto cleanup;
+    if (zctx->streaming)
+        return readstat_write_bytes_at(writer, zheader_ofs, zheader, sizeof(zheader));
 
-    if ((retval = readstat_write_bytes(writer, &ztrailer_len, sizeof(uint64_t))) != READSTAT_OK)
-        goto cleanup;
-
-cleanup:
-    return retval;
+    return readstat_write_bytes(writer, zheader, sizeof(zheader));
 }
 
 static readstat_error_t zsav_write_data_blocks(readstat_writer_t *writer, zsav_ctx_t *zctx) {
     readstat_error_t retval = READSTAT_OK;
-    int i;
-    for (i=0; i<zctx->blocks_count; i++) {
-        zsav_block_t *block = zctx->blocks[i];
+    while (zctx->blocks_written < zctx->blocks_compressed) {
+        zsav_block_t *block = zctx->blocks[zctx->blocks_written];
 
         if ((retval = readstat_write_bytes(writer, block->compressed_data, block->compressed_size)) != READSTAT_OK)
             goto cleanup;
+
+        free(block->compressed_data);
+        block->compressed_data = NULL;
+        zctx->blocks_written++;
     }
 
 cleanup:
@@ -121,9 +138,11 @@ readstat_error_t zsav_end_data(void *writer_ctx) {
     zsav_ctx_t *zctx = writer->module_ctx;
     readstat_error_t retval = READSTAT_OK;
 
-    retval = zsav_write_data_header(writer, zctx);
-    if (retval != READSTAT_OK)
-        goto cleanup;
+    if (!zctx->streaming) {
+        retval = zsav_write_data_header(writer, zctx);
+        if (retval != READSTAT_OK)
+            goto cleanup;
+    }
 
     retval = zsav_write_data_blocks(writer, zctx);
     if (retval != READSTAT_OK)
@@ -133,6 +152,11 @@ readstat_error_t zsav_end_data(void *writer_ctx) {
     if (retval != READSTAT_OK)
         goto cleanup;
 
+    if (zctx->streaming) {
+        retval = zsav_write_data_header(writer, zctx);
+        if (retval != READSTAT_OK)
+            goto cleanup;
+    }
 
 cleanup:
     return retval;
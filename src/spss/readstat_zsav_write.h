@@ -1,3 +1,4 @@
+readstat_error_t zsav_begin_data(readstat_writer_t *writer);
 
 readstat_error_t zsav_write_compressed_row(void *writer_ctx, void *row, size_t len);
 readstat_error_t zsav_end_data(void *writer_ctx);
@@ -6,8 +6,10 @@
 
 #include "../readstat.h"
 #include "../readstat_iconv.h"
+#include "../readstat_convert.h"
 #include "../readstat_malloc.h"
 #include "../readstat_bits.h"
+#include "../readstat_batch.h"
 
 #include "readstat_dta.h"
 
@@ -156,15 +158,16 @@ readstat_error_t dta_ctx_init(dta_ctx_t *ctx, uint32_t nvar, uint64_t nobs,
     }
 
     if (output_encoding) {
+        const char *src_charset = NULL;
         if (input_encoding) {
-            ctx->converter = iconv_open(output_encoding, input_encoding);
+            src_charset = input_encoding;
         } else if (ds_format < 118) {
-            ctx->converter = iconv_open(output_encoding, "WINDOWS-1252");
+            src_charset = "WINDOWS-1252";
         } else if (strcmp(output_encoding, "UTF-8") != 0) {
-            ctx->converter = iconv_open(output_encoding, "UTF-8");
+            src_charset = "UTF-8";
         }
-        if (ctx->converter == (iconv_t)-1) {
-            ctx->converter = NULL;
+        if (src_charset &&
+                (ctx->converter = readstat_converter_init(output_encoding, src_charset)) == NULL) {
             retval = READSTAT_ERROR_UNSUPPORTED_CHARSET;
             goto cleanup;
         }
@@ -230,7 +233,7 @@ void dta_ctx_free(dta_ctx_t *ctx) {
     if (ctx->variable_labels)
         free(ctx->variable_labels);
     if (ctx->converter)
-        iconv_close(ctx->converter);
+        readstat_converter_free(ctx->converter);
     if (ctx->data_label)
         free(ctx->data_label);
     if (ctx->variables) {
@@ -241,6 +244,8 @@ void dta_ctx_free(dta_ctx_t *ctx) {
         }
         free(ctx->variables);
     }
+    if (ctx->columns)
+        free(ctx->columns);
     if (ctx->strls) {
         int i;
         for (i=0; i<ctx->strls_count; i++) {
@@ -248,6 +253,8 @@ void dta_ctx_free(dta_ctx_t *ctx) {
         }
         free(ctx->strls);
     }
+    if (ctx->batch)
+        readstat_batch_free(ctx->batch);
     free(ctx);
 }
 
@@ -44,6 +44,14 @@ typedef struct dta_strl_s {
     char            data[1]; // Flexible array; use [1] for C++98 compatibility
 } dta_strl_t;
 
+/* A column that is actually decoded, with its place in the record */
+typedef struct dta_column_s {
+    readstat_variable_t *variable;
+    size_t          offset;
+    size_t          len;
+    readstat_type_t type;
+} dta_column_t;
+
 typedef struct dta_ctx_s {
     char          *data_label;
     size_t         data_label_len;
@@ -106,10 +114,14 @@ typedef struct dta_ctx_s {
     size_t         strls_capacity;
 
     readstat_variable_t  **variables;
+    dta_column_t        *columns;
+    int                  columns_count;
     readstat_endian_t    endianness;
+    struct readstat_batch_s *batch;
 
-    iconv_t              converter;
+    readstat_converter_t *converter;
     readstat_callbacks_t handle;
+    const readstat_projection_t *projection;
     size_t               file_size;
     void                *user_ctx;
     readstat_io_t       *io;
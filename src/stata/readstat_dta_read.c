@@ -12,12 +12,18 @@
 #include "../readstat_iconv.h"
 #include "../readstat_convert.h"
 #include "../readstat_malloc.h"
+#include "../readstat_batch.h"
+#include "../readstat_projection.h"
 
 #include "readstat_dta.h"
 #include "readstat_dta_parse_timestamp.h"
 
 #define MAX_VALUE_LABEL_LEN 32000
 
+#define DTA_STRING_BUFFER_LEN 2048
+#define DTA_SYSTEM_MISSING    '.'
+
+
 static readstat_error_t dta_update_progress(dta_ctx_t *ctx);
 static readstat_error_t dta_read_descriptors(dta_ctx_t *ctx);
 static readstat_error_t dta_read_tag(dta_ctx_t *ctx, const char *tag);
@@ -471,29 +477,30 @@ cleanup:
     return retval;
 }
 
-static readstat_value_t dta_interpret_int8_bytes(dta_ctx_t *ctx, const void *buf) {
-    readstat_value_t value = { .type = READSTAT_TYPE_INT8 };
+/* Numeric cells decode to a number and a missing code: 0 for an actual
+ * value, DTA_SYSTEM_MISSING for ".", or the letter of a tagged missing value */
+static int dta_read_int8(dta_ctx_t *ctx, const void *buf, int8_t *out) {
     int8_t byte = 0;
+    int missing = 0;
     memcpy(&byte, buf, sizeof(int8_t));
     if (ctx->machine_is_twos_complement) {
         byte = ones_to_twos_complement1(byte);
     }
     if (byte > ctx->max_int8) {
         if (ctx->supports_tagged_missing && byte > DTA_113_MISSING_INT8) {
-            value.tag = 'a' + (byte - DTA_113_MISSING_INT8_A);
-            value.is_tagged_missing = 1;
+            missing = 'a' + (byte - DTA_113_MISSING_INT8_A);
         } else {
-            value.is_system_missing = 1;
+            missing = DTA_SYSTEM_MISSING;
         }
     }
-    value.v.i8_value = byte;
+    *out = byte;
 
-    return value;
+    return missing;
 }
 
-static readstat_value_t dta_interpret_int16_bytes(dta_ctx_t *ctx, const void *buf) {
-    readstat_value_t value = { .type = READSTAT_TYPE_INT16 };
+static int dta_read_int16(dta_ctx_t *ctx, const void *buf, int16_t *out) {
     int16_t num = 0;
+    int missing = 0;
     memcpy(&num, buf, sizeof(int16_t));
     if (ctx->bswap) {
         num = byteswap2(num);
@@ -503,20 +510,19 @@ static readstat_value_t dta_interpret_int16_bytes(dta_ctx_t *ctx, const void *bu
     }
     if (num > ctx->max_int16) {
         if (ctx->supports_tagged_missing && num > DTA_113_MISSING_INT16) {
-            value.tag = 'a' + (num - DTA_113_MISSING_INT16_A);
-            value.is_tagged_missing = 1;
+            missing = 'a' + (num - DTA_113_MISSING_INT16_A);
         } else {
-            value.is_system_missing = 1;
+            missing = DTA_SYSTEM_MISSING;
         }
     }
-    value.v.i16_value = num;
+    *out = num;
 
-    return value;
+    return missing;
 }
 
-static readstat_value_t dta_interpret_int32_bytes(dta_ctx_t *ctx, const void *buf) {
-    readstat_value_t value = { .type = READSTAT_TYPE_INT32 };
+static int dta_read_int32(dta_ctx_t *ctx, const void *buf, int32_t *out) {
     int32_t num = 0;
+    int missing = 0;
     memcpy(&num, buf, sizeof(int32_t));
     if (ctx->bswap) {
         num = byteswap4(num);
@@ -526,122 +532,186 @@ static readstat_value_t dta_interpret_int32_bytes(dta_ctx_t *ctx, const void *bu
     }
     if (num > ctx->max_int32) {
         if (ctx->supports_tagged_missing && num > DTA_113_MISSING_INT32) {
-            value.tag = 'a' + (num - DTA_113_MISSING_INT32_A);
-            value.is_tagged_missing = 1;
+            missing = 'a' + (num - DTA_113_MISSING_INT32_A);
         } else {
-            value.is_system_missing = 1;
+            missing = DTA_SYSTEM_MISSING;
         }
     }
-    value.v.i32_value = num;
+    *out = num;
 
-    return value;
+    return missing;
 }
 
-static readstat_value_t dta_interpret_float_bytes(dta_ctx_t *ctx, const void *buf) {
-    readstat_value_t value = { .type = READSTAT_TYPE_FLOAT };
+static int dta_read_float(dta_ctx_t *ctx, const void *buf, float *out) {
     float f_num = NAN;
     int32_t num = 0;
+    int missing = 0;
     memcpy(&num, buf, sizeof(int32_t));
     if (ctx->bswap) {
         num = byteswap4(num);
     }
     if (num > ctx->max_float) {
         if (ctx->supports_tagged_missing && num > DTA_113_MISSING_FLOAT) {
-            value.tag = 'a' + ((num - DTA_113_MISSING_FLOAT_A) >> 11);
-            value.is_tagged_missing = 1;
+            missing = 'a' + ((num - DTA_113_MISSING_FLOAT_A) >> 11);
         } else {
-            value.is_system_missing = 1;
+            missing = DTA_SYSTEM_MISSING;
         }
     } else {
         memcpy(&f_num, &num, sizeof(int32_t));
     }
-    value.v.float_value = f_num;
+    *out = f_num;
 
-    return value;
+    return missing;
 }
 
-static readstat_value_t dta_interpret_double_bytes(dta_ctx_t *ctx, const void *buf) {
-    readstat_value_t value = { .type = READSTAT_TYPE_DOUBLE };
+static int dta_read_double(dta_ctx_t *ctx, const void *buf, double *out) {
     double d_num = NAN;
     int64_t num = 0;
+    int missing = 0;
     memcpy(&num, buf, sizeof(int64_t));
     if (ctx->bswap) {
         num = byteswap8(num);
     }
     if (num > ctx->max_double) {
         if (ctx->supports_tagged_missing && num > DTA_113_MISSING_DOUBLE) {
-            value.tag = 'a' + ((num - DTA_113_MISSING_DOUBLE_A) >> 40);
-            value.is_tagged_missing = 1;
+            missing = 'a' + ((num - DTA_113_MISSING_DOUBLE_A) >> 40);
         } else {
-            value.is_system_missing = 1;
+            missing = DTA_SYSTEM_MISSING;
         }
     } else {
         memcpy(&d_num, &num, sizeof(int64_t));
     }
-    value.v.double_value = d_num;
+    *out = d_num;
+
+    return missing;
+}
+
+static void dta_assign_missing(readstat_value_t *value, int missing) {
+    if (missing == DTA_SYSTEM_MISSING) {
+        value->is_system_missing = 1;
+    } else if (missing) {
+        value->tag = missing;
+        value->is_tagged_missing = 1;
+    }
+}
 
+static readstat_value_t dta_interpret_int32_bytes(dta_ctx_t *ctx, const void *buf) {
+    readstat_value_t value = { .type = READSTAT_TYPE_INT32 };
+    dta_assign_missing(&value, dta_read_int32(ctx, buf, &value.v.i32_value));
     return value;
 }
 
+static const char *dta_lookup_strl(dta_ctx_t *ctx, const unsigned char *data) {
+    dta_strl_t key = dta_interpret_strl_vo_bytes(ctx, data);
+    dta_strl_t **found = bsearch(&key, ctx->strls, ctx->strls_count, sizeof(dta_strl_t *), &dta_compare_strls);
+
+    return found ? (*found)->data : NULL;
+}
+
 static readstat_error_t dta_handle_row(const unsigned char *buf, dta_ctx_t *ctx) {
-    char  str_buf[2048];
+    char  str_buf[DTA_STRING_BUFFER_LEN];
     int j;
-    readstat_off_t offset = 0;
     readstat_error_t retval = READSTAT_OK;
-    for (j=0; j<ctx->nvar; j++) {
-        size_t max_len;
-        readstat_value_t value = { { 0 } };
-
-        retval = dta_type_info(ctx->typlist[j], ctx, &max_len, &value.type);
-        if (retval != READSTAT_OK)
-            goto cleanup;
-
-        if (ctx->variables[j]->skip) {
-            offset += max_len;
-            continue;
-        }
-
-        if (offset + max_len > ctx->record_len) {
-            retval = READSTAT_ERROR_PARSE;
-            goto cleanup;
-        }
+    for (j=0; j<ctx->columns_count; j++) {
+        const dta_column_t *column = &ctx->columns[j];
+        const unsigned char *data = &buf[column->offset];
+        readstat_value_t value = { .type = column->type };
+        int missing = 0;
 
         if (value.type == READSTAT_TYPE_STRING) {
             size_t str_len = 0;
-            while (str_len < max_len && buf[offset + str_len] != '\0') {
+            while (str_len < column->len && data[str_len] != '\0') {
                 str_len++;
             }
             retval = readstat_convert(str_buf, sizeof(str_buf),
-                    (const char *)&buf[offset], str_len, ctx->converter);
+                    (const char *)data, str_len, ctx->converter);
             if (retval != READSTAT_OK)
                 goto cleanup;
             value.v.string_value = str_buf;
         } else if (value.type == READSTAT_TYPE_STRING_REF) {
-            dta_strl_t key = dta_interpret_strl_vo_bytes(ctx, &buf[offset]);
-            dta_strl_t **found = bsearch(&key, ctx->strls, ctx->strls_count, sizeof(dta_strl_t *), &dta_compare_strls);
-
-            if (found) {
-                value.v.string_value = (*found)->data;
-            }
+            value.v.string_value = dta_lookup_strl(ctx, data);
             value.type = READSTAT_TYPE_STRING;
         } else if (value.type == READSTAT_TYPE_INT8) {
-            value = dta_interpret_int8_bytes(ctx, &buf[offset]);
+            missing = dta_read_int8(ctx, data, &value.v.i8_value);
         } else if (value.type == READSTAT_TYPE_INT16) {
-            value = dta_interpret_int16_bytes(ctx, &buf[offset]);
+            missing = dta_read_int16(ctx, data, &value.v.i16_value);
         } else if (value.type == READSTAT_TYPE_INT32) {
-            value = dta_interpret_int32_bytes(ctx, &buf[offset]);
+            missing = dta_read_int32(ctx, data, &value.v.i32_value);
         } else if (value.type == READSTAT_TYPE_FLOAT) {
-            value = dta_interpret_float_bytes(ctx, &buf[offset]);
+            missing = dta_read_float(ctx, data, &value.v.float_value);
         } else if (value.type == READSTAT_TYPE_DOUBLE) {
-            value = dta_interpret_double_bytes(ctx, &buf[offset]);
+            missing = dta_read_double(ctx, data, &value.v.double_value);
         }
+        dta_assign_missing(&value, missing);
 
-        if (ctx->handle.value(ctx->current_row, ctx->variables[j], value, ctx->user_ctx) != READSTAT_HANDLER_OK) {
+        if (ctx->handle.value(ctx->current_row, column->variable, value, ctx->user_ctx) != READSTAT_HANDLER_OK) {
             retval = READSTAT_ERROR_USER_ABORT;
             goto cleanup;
         }
+    }
+cleanup:
+    return retval;
+}
+
+/* Decode a row straight into the batch's column arrays */
+static readstat_error_t dta_handle_batch_row(const unsigned char *buf, dta_ctx_t *ctx) {
+    readstat_error_t retval = READSTAT_OK;
+    int row = 0;
+    int j;
+
+    if ((retval = readstat_batch_row(ctx->batch, ctx->current_row, &row)) != READSTAT_OK)
+        goto cleanup;
 
-        offset += max_len;
+    for (j=0; j<ctx->columns_count; j++) {
+        const dta_column_t *column = &ctx->columns[j];
+        const unsigned char *data = &buf[column->offset];
+        readstat_batch_column_t *batch_column = NULL;
+        int missing = 0;
+
+        if ((retval = readstat_batch_column(ctx->batch, column->variable, &batch_column)) != READSTAT_OK)
+            goto cleanup;
+
+        if (column->type == READSTAT_TYPE_STRING) {
+            size_t str_len = 0;
+            size_t dst_len = 4*column->len+1;
+            if (dst_len > DTA_STRING_BUFFER_LEN)
+                dst_len = DTA_STRING_BUFFER_LEN;
+            char *dst = NULL;
+            while (str_len < column->len && data[str_len] != '\0') {
+                str_len++;
+            }
+            if ((dst = readstat_batch_reserve_string(ctx->batch, batch_column, row, dst_len)) == NULL) {
+                retval = READSTAT_ERROR_MALLOC;
+                goto cleanup;
+            }
+            retval = readstat_convert(dst, dst_len, (const char *)data, str_len, ctx->converter);
+            if (retval != READSTAT_OK)
+                goto cleanup;
+            readstat_batch_end_string(ctx->batch, batch_column);
+        } else if (column->type == READSTAT_TYPE_STRING_REF) {
+            retval = readstat_batch_set_string(ctx->batch, batch_column, row, dta_lookup_strl(ctx, data));
+            if (retval != READSTAT_OK)
+                goto cleanup;
+        } else if (column->type == READSTAT_TYPE_INT8) {
+            int8_t num = 0;
+            missing = dta_read_int8(ctx, data, &num);
+            batch_column->int32_values[row] = num;
+        } else if (column->type == READSTAT_TYPE_INT16) {
+            int16_t num = 0;
+            missing = dta_read_int16(ctx, data, &num);
+            batch_column->int32_values[row] = num;
+        } else if (column->type == READSTAT_TYPE_INT32) {
+            missing = dta_read_int32(ctx, data, &batch_column->int32_values[row]);
+        } else if (column->type == READSTAT_TYPE_FLOAT) {
+            float num = NAN;
+            missing = dta_read_float(ctx, data, &num);
+            batch_column->double_values[row] = num;
+        } else if (column->type == READSTAT_TYPE_DOUBLE) {
+            missing = dta_read_double(ctx, data, &batch_column->double_values[row]);
+        }
+
+        if (missing)
+            readstat_batch_set_missing(batch_column, row, missing == DTA_SYSTEM_MISSING ? '\0' : missing);
     }
 cleanup:
     return retval;
@@ -666,13 +736,23 @@ static readstat_error_t dta_handle_rows(dta_ctx_t *ctx) {
     }
 
     for (i=0; i<ctx->row_limit; i++) {
-        if (io->read(buf, ctx->record_len, io->io_ctx) != ctx->record_len) {
-            retval = READSTAT_ERROR_READ;
-            goto cleanup;
+        const unsigned char *row = NULL;
+        if (io->borrow)
+            row = io->borrow(ctx->record_len, io->io_ctx);
+        if (row == NULL) {
+            if (io->read(buf, ctx->record_len, io->io_ctx) != ctx->record_len) {
+                retval = READSTAT_ERROR_READ;
+                goto cleanup;
+            }
+            row = buf;
         }
-        if ((retval = dta_handle_row(buf, ctx)) != READSTAT_OK) {
-            goto cleanup;
+        if (ctx->batch) {
+            retval = dta_handle_batch_row(row, ctx);
+        } else {
+            retval = dta_handle_row(row, ctx);
         }
+        if (retval != READSTAT_OK)
+            goto cleanup;
         ctx->current_row++;
         if ((retval = dta_update_progress(ctx)) != READSTAT_OK) {
             goto cleanup;
@@ -695,7 +775,7 @@ static readstat_error_t dta_read_data(dta_ctx_t *ctx) {
     readstat_error_t retval = READSTAT_OK;
     readstat_io_t *io = ctx->io;
 
-    if (!ctx->handle.value) {
+    if (!ctx->handle.value && !ctx->batch) {
         return READSTAT_OK;
     }
 
@@ -718,6 +798,9 @@ static readstat_error_t dta_read_data(dta_ctx_t *ctx) {
     if ((retval = dta_handle_rows(ctx)) != READSTAT_OK)
         goto cleanup;
 
+    if ((retval = readstat_batch_flush(ctx->batch)) != READSTAT_OK)
+        goto cleanup;
+
     if ((retval = dta_read_tag(ctx, "</data>")) != READSTAT_OK)
         goto cleanup;
 
@@ -926,21 +1009,33 @@ cleanup:
     return retval;
 }
 
+/* Variables are set up even without a variable handler, since the rows are
+ * decoded through ctx->columns: one entry per column that was neither
+ * projected away nor skipped by the handler, so rows never look at the
+ * bytes of the others. */
 static readstat_error_t dta_handle_variables(dta_ctx_t *ctx) {
-    if (!ctx->handle.variable)
-        return READSTAT_OK;
-
     readstat_error_t retval = READSTAT_OK;
     int i;
     int index_after_skipping = 0;
+    size_t offset = 0;
+
+    if (ctx->nvar == 0)
+        return READSTAT_OK;
+
+    if ((ctx->columns = readstat_calloc(ctx->nvar, sizeof(dta_column_t))) == NULL) {
+        retval = READSTAT_ERROR_MALLOC;
+        goto cleanup;
+    }
 
     for (i=0; i<ctx->nvar; i++) {
-        size_t      max_len;
-        readstat_type_t type;
-        retval = dta_type_info(ctx->typlist[i], ctx, &max_len, &type);
+        size_t      max_len, len;
+        readstat_type_t type, column_type;
+        retval = dta_type_info(ctx->typlist[i], ctx, &len, &column_type);
         if (retval != READSTAT_OK)
             goto cleanup;
 
+        max_len = len;
+        type = column_type;
         if (type == READSTAT_TYPE_STRING)
             max_len++; /* might append NULL */
         if (type == READSTAT_TYPE_STRING_REF) {
@@ -950,12 +1045,18 @@ static readstat_error_t dta_handle_variables(dta_ctx_t *ctx) {
 
         ctx->variables[i] = dta_init_variable(ctx, i, index_after_skipping, type, max_len);
 
-        const char *value_labels = NULL;
+        int cb_retval = READSTAT_HANDLER_SKIP_VARIABLE;
+        if (readstat_projection_includes(ctx->projection, i, ctx->variables[i]->name)) {
+            cb_retval = READSTAT_HANDLER_OK;
+            if (ctx->handle.variable) {
+                const char *value_labels = NULL;
 
-        if (ctx->lbllist[ctx->lbllist_entry_len*i])
-            value_labels = &ctx->lbllist[ctx->lbllist_entry_len*i];
+                if (ctx->lbllist[ctx->lbllist_entry_len*i])
+                    value_labels = &ctx->lbllist[ctx->lbllist_entry_len*i];
 
-        int cb_retval = ctx->handle.variable(i, ctx->variables[i], value_labels, ctx->user_ctx);
+                cb_retval = ctx->handle.variable(i, ctx->variables[i], value_labels, ctx->user_ctx);
+            }
+        }
 
         if (cb_retval == READSTAT_HANDLER_ABORT) {
             retval = READSTAT_ERROR_USER_ABORT;
@@ -965,8 +1066,15 @@ static readstat_error_t dta_handle_variables(dta_ctx_t *ctx) {
         if (cb_retval == READSTAT_HANDLER_SKIP_VARIABLE) {
             ctx->variables[i]->skip = 1;
         } else {
+            dta_column_t *column = &ctx->columns[ctx->columns_count++];
+            column->variable = ctx->variables[i];
+            column->offset = offset;
+            column->len = len;
+            column->type = column_type;
             index_after_skipping++;
         }
+
+        offset += len;
     }
 cleanup:
     return retval;
@@ -1185,6 +1293,11 @@ readstat_error_t readstat_parse_dta(readstat_parser_t *parser, const char *path,
     ctx->user_ctx = user_ctx;
     ctx->file_size = file_size;
     ctx->handle = parser->handlers;
+    ctx->projection = parser->projection;
+    if (parser->handlers.batch && (ctx->batch = readstat_batch_init(parser, user_ctx)) == NULL) {
+        retval = READSTAT_ERROR_MALLOC;
+        goto cleanup;
+    }
     if (parser->row_offset > 0)
         ctx->row_offset = parser->row_offset;
     int64_t nobs_after_skipping = ctx->nobs - ctx->row_offset;
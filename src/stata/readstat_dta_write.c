@@ -1259,6 +1259,70 @@ static readstat_error_t dta_write_double(void *row, const readstat_variable_t *v
     return dta_write_raw_double(row, value);
 }
 
+static readstat_error_t dta_write_floats(void *row, size_t row_len, const readstat_variable_t *var,
+        const double *values, int count) {
+    readstat_error_t retval = READSTAT_OK;
+    unsigned char *cell = (unsigned char *)row;
+    int i;
+    for (i=0; i<count; i++, cell += row_len) {
+        if ((retval = dta_write_float(cell, var, values[i])) != READSTAT_OK)
+            break;
+    }
+    return retval;
+}
+
+static readstat_error_t dta_write_doubles(void *row, size_t row_len, const readstat_variable_t *var,
+        const double *values, int count) {
+    readstat_error_t retval = READSTAT_OK;
+    unsigned char *cell = (unsigned char *)row;
+    int i;
+    for (i=0; i<count; i++, cell += row_len) {
+        if ((retval = dta_write_double(cell, var, values[i])) != READSTAT_OK)
+            break;
+    }
+    return retval;
+}
+
+/* Values above the largest non-missing value of the variable's type would
+ * read back as missing values */
+static readstat_error_t dta_write_int32s(void *row, size_t row_len, const readstat_variable_t *var,
+        const int32_t *values, int count, int32_t max_int8, int32_t max_int16, int32_t max_int32) {
+    unsigned char *cell = (unsigned char *)row;
+    int i;
+    if (var->type == READSTAT_TYPE_INT8) {
+        for (i=0; i<count; i++, cell += row_len) {
+            if (values[i] > max_int8)
+                return READSTAT_ERROR_NUMERIC_VALUE_IS_OUT_OF_RANGE;
+            dta_write_raw_int8(cell, values[i]);
+        }
+    } else if (var->type == READSTAT_TYPE_INT16) {
+        for (i=0; i<count; i++, cell += row_len) {
+            if (values[i] > max_int16)
+                return READSTAT_ERROR_NUMERIC_VALUE_IS_OUT_OF_RANGE;
+            dta_write_raw_int16(cell, values[i]);
+        }
+    } else {
+        for (i=0; i<count; i++, cell += row_len) {
+            if (values[i] > max_int32)
+                return READSTAT_ERROR_NUMERIC_VALUE_IS_OUT_OF_RANGE;
+            dta_write_raw_int32(cell, values[i]);
+        }
+    }
+    return READSTAT_OK;
+}
+
+static readstat_error_t dta_113_write_int32s(void *row, size_t row_len, const readstat_variable_t *var,
+        const int32_t *values, int count) {
+    return dta_write_int32s(row, row_len, var, values, count,
+            DTA_113_MAX_INT8, DTA_113_MAX_INT16, DTA_113_MAX_INT32);
+}
+
+static readstat_error_t dta_old_write_int32s(void *row, size_t row_len, const readstat_variable_t *var,
+        const int32_t *values, int count) {
+    return dta_write_int32s(row, row_len, var, values, count,
+            DTA_OLD_MAX_INT8, DTA_OLD_MAX_INT16, DTA_OLD_MAX_INT32);
+}
+
 static readstat_error_t dta_write_string(void *row, const readstat_variable_t *var, const char *value) {
     size_t max_len = var->storage_width;
     if (value == NULL || value[0] == '\0') {
@@ -1434,17 +1498,21 @@ readstat_error_t readstat_begin_writing_dta(readstat_writer_t *writer, void *use
         writer->callbacks.write_int8 = &dta_113_write_int8;
         writer->callbacks.write_int16 = &dta_113_write_int16;
         writer->callbacks.write_int32 = &dta_113_write_int32;
+        writer->callbacks.write_int32s = &dta_113_write_int32s;
         writer->callbacks.write_missing_number = &dta_113_write_missing_numeric;
         writer->callbacks.write_missing_tagged = &dta_113_write_missing_tagged;
     } else {
         writer->callbacks.write_int8 = &dta_old_write_int8;
         writer->callbacks.write_int16 = &dta_old_write_int16;
         writer->callbacks.write_int32 = &dta_old_write_int32;
+        writer->callbacks.write_int32s = &dta_old_write_int32s;
         writer->callbacks.write_missing_number = &dta_old_write_missing_numeric;
     }
 
     writer->callbacks.write_float = &dta_write_float;
     writer->callbacks.write_double = &dta_write_double;
+    writer->callbacks.write_floats = &dta_write_floats;
+    writer->callbacks.write_doubles = &dta_write_doubles;
     writer->callbacks.write_string = &dta_write_string;
     writer->callbacks.write_missing_string = &dta_write_missing_string;
 
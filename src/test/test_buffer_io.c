@@ -50,6 +50,16 @@ ssize_t rt_read_handler(void *buf, size_t nbytes, void *io_ctx) {
     return bytes_copied;
 }
 
+const void *rt_borrow_handler(size_t nbytes, void *io_ctx) {
+    rt_buffer_ctx_t *buffer_ctx = (rt_buffer_ctx_t *)io_ctx;
+    const void *bytes = NULL;
+    if (nbytes <= buffer_ctx->buffer->used - buffer_ctx->pos) {
+        bytes = buffer_ctx->buffer->bytes + buffer_ctx->pos;
+        buffer_ctx->pos += nbytes;
+    }
+    return bytes;
+}
+
 readstat_error_t rt_update_handler(long file_size, readstat_progress_handler progress_handler,
         void *user_ctx, void *io_ctx) {
     if (!progress_handler)
@@ -0,0 +1,304 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../readstat.h"
+
+#include "test_buffer.h"
+
+/* Writes the same numeric columns one value at a time and through
+ * readstat_insert_column_batch, and checks that the two files come out byte
+ * for byte the same, whether or not the format has whole-column encoders.
+ * Then checks that integers too big for an INT8 or INT16 variable are
+ * rejected instead of being cut down to fit. */
+
+#define TEST_ROWS           5000
+#define TEST_COLUMNS           5
+
+typedef readstat_error_t (*begin_writing_t)(readstat_writer_t *writer, void *user_ctx, long row_count);
+
+typedef struct format_test_s {
+    const char         *label;
+    begin_writing_t     begin_writing;
+    readstat_compress_t compression;
+} format_test_t;
+
+typedef struct columns_s {
+    int32_t             int8_values[TEST_ROWS];
+    int32_t             int16_values[TEST_ROWS];
+    int32_t             int32_values[TEST_ROWS];
+    double              float_values[TEST_ROWS];
+    double              double_values[TEST_ROWS];
+    unsigned char       missing[(TEST_ROWS + 7) / 8];
+} columns_t;
+
+static format_test_t _formats[] = {
+    { "SAS7BDAT", &readstat_begin_writing_sas7bdat, READSTAT_COMPRESS_NONE },
+    { "SAS7BDAT (compressed)", &readstat_begin_writing_sas7bdat, READSTAT_COMPRESS_ROWS },
+    { "SAV", &readstat_begin_writing_sav, READSTAT_COMPRESS_NONE },
+    { "SAV (compressed)", &readstat_begin_writing_sav, READSTAT_COMPRESS_ROWS },
+#if HAVE_ZLIB
+    { "ZSAV", &readstat_begin_writing_sav, READSTAT_COMPRESS_BINARY },
+#endif
+    { "DTA", &readstat_begin_writing_dta, READSTAT_COMPRESS_NONE },
+    { "POR", &readstat_begin_writing_por, READSTAT_COMPRESS_NONE },
+    { "XPORT", &readstat_begin_writing_xport, READSTAT_COMPRESS_NONE }
+};
+
+static readstat_type_t _types[TEST_COLUMNS] = {
+    READSTAT_TYPE_INT8,
+    READSTAT_TYPE_INT16,
+    READSTAT_TYPE_INT32,
+    READSTAT_TYPE_FLOAT,
+    READSTAT_TYPE_DOUBLE
+};
+
+static const char *_names[TEST_COLUMNS] = { "I8", "I16", "I32", "FLT", "DBL" };
+
+/* Runs of missing values of different lengths, at the start and end too */
+static int is_missing(int row) {
+    return row % 7 == 0 || row % 11 == 3 || row % 11 == 4 || row == TEST_ROWS - 1;
+}
+
+/* Within range for every format, Stata's reserved values included */
+static void fill_columns(columns_t *columns) {
+    int i;
+
+    memset(columns->missing, 0, sizeof(columns->missing));
+
+    for (i=0; i<TEST_ROWS; i++) {
+        columns->int8_values[i] = i % 201 - 100;
+        columns->int16_values[i] = (i * 37) % 60001 - 30000;
+        columns->int32_values[i] = (i - TEST_ROWS / 2) * 104729;
+        columns->float_values[i] = i * 0.25 - 100;
+        columns->double_values[i] = i / 3.0 - 1000;
+        if (is_missing(i)) {
+            columns->missing[i / 8] |= (1 << (i % 8));
+            /* Never looked at, and out of range for everything */
+            columns->int8_values[i] = columns->int16_values[i] = columns->int32_values[i] = INT32_MAX;
+            columns->float_values[i] = columns->double_values[i] = 1e300;
+        }
+    }
+}
+
+static ssize_t write_data(const void *bytes, size_t len, void *ctx) {
+    rt_buffer_t *buffer = (rt_buffer_t *)ctx;
+    buffer_grow(buffer, len);
+    if (buffer->bytes == NULL)
+        return -1;
+
+    memcpy(buffer->bytes + buffer->used, bytes, len);
+    buffer->used += len;
+    return len;
+}
+
+static readstat_writer_t *writer_init(format_test_t *format, readstat_variable_t **variables,
+        int columns_count) {
+    readstat_writer_t *writer = readstat_writer_init();
+    int j;
+
+    readstat_set_data_writer(writer, &write_data);
+    readstat_writer_set_file_timestamp(writer, 1500000000);
+    readstat_writer_set_compression(writer, format->compression);
+
+    for (j=0; j<columns_count; j++) {
+        variables[j] = readstat_add_variable(writer, _names[j], _types[j], 0);
+    }
+
+    return writer;
+}
+
+static readstat_error_t insert_value(readstat_writer_t *writer, readstat_variable_t *variable,
+        columns_t *columns, int i) {
+    if (is_missing(i))
+        return readstat_insert_missing_value(writer, variable);
+
+    switch (readstat_variable_get_type(variable)) {
+        case READSTAT_TYPE_INT8:
+            return readstat_insert_int8_value(writer, variable, columns->int8_values[i]);
+        case READSTAT_TYPE_INT16:
+            return readstat_insert_int16_value(writer, variable, columns->int16_values[i]);
+        case READSTAT_TYPE_INT32:
+            return readstat_insert_int32_value(writer, variable, columns->int32_values[i]);
+        case READSTAT_TYPE_FLOAT:
+            return readstat_insert_float_value(writer, variable, columns->float_values[i]);
+        default:
+            return readstat_insert_double_value(writer, variable, columns->double_values[i]);
+    }
+}
+
+static readstat_error_t write_rows(format_test_t *format, columns_t *columns, rt_buffer_t *buffer) {
+    readstat_variable_t *variables[TEST_COLUMNS];
+    readstat_writer_t *writer = writer_init(format, variables, TEST_COLUMNS);
+    readstat_error_t error = READSTAT_OK;
+    int i, j;
+
+    buffer_reset(buffer);
+    if ((error = format->begin_writing(writer, buffer, TEST_ROWS)) != READSTAT_OK)
+        goto cleanup;
+
+    for (i=0; i<TEST_ROWS; i++) {
+        if ((error = readstat_begin_row(writer)) != READSTAT_OK)
+            goto cleanup;
+        for (j=0; j<TEST_COLUMNS; j++) {
+            if ((error = insert_value(writer, variables[j], columns, i)) != READSTAT_OK)
+                goto cleanup;
+        }
+        if ((error = readstat_end_row(writer)) != READSTAT_OK)
+            goto cleanup;
+    }
+
+    error = readstat_end_writing(writer);
+
+cleanup:
+    readstat_writer_free(writer);
+    return error;
+}
+
+static void set_batch_columns(readstat_batch_column_t *batch, readstat_variable_t **variables,
+        columns_t *columns) {
+    int32_t *int32_values[TEST_COLUMNS] = {
+        columns->int8_values, columns->int16_values, columns->int32_values, NULL, NULL };
+    double *double_values[TEST_COLUMNS] = {
+        NULL, NULL, NULL, columns->float_values, columns->double_values };
+    int j;
+
+    for (j=0; j<TEST_COLUMNS; j++) {
+        batch[j] = (readstat_batch_column_t) {
+            .variable = variables[j],
+            .type = _types[j],
+            .int32_values = int32_values[j],
+            .double_values = double_values[j],
+            .missing = columns->missing
+        };
+    }
+}
+
+/* Two batches, so that the second starts partway through a page or block */
+static readstat_error_t write_column_batch(format_test_t *format, columns_t *columns, rt_buffer_t *buffer) {
+    readstat_variable_t *variables[TEST_COLUMNS];
+    readstat_writer_t *writer = writer_init(format, variables, TEST_COLUMNS);
+    readstat_batch_column_t batch[TEST_COLUMNS];
+    readstat_error_t error = READSTAT_OK;
+    unsigned char missing[(TEST_ROWS + 7) / 8];
+    int first_rows = TEST_ROWS / 3 + 5;
+    int j;
+
+    set_batch_columns(batch, variables, columns);
+
+    buffer_reset(buffer);
+    if ((error = format->begin_writing(writer, buffer, TEST_ROWS)) != READSTAT_OK)
+        goto cleanup;
+
+    if ((error = readstat_insert_column_batch(writer, first_rows, batch, TEST_COLUMNS)) != READSTAT_OK)
+        goto cleanup;
+
+    /* The missing bitmap counts from the start of each batch, so the second
+     * batch gets a bitmap of its own */
+    memset(missing, 0, sizeof(missing));
+    for (j=first_rows; j<TEST_ROWS; j++) {
+        if (is_missing(j))
+            missing[(j - first_rows) / 8] |= (1 << ((j - first_rows) % 8));
+    }
+    for (j=0; j<TEST_COLUMNS; j++) {
+        batch[j].missing = missing;
+        if (batch[j].int32_values)
+            batch[j].int32_values += first_rows;
+        if (batch[j].double_values)
+            batch[j].double_values += first_rows;
+    }
+
+    if ((error = readstat_insert_column_batch(writer, TEST_ROWS - first_rows, batch, TEST_COLUMNS)) != READSTAT_OK)
+        goto cleanup;
+
+    error = readstat_end_writing(writer);
+
+cleanup:
+    readstat_writer_free(writer);
+    return error;
+}
+
+static int test_same_output(format_test_t *format, columns_t *columns,
+        rt_buffer_t *row_buffer, rt_buffer_t *batch_buffer) {
+    readstat_error_t error = READSTAT_OK;
+    size_t i;
+
+    if ((error = write_rows(format, columns, row_buffer)) != READSTAT_OK) {
+        printf("%s: Error writing rows: %s\n", format->label, readstat_error_message(error));
+        return 1;
+    }
+    if ((error = write_column_batch(format, columns, batch_buffer)) != READSTAT_OK) {
+        printf("%s: Error writing columns: %s\n", format->label, readstat_error_message(error));
+        return 1;
+    }
+
+    if (row_buffer->used != batch_buffer->used) {
+        printf("%s: Files differ in size (%ld and %ld bytes)\n", format->label,
+                (long)row_buffer->used, (long)batch_buffer->used);
+        return 1;
+    }
+
+    for (i=0; i<row_buffer->used; i++) {
+        if (row_buffer->bytes[i] != batch_buffer->bytes[i]) {
+            printf("%s: Files differ at byte %ld\n", format->label, (long)i);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int test_out_of_range(format_test_t *format, int column, int32_t value, rt_buffer_t *buffer) {
+    readstat_variable_t *variables[TEST_COLUMNS];
+    readstat_writer_t *writer = writer_init(format, variables, column + 1);
+    readstat_batch_column_t batch[TEST_COLUMNS];
+    readstat_error_t error = READSTAT_OK;
+    columns_t *columns = calloc(1, sizeof(columns_t));
+
+    set_batch_columns(batch, variables, columns);
+    columns->int8_values[1] = columns->int16_values[1] = value;
+
+    buffer_reset(buffer);
+    if ((error = format->begin_writing(writer, buffer, 2)) == READSTAT_OK)
+        error = readstat_insert_column_batch(writer, 2, &batch[column], 1);
+
+    readstat_writer_free(writer);
+    free(columns);
+
+    if (error != READSTAT_ERROR_NUMERIC_VALUE_IS_OUT_OF_RANGE) {
+        printf("%s: Writing %d to %s returned \"%s\", expected \"%s\"\n", format->label,
+                (int)value, _names[column], readstat_error_message(error),
+                readstat_error_message(READSTAT_ERROR_NUMERIC_VALUE_IS_OUT_OF_RANGE));
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    rt_buffer_t *row_buffer = buffer_init();
+    rt_buffer_t *batch_buffer = buffer_init();
+    columns_t *columns = malloc(sizeof(columns_t));
+    int failures = 0;
+    int i;
+
+    fill_columns(columns);
+
+    for (i=0; i<sizeof(_formats)/sizeof(_formats[0]); i++) {
+        format_test_t *format = &_formats[i];
+
+        failures += test_same_output(format, columns, row_buffer, batch_buffer);
+
+        failures += test_out_of_range(format, 0, 300, batch_buffer);
+        failures += test_out_of_range(format, 0, -300, batch_buffer);
+        failures += test_out_of_range(format, 1, 40000, batch_buffer);
+        failures += test_out_of_range(format, 1, -40000, batch_buffer);
+    }
+
+    free(columns);
+    buffer_free(row_buffer);
+    buffer_free(batch_buffer);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
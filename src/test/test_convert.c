@@ -0,0 +1,281 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../readstat.h"
+#include "../readstat_iconv.h"
+#include "../readstat_convert.h"
+
+#include "test_buffer.h"
+#include "test_buffer_io.h"
+#include "test_rows.h"
+
+/* Writes a column of strings already in some file encoding, reads it back
+ * in that encoding, and checks the UTF-8 that comes out of each cell. ASCII
+ * and non-ASCII cells are mixed in one column, so cells that are copied sit
+ * next to cells that are converted, and each converted cell has to start
+ * and end on its own: nothing held back by the converter may go missing or
+ * turn up in the next cell, and no shift state may carry over. */
+
+#define TEST_MAX_CELLS      8
+#define TEST_STRING_WIDTH  16
+#define TEST_DST_SIZE      32
+
+typedef struct convert_cell_s {
+    const char         *raw;
+    const char         *utf8;
+} convert_cell_t;
+
+typedef struct convert_test_s {
+    const char         *label;
+    rt_begin_writing_t  begin_writing;
+    rt_parse_t          parse;
+    const char         *encoding;
+    convert_cell_t      cells[TEST_MAX_CELLS];
+} convert_test_t;
+
+/* A single call to readstat_convert, with the converter's choice of path:
+ * a lookup table for single-byte encodings, or iconv for the rest */
+typedef struct convert_string_test_s {
+    const char         *encoding;
+    int                 single_byte;
+    const char         *src;
+    size_t              dst_len;
+    readstat_error_t    error;
+    const char         *dst;
+} convert_string_test_t;
+
+typedef struct convert_ctx_s {
+    convert_test_t     *test;
+    long                cells_read;
+    long                errors;
+} convert_ctx_t;
+
+static convert_test_t _tests[] = {
+    { "SAS7BDAT", &readstat_begin_writing_sas7bdat, &readstat_parse_sas7bdat, "WINDOWS-1252", {
+        { "plain", "plain" },
+        { "caf\xe9", "caf\xc3\xa9" },
+        { "ascii again", "ascii again" },
+        { "\xe9t\xe9", "\xc3\xa9t\xc3\xa9" },
+        { "x", "x" } } },
+    /* EBCDIC, where nothing is copied, ASCII letters included. SAV keeps
+     * records of variable names in the file encoding, which this one would
+     * garble. */
+    { "SAS7BDAT", &readstat_begin_writing_sas7bdat, &readstat_parse_sas7bdat, "IBM037", {
+        { "\xc8\x85\x93\x93\x96", "Hello" },
+        { "\x83\x81\x86\x51", "caf\xc3\xa9" },
+        { "\xf1\xf2\xf3", "123" } } },
+    /* iconv holds back a trailing vowel in case a tone mark follows it */
+    { "SAV", &readstat_begin_writing_sav, &readstat_parse_sav, "WINDOWS-1258", {
+        { "Vi\xea", "Vi\xc3\xaa" },
+        { "t", "t" },
+        { "\xe0", "\xc3\xa0" },
+        { "Nam", "Nam" } } },
+    /* The first cell ends without switching back to ASCII. SAS7BDAT pads
+     * cells with NULs, which aren't valid before the switch back. */
+    { "SAV", &readstat_begin_writing_sav, &readstat_parse_sav, "ISO-2022-JP", {
+        { "\x1b$B$3", "\xe3\x81\x93" },
+        { "ab", "ab" },
+        { "\x1b$B$3$s\x1b(B", "\xe3\x81\x93\xe3\x82\x93" },
+        { "cd", "cd" } } }
+};
+
+static convert_string_test_t _string_tests[] = {
+    { "WINDOWS-1252", 1, "\xe9", TEST_DST_SIZE, READSTAT_OK, "\xc3\xa9" },
+    { "WINDOWS-1252", 1, "caf\xe9  ", TEST_DST_SIZE, READSTAT_OK, "caf\xc3\xa9" },
+    { "WINDOWS-1252", 1, "a\x81", TEST_DST_SIZE, READSTAT_ERROR_CONVERT_BAD_STRING, NULL },
+    /* Room for the output and its terminator, and one byte short of it */
+    { "WINDOWS-1252", 1, "caf\xe9", 6, READSTAT_OK, "caf\xc3\xa9" },
+    { "WINDOWS-1252", 1, "caf\xe9", 5, READSTAT_ERROR_CONVERT_LONG_STRING, NULL },
+    { "WINDOWS-1252", 1, "abc", 4, READSTAT_OK, "abc" },
+    { "WINDOWS-1252", 1, "abcd", 4, READSTAT_ERROR_CONVERT_LONG_STRING, NULL },
+    { "WINDOWS-1252", 1, "abc", 0, READSTAT_ERROR_CONVERT_LONG_STRING, NULL },
+
+    { "WINDOWS-1258", 0, "Vi\xea", TEST_DST_SIZE, READSTAT_OK, "Vi\xc3\xaa" },
+    { "WINDOWS-1258", 0, "Vi\xea", 5, READSTAT_OK, "Vi\xc3\xaa" },
+    /* The held-back vowel only comes out when it's flushed */
+    { "WINDOWS-1258", 0, "Vi\xea", 4, READSTAT_ERROR_CONVERT_LONG_STRING, NULL },
+
+    { "ISO-2022-JP", 0, "\x1b$B$3\x1b(B", TEST_DST_SIZE, READSTAT_OK, "\xe3\x81\x93" },
+    { "ISO-2022-JP", 0, "\x1b$B$3\x1b(B", 3, READSTAT_ERROR_CONVERT_LONG_STRING, NULL },
+    { "ISO-2022-JP", 0, "ab", TEST_DST_SIZE, READSTAT_OK, "ab" },
+
+    { "UTF-8", 0, "caf\xc3\xa9", TEST_DST_SIZE, READSTAT_OK, "caf\xc3\xa9" },
+    { "UTF-8", 0, "caf\xc3\xa9", 5, READSTAT_ERROR_CONVERT_LONG_STRING, NULL },
+    /* A sequence cut off at the end of the field is dropped */
+    { "UTF-8", 0, "caf\xc3", TEST_DST_SIZE, READSTAT_OK, "caf" },
+    { "UTF-8", 0, "\xff", TEST_DST_SIZE, READSTAT_ERROR_CONVERT_BAD_STRING, NULL }
+};
+
+static long cell_count(convert_test_t *test) {
+    long count = 0;
+    while (count < TEST_MAX_CELLS && test->cells[count].raw)
+        count++;
+    return count;
+}
+
+static ssize_t write_data(const void *bytes, size_t len, void *ctx) {
+    rt_buffer_t *buffer = (rt_buffer_t *)ctx;
+    buffer_grow(buffer, len);
+    if (buffer->bytes == NULL)
+        return -1;
+
+    memcpy(buffer->bytes + buffer->used, bytes, len);
+    buffer->used += len;
+    return len;
+}
+
+static readstat_error_t write_file(convert_test_t *test, rt_buffer_t *buffer) {
+    readstat_writer_t *writer = readstat_writer_init();
+    readstat_error_t error = READSTAT_OK;
+    long row_count = cell_count(test);
+    long i;
+
+    buffer_reset(buffer);
+    readstat_set_data_writer(writer, &write_data);
+
+    readstat_variable_t *cell = readstat_add_variable(writer, "CELL", READSTAT_TYPE_STRING,
+            TEST_STRING_WIDTH);
+
+    if ((error = test->begin_writing(writer, buffer, row_count)) != READSTAT_OK)
+        goto cleanup;
+
+    for (i=0; i<row_count; i++) {
+        if ((error = readstat_begin_row(writer)) != READSTAT_OK)
+            goto cleanup;
+        if ((error = readstat_insert_string_value(writer, cell, test->cells[i].raw)) != READSTAT_OK)
+            goto cleanup;
+        if ((error = readstat_end_row(writer)) != READSTAT_OK)
+            goto cleanup;
+    }
+
+    error = readstat_end_writing(writer);
+
+cleanup:
+    readstat_writer_free(writer);
+    return error;
+}
+
+static int handle_value(int obs_index, readstat_variable_t *variable,
+        readstat_value_t value, void *ctx) {
+    convert_ctx_t *convert_ctx = (convert_ctx_t *)ctx;
+    const char *expected = convert_ctx->test->cells[obs_index].utf8;
+    const char *string = readstat_string_value(value);
+
+    if (string == NULL || strcmp(string, expected) != 0) {
+        printf("%s (%s): Cell %d came out as \"%s\", expected \"%s\"\n", convert_ctx->test->label,
+                convert_ctx->test->encoding, obs_index, string ? string : "(null)", expected);
+        convert_ctx->errors++;
+    }
+    convert_ctx->cells_read++;
+
+    return READSTAT_HANDLER_OK;
+}
+
+static int run_test(convert_test_t *test, rt_buffer_t *buffer) {
+    readstat_parser_t *parser = NULL;
+    readstat_error_t error = READSTAT_OK;
+    rt_buffer_ctx_t buffer_ctx = { .buffer = buffer };
+    convert_ctx_t ctx = { .test = test };
+
+    if ((error = write_file(test, buffer)) != READSTAT_OK) {
+        printf("%s (%s): Error writing file: %s\n", test->label, test->encoding,
+                readstat_error_message(error));
+        return 1;
+    }
+
+    parser = readstat_parser_init();
+    readstat_set_open_handler(parser, rt_open_handler);
+    readstat_set_close_handler(parser, rt_close_handler);
+    readstat_set_seek_handler(parser, rt_seek_handler);
+    readstat_set_read_handler(parser, rt_read_handler);
+    readstat_set_update_handler(parser, rt_update_handler);
+    readstat_set_io_ctx(parser, &buffer_ctx);
+
+    readstat_set_value_handler(parser, &handle_value);
+    readstat_set_file_character_encoding(parser, test->encoding);
+
+    error = test->parse(parser, NULL, &ctx);
+
+    readstat_parser_free(parser);
+
+    if (error != READSTAT_OK) {
+        printf("%s (%s): Error reading file: %s\n", test->label, test->encoding,
+                readstat_error_message(error));
+        return 1;
+    }
+
+    if (ctx.cells_read != cell_count(test)) {
+        printf("%s (%s): Read %ld cells, expected %ld\n", test->label, test->encoding,
+                ctx.cells_read, cell_count(test));
+        return 1;
+    }
+
+    return ctx.errors ? 1 : 0;
+}
+
+/* Converts into the front of a larger buffer, to check that nothing is
+ * written past dst_len */
+static int run_string_test(convert_string_test_t *test) {
+    readstat_converter_t *converter = readstat_converter_init("UTF-8", test->encoding);
+    readstat_error_t error = READSTAT_OK;
+    char dst[TEST_DST_SIZE+1];
+    int failures = 0;
+    int i;
+
+    if (converter == NULL) {
+        printf("%s: Error opening converter\n", test->encoding);
+        return 1;
+    }
+
+    if (converter->single_byte != test->single_byte) {
+        printf("%s: Converter %s a lookup table\n", test->encoding,
+                converter->single_byte ? "has" : "does not have");
+        failures++;
+    }
+
+    memset(dst, 'X', sizeof(dst));
+    error = readstat_convert(dst, test->dst_len, test->src, strlen(test->src), converter);
+
+    if (error != test->error) {
+        printf("%s: Converting \"%s\" into %ld bytes returned \"%s\", expected \"%s\"\n",
+                test->encoding, test->src, (long)test->dst_len,
+                readstat_error_message(error), readstat_error_message(test->error));
+        failures++;
+    } else if (error == READSTAT_OK && strcmp(dst, test->dst) != 0) {
+        printf("%s: Converting \"%s\" gave \"%s\", expected \"%s\"\n",
+                test->encoding, test->src, dst, test->dst);
+        failures++;
+    }
+
+    for (i=test->dst_len; i<sizeof(dst); i++) {
+        if (dst[i] != 'X') {
+            printf("%s: Converting \"%s\" into %ld bytes wrote past the end\n",
+                    test->encoding, test->src, (long)test->dst_len);
+            failures++;
+            break;
+        }
+    }
+
+    readstat_converter_free(converter);
+
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    rt_buffer_t *buffer = buffer_init();
+    int failures = 0;
+    int i;
+
+    for (i=0; i<sizeof(_string_tests)/sizeof(_string_tests[0]); i++) {
+        failures += run_string_test(&_string_tests[i]);
+    }
+    for (i=0; i<sizeof(_tests)/sizeof(_tests[0]); i++) {
+        failures += run_test(&_tests[i], buffer);
+    }
+
+    buffer_free(buffer);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
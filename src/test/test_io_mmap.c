@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../readstat.h"
+
+#include "test_buffer.h"
+#include "test_rows.h"
+
+/* Writes files to disk and reads them back through the memory-mapped I/O,
+ * which lends the readers pages and rows straight out of the mapping
+ * instead of copying them. */
+
+#define TEST_ROWS           5000
+#define TEST_FILE_PATH      "test_io_mmap.tmp"
+
+typedef struct mmap_test_s {
+    const char                 *label;
+    rt_begin_writing_t          begin_writing;
+    rt_parse_t                  parse;
+    readstat_compress_t         compression;
+} mmap_test_t;
+
+static mmap_test_t _tests[] = {
+    { "SAS7BDAT", &readstat_begin_writing_sas7bdat, &readstat_parse_sas7bdat, READSTAT_COMPRESS_NONE },
+    { "SAS7BDAT (RLE)", &readstat_begin_writing_sas7bdat, &readstat_parse_sas7bdat, READSTAT_COMPRESS_ROWS },
+    { "DTA", &readstat_begin_writing_dta, &readstat_parse_dta, READSTAT_COMPRESS_NONE },
+    { "SAV", &readstat_begin_writing_sav, &readstat_parse_sav, READSTAT_COMPRESS_NONE },
+    { "SAV (bytecode)", &readstat_begin_writing_sav, &readstat_parse_sav, READSTAT_COMPRESS_ROWS }
+};
+
+static int save_buffer(rt_buffer_t *buffer, const char *path) {
+    FILE *file = fopen(path, "wb");
+    int failed = 0;
+
+    if (file == NULL)
+        return 1;
+
+    if (fwrite(buffer->bytes, 1, buffer->used, file) != buffer->used)
+        failed = 1;
+    if (fclose(file) != 0)
+        failed = 1;
+
+    return failed;
+}
+
+static int run_test(mmap_test_t *test, rt_buffer_t *buffer) {
+    readstat_writer_t *writer = readstat_writer_init();
+    readstat_parser_t *parser = NULL;
+    readstat_error_t error = READSTAT_OK;
+    rt_rows_ctx_t rows_ctx;
+    int failures = 0;
+
+    readstat_writer_set_compression(writer, test->compression);
+    if ((error = rt_rows_write(writer, buffer, test->begin_writing, TEST_ROWS, 1)) != READSTAT_OK) {
+        printf("%s: Error writing file: %s\n", test->label, readstat_error_message(error));
+        failures++;
+        goto cleanup;
+    }
+
+    if (save_buffer(buffer, TEST_FILE_PATH)) {
+        printf("%s: Error saving file to %s\n", test->label, TEST_FILE_PATH);
+        failures++;
+        goto cleanup;
+    }
+
+    parser = readstat_parser_init();
+    rt_rows_set_handlers(parser);
+    if ((error = readstat_set_mmap_io(parser)) != READSTAT_OK) {
+        printf("%s: Error setting up mmap I/O: %s\n", test->label, readstat_error_message(error));
+        failures++;
+        goto cleanup;
+    }
+
+    rt_rows_ctx_reset(&rows_ctx, 1, 0);
+    if ((error = test->parse(parser, TEST_FILE_PATH, &rows_ctx)) != READSTAT_OK) {
+        printf("%s: Error reading file: %s\n", test->label, readstat_error_message(error));
+        failures++;
+    } else if (rows_ctx.errors) {
+        printf("%s: %ld wrong values\n", test->label, rows_ctx.errors);
+        failures++;
+    } else if (rows_ctx.rows_read != TEST_ROWS) {
+        printf("%s: Read %ld rows, expected %d\n", test->label, rows_ctx.rows_read, TEST_ROWS);
+        failures++;
+    }
+
+cleanup:
+    if (parser)
+        readstat_parser_free(parser);
+    readstat_writer_free(writer);
+    remove(TEST_FILE_PATH);
+
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    rt_buffer_t *buffer = buffer_init();
+    int failures = 0;
+    int i;
+
+    for (i=0; i<sizeof(_tests)/sizeof(_tests[0]); i++) {
+        failures += run_test(&_tests[i], buffer);
+    }
+
+    buffer_free(buffer);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
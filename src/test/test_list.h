@@ -171,6 +171,47 @@ static rt_test_group_t _test_groups[] = {
                         }
                     }
                 }
+            },
+
+            {
+                .label = "SAS7BDAT RDC compression",
+                .test_formats = RT_FORMAT_SAS7BDAT_COMP_BINARY,
+                .rows = 8,
+                .columns = {
+                    {
+                        .name = "VAR1",
+                        .type = READSTAT_TYPE_DOUBLE,
+                        .label = "Double-precision variable",
+                        .values = {
+                            { .type = READSTAT_TYPE_DOUBLE, .v = { .double_value = 0.0 } },
+                            { .type = READSTAT_TYPE_DOUBLE, .is_system_missing = 1 },
+                            { .type = READSTAT_TYPE_DOUBLE, .v = { .double_value = 1.5 } },
+                            { .type = READSTAT_TYPE_DOUBLE, .v = { .double_value = -1e100 } },
+
+                            { .type = READSTAT_TYPE_DOUBLE, .v = { .double_value = 0.0 } },
+                            { .type = READSTAT_TYPE_DOUBLE, .v = { .double_value = 0.0 } },
+                            { .type = READSTAT_TYPE_DOUBLE, .v = { .double_value = 1.5 } },
+                            { .type = READSTAT_TYPE_DOUBLE, .v = { .double_value = 1.5 } }
+                        }
+                    },
+
+                    {
+                        .name = "VAR2",
+                        .type = READSTAT_TYPE_STRING,
+                        .label = "String variable",
+                        .values = {
+                            { .type = READSTAT_TYPE_STRING, .v = { .string_value = "" } },
+                            { .type = READSTAT_TYPE_STRING, .v = { .string_value = "abcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabcabc" } },
+                            { .type = READSTAT_TYPE_STRING, .v = { .string_value = "short run->xxxx<-- long run->yyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyy<--" } },
+                            { .type = READSTAT_TYPE_STRING, .v = { .string_value = "the quick brown fox, the quick brown fox, the quick brown fox" } },
+
+                            { .type = READSTAT_TYPE_STRING, .v = { .string_value = "jiafojdsaufwejfiewnfiabfiuaewbfiuwhfeiuwfuienawuifnwauiefnhfuiwheufhwfuiewfjwuifewuif" } },
+                            { .type = READSTAT_TYPE_STRING, .v = { .string_value = "0123456789012345678901234567890123456789012345678901234567890123456789" } },
+                            { .type = READSTAT_TYPE_STRING, .v = { .string_value = "ab" } },
+                            { .type = READSTAT_TYPE_STRING, .v = { .string_value = "@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@" } }
+                        }
+                    }
+                }
             }
         }
     },
@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../readstat.h"
+
+#include "test_buffer.h"
+#include "test_buffer_io.h"
+#include "test_rows.h"
+
+/* Parses multi-page SAS7BDAT files with no value handler, which only wants
+ * the metadata, and counts the calls to the read handler. With no AMD pages
+ * in the file, the scan for them shouldn't have to visit every page. */
+
+#define TEST_ROWS           40000
+/* The pages up to the first one with rows, plus the scan from the end */
+#define TEST_MAX_READS        200
+
+typedef struct counting_io_ctx_s {
+    rt_buffer_ctx_t     buffer_ctx;
+    long                reads;
+    size_t              bytes_read;
+} counting_io_ctx_t;
+
+typedef struct metadata_ctx_s {
+    int                 var_count;
+    int                 row_count;
+} metadata_ctx_t;
+
+typedef struct metadata_test_s {
+    const char                 *label;
+    readstat_compress_t         compression;
+} metadata_test_t;
+
+static metadata_test_t _tests[] = {
+    { "SAS7BDAT", READSTAT_COMPRESS_NONE },
+    { "SAS7BDAT (RLE)", READSTAT_COMPRESS_ROWS }
+};
+
+static ssize_t counting_read_handler(void *buf, size_t nbytes, void *io_ctx) {
+    counting_io_ctx_t *ctx = (counting_io_ctx_t *)io_ctx;
+    ssize_t bytes_read = rt_read_handler(buf, nbytes, &ctx->buffer_ctx);
+    ctx->reads++;
+    if (bytes_read > 0)
+        ctx->bytes_read += bytes_read;
+    return bytes_read;
+}
+
+static int handle_metadata(readstat_metadata_t *metadata, void *ctx) {
+    metadata_ctx_t *metadata_ctx = (metadata_ctx_t *)ctx;
+    metadata_ctx->var_count = readstat_get_var_count(metadata);
+    metadata_ctx->row_count = readstat_get_row_count(metadata);
+    return READSTAT_HANDLER_OK;
+}
+
+static int run_test(metadata_test_t *test, rt_buffer_t *buffer) {
+    readstat_writer_t *writer = readstat_writer_init();
+    readstat_parser_t *parser = NULL;
+    readstat_error_t error = READSTAT_OK;
+    counting_io_ctx_t io_ctx = { .buffer_ctx = { .buffer = buffer } };
+    metadata_ctx_t ctx = { 0 };
+
+    readstat_writer_set_compression(writer, test->compression);
+    error = rt_rows_write(writer, buffer, &readstat_begin_writing_sas7bdat, TEST_ROWS, 1);
+    readstat_writer_free(writer);
+
+    if (error != READSTAT_OK) {
+        printf("%s: Error writing file: %s\n", test->label, readstat_error_message(error));
+        return 1;
+    }
+
+    parser = readstat_parser_init();
+    readstat_set_open_handler(parser, rt_open_handler);
+    readstat_set_close_handler(parser, rt_close_handler);
+    readstat_set_seek_handler(parser, rt_seek_handler);
+    readstat_set_read_handler(parser, counting_read_handler);
+    readstat_set_update_handler(parser, rt_update_handler);
+    readstat_set_io_ctx(parser, &io_ctx);
+
+    readstat_set_metadata_handler(parser, &handle_metadata);
+
+    error = readstat_parse_sas7bdat(parser, NULL, &ctx);
+
+    readstat_parser_free(parser);
+
+    if (error != READSTAT_OK) {
+        printf("%s: Error reading file: %s\n", test->label, readstat_error_message(error));
+        return 1;
+    }
+
+    if (ctx.var_count != 4 || ctx.row_count != TEST_ROWS) {
+        printf("%s: Got %d columns and %d rows, expected 4 and %d\n", test->label,
+                ctx.var_count, ctx.row_count, TEST_ROWS);
+        return 1;
+    }
+
+    if (io_ctx.reads > TEST_MAX_READS) {
+        printf("%s: Made %ld reads (%ld bytes of %ld), expected at most %d\n", test->label,
+                io_ctx.reads, (long)io_ctx.bytes_read, (long)buffer->used, TEST_MAX_READS);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    rt_buffer_t *buffer = buffer_init();
+    int failures = 0;
+    int i;
+
+    for (i=0; i<sizeof(_tests)/sizeof(_tests[0]); i++) {
+        failures += run_test(&_tests[i], buffer);
+    }
+
+    buffer_free(buffer);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../readstat.h"
+
+#include "test_buffer.h"
+#include "test_buffer_io.h"
+#include "test_rows.h"
+
+/* Reads files large enough for the readers to hand work to more than one
+ * thread, and checks that every value comes out the same as it does from a
+ * single-threaded read. The fixtures in test_readstat.c are a page or a
+ * block long, so they never get that far. */
+
+#define TEST_THREAD_COUNT       4
+#define TEST_ZSAV_ROWS     400000
+
+typedef struct parallel_test_s {
+    const char                 *label;
+    rt_begin_writing_t          begin_writing;
+    rt_parse_t                  parse;
+    readstat_compress_t         compression;
+    long                        row_count;
+    int64_t                     min_blocks;
+} parallel_test_t;
+
+static parallel_test_t _tests[] = {
+    { "SAS7BDAT", &readstat_begin_writing_sas7bdat, &readstat_parse_sas7bdat,
+        READSTAT_COMPRESS_NONE, 40000, 200 },
+    { "SAS7BDAT (RLE)", &readstat_begin_writing_sas7bdat, &readstat_parse_sas7bdat,
+        READSTAT_COMPRESS_ROWS, 40000, 200 },
+    { "SAS7BDAT (RDC)", &readstat_begin_writing_sas7bdat, &readstat_parse_sas7bdat,
+        READSTAT_COMPRESS_BINARY, 40000, 200 },
+#if HAVE_ZLIB
+    /* ZSAV blocks hold 0x3FF000 bytes of bytecode, or about 40000 rows */
+    { "ZSAV", &readstat_begin_writing_sav, &readstat_parse_sav,
+        READSTAT_COMPRESS_BINARY, TEST_ZSAV_ROWS, 8 },
+    { "ZSAV (no rows)", &readstat_begin_writing_sav, &readstat_parse_sav,
+        READSTAT_COMPRESS_BINARY, 0, 0 }
+#endif
+};
+
+static readstat_error_t read_file(rt_parse_t parse, rt_buffer_t *buffer,
+        int thread_count, int borrow, readstat_row_index_t *index, rt_rows_ctx_t *rows_ctx) {
+    readstat_error_t error = READSTAT_OK;
+    rt_buffer_ctx_t buffer_ctx = { .buffer = buffer };
+    readstat_parser_t *parser = readstat_parser_init();
+
+    readstat_set_open_handler(parser, rt_open_handler);
+    readstat_set_close_handler(parser, rt_close_handler);
+    readstat_set_seek_handler(parser, rt_seek_handler);
+    readstat_set_read_handler(parser, rt_read_handler);
+    if (borrow)
+        readstat_set_borrow_handler(parser, rt_borrow_handler);
+    readstat_set_update_handler(parser, rt_update_handler);
+    readstat_set_io_ctx(parser, &buffer_ctx);
+
+    rt_rows_set_handlers(parser);
+    readstat_set_thread_count(parser, thread_count);
+    if (index)
+        readstat_set_row_index(parser, index);
+
+    rt_rows_ctx_reset(rows_ctx, 1, 0);
+    error = parse(parser, NULL, rows_ctx);
+
+    readstat_parser_free(parser);
+
+    return error;
+}
+
+static int check_read(const char *label, readstat_error_t error, rt_rows_ctx_t *rows_ctx, long rows) {
+    if (error != READSTAT_OK) {
+        printf("%s: Error reading file: %s\n", label, readstat_error_message(error));
+        return 1;
+    }
+    if (rows_ctx->errors) {
+        printf("%s: %ld wrong values\n", label, rows_ctx->errors);
+        return 1;
+    }
+    if (rows_ctx->rows_read != rows) {
+        printf("%s: Read %ld rows, expected %ld\n", label, rows_ctx->rows_read, rows);
+        return 1;
+    }
+    return 0;
+}
+
+static int run_test(parallel_test_t *test, rt_buffer_t *buffer) {
+    readstat_writer_t *writer = readstat_writer_init();
+    readstat_row_index_t *index = readstat_row_index_init();
+    readstat_error_t error = READSTAT_OK;
+    rt_rows_ctx_t single_ctx, threaded_ctx;
+    int failures = 0;
+    int borrow;
+
+    readstat_writer_set_compression(writer, test->compression);
+    if ((error = rt_rows_write(writer, buffer, test->begin_writing, test->row_count, 1)) != READSTAT_OK) {
+        printf("%s: Error writing file: %s\n", test->label, readstat_error_message(error));
+        failures++;
+        goto cleanup;
+    }
+
+    /* The index is only there to count the pages or blocks */
+    error = read_file(test->parse, buffer, 1, 0, index, &single_ctx);
+    if ((failures += check_read(test->label, error, &single_ctx, test->row_count)))
+        goto cleanup;
+
+    if (readstat_row_index_get_block_count(index) < test->min_blocks) {
+        printf("%s: File has only %" PRId64 " blocks\n", test->label,
+                readstat_row_index_get_block_count(index));
+        failures++;
+        goto cleanup;
+    }
+
+    for (borrow=0; borrow<2; borrow++) {
+        error = read_file(test->parse, buffer, TEST_THREAD_COUNT, borrow, NULL, &threaded_ctx);
+        if (check_read(test->label, error, &threaded_ctx, test->row_count)) {
+            failures++;
+        } else if (threaded_ctx.checksum != single_ctx.checksum) {
+            printf("%s: Values read on %d threads%s differ from a single-threaded read\n",
+                    test->label, TEST_THREAD_COUNT, borrow ? " (borrowed)" : "");
+            failures++;
+        }
+    }
+
+cleanup:
+    readstat_row_index_free(index);
+    readstat_writer_free(writer);
+
+    return failures;
+}
+
+#if HAVE_ZLIB
+/* Blocks compressed on worker threads must come out in the same order and
+ * with the same bytes as blocks compressed one at a time */
+static int test_zsav_writer(rt_buffer_t *buffer) {
+    readstat_writer_t *writer = NULL;
+    readstat_error_t error = READSTAT_OK;
+    rt_buffer_t *threaded_buffer = buffer_init();
+    rt_rows_ctx_t rows_ctx;
+    int failures = 0;
+
+    writer = readstat_writer_init();
+    readstat_writer_set_compression(writer, READSTAT_COMPRESS_BINARY);
+    error = rt_rows_write(writer, buffer, &readstat_begin_writing_sav, TEST_ZSAV_ROWS, 1);
+    readstat_writer_free(writer);
+    if (error != READSTAT_OK) {
+        printf("ZSAV writer: Error writing file: %s\n", readstat_error_message(error));
+        failures++;
+        goto cleanup;
+    }
+
+    writer = readstat_writer_init();
+    readstat_writer_set_compression(writer, READSTAT_COMPRESS_BINARY);
+    readstat_writer_set_thread_count(writer, TEST_THREAD_COUNT);
+    error = rt_rows_write(writer, threaded_buffer, &readstat_begin_writing_sav, TEST_ZSAV_ROWS, 1);
+    readstat_writer_free(writer);
+    if (error != READSTAT_OK) {
+        printf("ZSAV writer: Error writing file on %d threads: %s\n", TEST_THREAD_COUNT,
+                readstat_error_message(error));
+        failures++;
+        goto cleanup;
+    }
+
+    if (threaded_buffer->used != buffer->used ||
+            memcmp(threaded_buffer->bytes, buffer->bytes, buffer->used) != 0) {
+        printf("ZSAV writer: File written on %d threads differs from a single-threaded write\n",
+                TEST_THREAD_COUNT);
+        failures++;
+        goto cleanup;
+    }
+
+    error = read_file(&readstat_parse_sav, threaded_buffer, TEST_THREAD_COUNT, 0, NULL, &rows_ctx);
+    failures += check_read("ZSAV writer", error, &rows_ctx, TEST_ZSAV_ROWS);
+
+cleanup:
+    buffer_free(threaded_buffer);
+
+    return failures;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+    rt_buffer_t *buffer = buffer_init();
+    int failures = 0;
+    int i;
+
+    for (i=0; i<sizeof(_tests)/sizeof(_tests[0]); i++) {
+        failures += run_test(&_tests[i], buffer);
+    }
+#if HAVE_ZLIB
+    failures += test_zsav_writer(buffer);
+#endif
+
+    buffer_free(buffer);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
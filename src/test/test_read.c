@@ -45,10 +45,14 @@ char *file_extension(long format) {
         return "sas7bdat32";
     if (format == RT_FORMAT_SAS7BDAT_32BIT_COMP_ROWS)
         return "sas7bdat32row";
+    if (format == RT_FORMAT_SAS7BDAT_32BIT_COMP_BINARY)
+        return "sas7bdat32bin";
     if (format == RT_FORMAT_SAS7BDAT_64BIT_COMP_NONE)
         return "sas7bdat64";
     if (format == RT_FORMAT_SAS7BDAT_64BIT_COMP_ROWS)
         return "sas7bdat64row";
+    if (format == RT_FORMAT_SAS7BDAT_64BIT_COMP_BINARY)
+        return "sas7bdat64bin";
     if (format == RT_FORMAT_XPORT_5)
         return "xpt5";
     if (format == RT_FORMAT_XPORT_8)
@@ -88,6 +92,7 @@ void parse_ctx_reset(rt_parse_ctx_t *parse_ctx, long file_format) {
     }
     parse_ctx->var_index = -1;
     parse_ctx->obs_index = -1;
+    parse_ctx->row_count = -1;
     parse_ctx->notes_count = 0;
     parse_ctx->variables_count = 0;
     parse_ctx->value_labels_count = 0;
@@ -112,6 +117,31 @@ long expected_row_count(rt_parse_ctx_t *parse_ctx) {
     return expected_rows;
 }
 
+/* With args->projection, only the even-numbered columns are selected */
+static int column_is_selected(rt_parse_ctx_t *parse_ctx, long index) {
+    return !parse_ctx->args->projection || index % 2 == 0;
+}
+
+static long expected_column_count(rt_parse_ctx_t *parse_ctx) {
+    if (parse_ctx->args->projection)
+        return (parse_ctx->file->columns_count + 1) / 2;
+    return parse_ctx->file->columns_count;
+}
+
+static void select_columns(readstat_parser_t *parser, rt_parse_ctx_t *parse_ctx) {
+    long i;
+    for (i=0; i<parse_ctx->file->columns_count; i++) {
+        if (!column_is_selected(parse_ctx, i))
+            continue;
+        /* Exercise both ways of selecting a column */
+        if (i % 4 == 0) {
+            readstat_select_column_index(parser, i);
+        } else {
+            readstat_select_column_name(parser, parse_ctx->file->columns[i].name);
+        }
+    }
+}
+
 static int handle_metadata(readstat_metadata_t *metadata, void *ctx) {
     rt_parse_ctx_t *rt_ctx = (rt_parse_ctx_t *)ctx;
 
@@ -120,6 +150,8 @@ static int handle_metadata(readstat_metadata_t *metadata, void *ctx) {
 
     int var_count = readstat_get_var_count(metadata);
     int obs_count = readstat_get_row_count(metadata);
+
+    rt_ctx->row_count = obs_count;
     const char *file_label = readstat_get_file_label(metadata);
     const char *table_name = readstat_get_table_name(metadata);
     time_t timestamp = readstat_get_creation_time(metadata);
@@ -180,6 +212,14 @@ static int handle_variable(int index, readstat_variable_t *variable,
 
     rt_ctx->var_index = index;
 
+    if (!column_is_selected(rt_ctx, index)) {
+        push_error_if_doubles_differ(rt_ctx, 0, 1, "Unselected column");
+    } else if (rt_ctx->args->projection) {
+        push_error_if_doubles_differ(rt_ctx, index / 2,
+                readstat_variable_get_index_after_skipping(variable),
+                "Column index after skipping");
+    }
+
     push_error_if_strings_differ(rt_ctx, column->label_set, 
             val_labels,
             "Column label sets");
@@ -252,6 +292,11 @@ static int handle_value(int obs_index, readstat_variable_t *variable, readstat_v
 
     rt_column_t *column = &rt_ctx->file->columns[rt_ctx->var_index];
 
+    if (!column_is_selected(rt_ctx, rt_ctx->var_index)) {
+        push_error_if_doubles_differ(rt_ctx, 0, 1, "Value of unselected column");
+        return READSTAT_HANDLER_OK;
+    }
+
     if (column->type == READSTAT_TYPE_STRING_REF) {
         push_error_if_strings_differ(rt_ctx,
                 rt_ctx->file->string_refs[readstat_int32_value(column->values[file_obs_index])],
@@ -265,6 +310,33 @@ static int handle_value(int obs_index, readstat_variable_t *variable, readstat_v
     return READSTAT_HANDLER_OK;
 }
 
+static int handle_batch(int obs_index, int obs_count,
+        readstat_batch_column_t *columns, int column_count, void *ctx) {
+    int i, j;
+    for (j=0; j<column_count; j++) {
+        readstat_batch_column_t *column = &columns[j];
+        for (i=0; i<obs_count; i++) {
+            readstat_value_t value = { .type = column->type };
+            if (column->string_offsets) {
+                value.v.string_value = &column->string_data[column->string_offsets[i]];
+            } else if (column->int32_values) {
+                value.type = READSTAT_TYPE_INT32;
+                value.v.i32_value = column->int32_values[i];
+            } else {
+                value.type = READSTAT_TYPE_DOUBLE;
+                value.v.double_value = column->double_values[i];
+            }
+            if (column->missing[i / 8] & (1 << (i % 8))) {
+                value.tag = column->tags[i];
+                value.is_tagged_missing = (value.tag != '\0');
+                value.is_system_missing = (value.tag == '\0');
+            }
+            handle_value(obs_index + i, column->variable, value, ctx);
+        }
+    }
+    return READSTAT_HANDLER_OK;
+}
+
 static void handle_error(const char *error_message, void *ctx) {
     printf("%s\n", error_message);
 }
@@ -278,6 +350,8 @@ readstat_error_t read_file(rt_parse_ctx_t *parse_ctx, long format) {
     readstat_set_close_handler(parser, rt_close_handler);
     readstat_set_seek_handler(parser, rt_seek_handler);
     readstat_set_read_handler(parser, rt_read_handler);
+    if (parse_ctx->args->borrow)
+        readstat_set_borrow_handler(parser, rt_borrow_handler);
     readstat_set_update_handler(parser, rt_update_handler);
     readstat_set_io_ctx(parser, parse_ctx->buffer_ctx);
 
@@ -285,12 +359,23 @@ readstat_error_t read_file(rt_parse_ctx_t *parse_ctx, long format) {
     readstat_set_note_handler(parser, &handle_note);
     readstat_set_variable_handler(parser, &handle_variable);
     readstat_set_fweight_handler(parser, &handle_fweight);
-    readstat_set_value_handler(parser, &handle_value);
+    if (!parse_ctx->args->metadata_only)
+        readstat_set_value_handler(parser, &handle_value);
     readstat_set_value_label_handler(parser, &handle_value_label);
     readstat_set_error_handler(parser, &handle_error);
 
     readstat_set_row_limit(parser, parse_ctx->args->row_limit);
     readstat_set_row_offset(parser, parse_ctx->args->row_offset);
+    if (parse_ctx->args->thread_count)
+        readstat_set_thread_count(parser, parse_ctx->args->thread_count);
+
+    if (parse_ctx->args->batch_size) {
+        readstat_set_batch_handler(parser, &handle_batch);
+        readstat_set_batch_size(parser, parse_ctx->args->batch_size);
+    }
+
+    if (parse_ctx->args->projection)
+        select_columns(parser, parse_ctx);
 
     if ((format & RT_FORMAT_DTA)) {
         parse_ctx->file_format_version = dta_file_format_version(format);
@@ -316,11 +401,17 @@ readstat_error_t read_file(rt_parse_ctx_t *parse_ctx, long format) {
     push_error_if_doubles_differ(parse_ctx, parse_ctx->file->notes_count,
             parse_ctx->notes_count, "Note count");
 
-    push_error_if_doubles_differ(parse_ctx, parse_ctx->file->columns_count,
+    push_error_if_doubles_differ(parse_ctx, expected_column_count(parse_ctx),
             parse_ctx->variables_count, "Column count");
 
-    push_error_if_doubles_differ(parse_ctx, expected_row_count(parse_ctx),
-            parse_ctx->obs_index + 1, "Row count");
+    if (!parse_ctx->args->metadata_only) {
+        push_error_if_doubles_differ(parse_ctx, expected_row_count(parse_ctx),
+                parse_ctx->obs_index + 1, "Row count");
+    } else if ((format & (RT_FORMAT_DTA | RT_FORMAT_SAV | RT_FORMAT_SAS7BDAT))) {
+        /* No rows are read, but these formats give the count in the header */
+        push_error_if_doubles_differ(parse_ctx, expected_row_count(parse_ctx),
+                parse_ctx->row_count, "Row count");
+    }
 
     long value_labels_count = 0;
     long i;
@@ -27,6 +27,53 @@ static rt_test_args_t _test_args[] = {
     {
         .row_limit = 1,
         .row_offset = 1,
+    },
+    {
+        .row_limit = 0,
+        .row_offset = 0,
+        .batch_size = 3,
+    },
+    {
+        .row_limit = 0,
+        .row_offset = 1,
+        .borrow = 1,
+    },
+    {
+        .row_limit = 0,
+        .row_offset = 1,
+        .thread_count = 3,
+    },
+    {
+        .row_limit = 0,
+        .row_offset = 0,
+        .seekable = 1,
+    },
+    {
+        .row_limit = 0,
+        .row_offset = 0,
+        .column_batch = 1,
+    },
+    {
+        .row_limit = 0,
+        .row_offset = 0,
+        .projection = 1,
+    },
+    {
+        .row_limit = 0,
+        .row_offset = 0,
+        .metadata_only = 1,
+    },
+    {
+        .row_limit = 0,
+        .row_offset = 0,
+        .set_write_buffer_size = 1,
+        .write_buffer_size = 0,
+    },
+    {
+        .row_limit = 0,
+        .row_offset = 0,
+        .set_write_buffer_size = 1,
+        .write_buffer_size = 7,
     }
 };
 
@@ -64,7 +111,7 @@ int main(int argc, char *argv[]) {
                     int old_errors_count = parse_ctx->errors_count;
                     parse_ctx_reset(parse_ctx, f);
 
-                    error = write_file_to_buffer(file, buffer, f);
+                    error = write_file_to_buffer_with_args(file, buffer, f, args);
                     if (error != file->write_error) {
                         push_error_if_codes_differ(parse_ctx, file->write_error, error);
                         error = READSTAT_OK;
@@ -39,14 +39,19 @@
 
 #define RT_FORMAT_SAS7BDAT_32BIT_COMP_NONE    0x010000
 #define RT_FORMAT_SAS7BDAT_32BIT_COMP_ROWS    0x020000
-#define RT_FORMAT_SAS7BDAT_32BIT (RT_FORMAT_SAS7BDAT_32BIT_COMP_NONE | RT_FORMAT_SAS7BDAT_32BIT_COMP_ROWS)
+#define RT_FORMAT_SAS7BDAT_32BIT_COMP_BINARY  0x800000
+#define RT_FORMAT_SAS7BDAT_32BIT (RT_FORMAT_SAS7BDAT_32BIT_COMP_NONE | RT_FORMAT_SAS7BDAT_32BIT_COMP_ROWS | \
+        RT_FORMAT_SAS7BDAT_32BIT_COMP_BINARY)
 
 #define RT_FORMAT_SAS7BDAT_64BIT_COMP_NONE    0x040000
 #define RT_FORMAT_SAS7BDAT_64BIT_COMP_ROWS    0x080000
-#define RT_FORMAT_SAS7BDAT_64BIT (RT_FORMAT_SAS7BDAT_64BIT_COMP_NONE | RT_FORMAT_SAS7BDAT_64BIT_COMP_ROWS)
+#define RT_FORMAT_SAS7BDAT_64BIT_COMP_BINARY  0x1000000
+#define RT_FORMAT_SAS7BDAT_64BIT (RT_FORMAT_SAS7BDAT_64BIT_COMP_NONE | RT_FORMAT_SAS7BDAT_64BIT_COMP_ROWS | \
+        RT_FORMAT_SAS7BDAT_64BIT_COMP_BINARY)
 
 #define RT_FORMAT_SAS7BDAT_COMP_NONE (RT_FORMAT_SAS7BDAT_32BIT_COMP_NONE | RT_FORMAT_SAS7BDAT_64BIT_COMP_NONE)
 #define RT_FORMAT_SAS7BDAT_COMP_ROWS (RT_FORMAT_SAS7BDAT_32BIT_COMP_ROWS | RT_FORMAT_SAS7BDAT_64BIT_COMP_ROWS)
+#define RT_FORMAT_SAS7BDAT_COMP_BINARY (RT_FORMAT_SAS7BDAT_32BIT_COMP_BINARY | RT_FORMAT_SAS7BDAT_64BIT_COMP_BINARY)
 
 #define RT_FORMAT_SAS7BDAT  (RT_FORMAT_SAS7BDAT_32BIT | RT_FORMAT_SAS7BDAT_64BIT)
 
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../readstat.h"
+
+#include "test_buffer.h"
+#include "test_buffer_io.h"
+
+/* Checks that once the first row has been decoded, the readers decode every
+ * further row without calling the allocator. Threaded reads set up their
+ * threads and buffers as the first batches are handed out, which for a
+ * compressed SAS7BDAT file comes after the rows on the pages that pass 1
+ * kept, so they are checked over the second half of the file, once every
+ * batch has been used at least once. Calls are counted by replacing malloc,
+ * calloc and realloc in this program, which only works where the C library
+ * exports its own entry points to forward to. */
+
+#define TEST_ROWS           3000
+/* Enough for several ZSAV blocks, and for several batches of them or of
+ * SAS7BDAT pages on each thread */
+#define TEST_THREADED_ROWS  120000
+#define TEST_THREAD_COUNT      4
+#define TEST_STRING_WIDTH     80
+#define TEST_LONG_STRING_WIDTH   600
+
+#define EXIT_SKIP             77
+
+#if defined(__GLIBC__)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static long alloc_count;
+
+void *malloc(size_t size) {
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    alloc_count++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+
+typedef readstat_error_t (*begin_writing_t)(readstat_writer_t *writer, void *user_ctx, long row_count);
+typedef readstat_error_t (*parse_t)(readstat_parser_t *parser, const char *path, void *user_ctx);
+
+typedef struct row_allocs_format_s {
+    const char             *label;
+    begin_writing_t         begin_writing;
+    parse_t                 parse;
+    long                    version;
+    readstat_compress_t     compression;
+    size_t                  long_string_width;
+    int                     ascii_only;
+    long                    rows;
+    int                     thread_count;
+} row_allocs_format_t;
+
+typedef struct row_allocs_ctx_s {
+    long    rows;
+    long    first_row;
+    int     var_count;
+    long    first_row_allocs;
+    long    last_row_allocs;
+} row_allocs_ctx_t;
+
+static row_allocs_format_t _formats[] = {
+    { "dta104", &readstat_begin_writing_dta, &readstat_parse_dta, 104, READSTAT_COMPRESS_NONE, TEST_STRING_WIDTH, 0, TEST_ROWS, 1 },
+    { "dta111", &readstat_begin_writing_dta, &readstat_parse_dta, 111, READSTAT_COMPRESS_NONE, TEST_STRING_WIDTH, 0, TEST_ROWS, 1 },
+    { "dta114", &readstat_begin_writing_dta, &readstat_parse_dta, 114, READSTAT_COMPRESS_NONE, TEST_STRING_WIDTH, 0, TEST_ROWS, 1 },
+    { "dta117", &readstat_begin_writing_dta, &readstat_parse_dta, 117, READSTAT_COMPRESS_NONE, TEST_STRING_WIDTH, 0, TEST_ROWS, 1 },
+    { "dta118", &readstat_begin_writing_dta, &readstat_parse_dta, 118, READSTAT_COMPRESS_NONE, TEST_STRING_WIDTH, 0, TEST_ROWS, 1 },
+    { "sav", &readstat_begin_writing_sav, &readstat_parse_sav, 0, READSTAT_COMPRESS_NONE, TEST_LONG_STRING_WIDTH, 0, TEST_ROWS, 1 },
+    { "savrow", &readstat_begin_writing_sav, &readstat_parse_sav, 0, READSTAT_COMPRESS_ROWS, TEST_LONG_STRING_WIDTH, 0, TEST_ROWS, 1 },
+#if HAVE_ZLIB
+    { "zsav", &readstat_begin_writing_sav, &readstat_parse_sav, 0, READSTAT_COMPRESS_BINARY, TEST_LONG_STRING_WIDTH, 0, TEST_ROWS, 1 },
+    { "zsav (blocks)", &readstat_begin_writing_sav, &readstat_parse_sav, 0, READSTAT_COMPRESS_BINARY, TEST_LONG_STRING_WIDTH, 0, TEST_THREADED_ROWS, 1 },
+    /* About ten blocks, so two threads take them in batches of two */
+    { "zsav (threads)", &readstat_begin_writing_sav, &readstat_parse_sav, 0, READSTAT_COMPRESS_BINARY, TEST_LONG_STRING_WIDTH, 0, TEST_THREADED_ROWS, 2 },
+#endif
+    { "por", &readstat_begin_writing_por, &readstat_parse_por, 0, READSTAT_COMPRESS_NONE, TEST_STRING_WIDTH, 1, TEST_ROWS, 1 },
+    { "sas7bdat", &readstat_begin_writing_sas7bdat, &readstat_parse_sas7bdat, 0, READSTAT_COMPRESS_NONE, TEST_LONG_STRING_WIDTH, 0, TEST_ROWS, 1 },
+    { "sas7bdatrow", &readstat_begin_writing_sas7bdat, &readstat_parse_sas7bdat, 0, READSTAT_COMPRESS_ROWS, TEST_LONG_STRING_WIDTH, 0, TEST_ROWS, 1 },
+    { "sas7bdatbin", &readstat_begin_writing_sas7bdat, &readstat_parse_sas7bdat, 0, READSTAT_COMPRESS_BINARY, TEST_LONG_STRING_WIDTH, 0, TEST_ROWS, 1 },
+    { "sas7bdat (threads)", &readstat_begin_writing_sas7bdat, &readstat_parse_sas7bdat, 0, READSTAT_COMPRESS_NONE, TEST_LONG_STRING_WIDTH, 0, TEST_THREADED_ROWS, TEST_THREAD_COUNT },
+    { "sas7bdatrow (threads)", &readstat_begin_writing_sas7bdat, &readstat_parse_sas7bdat, 0, READSTAT_COMPRESS_ROWS, TEST_LONG_STRING_WIDTH, 0, TEST_THREADED_ROWS, TEST_THREAD_COUNT },
+    { "sas7bdatbin (threads)", &readstat_begin_writing_sas7bdat, &readstat_parse_sas7bdat, 0, READSTAT_COMPRESS_BINARY, TEST_LONG_STRING_WIDTH, 0, TEST_THREADED_ROWS, TEST_THREAD_COUNT },
+    { "xpt5", &readstat_begin_writing_xport, &readstat_parse_xport, 5, READSTAT_COMPRESS_NONE, TEST_STRING_WIDTH, 0, TEST_ROWS, 1 },
+    { "xpt8", &readstat_begin_writing_xport, &readstat_parse_xport, 8, READSTAT_COMPRESS_NONE, TEST_STRING_WIDTH, 0, TEST_ROWS, 1 }
+};
+
+static ssize_t write_data(const void *bytes, size_t len, void *ctx) {
+    rt_buffer_t *buffer = (rt_buffer_t *)ctx;
+    buffer_grow(buffer, len);
+    if (buffer->bytes == NULL)
+        return -1;
+
+    memcpy(buffer->bytes + buffer->used, bytes, len);
+    buffer->used += len;
+    return len;
+}
+
+static readstat_error_t write_file(rt_buffer_t *buffer, row_allocs_format_t *format) {
+    readstat_error_t error = READSTAT_OK;
+    readstat_writer_t *writer = readstat_writer_init();
+    char long_string[TEST_LONG_STRING_WIDTH+1];
+    int i;
+
+    readstat_set_data_writer(writer, &write_data);
+    if (format->version)
+        readstat_writer_set_file_format_version(writer, format->version);
+    readstat_writer_set_compression(writer, format->compression);
+
+    readstat_variable_t *dbl = readstat_add_variable(writer, "DBL", READSTAT_TYPE_DOUBLE, 0);
+    readstat_variable_t *int32 = readstat_add_variable(writer, "INT32", READSTAT_TYPE_INT32, 0);
+    readstat_variable_t *str = readstat_add_variable(writer, "STR", READSTAT_TYPE_STRING, 8);
+    readstat_variable_t *long_str = readstat_add_variable(writer, "LONGSTR", READSTAT_TYPE_STRING,
+            format->long_string_width);
+
+    if ((error = format->begin_writing(writer, buffer, format->rows)) != READSTAT_OK)
+        goto cleanup;
+
+    for (i=0; i<format->rows; i++) {
+        size_t long_string_len = (i * 7) % format->long_string_width;
+        memset(long_string, 'a' + i % 26, long_string_len);
+        long_string[long_string_len] = '\0';
+
+        if ((error = readstat_begin_row(writer)) != READSTAT_OK)
+            goto cleanup;
+
+        if (i % 5 == 0) {
+            error = readstat_insert_missing_value(writer, dbl);
+        } else {
+            error = readstat_insert_double_value(writer, dbl, i * 1.5);
+        }
+        if (error != READSTAT_OK)
+            goto cleanup;
+        if ((error = readstat_insert_int32_value(writer, int32, i)) != READSTAT_OK)
+            goto cleanup;
+        if ((error = readstat_insert_string_value(writer, str,
+                        (i % 3 || format->ascii_only) ? "abc" : "caf\xc3\xa9")) != READSTAT_OK)
+            goto cleanup;
+        if ((error = readstat_insert_string_value(writer, long_str, long_string)) != READSTAT_OK)
+            goto cleanup;
+
+        if ((error = readstat_end_row(writer)) != READSTAT_OK)
+            goto cleanup;
+    }
+    error = readstat_end_writing(writer);
+
+cleanup:
+    readstat_writer_free(writer);
+    return error;
+}
+
+static int handle_metadata(readstat_metadata_t *metadata, void *ctx) {
+    row_allocs_ctx_t *rt_ctx = (row_allocs_ctx_t *)ctx;
+    rt_ctx->var_count = readstat_get_var_count(metadata);
+    return READSTAT_HANDLER_OK;
+}
+
+static int handle_value(int obs_index, readstat_variable_t *variable, readstat_value_t value, void *ctx) {
+    row_allocs_ctx_t *rt_ctx = (row_allocs_ctx_t *)ctx;
+    int var_index = readstat_variable_get_index(variable);
+
+    if (obs_index == rt_ctx->first_row && var_index == 0)
+        rt_ctx->first_row_allocs = alloc_count;
+    if (obs_index == rt_ctx->rows - 1 && var_index == rt_ctx->var_count - 1)
+        rt_ctx->last_row_allocs = alloc_count;
+
+    return READSTAT_HANDLER_OK;
+}
+
+static readstat_error_t read_file(rt_buffer_t *buffer, row_allocs_format_t *format,
+        const char *encoding, row_allocs_ctx_t *rt_ctx) {
+    readstat_error_t error = READSTAT_OK;
+    rt_buffer_ctx_t *buffer_ctx = buffer_ctx_init(buffer);
+    readstat_parser_t *parser = readstat_parser_init();
+
+    readstat_set_open_handler(parser, rt_open_handler);
+    readstat_set_close_handler(parser, rt_close_handler);
+    readstat_set_seek_handler(parser, rt_seek_handler);
+    readstat_set_read_handler(parser, rt_read_handler);
+    readstat_set_update_handler(parser, rt_update_handler);
+    readstat_set_io_ctx(parser, buffer_ctx);
+
+    readstat_set_metadata_handler(parser, &handle_metadata);
+    readstat_set_value_handler(parser, &handle_value);
+    if (encoding)
+        readstat_set_file_character_encoding(parser, encoding);
+    readstat_set_thread_count(parser, format->thread_count);
+
+    rt_ctx->rows = format->rows;
+    rt_ctx->first_row = format->thread_count > 1 ? format->rows / 2 : 1;
+    rt_ctx->first_row_allocs = -1;
+    rt_ctx->last_row_allocs = -1;
+
+    error = format->parse(parser, NULL, rt_ctx);
+
+    readstat_parser_free(parser);
+    free(buffer_ctx);
+
+    return error;
+}
+
+int main(int argc, char *argv[]) {
+    /* With and without a character set conversion */
+    const char *encodings[] = { NULL, "WINDOWS-1252" };
+    rt_buffer_t *buffer = buffer_init();
+    readstat_error_t error = READSTAT_OK;
+    int failures = 0;
+    int f, e;
+
+    for (f=0; f<sizeof(_formats)/sizeof(_formats[0]); f++) {
+        row_allocs_format_t *format = &_formats[f];
+
+        buffer_reset(buffer);
+        if ((error = write_file(buffer, format)) != READSTAT_OK) {
+            printf("%s: Error writing file: %s\n", format->label, readstat_error_message(error));
+            failures++;
+            continue;
+        }
+
+        for (e=0; e<sizeof(encodings)/sizeof(encodings[0]); e++) {
+            row_allocs_ctx_t rt_ctx = { 0 };
+            const char *encoding = encodings[e] ? encodings[e] : "default encoding";
+
+            if ((error = read_file(buffer, format, encodings[e], &rt_ctx)) != READSTAT_OK) {
+                printf("%s (%s): Error reading file: %s\n", format->label, encoding,
+                        readstat_error_message(error));
+                failures++;
+            } else if (rt_ctx.first_row_allocs == -1 || rt_ctx.last_row_allocs == -1) {
+                printf("%s (%s): Not every row was read\n", format->label, encoding);
+                failures++;
+            } else if (rt_ctx.last_row_allocs != rt_ctx.first_row_allocs) {
+                printf("%s (%s): %ld allocations while decoding rows %ld-%ld\n", format->label, encoding,
+                        rt_ctx.last_row_allocs - rt_ctx.first_row_allocs, rt_ctx.first_row + 1, format->rows);
+                failures++;
+            }
+        }
+    }
+
+    buffer_free(buffer);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#else
+
+int main(int argc, char *argv[]) {
+    return EXIT_SKIP;
+}
+
+#endif
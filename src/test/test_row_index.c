@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../readstat.h"
+
+#include "test_buffer.h"
+#include "test_buffer_io.h"
+#include "test_rows.h"
+
+/* Builds a row index with a full read, saves it and loads it back, then
+ * checks that a read with a row offset uses it to skip ahead and still gets
+ * the right values, that an index built from another file is thrown away
+ * rather than trusted, and that a saved index with bad entries isn't
+ * loaded at all. */
+
+#define TEST_ROWS           40000
+#define TEST_ROW_OFFSET     31234
+#define TEST_ROW_LIMIT        100
+/* ZSAV blocks hold about 40000 rows each */
+#define TEST_ZSAV_ROWS     400000
+#define TEST_ZSAV_ROW_OFFSET 321234
+#define TEST_INDEX_PATH     "test_row_index.tmp"
+/* Layout of a saved index: a header, then one record per block that starts
+ * with the block's first row and row count */
+#define TEST_INDEX_HEADER_LEN   40
+#define TEST_INDEX_ENTRY_LEN    40
+
+typedef struct corrupt_entry_s {
+    const char         *label;
+    int                 entry; /* -1 for the last one */
+    int                 field_offset;
+    int64_t             delta;
+} corrupt_entry_t;
+
+static corrupt_entry_t _corrupt_entries[] = {
+    { "Negative first row", 0, 0, -1 },
+    /* Nothing follows the last block to show its count is wrong */
+    { "Negative row count", -1, 8, INT64_MIN },
+    { "Gap between blocks", 2, 0, 1 },
+    { "Overlapping blocks", 1, 8, 1 }
+};
+
+typedef struct counting_io_ctx_s {
+    rt_buffer_ctx_t     buffer_ctx;
+    size_t              bytes_read;
+} counting_io_ctx_t;
+
+static ssize_t counting_read_handler(void *buf, size_t nbytes, void *io_ctx) {
+    counting_io_ctx_t *ctx = (counting_io_ctx_t *)io_ctx;
+    ssize_t bytes_read = rt_read_handler(buf, nbytes, &ctx->buffer_ctx);
+    if (bytes_read > 0)
+        ctx->bytes_read += bytes_read;
+    return bytes_read;
+}
+
+static readstat_error_t write_file(rt_buffer_t *buffer, rt_begin_writing_t begin_writing,
+        readstat_compress_t compression, long row_count, long seed) {
+    readstat_writer_t *writer = readstat_writer_init();
+    readstat_error_t error = READSTAT_OK;
+
+    readstat_writer_set_compression(writer, compression);
+    error = rt_rows_write(writer, buffer, begin_writing, row_count, seed);
+
+    readstat_writer_free(writer);
+    return error;
+}
+
+/* Reads rows [row_offset, row_offset + row_limit) and checks them; a zero
+ * row_limit reads to the end */
+static readstat_error_t read_file(rt_buffer_t *buffer, rt_parse_t parse, readstat_row_index_t *index,
+        long row_offset, long row_limit, rt_rows_ctx_t *rows_ctx, size_t *bytes_read) {
+    readstat_error_t error = READSTAT_OK;
+    counting_io_ctx_t io_ctx = { .buffer_ctx = { .buffer = buffer } };
+    readstat_parser_t *parser = readstat_parser_init();
+
+    readstat_set_open_handler(parser, rt_open_handler);
+    readstat_set_close_handler(parser, rt_close_handler);
+    readstat_set_seek_handler(parser, rt_seek_handler);
+    readstat_set_read_handler(parser, counting_read_handler);
+    readstat_set_update_handler(parser, rt_update_handler);
+    readstat_set_io_ctx(parser, &io_ctx);
+
+    rt_rows_set_handlers(parser);
+    readstat_set_row_offset(parser, row_offset);
+    readstat_set_row_limit(parser, row_limit);
+    if (index)
+        readstat_set_row_index(parser, index);
+
+    error = parse(parser, NULL, rows_ctx);
+
+    readstat_parser_free(parser);
+
+    if (bytes_read)
+        *bytes_read = io_ctx.bytes_read;
+
+    return error;
+}
+
+static int check_read(const char *label, readstat_error_t error, rt_rows_ctx_t *rows_ctx, long rows) {
+    if (error != READSTAT_OK) {
+        printf("%s: Error reading file: %s\n", label, readstat_error_message(error));
+        return 1;
+    }
+    if (rows_ctx->errors) {
+        printf("%s: %ld wrong values\n", label, rows_ctx->errors);
+        return 1;
+    }
+    if (rows_ctx->rows_read != rows) {
+        printf("%s: Read %ld rows, expected %ld\n", label, rows_ctx->rows_read, rows);
+        return 1;
+    }
+    return 0;
+}
+
+static int test_saved_index(rt_buffer_t *buffer, const char *label, rt_begin_writing_t begin_writing,
+        rt_parse_t parse, readstat_compress_t compression, long row_count, long row_offset,
+        int64_t min_blocks) {
+    readstat_row_index_t *index = readstat_row_index_init();
+    readstat_row_index_t *loaded = readstat_row_index_init();
+    readstat_error_t error = READSTAT_OK;
+    rt_rows_ctx_t rows_ctx, unindexed_ctx;
+    size_t bytes_with_index = 0, bytes_without_index = 0;
+    int failures = 0;
+
+    if ((error = write_file(buffer, begin_writing, compression, row_count, 1)) != READSTAT_OK) {
+        printf("%s: Error writing file: %s\n", label, readstat_error_message(error));
+        failures++;
+        goto cleanup;
+    }
+
+    rt_rows_ctx_reset(&rows_ctx, 1, 0);
+    error = read_file(buffer, parse, index, 0, 0, &rows_ctx, NULL);
+    if ((failures += check_read(label, error, &rows_ctx, row_count)))
+        goto cleanup;
+
+    if (readstat_row_index_get_block_count(index) < min_blocks) {
+        printf("%s: Index has only %" PRId64 " blocks\n", label, readstat_row_index_get_block_count(index));
+        failures++;
+        goto cleanup;
+    }
+
+    if ((error = readstat_row_index_save(index, TEST_INDEX_PATH)) != READSTAT_OK ||
+            (error = readstat_row_index_load(loaded, TEST_INDEX_PATH)) != READSTAT_OK) {
+        printf("%s: Error saving and loading index: %s\n", label, readstat_error_message(error));
+        failures++;
+        goto cleanup;
+    }
+
+    if (readstat_row_index_get_block_count(loaded) != readstat_row_index_get_block_count(index)) {
+        printf("%s: Loaded index has %" PRId64 " blocks, saved index had %" PRId64 "\n", label,
+                readstat_row_index_get_block_count(loaded), readstat_row_index_get_block_count(index));
+        failures++;
+        goto cleanup;
+    }
+
+    rt_rows_ctx_reset(&rows_ctx, 1, row_offset);
+    error = read_file(buffer, parse, loaded, row_offset, TEST_ROW_LIMIT, &rows_ctx, &bytes_with_index);
+    failures += check_read(label, error, &rows_ctx, TEST_ROW_LIMIT);
+
+    rt_rows_ctx_reset(&unindexed_ctx, 1, row_offset);
+    error = read_file(buffer, parse, NULL, row_offset, TEST_ROW_LIMIT, &unindexed_ctx, &bytes_without_index);
+    failures += check_read(label, error, &unindexed_ctx, TEST_ROW_LIMIT);
+
+    if (rows_ctx.checksum != unindexed_ctx.checksum) {
+        printf("%s: Values read with the index differ from those read without it\n", label);
+        failures++;
+    }
+
+    if (bytes_with_index >= bytes_without_index / 2) {
+        printf("%s: Read %ld bytes with the index and %ld without it\n", label,
+                (long)bytes_with_index, (long)bytes_without_index);
+        failures++;
+    }
+
+cleanup:
+    readstat_row_index_free(index);
+    readstat_row_index_free(loaded);
+    remove(TEST_INDEX_PATH);
+
+    return failures;
+}
+
+/* Two uncompressed files with the same shape are the same size, so only the
+ * fingerprint tells them apart */
+static int test_other_file_index(rt_buffer_t *buffer) {
+    readstat_row_index_t *index = readstat_row_index_init();
+    readstat_row_index_t *loaded = readstat_row_index_init();
+    readstat_error_t error = READSTAT_OK;
+    rt_rows_ctx_t rows_ctx;
+    size_t file_size = 0;
+    int failures = 0;
+
+    if ((error = write_file(buffer, &readstat_begin_writing_sas7bdat, READSTAT_COMPRESS_NONE,
+                    TEST_ROWS, 1)) != READSTAT_OK) {
+        printf("Error writing file: %s\n", readstat_error_message(error));
+        failures++;
+        goto cleanup;
+    }
+    file_size = buffer->used;
+
+    rt_rows_ctx_reset(&rows_ctx, 1, 0);
+    error = read_file(buffer, &readstat_parse_sas7bdat, index, 0, 0, &rows_ctx, NULL);
+    if ((failures += check_read("Building index", error, &rows_ctx, TEST_ROWS)))
+        goto cleanup;
+
+    if ((error = readstat_row_index_save(index, TEST_INDEX_PATH)) != READSTAT_OK ||
+            (error = readstat_row_index_load(loaded, TEST_INDEX_PATH)) != READSTAT_OK) {
+        printf("Error saving and loading index: %s\n", readstat_error_message(error));
+        failures++;
+        goto cleanup;
+    }
+
+    if ((error = write_file(buffer, &readstat_begin_writing_sas7bdat, READSTAT_COMPRESS_NONE,
+                    TEST_ROWS, 2)) != READSTAT_OK) {
+        printf("Error writing file: %s\n", readstat_error_message(error));
+        failures++;
+        goto cleanup;
+    }
+
+    if (buffer->used != file_size) {
+        printf("Files differ in size (%ld and %ld bytes)\n", (long)file_size, (long)buffer->used);
+        failures++;
+        goto cleanup;
+    }
+
+    /* A read that stops after the first few rows only indexes the first few
+     * pages, so a full-length index afterwards means it was kept */
+    rt_rows_ctx_reset(&rows_ctx, 2, 0);
+    error = read_file(buffer, &readstat_parse_sas7bdat, loaded, 0, TEST_ROW_LIMIT, &rows_ctx, NULL);
+    failures += check_read("Reading with another file's index", error, &rows_ctx, TEST_ROW_LIMIT);
+
+    if (readstat_row_index_get_block_count(loaded) >= readstat_row_index_get_block_count(index)) {
+        printf("Index from another file was not discarded\n");
+        failures++;
+    }
+
+cleanup:
+    readstat_row_index_free(index);
+    readstat_row_index_free(loaded);
+    remove(TEST_INDEX_PATH);
+
+    return failures;
+}
+
+/* Adds delta to one little-endian field of a saved index, wrapping around */
+static int corrupt_saved_index(const char *path, long offset, int64_t delta) {
+    unsigned char bytes[8];
+    uint64_t value = 0;
+    int i;
+    FILE *file = fopen(path, "r+b");
+    if (file == NULL)
+        return -1;
+
+    if (fseek(file, offset, SEEK_SET) != 0 || fread(bytes, sizeof(bytes), 1, file) != 1)
+        goto fail;
+
+    for (i=7; i>=0; i--)
+        value = (value << 8) | bytes[i];
+    value += (uint64_t)delta;
+    for (i=0; i<8; i++)
+        bytes[i] = (value >> (8 * i)) & 0xFF;
+
+    if (fseek(file, offset, SEEK_SET) != 0 || fwrite(bytes, sizeof(bytes), 1, file) != 1)
+        goto fail;
+
+    return fclose(file);
+
+fail:
+    fclose(file);
+    return -1;
+}
+
+static int test_corrupt_index(rt_buffer_t *buffer) {
+    readstat_row_index_t *index = readstat_row_index_init();
+    readstat_error_t error = READSTAT_OK;
+    rt_rows_ctx_t rows_ctx;
+    int failures = 0;
+    int i;
+
+    if ((error = write_file(buffer, &readstat_begin_writing_sas7bdat, READSTAT_COMPRESS_NONE,
+                    TEST_ROWS, 1)) != READSTAT_OK) {
+        printf("Error writing file: %s\n", readstat_error_message(error));
+        failures++;
+        goto cleanup;
+    }
+
+    rt_rows_ctx_reset(&rows_ctx, 1, 0);
+    error = read_file(buffer, &readstat_parse_sas7bdat, index, 0, 0, &rows_ctx, NULL);
+    if ((failures += check_read("Building index", error, &rows_ctx, TEST_ROWS)))
+        goto cleanup;
+
+    if (readstat_row_index_get_block_count(index) < 3) {
+        printf("Index has %" PRId64 " blocks, expected at least 3\n",
+                readstat_row_index_get_block_count(index));
+        failures++;
+        goto cleanup;
+    }
+
+    for (i=0; i<sizeof(_corrupt_entries)/sizeof(_corrupt_entries[0]); i++) {
+        corrupt_entry_t *corrupt = &_corrupt_entries[i];
+        readstat_row_index_t *loaded = readstat_row_index_init();
+        int64_t entry = corrupt->entry == -1 ? readstat_row_index_get_block_count(index) - 1 : corrupt->entry;
+        long offset = TEST_INDEX_HEADER_LEN + entry * TEST_INDEX_ENTRY_LEN + corrupt->field_offset;
+
+        if ((error = readstat_row_index_save(index, TEST_INDEX_PATH)) != READSTAT_OK) {
+            printf("%s: Error saving index: %s\n", corrupt->label, readstat_error_message(error));
+            failures++;
+        } else if (corrupt_saved_index(TEST_INDEX_PATH, offset, corrupt->delta) != 0) {
+            printf("%s: Error editing saved index\n", corrupt->label);
+            failures++;
+        } else if ((error = readstat_row_index_load(loaded, TEST_INDEX_PATH)) != READSTAT_ERROR_PARSE) {
+            printf("%s: Loading index returned \"%s\", expected \"%s\"\n", corrupt->label,
+                    readstat_error_message(error), readstat_error_message(READSTAT_ERROR_PARSE));
+            failures++;
+        }
+
+        readstat_row_index_free(loaded);
+    }
+
+cleanup:
+    readstat_row_index_free(index);
+    remove(TEST_INDEX_PATH);
+
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    rt_buffer_t *buffer = buffer_init();
+    int failures = 0;
+
+    failures += test_saved_index(buffer, "SAS7BDAT", &readstat_begin_writing_sas7bdat,
+            &readstat_parse_sas7bdat, READSTAT_COMPRESS_ROWS, TEST_ROWS, TEST_ROW_OFFSET, 100);
+#if HAVE_ZLIB
+    failures += test_saved_index(buffer, "ZSAV", &readstat_begin_writing_sav,
+            &readstat_parse_sav, READSTAT_COMPRESS_BINARY, TEST_ZSAV_ROWS, TEST_ZSAV_ROW_OFFSET, 8);
+#endif
+    failures += test_other_file_index(buffer);
+    failures += test_corrupt_index(buffer);
+
+    buffer_free(buffer);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
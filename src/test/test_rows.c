@@ -0,0 +1,195 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../readstat.h"
+
+#include "test_buffer.h"
+#include "test_rows.h"
+
+#define RT_ROWS_STRING_WIDTH       24
+#define RT_ROWS_LONG_STRING_WIDTH  64
+
+enum {
+    RT_ROWS_VAR_ROW,
+    RT_ROWS_VAR_DBL,
+    RT_ROWS_VAR_STR,
+    RT_ROWS_VAR_LONG_STR
+};
+
+static int rt_rows_is_missing(long row, long seed) {
+    return (row + seed) % 13 == 0;
+}
+
+static double rt_rows_double(long row, long seed) {
+    return row * 0.5 + seed;
+}
+
+/* Strings are nearly full width and vary from row to row, so compressed
+ * pages and blocks hold different numbers of rows */
+static void rt_rows_string(char *buf, size_t width, long row, long seed) {
+    size_t len = width - (row % 5);
+    unsigned long state = row * 2654435761UL + seed;
+    int i;
+
+    for (i=0; i<len; i++) {
+        state = state * 1103515245UL + 12345UL;
+        buf[i] = 'a' + (state >> 16) % 26;
+    }
+    buf[len] = '\0';
+}
+
+static ssize_t rt_rows_write_data(const void *bytes, size_t len, void *ctx) {
+    rt_buffer_t *buffer = (rt_buffer_t *)ctx;
+    buffer_grow(buffer, len);
+    if (buffer->bytes == NULL)
+        return -1;
+
+    memcpy(buffer->bytes + buffer->used, bytes, len);
+    buffer->used += len;
+    return len;
+}
+
+/* Writes row_count rows with the given writer, which the caller has set up
+ * with any format version, compression and other options. The timestamp
+ * depends on the seed, so files with different seeds have different headers. */
+readstat_error_t rt_rows_write(readstat_writer_t *writer, rt_buffer_t *buffer,
+        rt_begin_writing_t begin_writing, long row_count, long seed) {
+    readstat_error_t error = READSTAT_OK;
+    char string[RT_ROWS_LONG_STRING_WIDTH+1];
+    long i;
+
+    buffer_reset(buffer);
+
+    readstat_set_data_writer(writer, &rt_rows_write_data);
+    readstat_writer_set_file_timestamp(writer, 1500000000 + seed);
+
+    readstat_variable_t *row = readstat_add_variable(writer, "ROW", READSTAT_TYPE_DOUBLE, 0);
+    readstat_variable_t *dbl = readstat_add_variable(writer, "DBL", READSTAT_TYPE_DOUBLE, 0);
+    readstat_variable_t *str = readstat_add_variable(writer, "STR", READSTAT_TYPE_STRING,
+            RT_ROWS_STRING_WIDTH);
+    readstat_variable_t *long_str = readstat_add_variable(writer, "LONGSTR", READSTAT_TYPE_STRING,
+            RT_ROWS_LONG_STRING_WIDTH);
+
+    if ((error = begin_writing(writer, buffer, row_count)) != READSTAT_OK)
+        goto cleanup;
+
+    for (i=0; i<row_count; i++) {
+        if ((error = readstat_begin_row(writer)) != READSTAT_OK)
+            goto cleanup;
+
+        if ((error = readstat_insert_double_value(writer, row, i)) != READSTAT_OK)
+            goto cleanup;
+
+        if (rt_rows_is_missing(i, seed)) {
+            error = readstat_insert_missing_value(writer, dbl);
+        } else {
+            error = readstat_insert_double_value(writer, dbl, rt_rows_double(i, seed));
+        }
+        if (error != READSTAT_OK)
+            goto cleanup;
+
+        rt_rows_string(string, RT_ROWS_STRING_WIDTH, i, seed);
+        if ((error = readstat_insert_string_value(writer, str, string)) != READSTAT_OK)
+            goto cleanup;
+
+        rt_rows_string(string, RT_ROWS_LONG_STRING_WIDTH, i, seed + 1);
+        if ((error = readstat_insert_string_value(writer, long_str, string)) != READSTAT_OK)
+            goto cleanup;
+
+        if ((error = readstat_end_row(writer)) != READSTAT_OK)
+            goto cleanup;
+    }
+
+    error = readstat_end_writing(writer);
+
+cleanup:
+    return error;
+}
+
+/* FNV-1a, so that two reads of the same file can be compared value by value */
+static uint64_t rt_rows_checksum(uint64_t checksum, const void *bytes, size_t len) {
+    const unsigned char *p = (const unsigned char *)bytes;
+    size_t i;
+
+    for (i=0; i<len; i++) {
+        checksum ^= p[i];
+        checksum *= 0x100000001b3ULL;
+    }
+    return checksum;
+}
+
+static uint64_t rt_rows_checksum_value(uint64_t checksum, readstat_value_t value) {
+    if (readstat_value_is_system_missing(value)) {
+        checksum = rt_rows_checksum(checksum, ".", 1);
+    } else if (readstat_value_type(value) == READSTAT_TYPE_STRING) {
+        const char *string = readstat_string_value(value);
+        checksum = rt_rows_checksum(checksum, string, strlen(string) + 1);
+    } else {
+        double dval = readstat_double_value(value);
+        checksum = rt_rows_checksum(checksum, &dval, sizeof(double));
+    }
+    return checksum;
+}
+
+static int rt_rows_handle_metadata(readstat_metadata_t *metadata, void *ctx) {
+    rt_rows_ctx_t *rows_ctx = (rt_rows_ctx_t *)ctx;
+    rows_ctx->var_count = readstat_get_var_count(metadata);
+    return READSTAT_HANDLER_OK;
+}
+
+static int rt_rows_handle_value(int obs_index, readstat_variable_t *variable,
+        readstat_value_t value, void *ctx) {
+    rt_rows_ctx_t *rows_ctx = (rt_rows_ctx_t *)ctx;
+    int var_index = readstat_variable_get_index(variable);
+    long row = obs_index + rows_ctx->row_offset;
+    char expected[RT_ROWS_LONG_STRING_WIDTH+1];
+    int ok = 1;
+
+    if (obs_index != rows_ctx->rows_read) {
+        ok = 0;
+    } else if (var_index == RT_ROWS_VAR_ROW) {
+        ok = (readstat_double_value(value) == row);
+    } else if (var_index == RT_ROWS_VAR_DBL) {
+        if (rt_rows_is_missing(row, rows_ctx->seed)) {
+            ok = readstat_value_is_system_missing(value);
+        } else {
+            ok = (!readstat_value_is_system_missing(value) &&
+                    readstat_double_value(value) == rt_rows_double(row, rows_ctx->seed));
+        }
+    } else if (var_index == RT_ROWS_VAR_STR) {
+        rt_rows_string(expected, RT_ROWS_STRING_WIDTH, row, rows_ctx->seed);
+        ok = (strcmp(readstat_string_value(value), expected) == 0);
+    } else if (var_index == RT_ROWS_VAR_LONG_STR) {
+        rt_rows_string(expected, RT_ROWS_LONG_STRING_WIDTH, row, rows_ctx->seed + 1);
+        ok = (strcmp(readstat_string_value(value), expected) == 0);
+    }
+
+    rows_ctx->checksum = rt_rows_checksum(rows_ctx->checksum, &obs_index, sizeof(int));
+    rows_ctx->checksum = rt_rows_checksum_value(rows_ctx->checksum, value);
+
+    if (!ok) {
+        if (rows_ctx->errors == 0)
+            printf("Unexpected value in row %ld (obs_index=%d), column %d\n", row, obs_index, var_index);
+        rows_ctx->errors++;
+    }
+
+    if (var_index == rows_ctx->var_count - 1)
+        rows_ctx->rows_read++;
+
+    return READSTAT_HANDLER_OK;
+}
+
+/* Checks every value against the row it should have come from */
+void rt_rows_set_handlers(readstat_parser_t *parser) {
+    readstat_set_metadata_handler(parser, &rt_rows_handle_metadata);
+    readstat_set_value_handler(parser, &rt_rows_handle_value);
+}
+
+void rt_rows_ctx_reset(rt_rows_ctx_t *ctx, long seed, long row_offset) {
+    memset(ctx, 0, sizeof(rt_rows_ctx_t));
+    ctx->seed = seed;
+    ctx->row_offset = row_offset;
+    ctx->checksum = 0xcbf29ce484222325ULL;
+}
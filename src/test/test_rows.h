@@ -0,0 +1,21 @@
+
+/* Files of many rows whose values are a function of the row number and a
+ * seed, for tests that need more than the handful of rows in
+ * test_readstat.c: multi-page, multi-block and threaded reads. */
+
+typedef readstat_error_t (*rt_begin_writing_t)(readstat_writer_t *writer, void *user_ctx, long row_count);
+typedef readstat_error_t (*rt_parse_t)(readstat_parser_t *parser, const char *path, void *user_ctx);
+
+typedef struct rt_rows_ctx_s {
+    long        seed;
+    long        row_offset;
+    long        rows_read;
+    long        errors;
+    int         var_count;
+    uint64_t    checksum;
+} rt_rows_ctx_t;
+
+readstat_error_t rt_rows_write(readstat_writer_t *writer, rt_buffer_t *buffer,
+        rt_begin_writing_t begin_writing, long row_count, long seed);
+void rt_rows_set_handlers(readstat_parser_t *parser);
+void rt_rows_ctx_reset(rt_rows_ctx_t *ctx, long seed, long row_offset);
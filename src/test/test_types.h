@@ -73,6 +73,16 @@ typedef struct rt_test_group_s {
 typedef struct rt_test_args_s {
     long             row_limit;
     long             row_offset;    
+    long             batch_size;
+    int              borrow;
+    int              thread_count;
+    int              seekable;
+    int              column_batch;
+    int              projection;
+    int              metadata_only;
+    /* Set the writer's buffer to write_buffer_size bytes, which may be 0 */
+    int              set_write_buffer_size;
+    size_t           write_buffer_size;
 } rt_test_args_t;
 
 
@@ -99,6 +109,8 @@ typedef struct rt_parse_ctx_s {
 
     long             var_index;
     long             obs_index;
+    /* As reported to the metadata handler; -1 if the format doesn't say */
+    long             row_count;
 
     long             variables_count;
     long             value_labels_count;
@@ -24,13 +24,157 @@ static ssize_t write_data(const void *bytes, size_t len, void *ctx) {
     return len;
 }
 
-readstat_error_t write_file_to_buffer(rt_test_file_t *file, rt_buffer_t *buffer, long format) {
+/* Output is always appended at buffer->used, so seeking just moves that mark;
+ * the writer always seeks back to the end after patching earlier bytes. */
+static readstat_off_t seek_data(readstat_off_t offset, readstat_io_flags_t whence, void *ctx) {
+    rt_buffer_t *buffer = (rt_buffer_t *)ctx;
+    if (whence != READSTAT_SEEK_SET || offset < 0 || offset > buffer->size)
+        return -1;
+
+    buffer->used = offset;
+    return offset;
+}
+
+static readstat_error_t write_rows(readstat_writer_t *writer, rt_test_file_t *file) {
+    readstat_error_t error = READSTAT_OK;
+    int i, j;
+
+    for (i=0; i<file->rows; i++) {
+        error = readstat_begin_row(writer);
+        if (error != READSTAT_OK)
+            goto cleanup;
+
+        for (j=0; j<file->columns_count; j++) {
+            rt_column_t *column = &file->columns[j];
+            readstat_variable_t *variable = readstat_get_variable(writer, j);
+
+            if (readstat_value_is_tagged_missing(column->values[i])) {
+                error = readstat_insert_tagged_missing_value(writer, variable, 
+                        readstat_value_tag(column->values[i]));
+            } else if (readstat_value_is_system_missing(column->values[i])) {
+                error = readstat_insert_missing_value(writer, variable);
+            } else if (column->type == READSTAT_TYPE_STRING) {
+                error = readstat_insert_string_value(writer, variable, 
+                        readstat_string_value(column->values[i]));
+            } else if (column->type == READSTAT_TYPE_STRING_REF) {
+                error = readstat_insert_string_ref(writer, variable, 
+                        readstat_get_string_ref(writer,
+                            readstat_int32_value(column->values[i])));
+            } else if (column->type == READSTAT_TYPE_DOUBLE) {
+                error = readstat_insert_double_value(writer, variable, 
+                        readstat_double_value(column->values[i]));
+            } else if (column->type == READSTAT_TYPE_FLOAT) {
+                error = readstat_insert_float_value(writer, variable, 
+                        readstat_float_value(column->values[i]));
+            } else if (column->type == READSTAT_TYPE_INT32) {
+                error = readstat_insert_int32_value(writer, variable, 
+                        readstat_int32_value(column->values[i]));
+            } else if (column->type == READSTAT_TYPE_INT16) {
+                error = readstat_insert_int16_value(writer, variable, 
+                        readstat_int16_value(column->values[i]));
+            } else if (column->type == READSTAT_TYPE_INT8) {
+                error = readstat_insert_int8_value(writer, variable, 
+                        readstat_int8_value(column->values[i]));
+            }
+            if (error != READSTAT_OK) {
+                goto cleanup;
+            }
+        }
+
+        error = readstat_end_row(writer);
+        if (error != READSTAT_OK)
+            goto cleanup;
+    }
+
+cleanup:
+    return error;
+}
+
+/* Same as write_rows, but through readstat_insert_column_batch */
+static readstat_error_t write_column_batch(readstat_writer_t *writer, rt_test_file_t *file) {
+    readstat_error_t error = READSTAT_OK;
+    readstat_batch_column_t columns[RT_MAX_COLS];
+    double double_values[RT_MAX_COLS][RT_MAX_ROWS];
+    int32_t int32_values[RT_MAX_COLS][RT_MAX_ROWS];
+    char *string_data[RT_MAX_COLS] = { NULL };
+    size_t string_offsets[RT_MAX_COLS][RT_MAX_ROWS];
+    unsigned char missing[RT_MAX_COLS][(RT_MAX_ROWS + 7) / 8];
+    char tags[RT_MAX_COLS][RT_MAX_ROWS];
+    int i, j;
+
+    memset(missing, 0, sizeof(missing));
+    memset(tags, 0, sizeof(tags));
+
+    for (j=0; j<file->columns_count; j++) {
+        rt_column_t *column = &file->columns[j];
+        size_t string_len = 0;
+
+        for (i=0; i<file->rows; i++) {
+            if (column->type == READSTAT_TYPE_STRING && readstat_string_value(column->values[i]))
+                string_len += strlen(readstat_string_value(column->values[i]));
+            string_len++;
+        }
+        if ((string_data[j] = malloc(string_len)) == NULL) {
+            error = READSTAT_ERROR_MALLOC;
+            goto cleanup;
+        }
+        string_len = 0;
+
+        columns[j] = (readstat_batch_column_t) {
+            .variable = readstat_get_variable(writer, j),
+            .type = column->type,
+            .double_values = double_values[j],
+            .int32_values = int32_values[j],
+            .string_data = string_data[j],
+            .string_offsets = string_offsets[j],
+            .missing = missing[j],
+            .tags = tags[j]
+        };
+
+        for (i=0; i<file->rows; i++) {
+            readstat_value_t value = column->values[i];
+            string_offsets[j][i] = string_len;
+            string_data[j][string_len] = '\0';
+            if (readstat_value_is_tagged_missing(value)) {
+                missing[j][i / 8] |= (1 << (i % 8));
+                tags[j][i] = readstat_value_tag(value);
+            } else if (readstat_value_is_system_missing(value)) {
+                missing[j][i / 8] |= (1 << (i % 8));
+            } else if (column->type == READSTAT_TYPE_STRING) {
+                const char *string = readstat_string_value(value);
+                if (string) {
+                    strcpy(&string_data[j][string_len], string);
+                    string_len += strlen(string);
+                }
+            } else if (column->type == READSTAT_TYPE_DOUBLE || column->type == READSTAT_TYPE_FLOAT) {
+                double_values[j][i] = readstat_double_value(value);
+            } else {
+                int32_values[j][i] = readstat_int32_value(value);
+            }
+            string_len++;
+        }
+    }
+
+    error = readstat_insert_column_batch(writer, file->rows, columns, file->columns_count);
+
+cleanup:
+    for (j=0; j<file->columns_count; j++) {
+        free(string_data[j]);
+    }
+    return error;
+}
+
+static readstat_error_t write_file(rt_test_file_t *file, rt_buffer_t *buffer, long format, rt_test_args_t *args) {
     readstat_error_t error = READSTAT_OK;
 
     ck_hash_table_t *label_sets = ck_hash_table_init(100);
 
     readstat_writer_t *writer = readstat_writer_init();
     readstat_set_data_writer(writer, &write_data);
+    if (args && args->seekable)
+        readstat_set_data_seeker(writer, &seek_data);
+    if (args && args->set_write_buffer_size)
+        readstat_writer_set_write_buffer_size(writer, args->write_buffer_size);
     readstat_writer_set_file_label(writer, file->label);
     readstat_writer_set_table_name(writer, file->table_name);
     readstat_writer_set_error_handler(writer, &handle_error);
@@ -153,6 +297,8 @@ readstat_error_t write_file_to_buffer(rt_test_file_t *file, rt_buffer_t *buffer,
     } else if ((format & RT_FORMAT_SAS7BDAT)) {
         if ((format & RT_FORMAT_SAS7BDAT_COMP_ROWS)) {
             readstat_writer_set_compression(writer, READSTAT_COMPRESS_ROWS);
+        } else if ((format & RT_FORMAT_SAS7BDAT_COMP_BINARY)) {
+            readstat_writer_set_compression(writer, READSTAT_COMPRESS_BINARY);
         }
         readstat_writer_set_file_format_version(writer, sas_file_format_version(format));
         readstat_writer_set_file_format_is_64bit(writer, !!(format & RT_FORMAT_SAS7BDAT_64BIT));
@@ -167,6 +313,8 @@ readstat_error_t write_file_to_buffer(rt_test_file_t *file, rt_buffer_t *buffer,
             readstat_writer_set_compression(writer, READSTAT_COMPRESS_ROWS);
         } else if (format == RT_FORMAT_SAV_COMP_ZLIB) {
             readstat_writer_set_compression(writer, READSTAT_COMPRESS_BINARY);
+            readstat_writer_set_compression_level(writer, 9);
+            readstat_writer_set_thread_count(writer, 2);
         }
         error = readstat_begin_writing_sav(writer, buffer, file->rows);
     } else if (format == RT_FORMAT_POR) {
@@ -178,52 +326,14 @@ readstat_error_t write_file_to_buffer(rt_test_file_t *file, rt_buffer_t *buffer,
     if (error != READSTAT_OK)
         goto cleanup;
 
-    for (i=0; i<file->rows; i++) {
-        error = readstat_begin_row(writer);
-        if (error != READSTAT_OK)
-            goto cleanup;
-
-        for (j=0; j<file->columns_count; j++) {
-            rt_column_t *column = &file->columns[j];
-            readstat_variable_t *variable = readstat_get_variable(writer, j);
-
-            if (readstat_value_is_tagged_missing(column->values[i])) {
-                error = readstat_insert_tagged_missing_value(writer, variable, 
-                        readstat_value_tag(column->values[i]));
-            } else if (readstat_value_is_system_missing(column->values[i])) {
-                error = readstat_insert_missing_value(writer, variable);
-            } else if (column->type == READSTAT_TYPE_STRING) {
-                error = readstat_insert_string_value(writer, variable, 
-                        readstat_string_value(column->values[i]));
-            } else if (column->type == READSTAT_TYPE_STRING_REF) {
-                error = readstat_insert_string_ref(writer, variable, 
-                        readstat_get_string_ref(writer,
-                            readstat_int32_value(column->values[i])));
-            } else if (column->type == READSTAT_TYPE_DOUBLE) {
-                error = readstat_insert_double_value(writer, variable, 
-                        readstat_double_value(column->values[i]));
-            } else if (column->type == READSTAT_TYPE_FLOAT) {
-                error = readstat_insert_float_value(writer, variable, 
-                        readstat_float_value(column->values[i]));
-            } else if (column->type == READSTAT_TYPE_INT32) {
-                error = readstat_insert_int32_value(writer, variable, 
-                        readstat_int32_value(column->values[i]));
-            } else if (column->type == READSTAT_TYPE_INT16) {
-                error = readstat_insert_int16_value(writer, variable, 
-                        readstat_int16_value(column->values[i]));
-            } else if (column->type == READSTAT_TYPE_INT8) {
-                error = readstat_insert_int8_value(writer, variable, 
-                        readstat_int8_value(column->values[i]));
-            }
-            if (error != READSTAT_OK) {
-                goto cleanup;
-            }
-        }
-
-        error = readstat_end_row(writer);
-        if (error != READSTAT_OK)
-            goto cleanup;
+    if (args && args->column_batch) {
+        error = write_column_batch(writer, file);
+    } else {
+        error = write_rows(writer, file);
     }
+    if (error != READSTAT_OK)
+        goto cleanup;
+
     error = readstat_end_writing(writer);
     if (error != READSTAT_OK)
         goto cleanup;
@@ -235,3 +345,12 @@ cleanup:
     return error;
 }
 
+
+readstat_error_t write_file_to_buffer(rt_test_file_t *file, rt_buffer_t *buffer, long format) {
+    return write_file(file, buffer, format, NULL);
+}
+
+readstat_error_t write_file_to_buffer_with_args(rt_test_file_t *file, rt_buffer_t *buffer, long format,
+        rt_test_args_t *args) {
+    return write_file(file, buffer, format, args);
+}
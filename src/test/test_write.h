@@ -1,2 +1,4 @@
 
 readstat_error_t write_file_to_buffer(rt_test_file_t *file, rt_buffer_t *buffer, long format);
+readstat_error_t write_file_to_buffer_with_args(rt_test_file_t *file, rt_buffer_t *buffer, long format,
+        rt_test_args_t *args);
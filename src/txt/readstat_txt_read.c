@@ -8,22 +8,30 @@
 #include "../readstat.h"
 #include "../readstat_iconv.h"
 #include "../readstat_convert.h"
+#include "../readstat_batch.h"
 #include "readstat_schema.h"
 
+#define TXT_READ_BUFFER_SIZE  65536
+
 typedef struct txt_ctx_s {
     int                rows;
-    iconv_t            converter;
+    readstat_converter_t *converter;
     readstat_schema_t *schema;
+    readstat_batch_t  *batch;
+    readstat_io_t     *io;
+    char              *read_buffer;
+    size_t             read_buffer_pos;
+    size_t             read_buffer_used;
 } txt_ctx_t;
 
-static readstat_error_t handle_value(readstat_parser_t *parser, iconv_t converter,
+static readstat_error_t handle_value(readstat_parser_t *parser, txt_ctx_t *txt_ctx,
         int obs_index, readstat_schema_entry_t *entry, char *bytes, size_t len, void *ctx) {
     readstat_error_t error = READSTAT_OK;
     char converted_value[4*len+1];
     readstat_variable_t *variable = &entry->variable;
     readstat_value_t value = { .type = variable->type };
     if (readstat_type_class(variable->type) == READSTAT_TYPE_CLASS_STRING) {
-        error = readstat_convert(converted_value, sizeof(converted_value), bytes, len, converter);
+        error = readstat_convert(converted_value, sizeof(converted_value), bytes, len, txt_ctx->converter);
         if (error != READSTAT_OK)
             goto cleanup;
         value.v.string_value = converted_value;
@@ -39,29 +47,83 @@ static readstat_error_t handle_value(readstat_parser_t *parser, iconv_t converte
         }
         value.is_system_missing = (endptr == bytes);
     }
-    if (parser->handlers.value(obs_index, variable, value, ctx) == READSTAT_HANDLER_ABORT) {
+    if (txt_ctx->batch) {
+        error = readstat_batch_append(txt_ctx->batch, obs_index, variable, value);
+    } else if (parser->handlers.value(obs_index, variable, value, ctx) == READSTAT_HANDLER_ABORT) {
         error = READSTAT_ERROR_USER_ABORT;
     }
 cleanup:
     return error;
 }
 
-static ssize_t txt_getdelim(char ** restrict linep, size_t * restrict linecapp,
-        int delimiter, readstat_io_t *io) {
-    char *value_buffer = *linep;
-    size_t value_buffer_len = *linecapp;
+/* Input is pulled through a block buffer so that each io->read() call
+ * fetches TXT_READ_BUFFER_SIZE bytes, whatever the I/O handlers are. */
+static ssize_t txt_fill_buffer(txt_ctx_t *ctx) {
+    readstat_io_t *io = ctx->io;
+
+    if (ctx->read_buffer_pos < ctx->read_buffer_used)
+        return ctx->read_buffer_used - ctx->read_buffer_pos;
+
+    ssize_t bytes_read = io->read(ctx->read_buffer, TXT_READ_BUFFER_SIZE, io->io_ctx);
+    ctx->read_buffer_pos = 0;
+    ctx->read_buffer_used = bytes_read > 0 ? bytes_read : 0;
+
+    return bytes_read;
+}
+
+static ssize_t txt_read(txt_ctx_t *ctx, char *dst, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        ssize_t bytes_avail = txt_fill_buffer(ctx);
+        if (bytes_avail == -1)
+            return -1;
+        if (bytes_avail == 0)
+            break;
+        size_t chunk_len = len - i;
+        if (chunk_len > bytes_avail)
+            chunk_len = bytes_avail;
+        memcpy(&dst[i], &ctx->read_buffer[ctx->read_buffer_pos], chunk_len);
+        ctx->read_buffer_pos += chunk_len;
+        i += chunk_len;
+    }
+    return i;
+}
+
+/* Reads up to and including the delimiter, or to the end of the input.
+ * If linep is NULL the bytes are discarded. */
+static ssize_t txt_getdelim(txt_ctx_t *ctx, char ** restrict linep, size_t * restrict linecapp,
+        int delimiter) {
     ssize_t i = 0;
-    ssize_t bytes_read = 0;
-    while ((bytes_read = io->read(&value_buffer[i], 1, io->io_ctx)) == 1 && value_buffer[i++] != delimiter) {
-        if (i == value_buffer_len) {
-            value_buffer = realloc(value_buffer, value_buffer_len *= 2);
+    while (1) {
+        ssize_t bytes_avail = txt_fill_buffer(ctx);
+        if (bytes_avail == -1)
+            return -1;
+        if (bytes_avail == 0)
+            break;
+
+        const char *src = &ctx->read_buffer[ctx->read_buffer_pos];
+        const char *match = memchr(src, delimiter, bytes_avail);
+        size_t chunk_len = match ? match - src + 1 : bytes_avail;
+
+        if (linep) {
+            if (i + chunk_len + 1 > *linecapp) {
+                size_t new_len = *linecapp;
+                while (i + chunk_len + 1 > new_len)
+                    new_len *= 2;
+                char *new_line = realloc(*linep, new_len);
+                if (new_line == NULL)
+                    return -1;
+                *linep = new_line;
+                *linecapp = new_len;
+            }
+            memcpy(&(*linep)[i], src, chunk_len);
         }
-    }
-    *linep = value_buffer;
-    *linecapp = value_buffer_len;
+        ctx->read_buffer_pos += chunk_len;
+        i += chunk_len;
 
-    if (bytes_read == -1)
-        return -1;
+        if (match)
+            break;
+    }
 
     return i;
 }
@@ -72,14 +134,13 @@ static readstat_error_t txt_parse_delimited(readstat_parser_t *parser,
     char *value_buffer = malloc(value_buffer_len);
     readstat_schema_t *schema = ctx->schema;
     readstat_error_t retval = READSTAT_OK;
-    readstat_io_t *io = parser->io;
     int k=0;
     
     while (1) {
         for (int j=0; j<schema->entry_count; j++) {
             readstat_schema_entry_t *entry = &schema->entries[j];
             int delimiter = (j == schema->entry_count-1) ? '\n' : schema->field_delimiter;
-            ssize_t chars_read = txt_getdelim(&value_buffer, &value_buffer_len, delimiter, io);
+            ssize_t chars_read = txt_getdelim(ctx, &value_buffer, &value_buffer_len, delimiter);
             if (chars_read == 0)
                 goto cleanup;
 
@@ -87,14 +148,14 @@ static readstat_error_t txt_parse_delimited(readstat_parser_t *parser,
                 retval = READSTAT_ERROR_READ;
                 goto cleanup;
             }
-            if (parser->handlers.value && !entry->skip) {
+            if ((parser->handlers.value || ctx->batch) && !entry->skip) {
                 chars_read--; // delimiter
                 if (chars_read > 0 && value_buffer[chars_read-1] == '\r') {
                     chars_read--; // CRLF
                 }
                 value_buffer[chars_read] = '\0';
 
-                retval = handle_value(parser, ctx->converter, k, entry, value_buffer, chars_read, user_ctx);
+                retval = handle_value(parser, ctx, k, entry, value_buffer, chars_read, user_ctx);
                 if (retval != READSTAT_OK)
                     goto cleanup;
             }
@@ -116,13 +177,12 @@ static readstat_error_t txt_parse_fixed_width(readstat_parser_t *parser,
         txt_ctx_t *ctx, void *user_ctx, const size_t *line_lens, char *line_buffer) {
     char   value_buffer[4096];
     readstat_schema_t *schema = ctx->schema;
-    readstat_io_t *io = parser->io;
     readstat_error_t retval = READSTAT_OK;
     int k=0;
     while (1) {
         int j=0;
         for (int i=0; i<schema->rows_per_observation; i++) {
-            ssize_t bytes_read = io->read(line_buffer, line_lens[i], io->io_ctx);
+            ssize_t bytes_read = txt_read(ctx, line_buffer, line_lens[i]);
             if (bytes_read == 0)
                 goto cleanup;
             
@@ -134,10 +194,10 @@ static readstat_error_t txt_parse_fixed_width(readstat_parser_t *parser,
                 readstat_schema_entry_t *entry = &schema->entries[j];
                 size_t field_len = schema->entries[j].len;
                 size_t field_offset = schema->entries[j].col;
-                if (field_len < sizeof(value_buffer) && parser->handlers.value && !entry->skip) {
+                if (field_len < sizeof(value_buffer) && (parser->handlers.value || ctx->batch) && !entry->skip) {
                     memcpy(value_buffer, &line_buffer[field_offset], field_len);
                     value_buffer[field_len] = '\0';
-                    retval = handle_value(parser, ctx->converter, k, entry, value_buffer, field_len, user_ctx);
+                    retval = handle_value(parser, ctx, k, entry, value_buffer, field_len, user_ctx);
                     if (retval != READSTAT_OK) {
                         goto cleanup;
                     }
@@ -145,8 +205,10 @@ static readstat_error_t txt_parse_fixed_width(readstat_parser_t *parser,
             }
 
             if (schema->cols_per_observation == 0) {
-                char throwaway = '\0';
-                while (io->read(&throwaway, 1, io->io_ctx) == 1 && throwaway != '\n');
+                if (txt_getdelim(ctx, NULL, NULL, '\n') == -1) {
+                    retval = READSTAT_ERROR_READ;
+                    goto cleanup;
+                }
             }
         }
         
@@ -169,17 +231,26 @@ readstat_error_t readstat_parse_txt(readstat_parser_t *parser, const char *filen
     
     size_t line_buffer_len = 0;
     char  *line_buffer = NULL;
-    txt_ctx_t ctx = { .schema = schema };
+    txt_ctx_t ctx = { .schema = schema, .io = io };
 
     if (parser->output_encoding && parser->input_encoding) {
-        ctx.converter = iconv_open(parser->output_encoding, parser->input_encoding);
-        if (ctx.converter == (iconv_t)-1) {
-            ctx.converter = NULL;
+        ctx.converter = readstat_converter_init(parser->output_encoding, parser->input_encoding);
+        if (ctx.converter == NULL) {
             retval = READSTAT_ERROR_UNSUPPORTED_CHARSET;
             goto cleanup;
         }
     }
     
+    if (parser->handlers.batch && (ctx.batch = readstat_batch_init(parser, user_ctx)) == NULL) {
+        retval = READSTAT_ERROR_MALLOC;
+        goto cleanup;
+    }
+
+    if ((ctx.read_buffer = malloc(TXT_READ_BUFFER_SIZE)) == NULL) {
+        retval = READSTAT_ERROR_MALLOC;
+        goto cleanup;
+    }
+
     if (io->open(filename, io->io_ctx) == -1) {
         retval = READSTAT_ERROR_OPEN;
         goto cleanup;
@@ -214,10 +285,12 @@ readstat_error_t readstat_parse_txt(readstat_parser_t *parser, const char *filen
     
     if (schema->first_line > 1) {
         int throwaway_lines = schema->first_line - 1;
-        char throwaway_char = '\0';
         
         while (throwaway_lines--) {
-            while (io->read(&throwaway_char, 1, io->io_ctx) == 1 && throwaway_char != '\n');
+            if (txt_getdelim(&ctx, NULL, NULL, '\n') == -1) {
+                retval = READSTAT_ERROR_READ;
+                goto cleanup;
+            }
         }
     }
     
@@ -230,6 +303,9 @@ readstat_error_t readstat_parse_txt(readstat_parser_t *parser, const char *filen
     if (retval != READSTAT_OK)
         goto cleanup;
 
+    if ((retval = readstat_batch_flush(ctx.batch)) != READSTAT_OK)
+        goto cleanup;
+
     if (parser->handlers.metadata) {
         readstat_metadata_t metadata = {
             .row_count = ctx.rows,
@@ -248,7 +324,11 @@ cleanup:
     if (line_lens)
         free(line_lens);
     if (ctx.converter)
-        iconv_close(ctx.converter);
+        readstat_converter_free(ctx.converter);
+    if (ctx.batch)
+        readstat_batch_free(ctx.batch);
+    if (ctx.read_buffer)
+        free(ctx.read_buffer);
     
     return retval;
 }